@@ -0,0 +1,204 @@
+/**
+ * Functions used to read which blocks of a container are allocated, according
+ * to its space manager; see `allocation-bitmap.h` for details.
+ */
+
+#include "allocation-bitmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/spaceman.h>
+
+#include <drat/io.h>
+
+#include <drat/func/cksum.h>
+
+/**
+ * Read a physical object of a given type, and check that it is valid.
+ *
+ * RETURN VALUE:    `true` if the object was read and is valid, else `false`,
+ *      in which case an explanation is printed to stderr.
+ */
+static bool read_spaceman_object(void* block, paddr_t addr, uint32_t type) {
+    if (read_blocks(block, addr, 1) != 1) {
+        fprintf(stderr, "\nERROR: %s: Could not read block %#"PRIx64".\n", __func__, addr);
+        return false;
+    }
+    obj_phys_t* obj = block;
+    if (!is_cksum_valid(block) || (obj->o_type & OBJECT_TYPE_MASK) != type) {
+        fprintf(stderr, "\nERROR: %s: Block %#"PRIx64" is not a valid space manager object of type %#"PRIx32".\n", __func__, addr, type);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Copy the bitmap of a chunk into the bitmap of the whole container.
+ */
+static bool add_chunk_bitmap(allocation_bitmap_t* bitmap, chunk_info_t* chunk, uint8_t* chunk_bits) {
+    uint64_t num_blocks = chunk->ci_block_count;
+    if (chunk->ci_addr >= bitmap->num_blocks || num_blocks > bitmap->num_blocks - chunk->ci_addr || num_blocks > nx_block_size * 8) {
+        fprintf(stderr, "\nERROR: %s: The chunk at block %#"PRIx64" lies outside the container.\n", __func__, chunk->ci_addr);
+        return false;
+    }
+
+    // A chunk without a bitmap has no allocated blocks
+    if (chunk->ci_bitmap_addr == 0) {
+        return true;
+    }
+    if (read_blocks(chunk_bits, chunk->ci_bitmap_addr, 1) != 1) {
+        fprintf(stderr, "\nERROR: %s: Could not read the bitmap at block %#"PRIx64".\n", __func__, chunk->ci_bitmap_addr);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (chunk_bits[i / 8] & (1 << (i % 8))) {
+            uint64_t addr = chunk->ci_addr + i;
+            bitmap->bits[addr / 8] |= 1 << (addr % 8);
+            bitmap->num_allocated++;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read the bitmaps of the chunks described by a chunk-info block.
+ */
+static bool add_cib_bitmaps(allocation_bitmap_t* bitmap, paddr_t cib_addr, char* block, uint8_t* chunk_bits) {
+    if (!read_spaceman_object(block, cib_addr, OBJECT_TYPE_SPACEMAN_CIB)) {
+        return false;
+    }
+    chunk_info_block_t* cib = (chunk_info_block_t*)block;
+    if (cib->cib_chunk_info_count > (nx_block_size - sizeof(chunk_info_block_t)) / sizeof(chunk_info_t)) {
+        fprintf(stderr, "\nERROR: %s: The chunk-info block at %#"PRIx64" has too many entries.\n", __func__, cib_addr);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < cib->cib_chunk_info_count; i++) {
+        if (!add_chunk_bitmap(bitmap, cib->cib_chunk_info + i, chunk_bits)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read which blocks of a container's main device are allocated, according to
+ * the space manager of a session's checkpoint.
+ *
+ * RETURN VALUE:
+ *      A pointer to the bitmap, which the caller must free with
+ *      `free_allocation_bitmap()`, or a NULL pointer if the space manager
+ *      couldn't be read or is malformed, in which case an explanation is
+ *      printed to stderr.
+ */
+allocation_bitmap_t* read_allocation_bitmap(nx_session_t* session) {
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        return NULL;
+    }
+    uint32_t num_objects = 0;
+    char (*xp_obj)[nx_block_size] = get_session_ephemeral_objects(session, &num_objects);
+    if (!xp_obj) {
+        return NULL;
+    }
+
+    spaceman_phys_t* sm = NULL;
+    for (uint32_t i = 0; i < num_objects; i++) {
+        obj_phys_t* obj = (obj_phys_t*)xp_obj[i];
+        if (obj->o_oid == nxsb->nx_spaceman_oid && (obj->o_type & OBJECT_TYPE_MASK) == OBJECT_TYPE_SPACEMAN) {
+            sm = (spaceman_phys_t*)obj;
+        }
+    }
+    if (!sm) {
+        fprintf(stderr, "\nERROR: %s: This checkpoint has no space manager.\n", __func__);
+        return NULL;
+    }
+
+    // The addresses of the main device's chunk-info blocks, or of its
+    // chunk-info address blocks if it has any, follow the space manager
+    spaceman_device_t* dev = sm->sm_dev + SD_MAIN;
+    uint32_t num_addrs = dev->sm_cab_count != 0 ? dev->sm_cab_count : dev->sm_cib_count;
+    if (dev->sm_addr_offset < sizeof(obj_phys_t) || dev->sm_addr_offset > nx_block_size || num_addrs > (nx_block_size - dev->sm_addr_offset) / sizeof(paddr_t)) {
+        fprintf(stderr, "\nERROR: %s: The space manager's chunk-info addresses don't fit in its first block; this is not yet supported.\n", __func__);
+        return NULL;
+    }
+    paddr_t* addrs = (paddr_t*)((char*)sm + dev->sm_addr_offset);
+
+    allocation_bitmap_t* bitmap = calloc(1, sizeof(allocation_bitmap_t));
+    char* block = malloc(nx_block_size);
+    char* cab_block = malloc(nx_block_size);
+    uint8_t* chunk_bits = malloc(nx_block_size);
+    if (!bitmap || !block || !cab_block || !chunk_bits) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `bitmap`.\n", __func__);
+        exit(-1);
+    }
+    bitmap->num_blocks = nxsb->nx_block_count;
+    bitmap->bits = calloc((bitmap->num_blocks + 7) / 8, 1);
+    if (!bitmap->bits) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `bitmap->bits`.\n", __func__);
+        exit(-1);
+    }
+
+    fprintf(session->log, "Reading the space manager's bitmaps ... ");
+    bool success = true;
+    for (uint32_t i = 0; success && i < num_addrs; i++) {
+        if (dev->sm_cab_count == 0) {
+            success = add_cib_bitmaps(bitmap, addrs[i], block, chunk_bits);
+            continue;
+        }
+
+        success = read_spaceman_object(cab_block, addrs[i], OBJECT_TYPE_SPACEMAN_CAB);
+        cib_addr_block_t* cab = (cib_addr_block_t*)cab_block;
+        if (success && cab->cab_cib_count > (nx_block_size - sizeof(cib_addr_block_t)) / sizeof(paddr_t)) {
+            fprintf(stderr, "\nERROR: %s: The chunk-info address block at %#"PRIx64" has too many entries.\n", __func__, addrs[i]);
+            success = false;
+        }
+        for (uint32_t j = 0; success && j < cab->cab_cib_count; j++) {
+            success = add_cib_bitmaps(bitmap, cab->cab_cib_addr[j], block, chunk_bits);
+        }
+    }
+    free(block);
+    free(cab_block);
+    free(chunk_bits);
+
+    if (!success) {
+        fprintf(session->log, "FAILED.\n");
+        free_allocation_bitmap(bitmap);
+        return NULL;
+    }
+    fprintf(session->log, "OK.\n");
+    return bitmap;
+}
+
+void free_allocation_bitmap(allocation_bitmap_t* bitmap) {
+    if (!bitmap) {
+        return;
+    }
+    free(bitmap->bits);
+    free(bitmap);
+}
+
+/**
+ * Determine whether a block is allocated. Blocks beyond the end of the
+ * container are treated as allocated.
+ */
+bool is_block_allocated(const allocation_bitmap_t* bitmap, paddr_t addr) {
+    return (uint64_t)addr >= bitmap->num_blocks || (bitmap->bits[addr / 8] & (1 << (addr % 8)));
+}
+
+/**
+ * Get the number of consecutive free blocks starting at a given block, up to
+ * `max_blocks`.
+ */
+uint64_t get_free_run_length(const allocation_bitmap_t* bitmap, paddr_t addr, uint64_t max_blocks) {
+    uint64_t len = 0;
+    while (len < max_blocks && !is_block_allocated(bitmap, addr + len)) {
+        len++;
+    }
+    return len;
+}
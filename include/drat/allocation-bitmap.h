@@ -0,0 +1,39 @@
+#ifndef DRAT_ALLOCATION_BITMAP_H
+#define DRAT_ALLOCATION_BITMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <apfs/general.h>   // paddr_t
+
+#include <drat/nx-session.h>
+
+/**
+ * A map of which blocks of a container are in use, as recorded by the space
+ * manager of a session's checkpoint. Every block that holds live metadata or
+ * belongs to a live file extent is marked as allocated; all other blocks are
+ * free space, which may still contain the data of deleted files.
+ *
+ * The space manager divides the main device into chunks, each of which has a
+ * bitmap block with one bit per block, set if the block is allocated. The
+ * chunks are described by chunk-info blocks, whose addresses are given either
+ * by the space manager itself, or, for larger containers, by chunk-info
+ * address blocks. All of the chunks' bitmaps are read and combined into a
+ * single bitmap covering the whole container.
+ *
+ * bits:    One bit per block, least significant bit first, set if the block
+ *      is allocated.
+ */
+typedef struct {
+    uint8_t*    bits;
+    uint64_t    num_blocks;
+    uint64_t    num_allocated;
+} allocation_bitmap_t;
+
+allocation_bitmap_t* read_allocation_bitmap(nx_session_t* session);
+void free_allocation_bitmap(allocation_bitmap_t* bitmap);
+
+bool is_block_allocated(const allocation_bitmap_t* bitmap, paddr_t addr);
+uint64_t get_free_run_length(const allocation_bitmap_t* bitmap, paddr_t addr, uint64_t max_blocks);
+
+#endif // DRAT_ALLOCATION_BITMAP_H
@@ -0,0 +1,698 @@
+/**
+ * Functions used to build and read block indexes; see `block-index.h` for a
+ * description of what these are.
+ */
+
+#include "block-index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <apfs/btree.h>
+#include <apfs/j.h>
+
+#include <drat/io.h>    // nx_block_size
+
+#include <drat/func/boolean.h>
+#include <drat/func/cksum.h>
+#include <drat/func/digest.h>
+
+/**
+ * Get the line and bit positions of a key in a region filter. All of a key's
+ * bits are within a single line, so only one cache line needs to be touched
+ * per lookup.
+ *
+ * RETURN VALUE:    The index of the line.
+ */
+static uint32_t get_block_index_filter_bits(uint64_t key, uint32_t num_lines, uint32_t* bits) {
+    // SplitMix64 finaliser; each bit uses a different 9-bit slice of it, and
+    // the line is chosen by the high bits of its product with another constant
+    uint64_t hash = key + 0x9e3779b97f4a7c15;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    hash ^= hash >> 31;
+    for (int i = 0; i < BLOCK_INDEX_FILTER_HASHES; i++) {
+        bits[i] = (hash >> (9 * i)) % (8 * BLOCK_INDEX_FILTER_LINE_BYTES);
+    }
+    return (uint32_t)((((hash * 0x9e3779b97f4a7c15) >> 32) * num_lines) >> 32);
+}
+
+/**
+ * Get the number of lines of a filter over a given number of distinct keys.
+ */
+uint32_t get_block_index_filter_lines(size_t num_keys) {
+    return (num_keys * BLOCK_INDEX_FILTER_BITS_PER_KEY + 8 * BLOCK_INDEX_FILTER_LINE_BYTES - 1) / (8 * BLOCK_INDEX_FILTER_LINE_BYTES);
+}
+
+/**
+ * Build a filter of `num_lines` lines over a list of keys.
+ */
+void build_block_index_filter(uint8_t* filter, uint32_t num_lines, const uint64_t* keys, size_t num_keys) {
+    if (num_lines == 0) {
+        return;
+    }
+    memset(filter, 0, num_lines * BLOCK_INDEX_FILTER_LINE_BYTES);
+    for (size_t i = 0; i < num_keys; i++) {
+        uint32_t bits[BLOCK_INDEX_FILTER_HASHES];
+        uint8_t* line = filter + get_block_index_filter_bits(keys[i], num_lines, bits) * BLOCK_INDEX_FILTER_LINE_BYTES;
+        for (int j = 0; j < BLOCK_INDEX_FILTER_HASHES; j++) {
+            line[bits[j] / 8] |= 1 << (bits[j] % 8);
+        }
+    }
+}
+
+/**
+ * Determine whether a region filter of `num_lines` lines might contain a key.
+ *
+ * RETURN VALUE:    `false` if the key was definitely never added, else `true`.
+ */
+bool block_index_filter_may_contain(const uint8_t* filter, uint32_t num_lines, uint64_t key) {
+    if (num_lines == 0) {
+        return false;
+    }
+    uint32_t bits[BLOCK_INDEX_FILTER_HASHES];
+    const uint8_t* line = filter + get_block_index_filter_bits(key, num_lines, bits) * BLOCK_INDEX_FILTER_LINE_BYTES;
+    for (int i = 0; i < BLOCK_INDEX_FILTER_HASHES; i++) {
+        if (!(line[bits[i] / 8] & (1 << (bits[i] % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * A list of the keys to build one of a region's filters from.
+ */
+typedef struct {
+    uint64_t*   keys;
+    size_t      num_keys;
+    size_t      capacity;
+} block_index_keys_t;
+
+static void add_block_index_key(block_index_keys_t* keys, uint64_t key) {
+    if (keys->num_keys == keys->capacity) {
+        keys->capacity = keys->capacity ? 2 * keys->capacity : BLOCK_INDEX_REGION_BLOCKS;
+        keys->keys = realloc(keys->keys, keys->capacity * sizeof(uint64_t));
+        if (!keys->keys) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `keys->keys`.\n", __func__);
+            exit(-1);
+        }
+    }
+    keys->keys[keys->num_keys++] = key;
+}
+
+static int compare_block_index_keys(const void* a, const void* b) {
+    uint64_t key_a = *(const uint64_t*)a;
+    uint64_t key_b = *(const uint64_t*)b;
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+/**
+ * Sort a list of keys and remove duplicates, so that filters are sized by
+ * the number of distinct keys.
+ */
+static void dedupe_block_index_keys(block_index_keys_t* keys) {
+    if (keys->num_keys == 0) {
+        return;
+    }
+    qsort(keys->keys, keys->num_keys, sizeof(uint64_t), compare_block_index_keys);
+    size_t num_distinct = 1;
+    for (size_t i = 1; i < keys->num_keys; i++) {
+        if (keys->keys[i] != keys->keys[num_distinct - 1]) {
+            keys->keys[num_distinct++] = keys->keys[i];
+        }
+    }
+    keys->num_keys = num_distinct;
+}
+
+/**
+ * Add the FSOIDs in the keys of a file-system tree node to a list of keys.
+ */
+static void add_fs_node_to_block_index_keys(btree_node_phys_t* node, block_index_keys_t* keys) {
+    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
+    char* key_start = toc_start + node->btn_table_space.len;
+    char* val_end   = (char*)node + nx_block_size;
+    if (node->btn_flags & BTNODE_ROOT) {
+        val_end -= sizeof(btree_info_t);
+    }
+    if (
+           (node->btn_flags & BTNODE_FIXED_KV_SIZE)
+        || key_start > val_end
+        || node->btn_nkeys * sizeof(kvloc_t) > node->btn_table_space.len
+    ) {
+        return;
+    }
+
+    kvloc_t* toc_entry = (kvloc_t*)toc_start;
+    for (uint32_t i = 0; i < node->btn_nkeys; i++, toc_entry++) {
+        if (toc_entry->k.len < sizeof(j_key_t) || key_start + toc_entry->k.off + sizeof(j_key_t) > val_end) {
+            continue;
+        }
+        j_key_t* hdr = (j_key_t*)(key_start + toc_entry->k.off);
+        add_block_index_key(keys, hdr->obj_id_and_type & OBJ_ID_MASK);
+    }
+}
+
+/**
+ * Copy the first `BLOCK_INDEX_KEY_SIZE` bytes of the `i`th key of a B-tree
+ * node, padded with zeroes, provided that the key lies within the node.
+ */
+static void get_block_index_key(btree_node_phys_t* node, uint32_t i, uint8_t* key) {
+    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
+    char* key_start = toc_start + node->btn_table_space.len;
+    char* val_end   = (char*)node + nx_block_size;
+    if (node->btn_flags & BTNODE_ROOT) {
+        val_end -= sizeof(btree_info_t);
+    }
+
+    char* key_ptr = NULL;
+    size_t key_len = 0;
+    if (node->btn_flags & BTNODE_FIXED_KV_SIZE) {
+        if ((i + 1) * sizeof(kvoff_t) > node->btn_table_space.len) {
+            return;
+        }
+        kvoff_t* toc_entry = (kvoff_t*)toc_start + i;
+        key_ptr = key_start + toc_entry->k;
+        key_len = BLOCK_INDEX_KEY_SIZE;
+    } else {
+        if ((i + 1) * sizeof(kvloc_t) > node->btn_table_space.len) {
+            return;
+        }
+        kvloc_t* toc_entry = (kvloc_t*)toc_start + i;
+        key_ptr = key_start + toc_entry->k.off;
+        key_len = toc_entry->k.len < BLOCK_INDEX_KEY_SIZE ? toc_entry->k.len : BLOCK_INDEX_KEY_SIZE;
+    }
+
+    if (key_start > val_end || key_ptr >= val_end) {
+        return;
+    }
+    if ((size_t)(val_end - key_ptr) < key_len) {
+        key_len = val_end - key_ptr;
+    }
+    memcpy(key, key_ptr, key_len);
+}
+
+/**
+ * Add an entry for a block to a chunk's results if the block's header is
+ * plausible and its checksum is valid, and add its OID and any FSOIDs to the
+ * lists of keys for the filters of its region.
+ */
+static void index_block(obj_phys_t* block, paddr_t addr, block_scan_results_t* results, block_index_keys_t* oids, block_index_keys_t* fsoids) {
+    if (!is_obj_header_plausible(block)) {
+        results->num_rejected++;
+        return;
+    }
+    if (!is_cksum_valid((uint32_t*)block)) {
+        results->num_invalid++;
+        return;
+    }
+
+    block_index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.bie_paddr     = addr;
+    entry.bie_oid       = block->o_oid;
+    entry.bie_xid       = block->o_xid;
+    entry.bie_type      = block->o_type;
+    entry.bie_subtype   = block->o_subtype;
+    add_block_index_key(oids, block->o_oid);
+
+    uint32_t type = block->o_type & OBJECT_TYPE_MASK;
+    if (type == OBJECT_TYPE_BTREE || type == OBJECT_TYPE_BTREE_NODE) {
+        btree_node_phys_t* node = (btree_node_phys_t*)block;
+        entry.bie_btn_flags = node->btn_flags;
+        entry.bie_btn_level = node->btn_level;
+        entry.bie_btn_nkeys = node->btn_nkeys;
+        if (node->btn_nkeys != 0 && !(node->btn_flags & BTNODE_NOHEADER)) {
+            get_block_index_key(node, 0, entry.bie_first_key);
+            get_block_index_key(node, node->btn_nkeys - 1, entry.bie_last_key);
+        }
+        if (block->o_subtype == OBJECT_TYPE_FSTREE) {
+            add_fs_node_to_block_index_keys(node, fsoids);
+        }
+    }
+
+    add_block_scan_data(results, &entry, sizeof(entry));
+}
+
+/**
+ * Index a region of the container; see `block_scan_chunk_fn`. The region is
+ * hashed first, and if the index being refreshed has the same hash for it,
+ * its entries and filters are copied from there rather than looking at its
+ * blocks. The results can be written directly to the index file, after the
+ * entries of the previous regions; the filters are kept in `region_filters`
+ * until `checkpoint_block_index()` writes them.
+ */
+void index_block_chunk(void* context, char* blocks, paddr_t addr, size_t num_blocks, block_scan_results_t* results) {
+    block_index_builder_t* builder = context;
+    uint64_t region = addr / BLOCK_INDEX_REGION_BLOCKS;
+
+    xxh64_ctx_t ctx;
+    xxh64_init(&ctx, 0);
+    xxh64_update(&ctx, blocks, num_blocks * nx_block_size);
+    uint64_t hash = xxh64_final(&ctx);
+
+    // Each region is only ever indexed by one thread, so this needs no lock
+    block_index_region_t* region_info = builder->regions + region;
+    memset(region_info, 0, sizeof(block_index_region_t));
+
+    uint8_t* filters = NULL;
+    block_index_t* previous = builder->previous;
+    if (previous && region < previous->header.bih_region_count && previous->regions[region].bir_hash == hash) {
+        memcpy(region_info, previous->regions + region, sizeof(block_index_region_t));
+        for (uint64_t i = previous->region_starts[region]; i < previous->region_starts[region + 1]; i++) {
+            add_block_scan_data(results, previous->entries + i, sizeof(block_index_entry_t));
+        }
+        size_t filter_bytes = (size_t)(region_info->bir_oid_filter_lines + region_info->bir_fsoid_filter_lines) * BLOCK_INDEX_FILTER_LINE_BYTES;
+        filters = malloc(filter_bytes);
+        if (filter_bytes != 0 && !filters) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `filters`.\n", __func__);
+            exit(-1);
+        }
+        if (filter_bytes != 0) {
+            memcpy(filters, previous->filters + region_info->bir_filter_offset, filter_bytes);
+        }
+    } else {
+        block_index_keys_t oids = { 0 };
+        block_index_keys_t fsoids = { 0 };
+        for (size_t i = 0; i < num_blocks; i++) {
+            index_block((obj_phys_t*)(blocks + i * nx_block_size), addr + i, results, &oids, &fsoids);
+        }
+        dedupe_block_index_keys(&oids);
+        dedupe_block_index_keys(&fsoids);
+
+        region_info->bir_oid_filter_lines = get_block_index_filter_lines(oids.num_keys);
+        region_info->bir_fsoid_filter_lines = get_block_index_filter_lines(fsoids.num_keys);
+        size_t oid_filter_bytes = (size_t)region_info->bir_oid_filter_lines * BLOCK_INDEX_FILTER_LINE_BYTES;
+        size_t filter_bytes = oid_filter_bytes + (size_t)region_info->bir_fsoid_filter_lines * BLOCK_INDEX_FILTER_LINE_BYTES;
+        filters = malloc(filter_bytes);
+        if (filter_bytes != 0 && !filters) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `filters`.\n", __func__);
+            exit(-1);
+        }
+        build_block_index_filter(filters, region_info->bir_oid_filter_lines, oids.keys, oids.num_keys);
+        build_block_index_filter(filters + oid_filter_bytes, region_info->bir_fsoid_filter_lines, fsoids.keys, fsoids.num_keys);
+        free(oids.keys);
+        free(fsoids.keys);
+    }
+
+    builder->region_filters[region] = filters;
+    region_info->bir_hash = hash;
+    region_info->bir_entry_count = results->num_results;
+}
+
+/**
+ * Write the header and any regions that have been completed since the last
+ * time this was called, then flush everything to disk, so that the file
+ * describes all of the regions that are done. The filters are flushed first,
+ * since the header gives their size.
+ */
+static bool write_block_index_checkpoint(block_index_builder_t* builder) {
+    FILE* file = builder->file;
+    uint64_t num_regions = builder->header.bih_regions_done - builder->regions_written;
+    if (fflush(builder->filter_file) != 0 || fsync(fileno(builder->filter_file)) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not write to `%s`.\n", __func__, builder->partial_filters_path);
+        return false;
+    }
+    bool success = fflush(file) == 0
+        && fsync(fileno(file)) == 0
+        && fseek(file, 0, SEEK_SET) == 0
+        && fwrite(&builder->header, sizeof(block_index_header_t), 1, file) == 1
+        && fseek(file, sizeof(block_index_header_t) + builder->regions_written * sizeof(block_index_region_t), SEEK_SET) == 0
+        && fwrite(builder->regions + builder->regions_written, sizeof(block_index_region_t), num_regions, file) == num_regions
+        && fflush(file) == 0
+        && fsync(fileno(file)) == 0
+        && fseek(file, 0, SEEK_END) == 0;
+    if (!success) {
+        fprintf(stderr, "\nERROR: %s: Could not write to `%s`.\n", __func__, builder->partial_path);
+        return false;
+    }
+    builder->regions_written = builder->header.bih_regions_done;
+    builder->last_checkpoint = time(NULL);
+    return true;
+}
+
+/**
+ * Record that the results for some regions have been written, and write the
+ * latest region's filters after those of the previous regions; see
+ * `block_scan_output_fn`. A checkpoint is written every
+ * `BLOCK_INDEX_CHECKPOINT_INTERVAL` seconds.
+ */
+bool checkpoint_block_index(void* context, uint64_t num_chunks_output, block_scan_stats_t* stats) {
+    block_index_builder_t* builder = context;
+
+    uint64_t region = builder->base_regions + num_chunks_output - 1;
+    block_index_region_t* region_info = builder->regions + region;
+    size_t filter_bytes = (size_t)(region_info->bir_oid_filter_lines + region_info->bir_fsoid_filter_lines) * BLOCK_INDEX_FILTER_LINE_BYTES;
+    bool written = filter_bytes == 0 || fwrite(builder->region_filters[region], filter_bytes, 1, builder->filter_file) == 1;
+    free(builder->region_filters[region]);
+    builder->region_filters[region] = NULL;
+    if (!written) {
+        fprintf(stderr, "\nERROR: %s: Could not write to `%s`.\n", __func__, builder->partial_filters_path);
+        return false;
+    }
+    region_info->bir_filter_offset = builder->header.bih_filter_bytes;
+    builder->header.bih_filter_bytes += filter_bytes;
+    block_index_t* previous = builder->previous;
+    if (previous && region < previous->header.bih_region_count && previous->regions[region].bir_hash == builder->regions[region].bir_hash) {
+        builder->num_reused++;
+    }
+
+    builder->header.bih_regions_done = region + 1;
+    builder->header.bih_entry_count = builder->base_entries + stats->num_results;
+    if (time(NULL) - builder->last_checkpoint < BLOCK_INDEX_CHECKPOINT_INTERVAL) {
+        return true;
+    }
+    return write_block_index_checkpoint(builder);
+}
+
+/**
+ * Open an index for building at `<path>.partial`, with its filters at
+ * `<path>.partial-filters`.
+ *
+ * resume:      Whether to continue building an existing partial index rather
+ *      than starting from scratch. If it doesn't exist, or it describes a
+ *      different container, a new one is started.
+ *
+ * previous:    The old index that is being refreshed, if any.
+ *
+ * RETURN VALUE:
+ *      A pointer to the builder, or NULL if the files couldn't be opened. Its
+ *      `header.bih_regions_done` gives the region to start scanning at. The
+ *      caller must free this pointer with `free_block_index_builder()`.
+ */
+block_index_builder_t* open_block_index_builder(const char* path, uuid_t nx_uuid, uint64_t block_count, bool resume, block_index_t* previous) {
+    block_index_builder_t* builder = calloc(1, sizeof(block_index_builder_t));
+    if (!builder) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `builder`.\n", __func__);
+        exit(-1);
+    }
+    builder->path = strdup(path);
+    builder->partial_path = malloc(strlen(path) + sizeof(BLOCK_INDEX_PARTIAL_SUFFIX));
+    builder->partial_filters_path = malloc(strlen(path) + sizeof(BLOCK_INDEX_PARTIAL_FILTERS_SUFFIX));
+    if (!builder->path || !builder->partial_path || !builder->partial_filters_path) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `builder->partial_path`.\n", __func__);
+        exit(-1);
+    }
+    sprintf(builder->partial_path, "%s%s", path, BLOCK_INDEX_PARTIAL_SUFFIX);
+    sprintf(builder->partial_filters_path, "%s%s", path, BLOCK_INDEX_PARTIAL_FILTERS_SUFFIX);
+    builder->previous = previous;
+
+    block_index_header_t* header = &builder->header;
+    memcpy(header->bih_magic, BLOCK_INDEX_MAGIC, sizeof(header->bih_magic));
+    header->bih_version = BLOCK_INDEX_VERSION;
+    header->bih_block_size = nx_block_size;
+    memcpy(header->bih_nx_uuid, nx_uuid, sizeof(uuid_t));
+    header->bih_block_count = block_count;
+    header->bih_region_count = (block_count + BLOCK_INDEX_REGION_BLOCKS - 1) / BLOCK_INDEX_REGION_BLOCKS;
+
+    builder->regions = calloc(header->bih_region_count, sizeof(block_index_region_t));
+    builder->region_filters = calloc(header->bih_region_count, sizeof(uint8_t*));
+    if (header->bih_region_count != 0 && (!builder->regions || !builder->region_filters)) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `builder->regions`.\n", __func__);
+        exit(-1);
+    }
+
+    bool resumed = false;
+    if (resume) {
+        builder->file = fopen(builder->partial_path, "r+b");
+        builder->filter_file = fopen(builder->partial_filters_path, "r+b");
+    }
+    if (builder->file && builder->filter_file) {
+        block_index_header_t existing;
+        memset(&existing, 0, sizeof(existing));
+        bool usable = fread(&existing, sizeof(existing), 1, builder->file) == 1
+            && memcmp(existing.bih_magic, header->bih_magic, sizeof(existing.bih_magic)) == 0
+            && existing.bih_version == header->bih_version
+            && existing.bih_block_size == header->bih_block_size
+            && memcmp(existing.bih_nx_uuid, header->bih_nx_uuid, sizeof(uuid_t)) == 0
+            && existing.bih_block_count == header->bih_block_count
+            && existing.bih_regions_done <= header->bih_region_count
+            && fread(builder->regions, sizeof(block_index_region_t), existing.bih_regions_done, builder->file) == existing.bih_regions_done;
+
+        // Discard any entries and filters that were written after the last
+        // checkpoint
+        off_t entries_end = sizeof(block_index_header_t)
+            + header->bih_region_count * sizeof(block_index_region_t)
+            + existing.bih_entry_count * sizeof(block_index_entry_t);
+        off_t filters_end = existing.bih_filter_bytes;
+        usable = usable
+            && fseek(builder->file, 0, SEEK_END) == 0 && ftello(builder->file) >= entries_end
+            && fseek(builder->filter_file, 0, SEEK_END) == 0 && ftello(builder->filter_file) >= filters_end;
+        resumed = usable
+            && ftruncate(fileno(builder->file), entries_end) == 0 && fseek(builder->file, 0, SEEK_END) == 0
+            && ftruncate(fileno(builder->filter_file), filters_end) == 0 && fseek(builder->filter_file, 0, SEEK_END) == 0;
+        if (resumed) {
+            header->bih_regions_done = existing.bih_regions_done;
+            header->bih_entry_count = existing.bih_entry_count;
+            header->bih_filter_bytes = existing.bih_filter_bytes;
+        } else {
+            memset(builder->regions, 0, header->bih_region_count * sizeof(block_index_region_t));
+        }
+    }
+    if (!resumed) {
+        if (builder->file) {
+            fclose(builder->file);
+        }
+        if (builder->filter_file) {
+            fclose(builder->filter_file);
+        }
+        builder->file = fopen(builder->partial_path, "w+b");
+        builder->filter_file = fopen(builder->partial_filters_path, "w+b");
+        if (!builder->file || !builder->filter_file) {
+            fprintf(stderr, "\nERROR: %s: Could not open `%s` and `%s` for writing.\n", __func__, builder->partial_path, builder->partial_filters_path);
+            free_block_index_builder(builder);
+            return NULL;
+        }
+        // Reserve space for the header and the region table
+        if (
+               fwrite(header, sizeof(block_index_header_t), 1, builder->file) != 1
+            || fwrite(builder->regions, sizeof(block_index_region_t), header->bih_region_count, builder->file) != header->bih_region_count
+        ) {
+            fprintf(stderr, "\nERROR: %s: Could not write to `%s`.\n", __func__, builder->partial_path);
+            free_block_index_builder(builder);
+            return NULL;
+        }
+    }
+
+    builder->base_regions = header->bih_regions_done;
+    builder->base_entries = header->bih_entry_count;
+    builder->regions_written = header->bih_regions_done;
+    builder->last_checkpoint = time(NULL);
+    return builder;
+}
+
+/**
+ * Write the final checkpoint of a complete index, append its filters to it,
+ * and move it from `<path>.partial` to `<path>`.
+ *
+ * RETURN VALUE:    `true` on success, `false` on failure.
+ */
+bool finish_block_index(block_index_builder_t* builder) {
+    if (!write_block_index_checkpoint(builder)) {
+        return false;
+    }
+
+    char buffer[1 << 16];
+    bool success = fseek(builder->filter_file, 0, SEEK_SET) == 0;
+    for (uint64_t num_copied = 0; success && num_copied < builder->header.bih_filter_bytes; ) {
+        size_t num_bytes = sizeof(buffer);
+        if (num_bytes > builder->header.bih_filter_bytes - num_copied) {
+            num_bytes = builder->header.bih_filter_bytes - num_copied;
+        }
+        success = fread(buffer, num_bytes, 1, builder->filter_file) == 1
+            && fwrite(buffer, num_bytes, 1, builder->file) == 1;
+        num_copied += num_bytes;
+    }
+    success = success && fflush(builder->file) == 0 && fsync(fileno(builder->file)) == 0;
+    success = fclose(builder->file) == 0 && success;
+    builder->file = NULL;
+    if (!success) {
+        fprintf(stderr, "\nERROR: %s: Could not copy the filters from `%s` to `%s`.\n", __func__, builder->partial_filters_path, builder->partial_path);
+        return false;
+    }
+    if (rename(builder->partial_path, builder->path) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not move `%s` to `%s`.\n", __func__, builder->partial_path, builder->path);
+        return false;
+    }
+    fclose(builder->filter_file);
+    builder->filter_file = NULL;
+    remove(builder->partial_filters_path);
+    return true;
+}
+
+/**
+ * Free a builder. If the index is incomplete, the partial index is left in
+ * place, as of its last checkpoint.
+ */
+void free_block_index_builder(block_index_builder_t* builder) {
+    if (!builder) {
+        return;
+    }
+    if (builder->file) {
+        fclose(builder->file);
+    }
+    if (builder->filter_file) {
+        fclose(builder->filter_file);
+    }
+    if (builder->region_filters) {
+        for (uint64_t i = 0; i < builder->header.bih_region_count; i++) {
+            free(builder->region_filters[i]);
+        }
+    }
+    free(builder->path);
+    free(builder->partial_path);
+    free(builder->partial_filters_path);
+    free(builder->regions);
+    free(builder->region_filters);
+    free(builder);
+}
+
+/**
+ * Read a complete block index from a file that was created by
+ * `create-index`.
+ *
+ * with_entries:    Whether to read all of the entries. If not, the file is
+ *      kept open so that the entries of particular regions can be read with
+ *      `read_block_index_entries()`.
+ *
+ * RETURN VALUE:
+ *      A pointer to the index, or NULL if the file could not be read or is not
+ *      a complete block index. The caller must free this pointer with
+ *      `free_block_index()` when it is no longer needed.
+ */
+block_index_t* read_block_index(const char* path, bool with_entries) {
+    FILE* index_file = fopen(path, "rb");
+    if (!index_file) {
+        fprintf(stderr, "\nERROR: %s: Could not open `%s` for reading.\n", __func__, path);
+        return NULL;
+    }
+
+    block_index_t* index = calloc(1, sizeof(block_index_t));
+    if (!index) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index`.\n", __func__);
+        exit(-1);
+    }
+    index->file = index_file;
+
+    if (fread(&(index->header), sizeof(block_index_header_t), 1, index_file) != 1) {
+        fprintf(stderr, "\nERROR: %s: Could not read the header of `%s`.\n", __func__, path);
+        goto error;
+    }
+    if (memcmp(index->header.bih_magic, BLOCK_INDEX_MAGIC, sizeof(index->header.bih_magic)) != 0) {
+        fprintf(stderr, "\nERROR: %s: `%s` is not a block index.\n", __func__, path);
+        goto error;
+    }
+    if (index->header.bih_version != BLOCK_INDEX_VERSION) {
+        fprintf(stderr, "\nERROR: %s: `%s` has unsupported version %"PRIu32"; recreate it with `create-index`.\n", __func__, path, index->header.bih_version);
+        goto error;
+    }
+    if (index->header.bih_regions_done != index->header.bih_region_count) {
+        fprintf(stderr, "\nERROR: %s: `%s` is incomplete; finish it with `create-index --resume`.\n", __func__, path);
+        goto error;
+    }
+
+    size_t num_regions = index->header.bih_region_count;
+    size_t num_entries = index->header.bih_entry_count;
+    index->regions = malloc(num_regions * sizeof(block_index_region_t));
+    index->region_starts = malloc((num_regions + 1) * sizeof(uint64_t));
+    if ((num_regions != 0 && !index->regions) || !index->region_starts) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index->regions`.\n", __func__);
+        exit(-1);
+    }
+    if (fread(index->regions, sizeof(block_index_region_t), num_regions, index_file) != num_regions) {
+        fprintf(stderr, "\nERROR: %s: `%s` is truncated.\n", __func__, path);
+        goto error;
+    }
+
+    uint64_t filter_bytes = index->header.bih_filter_bytes;
+    bool corrupt = false;
+    index->region_starts[0] = 0;
+    for (size_t i = 0; i < num_regions; i++) {
+        block_index_region_t* region = index->regions + i;
+        index->region_starts[i + 1] = index->region_starts[i] + region->bir_entry_count;
+        uint64_t region_filter_bytes = ((uint64_t)region->bir_oid_filter_lines + region->bir_fsoid_filter_lines) * BLOCK_INDEX_FILTER_LINE_BYTES;
+        corrupt = corrupt || region->bir_filter_offset > filter_bytes || region_filter_bytes > filter_bytes - region->bir_filter_offset;
+    }
+    if (corrupt || index->region_starts[num_regions] != num_entries) {
+        fprintf(stderr, "\nERROR: %s: `%s` is corrupt.\n", __func__, path);
+        goto error;
+    }
+
+    if (with_entries) {
+        index->entries = malloc(num_entries * sizeof(block_index_entry_t));
+        if (num_entries != 0 && !index->entries) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index->entries`.\n", __func__);
+            exit(-1);
+        }
+        if (fread(index->entries, sizeof(block_index_entry_t), num_entries, index_file) != num_entries) {
+            fprintf(stderr, "\nERROR: %s: `%s` is truncated.\n", __func__, path);
+            goto error;
+        }
+    }
+
+    // The filters follow the entries
+    off_t filters_start = sizeof(block_index_header_t)
+        + num_regions * sizeof(block_index_region_t)
+        + num_entries * sizeof(block_index_entry_t);
+    index->filters = malloc(filter_bytes);
+    if (filter_bytes != 0 && !index->filters) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index->filters`.\n", __func__);
+        exit(-1);
+    }
+    if (fseeko(index_file, filters_start, SEEK_SET) != 0 || (filter_bytes != 0 && fread(index->filters, filter_bytes, 1, index_file) != 1)) {
+        fprintf(stderr, "\nERROR: %s: `%s` is truncated.\n", __func__, path);
+        goto error;
+    }
+
+    if (with_entries) {
+        fclose(index_file);
+        index->file = NULL;
+    }
+    return index;
+
+error:
+    free_block_index(index);
+    return NULL;
+}
+
+/**
+ * Read the entries of a run of consecutive regions from an index that was
+ * read without its entries.
+ *
+ * entries:     A buffer with room for all of the regions' entries, i.e.
+ *      `region_starts[first_region + num_regions] - region_starts[first_region]`
+ *      of them.
+ *
+ * RETURN VALUE:    `true` on success, `false` on failure.
+ */
+bool read_block_index_entries(block_index_t* index, uint64_t first_region, uint64_t num_regions, block_index_entry_t* entries) {
+    uint64_t first_entry = index->region_starts[first_region];
+    uint64_t num_entries = index->region_starts[first_region + num_regions] - first_entry;
+    off_t offset = sizeof(block_index_header_t)
+        + index->header.bih_region_count * sizeof(block_index_region_t)
+        + first_entry * sizeof(block_index_entry_t);
+    if (
+           fseeko(index->file, offset, SEEK_SET) != 0
+        || fread(entries, sizeof(block_index_entry_t), num_entries, index->file) != num_entries
+    ) {
+        fprintf(stderr, "\nERROR: %s: Could not read the index's entries.\n", __func__);
+        return false;
+    }
+    return true;
+}
+
+void free_block_index(block_index_t* index) {
+    if (!index) {
+        return;
+    }
+    if (index->file) {
+        fclose(index->file);
+    }
+    free(index->regions);
+    free(index->region_starts);
+    free(index->entries);
+    free(index->filters);
+    free(index);
+}
@@ -0,0 +1,202 @@
+#ifndef DRAT_BLOCK_INDEX_H
+#define DRAT_BLOCK_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <apfs/general.h>   // paddr_t, uuid_t
+#include <apfs/object.h>    // oid_t, xid_t, obj_phys_t
+
+#include <drat/block-scan.h>
+
+/**
+ * A block index is a file describing every object in a container whose
+ * checksum is valid, as found by a scan of the whole container. It lets
+ * `search` consider only the blocks that could possibly match a query, rather
+ * than reading and checksumming every block again.
+ *
+ * The container is divided into regions of `BLOCK_INDEX_REGION_BLOCKS`
+ * blocks, i.e. 1 MiB with the usual 4 KiB blocks, and a hash of each region's
+ * contents is kept alongside the entries for the objects within it. When an
+ * index is refreshed, every region is hashed again, and only those whose hash
+ * has changed are indexed again; the entries of the others are copied from
+ * the old index.
+ *
+ * Each region also has a pair of blocked Bloom filters: one over the OIDs of
+ * the objects within the region, and one over the FSOIDs of the records in the
+ * file-system tree nodes within the region. Each filter is sized from the
+ * number of distinct keys in it, at `BLOCK_INDEX_FILTER_BITS_PER_KEY` bits per
+ * key rounded up to whole 64-byte lines, and each key sets
+ * `BLOCK_INDEX_FILTER_HASHES` bits within a single line chosen by its hash,
+ * which gives a false-positive rate of about 1% however many keys a region
+ * has. A search for particular OIDs or FSOIDs only reads the entries of
+ * regions whose filters might contain them, and so can rule out most of a
+ * large container by reading a few bytes per region.
+ *
+ * The file consists of an instance of `block_index_header_t`, followed by
+ * `bih_region_count` instances of `block_index_region_t`, in address order,
+ * followed by `bih_entry_count` instances of `block_index_entry_t`, sorted by
+ * block address, followed by the regions' filters, `bih_filter_bytes` bytes
+ * in all.
+ *
+ * An index is built at `<path>.partial`, with its filters at
+ * `<path>.partial-filters`, and the two are joined and renamed to `<path>`
+ * once it is complete. Whilst it is being built, its header, region table,
+ * entries, and filters are periodically flushed to disk so that they
+ * describe the regions that have been scanned so far, given by
+ * `bih_regions_done`. If the build is interrupted, it can resume from the
+ * last such checkpoint.
+ */
+
+#define BLOCK_INDEX_MAGIC   "DRATBKIX"
+#define BLOCK_INDEX_VERSION 4
+
+#define BLOCK_INDEX_PARTIAL_SUFFIX          ".partial"
+#define BLOCK_INDEX_PARTIAL_FILTERS_SUFFIX  ".partial-filters"
+
+/** Number of blocks in each region; each region is one chunk of the scan */
+#define BLOCK_INDEX_REGION_BLOCKS   BLOCK_SCAN_CHUNK_BLOCKS
+
+/** Minimum number of seconds between checkpoints whilst building an index */
+#define BLOCK_INDEX_CHECKPOINT_INTERVAL     5
+
+/** Size of each line of a filter; one cache line */
+#define BLOCK_INDEX_FILTER_LINE_BYTES   64
+
+/** Number of filter bits per distinct key */
+#define BLOCK_INDEX_FILTER_BITS_PER_KEY     10
+
+/** Number of bits set in a filter for each key; optimal for 10 bits per key */
+#define BLOCK_INDEX_FILTER_HASHES   7
+
+/** Size of the key prefixes recorded for each B-tree node */
+#define BLOCK_INDEX_KEY_SIZE    16
+
+typedef struct {
+    char        bih_magic[8];
+    uint32_t    bih_version;
+    uint32_t    bih_block_size;
+    uuid_t      bih_nx_uuid;
+    uint64_t    bih_block_count;    // Number of blocks in the container when it was scanned
+    uint64_t    bih_region_count;
+    uint64_t    bih_regions_done;   // Number of regions scanned; equal to `bih_region_count` once complete
+    uint64_t    bih_entry_count;
+    uint64_t    bih_filter_bytes;
+} block_index_header_t;
+
+/**
+ * A region of the container.
+ *
+ * bir_hash:    XXH64 hash of the region's contents; blocks that couldn't be
+ *      read are hashed as zeroes.
+ *
+ * bir_entry_count:     Number of entries for objects within the region.
+ *
+ * bir_filter_offset:   Offset of the region's filters within the filters
+ *      that follow the entries: `bir_oid_filter_lines` lines of a blocked
+ *      Bloom filter over the OIDs of those objects, followed by
+ *      `bir_fsoid_filter_lines` lines of one over the FSOIDs in the keys of
+ *      the file-system tree nodes among those objects.
+ */
+typedef struct {
+    uint64_t    bir_hash;
+    uint64_t    bir_entry_count;
+    uint64_t    bir_filter_offset;
+    uint32_t    bir_oid_filter_lines;
+    uint32_t    bir_fsoid_filter_lines;
+} block_index_region_t;
+
+/**
+ * An object that was found in the container.
+ *
+ * bie_first_key, bie_last_key:     For B-tree nodes that have keys, the first
+ *      `BLOCK_INDEX_KEY_SIZE` bytes of the node's first and last keys, padded
+ *      with zeroes, e.g. the (OID, XID) pair of an object map key, or the
+ *      `obj_id_and_type` field of a file-system record key followed by the
+ *      start of the rest of the key. Zero for other objects.
+ */
+typedef struct {
+    paddr_t     bie_paddr;
+    oid_t       bie_oid;
+    xid_t       bie_xid;
+    uint32_t    bie_type;
+    uint32_t    bie_subtype;
+    uint16_t    bie_btn_flags;
+    uint16_t    bie_btn_level;
+    uint32_t    bie_btn_nkeys;
+    uint8_t     bie_first_key[BLOCK_INDEX_KEY_SIZE];
+    uint8_t     bie_last_key[BLOCK_INDEX_KEY_SIZE];
+} block_index_entry_t;
+
+/**
+ * region_starts:   For each region, the index of its first entry, followed by
+ *      the total number of entries, so that the entries of region `r` are
+ *      those from `region_starts[r]` up to `region_starts[r + 1]`.
+ *
+ * entries:     All of the entries, or a NULL pointer if they weren't read, in
+ *      which case they can be read region by region from `file`.
+ *
+ * filters:     All of the regions' filters.
+ */
+typedef struct {
+    block_index_header_t    header;
+    block_index_region_t*   regions;
+    uint64_t*               region_starts;
+    block_index_entry_t*    entries;
+    uint8_t*                filters;
+    FILE*                   file;
+} block_index_t;
+
+/**
+ * An index that is being built.
+ *
+ * previous:    The old index that is being refreshed, or a NULL pointer.
+ *
+ * base_regions, base_entries:  The number of regions and entries that were
+ *      already in the file when this build started, i.e. when resuming.
+ *
+ * region_filters:  For each region that has been indexed but whose filters
+ *      haven't yet been written to `filter_file`, its filters; else NULL.
+ *
+ * regions_written:     The number of leading entries of `regions` that are
+ *      up to date in the file.
+ *
+ * num_reused:      Number of regions whose entries were copied from
+ *      `previous` because their hash hadn't changed.
+ */
+typedef struct {
+    char*                   path;
+    char*                   partial_path;
+    char*                   partial_filters_path;
+    FILE*                   file;
+    FILE*                   filter_file;
+    block_index_header_t    header;
+    block_index_region_t*   regions;
+    uint8_t**               region_filters;
+    block_index_t*          previous;
+
+    uint64_t                base_regions;
+    uint64_t                base_entries;
+    uint64_t                regions_written;
+    uint64_t                num_reused;
+    time_t                  last_checkpoint;
+} block_index_builder_t;
+
+uint32_t get_block_index_filter_lines(size_t num_keys);
+void build_block_index_filter(uint8_t* filter, uint32_t num_lines, const uint64_t* keys, size_t num_keys);
+bool block_index_filter_may_contain(const uint8_t* filter, uint32_t num_lines, uint64_t key);
+
+block_index_t* read_block_index(const char* path, bool with_entries);
+bool read_block_index_entries(block_index_t* index, uint64_t first_region, uint64_t num_regions, block_index_entry_t* entries);
+void free_block_index(block_index_t* index);
+
+block_index_builder_t* open_block_index_builder(const char* path, uuid_t nx_uuid, uint64_t block_count, bool resume, block_index_t* previous);
+void index_block_chunk(void* builder, char* blocks, paddr_t addr, size_t num_blocks, block_scan_results_t* results);
+bool checkpoint_block_index(void* builder, uint64_t num_chunks_output, block_scan_stats_t* stats);
+bool finish_block_index(block_index_builder_t* builder);
+void free_block_index_builder(block_index_builder_t* builder);
+
+#endif // DRAT_BLOCK_INDEX_H
@@ -0,0 +1,432 @@
+/**
+ * Functions used to scan a range of blocks of the container in parallel; see
+ * `block-scan.h` for details.
+ */
+
+#include "block-scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <drat/io.h>
+
+/**
+ * Number of chunks between progress updates.
+ */
+#define BLOCK_SCAN_PROGRESS_CHUNKS  64
+
+#define BLOCK_SCAN_MAX_SLOTS    (BLOCK_SCAN_SLOTS_PER_THREAD * BLOCK_SCAN_MAX_THREADS)
+
+/**
+ * Make room for a result of a given length in a chunk's results.
+ */
+static void reserve_block_scan_result(block_scan_results_t* results, size_t len) {
+    if (results->text_capacity - results->text_len < len + 1) {
+        while (results->text_capacity - results->text_len < len + 1) {
+            results->text_capacity = results->text_capacity ? 2 * results->text_capacity : 4096;
+        }
+        results->text = realloc(results->text, results->text_capacity);
+        if (!results->text) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `results->text`.\n", __func__);
+            exit(-1);
+        }
+    }
+    if (results->num_results == results->results_capacity) {
+        results->results_capacity = results->results_capacity ? 2 * results->results_capacity : 64;
+        results->result_ends = realloc(results->result_ends, results->results_capacity * sizeof(size_t));
+        if (!results->result_ends) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `results->result_ends`.\n", __func__);
+            exit(-1);
+        }
+    }
+}
+
+/**
+ * Add a result to a chunk's results. The text is formatted like `printf()`,
+ * and should normally end with a newline.
+ */
+void add_block_scan_result(block_scan_results_t* results, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    reserve_block_scan_result(results, len);
+
+    va_start(args, format);
+    vsnprintf(results->text + results->text_len, len + 1, format, args);
+    va_end(args);
+    results->text_len += len;
+    results->result_ends[results->num_results++] = results->text_len;
+}
+
+/**
+ * Add a binary result to a chunk's results, e.g. a record to be written to an
+ * index file.
+ */
+void add_block_scan_data(block_scan_results_t* results, const void* data, size_t len) {
+    reserve_block_scan_result(results, len);
+    memcpy(results->text + results->text_len, data, len);
+    results->text_len += len;
+    results->result_ends[results->num_results++] = results->text_len;
+}
+
+/**
+ * Empty a chunk's results, keeping their memory for the next chunk.
+ */
+static void clear_block_scan_results(block_scan_results_t* results) {
+    results->text_len = 0;
+    results->num_results = 0;
+    results->num_rejected = 0;
+    results->num_invalid = 0;
+}
+
+/**
+ * State shared between the worker threads and the calling thread. All fields
+ * other than the slots' contents are protected by `lock`.
+ *
+ * addrs:   The addresses of the blocks to scan, in ascending order, or a NULL
+ *      pointer to scan `num_blocks` consecutive blocks from `start_addr`.
+ *
+ * chunk_fn:    If set, called once per chunk instead of calling `fn` on each
+ *      block; see `scan_block_chunks()`.
+ *
+ * slot_chunks:     For each slot, the index of the chunk whose results it
+ *      holds, plus one; zero if it doesn't hold any yet.
+ *
+ * slot_num_read:   For each slot, the number of blocks of its chunk that
+ *      could be read.
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      chunk_ready;
+    pthread_cond_t      slot_free;
+
+    paddr_t             start_addr;
+    const paddr_t*      addrs;
+    uint64_t            num_blocks;
+    size_t              num_chunks;
+    block_scan_fn       fn;
+    block_scan_chunk_fn chunk_fn;
+    block_scan_output_fn    on_output;
+    void*               context;
+
+    size_t              num_slots;
+    block_scan_results_t    slots[BLOCK_SCAN_MAX_SLOTS];
+    size_t              slot_chunks[BLOCK_SCAN_MAX_SLOTS];
+    uint64_t            slot_num_read[BLOCK_SCAN_MAX_SLOTS];
+
+    size_t              next_claim;
+    size_t              next_output;
+    bool                stopped;
+} block_scan_t;
+
+static paddr_t get_block_scan_addr(block_scan_t* scan, uint64_t i) {
+    return scan->addrs ? scan->addrs[i] : scan->start_addr + (paddr_t)i;
+}
+
+static void* block_scan_worker(void* arg) {
+    block_scan_t* scan = arg;
+
+    char* blocks = malloc(BLOCK_SCAN_CHUNK_BLOCKS * nx_block_size);
+    if (!blocks) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `blocks`.\n", __func__);
+        exit(-1);
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    while (!scan->stopped && scan->next_claim < scan->num_chunks) {
+        size_t chunk_index = scan->next_claim++;
+
+        // Wait until the chunk that last used this slot has been output
+        while (!scan->stopped && chunk_index >= scan->next_output + scan->num_slots) {
+            pthread_cond_wait(&scan->slot_free, &scan->lock);
+        }
+        if (scan->stopped) {
+            break;
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        size_t slot = chunk_index % scan->num_slots;
+        block_scan_results_t* results = scan->slots + slot;
+        clear_block_scan_results(results);
+
+        uint64_t chunk_start = chunk_index * (uint64_t)BLOCK_SCAN_CHUNK_BLOCKS;
+        size_t chunk_len = BLOCK_SCAN_CHUNK_BLOCKS;
+        if (scan->num_blocks - chunk_start < chunk_len) {
+            chunk_len = scan->num_blocks - chunk_start;
+        }
+
+        // Read each run of consecutive addresses with a single request. If a
+        // run can't be read in one go, e.g. due to a bad sector, read as many
+        // of its blocks as possible one by one.
+        uint64_t num_readable = 0;
+        for (size_t i = 0; i < chunk_len; ) {
+            paddr_t run_addr = get_block_scan_addr(scan, chunk_start + i);
+            size_t run_len = 1;
+            while (i + run_len < chunk_len && get_block_scan_addr(scan, chunk_start + i + run_len) == run_addr + (paddr_t)run_len) {
+                run_len++;
+            }
+
+            size_t num_read = pread_blocks(blocks + i * nx_block_size, run_addr, run_len);
+            for (size_t j = 0; j < run_len; j++) {
+                char* block = blocks + (i + j) * nx_block_size;
+                if (j >= num_read && pread_blocks(block, run_addr + j, 1) != 1) {
+                    memset(block, 0, nx_block_size);
+                    continue;
+                }
+                num_readable++;
+                if (!scan->chunk_fn) {
+                    scan->fn(scan->context, (obj_phys_t*)block, run_addr + j, results);
+                }
+            }
+            i += run_len;
+        }
+        if (scan->chunk_fn) {
+            scan->chunk_fn(scan->context, blocks, get_block_scan_addr(scan, chunk_start), chunk_len, results);
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        scan->slot_chunks[slot] = chunk_index + 1;
+        scan->slot_num_read[slot] = num_readable;
+        pthread_cond_broadcast(&scan->chunk_ready);
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    free(blocks);
+    return NULL;
+}
+
+/**
+ * Run a scan whose fields other than the thread state have been set up; see
+ * `scan_blocks()` for the parameters.
+ */
+static bool run_block_scan(block_scan_t* scan, uint32_t num_threads, uint64_t limit, FILE* out, FILE* progress, block_scan_stats_t* stats) {
+    memset(stats, 0, sizeof(block_scan_stats_t));
+    if (scan->num_blocks == 0) {
+        return true;
+    }
+
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    if (num_threads > BLOCK_SCAN_MAX_THREADS) {
+        num_threads = BLOCK_SCAN_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&scan->lock, NULL);
+    pthread_cond_init(&scan->chunk_ready, NULL);
+    pthread_cond_init(&scan->slot_free, NULL);
+    scan->num_chunks = (scan->num_blocks + BLOCK_SCAN_CHUNK_BLOCKS - 1) / BLOCK_SCAN_CHUNK_BLOCKS;
+    scan->num_slots = BLOCK_SCAN_SLOTS_PER_THREAD * num_threads;
+
+    pthread_t threads[BLOCK_SCAN_MAX_THREADS];
+    for (; stats->num_threads < num_threads; stats->num_threads++) {
+        if (pthread_create(threads + stats->num_threads, NULL, block_scan_worker, scan) != 0) {
+            break;
+        }
+    }
+    if (stats->num_threads == 0) {
+        fprintf(stderr, "\nERROR: %s: Could not create any worker threads.\n", __func__);
+        return false;
+    }
+
+    bool success = true;
+    bool progress_shown = false;
+    for (size_t chunk_index = 0; chunk_index < scan->num_chunks; chunk_index++) {
+        size_t slot = chunk_index % scan->num_slots;
+        pthread_mutex_lock(&scan->lock);
+        while (scan->slot_chunks[slot] != chunk_index + 1) {
+            pthread_cond_wait(&scan->chunk_ready, &scan->lock);
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        block_scan_results_t* results = scan->slots + slot;
+        uint64_t chunk_start = chunk_index * (uint64_t)BLOCK_SCAN_CHUNK_BLOCKS;
+        uint64_t chunk_len = scan->num_blocks - chunk_start < BLOCK_SCAN_CHUNK_BLOCKS ? scan->num_blocks - chunk_start : BLOCK_SCAN_CHUNK_BLOCKS;
+        stats->num_blocks += chunk_len;
+        stats->num_read_errors += chunk_len - scan->slot_num_read[slot];
+        stats->num_rejected += results->num_rejected;
+        stats->num_invalid += results->num_invalid;
+
+        size_t num_to_output = results->num_results;
+        if (limit != 0 && num_to_output > limit - stats->num_results) {
+            num_to_output = limit - stats->num_results;
+        }
+        if (num_to_output != 0) {
+            if (progress_shown) {
+                fprintf(progress, "\r\033[2K");
+                progress_shown = false;
+            }
+            size_t text_len = results->result_ends[num_to_output - 1];
+            if (fwrite(results->text, 1, text_len, out) != text_len) {
+                fprintf(stderr, "\nERROR: %s: Could not write the results.\n", __func__);
+                success = false;
+            }
+        }
+        stats->num_results += num_to_output;
+        if (success && scan->on_output && !scan->on_output(scan->context, chunk_index + 1, stats)) {
+            success = false;
+        }
+
+        bool done = !success || (limit != 0 && stats->num_results == limit);
+        stats->limit_reached = success && done && chunk_index + 1 < scan->num_chunks;
+
+        pthread_mutex_lock(&scan->lock);
+        scan->next_output++;
+        scan->stopped = done;
+        pthread_cond_broadcast(&scan->slot_free);
+        pthread_mutex_unlock(&scan->lock);
+        if (done) {
+            break;
+        }
+
+        if (progress && (chunk_index % BLOCK_SCAN_PROGRESS_CHUNKS == 0 || chunk_index + 1 == scan->num_chunks)) {
+            fprintf(
+                progress, "\rScanned %#"PRIx64" of %#"PRIx64" blocks (%.2f%%) ... ",
+                stats->num_blocks, scan->num_blocks,
+                100.0 * stats->num_blocks / scan->num_blocks
+            );
+            progress_shown = true;
+        }
+    }
+    if (progress_shown) {
+        fprintf(progress, "\n");
+    }
+
+    for (uint32_t i = 0; i < stats->num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (size_t i = 0; i < scan->num_slots; i++) {
+        free(scan->slots[i].text);
+        free(scan->slots[i].result_ends);
+    }
+    pthread_mutex_destroy(&scan->lock);
+    pthread_cond_destroy(&scan->chunk_ready);
+    pthread_cond_destroy(&scan->slot_free);
+
+    return success;
+}
+
+/**
+ * Scan a range of blocks, calling a function on each one, and output the
+ * results in address order.
+ *
+ * start_addr, end_addr:    The range of block addresses to scan, excluding
+ *      `end_addr`.
+ *
+ * num_threads:     The number of worker threads.
+ *
+ * limit:   The maximum number of results to output, or zero for no limit.
+ *
+ * out:     The stream to write the results to.
+ *
+ * progress:    The stream to write progress updates to, or a NULL pointer.
+ *
+ * stats:   Set to the number of blocks scanned and results found.
+ *
+ * RETURN VALUE:    `true` if every result was written, else `false`.
+ */
+bool scan_blocks(
+    paddr_t             start_addr,
+    paddr_t             end_addr,
+    uint32_t            num_threads,
+    uint64_t            limit,
+    block_scan_fn       fn,
+    void*               context,
+    FILE*               out,
+    FILE*               progress,
+    block_scan_stats_t* stats
+) {
+    block_scan_t* scan = calloc(1, sizeof(block_scan_t));
+    if (!scan) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `scan`.\n", __func__);
+        exit(-1);
+    }
+    scan->start_addr = start_addr;
+    scan->num_blocks = start_addr < end_addr ? end_addr - start_addr : 0;
+    scan->fn = fn;
+    scan->context = context;
+
+    bool success = run_block_scan(scan, num_threads, limit, out, progress, stats);
+    free(scan);
+    return success;
+}
+
+/**
+ * Scan a list of blocks, e.g. the candidates given by an index, in the same
+ * way as `scan_blocks()`. Runs of consecutive addresses are read with a single
+ * request.
+ *
+ * addrs:   The addresses of the blocks to scan, in ascending order.
+ *
+ * num_addrs:   The number of entries in `addrs`.
+ */
+bool scan_block_list(
+    const paddr_t*      addrs,
+    uint64_t            num_addrs,
+    uint32_t            num_threads,
+    uint64_t            limit,
+    block_scan_fn       fn,
+    void*               context,
+    FILE*               out,
+    FILE*               progress,
+    block_scan_stats_t* stats
+) {
+    block_scan_t* scan = calloc(1, sizeof(block_scan_t));
+    if (!scan) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `scan`.\n", __func__);
+        exit(-1);
+    }
+    scan->addrs = addrs;
+    scan->num_blocks = num_addrs;
+    scan->fn = fn;
+    scan->context = context;
+
+    bool success = run_block_scan(scan, num_threads, limit, out, progress, stats);
+    free(scan);
+    return success;
+}
+
+/**
+ * Scan a range of blocks in the same way as `scan_blocks()`, but call a
+ * function on each chunk as a whole rather than on each block, e.g. to hash
+ * the chunk's contents before deciding whether to look at its blocks. Blocks
+ * that can't be read are passed to `fn` as zeroes.
+ *
+ * on_output:   If not a NULL pointer, called on the calling thread after each
+ *      chunk's results have been written, with the number of chunks whose
+ *      results have been written so far. If it returns `false`, the scan
+ *      stops and fails.
+ */
+bool scan_block_chunks(
+    paddr_t                 start_addr,
+    paddr_t                 end_addr,
+    uint32_t                num_threads,
+    block_scan_chunk_fn     fn,
+    block_scan_output_fn    on_output,
+    void*                   context,
+    FILE*                   out,
+    FILE*                   progress,
+    block_scan_stats_t*     stats
+) {
+    block_scan_t* scan = calloc(1, sizeof(block_scan_t));
+    if (!scan) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `scan`.\n", __func__);
+        exit(-1);
+    }
+    scan->start_addr = start_addr;
+    scan->num_blocks = start_addr < end_addr ? end_addr - start_addr : 0;
+    scan->chunk_fn = fn;
+    scan->on_output = on_output;
+    scan->context = context;
+
+    bool success = run_block_scan(scan, num_threads, 0, out, progress, stats);
+    free(scan);
+    return success;
+}
@@ -0,0 +1,131 @@
+#ifndef DRAT_BLOCK_SCAN_H
+#define DRAT_BLOCK_SCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/general.h>   // paddr_t
+#include <apfs/object.h>    // obj_phys_t
+
+/**
+ * A parallel scan over a range of blocks of the container, for commands that
+ * look at every block rather than following the container's structures.
+ *
+ * The range is split into chunks of `BLOCK_SCAN_CHUNK_BLOCKS` blocks. Worker
+ * threads claim chunks in address order, read each one with a single request,
+ * and pass each of its blocks to a callback, which may add any number of
+ * results, e.g. lines of output. Each chunk's results are kept apart, and the
+ * calling thread outputs them chunk by chunk in address order, so the output
+ * is the same regardless of the number of threads. At most
+ * `BLOCK_SCAN_SLOTS_PER_THREAD` chunks per thread are held at once; a worker
+ * that gets too far ahead waits for earlier chunks to be output.
+ *
+ * Once a given number of results have been output, the scan stops early,
+ * without reading the rest of the range.
+ *
+ * Instead of a range, a sorted list of addresses can be scanned, e.g. the
+ * candidate blocks given by an index; chunks are then made up of
+ * `BLOCK_SCAN_CHUNK_BLOCKS` entries of the list.
+ */
+
+#define BLOCK_SCAN_CHUNK_BLOCKS         256
+#define BLOCK_SCAN_SLOTS_PER_THREAD     4
+#define BLOCK_SCAN_MAX_THREADS          64
+
+/**
+ * The results of scanning a single chunk.
+ *
+ * text:    The text of all of the results, one after the other, of `text_len`
+ *      bytes; result `i` ends at byte offset `result_ends[i]`.
+ *
+ * num_rejected:    Number of blocks that the callback rejected by looking at
+ *      their headers alone.
+ *
+ * num_invalid:     Number of blocks that passed those checks, but whose
+ *      checksum was invalid.
+ */
+typedef struct {
+    char*       text;
+    size_t      text_len;
+    size_t      text_capacity;
+    size_t*     result_ends;
+    size_t      num_results;
+    size_t      results_capacity;
+    uint64_t    num_rejected;
+    uint64_t    num_invalid;
+} block_scan_results_t;
+
+void add_block_scan_result(block_scan_results_t* results, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void add_block_scan_data(block_scan_results_t* results, const void* data, size_t len);
+
+/**
+ * A function that is called on each block in the scanned range. It is called
+ * from several threads at once, so it must not modify `context` without
+ * synchronisation.
+ */
+typedef void (*block_scan_fn)(void* context, obj_phys_t* block, paddr_t addr, block_scan_results_t* results);
+
+/**
+ * A function that is called on each chunk in the scanned range, with the
+ * contents of its `num_blocks` blocks, the first of which is at `addr`.
+ */
+typedef void (*block_scan_chunk_fn)(void* context, char* blocks, paddr_t addr, size_t num_blocks, block_scan_results_t* results);
+
+/**
+ * num_read_errors:     Number of blocks that couldn't be read.
+ *
+ * limit_reached:   Whether the scan stopped early because the result limit
+ *      was reached, in which case the other counts only cover the chunks that
+ *      were output.
+ */
+typedef struct {
+    uint32_t    num_threads;
+    uint64_t    num_blocks;
+    uint64_t    num_read_errors;
+    uint64_t    num_rejected;
+    uint64_t    num_invalid;
+    uint64_t    num_results;
+    bool        limit_reached;
+} block_scan_stats_t;
+
+typedef bool (*block_scan_output_fn)(void* context, uint64_t num_chunks_output, block_scan_stats_t* stats);
+
+bool scan_blocks(
+    paddr_t             start_addr,
+    paddr_t             end_addr,
+    uint32_t            num_threads,
+    uint64_t            limit,
+    block_scan_fn       fn,
+    void*               context,
+    FILE*               out,
+    FILE*               progress,
+    block_scan_stats_t* stats
+);
+
+bool scan_block_list(
+    const paddr_t*      addrs,
+    uint64_t            num_addrs,
+    uint32_t            num_threads,
+    uint64_t            limit,
+    block_scan_fn       fn,
+    void*               context,
+    FILE*               out,
+    FILE*               progress,
+    block_scan_stats_t* stats
+);
+
+bool scan_block_chunks(
+    paddr_t                 start_addr,
+    paddr_t                 end_addr,
+    uint32_t                num_threads,
+    block_scan_chunk_fn     fn,
+    block_scan_output_fn    on_output,
+    void*                   context,
+    FILE*                   out,
+    FILE*                   progress,
+    block_scan_stats_t*     stats
+);
+
+#endif // DRAT_BLOCK_SCAN_H
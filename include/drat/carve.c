@@ -0,0 +1,533 @@
+/**
+ * Functions used to carve files out of raw blocks by their signatures; see
+ * `carve.h` for details.
+ */
+
+#include "carve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <drat/io.h>
+#include <drat/output.h>
+
+#define SIGNATURE(bytes)    bytes, sizeof(bytes) - 1
+
+#define MiB     (1024ULL * 1024)
+
+static uint16_t read_be16(const uint8_t* bytes) {
+    return (uint16_t)bytes[0] << 8 | bytes[1];
+}
+
+static uint32_t read_be32(const uint8_t* bytes) {
+    return (uint32_t)read_be16(bytes) << 16 | read_be16(bytes + 2);
+}
+
+static uint64_t read_be64(const uint8_t* bytes) {
+    return (uint64_t)read_be32(bytes) << 32 | read_be32(bytes + 4);
+}
+
+/**
+ * A JPEG's start-of-image marker is immediately followed by another marker.
+ */
+static bool check_jpeg_header(const uint8_t* block) {
+    return block[3] >= 0xc0 && block[3] != 0xff;
+}
+
+/** States of a walk through a JPEG; see `walk_jpeg()` */
+enum {
+    JPEG_WALK_MARKER_START,
+    JPEG_WALK_MARKER,
+    JPEG_WALK_LENGTH_HIGH,
+    JPEG_WALK_LENGTH_LOW,
+    JPEG_WALK_SEGMENT,
+    JPEG_WALK_SCAN_LENGTH_HIGH,
+    JPEG_WALK_SCAN_LENGTH_LOW,
+    JPEG_WALK_SCAN_SEGMENT,
+    JPEG_WALK_ENTROPY,
+    JPEG_WALK_ENTROPY_MARKER,
+};
+
+/**
+ * Walk through a JPEG's marker segments, skipping each by its length, and
+ * through the entropy-coded data that follows each start-of-scan segment, to
+ * its end-of-image marker. An end-of-image marker within a segment, such as
+ * that of a thumbnail in the EXIF data, is skipped along with the segment.
+ */
+static uint64_t walk_jpeg(carve_walk_t* walk, const uint8_t* window, size_t window_len, uint64_t window_offset) {
+    size_t pos = walk->offset - window_offset;
+    while (pos < window_len) {
+        uint8_t byte = window[pos];
+        switch (walk->state) {
+            case JPEG_WALK_MARKER_START:
+                if (byte != 0xff) {
+                    return CARVE_WALK_INVALID;
+                }
+                walk->state = JPEG_WALK_MARKER;
+                break;
+
+            case JPEG_WALK_MARKER:
+                if (byte == 0xd9) {
+                    return window_offset + pos + 1;
+                }
+                if (byte == 0xd8) {
+                    // Start of image, which only comes first
+                    if (window_offset + pos != 1) {
+                        return CARVE_WALK_INVALID;
+                    }
+                    walk->state = JPEG_WALK_MARKER_START;
+                } else if (byte == 0x01 || (byte >= 0xd0 && byte <= 0xd7)) {
+                    walk->state = JPEG_WALK_MARKER_START;   // No segment
+                } else if (byte == 0x00) {
+                    return CARVE_WALK_INVALID;
+                } else if (byte != 0xff) {  // Else a fill byte
+                    walk->state = byte == 0xda ? JPEG_WALK_SCAN_LENGTH_HIGH : JPEG_WALK_LENGTH_HIGH;
+                }
+                break;
+
+            case JPEG_WALK_LENGTH_HIGH:
+            case JPEG_WALK_SCAN_LENGTH_HIGH:
+                walk->remaining = (uint32_t)byte << 8;
+                walk->state++;
+                break;
+
+            case JPEG_WALK_LENGTH_LOW:
+            case JPEG_WALK_SCAN_LENGTH_LOW:
+                // The length includes its own two bytes
+                walk->remaining |= byte;
+                if (walk->remaining < 2) {
+                    return CARVE_WALK_INVALID;
+                }
+                walk->remaining -= 2;
+                walk->state++;
+                if (walk->remaining == 0) {
+                    walk->state = walk->state == JPEG_WALK_SEGMENT ? JPEG_WALK_MARKER_START : JPEG_WALK_ENTROPY;
+                }
+                break;
+
+            case JPEG_WALK_SEGMENT:
+            case JPEG_WALK_SCAN_SEGMENT: {
+                size_t num_bytes = window_len - pos < walk->remaining ? window_len - pos : walk->remaining;
+                walk->remaining -= num_bytes;
+                pos += num_bytes;
+                if (walk->remaining == 0) {
+                    walk->state = walk->state == JPEG_WALK_SEGMENT ? JPEG_WALK_MARKER_START : JPEG_WALK_ENTROPY;
+                }
+                continue;
+            }
+
+            case JPEG_WALK_ENTROPY: {
+                const uint8_t* marker = memchr(window + pos, 0xff, window_len - pos);
+                if (!marker) {
+                    pos = window_len;
+                    continue;
+                }
+                pos = marker - window;
+                walk->state = JPEG_WALK_ENTROPY_MARKER;
+                break;
+            }
+
+            case JPEG_WALK_ENTROPY_MARKER:
+                // A zero byte is stuffing and a restart marker is part of the
+                // data; anything else is the next marker
+                if (byte == 0x00 || (byte >= 0xd0 && byte <= 0xd7)) {
+                    walk->state = JPEG_WALK_ENTROPY;
+                } else if (byte != 0xff) {
+                    walk->state = JPEG_WALK_MARKER;
+                    continue;
+                }
+                break;
+        }
+        pos++;
+    }
+    walk->offset = window_offset + pos;
+    return 0;
+}
+
+/**
+ * A PDF's end-of-file marker is usually followed by a line ending, which is
+ * included in the file.
+ */
+static uint64_t get_pdf_end(const uint8_t* footer, uint64_t offset) {
+    uint64_t end = offset + 5;
+    if (footer[5] == '\r') {
+        end++;
+        if (footer[6] == '\n') {
+            end++;
+        }
+    } else if (footer[5] == '\n') {
+        end++;
+    }
+    return end;
+}
+
+/**
+ * A ZIP archive ends with its end-of-central-directory record, which is
+ * followed by a comment of the length given at byte 20 of the record.
+ */
+static uint64_t get_zip_end(const uint8_t* footer, uint64_t offset) {
+    return offset + 22 + (footer[20] | (uint16_t)footer[21] << 8);
+}
+
+/**
+ * An SQLite database's header gives its page size and number of pages.
+ */
+static uint64_t get_sqlite_size(const uint8_t* block) {
+    uint32_t page_size = read_be16(block + 16);
+    if (page_size == 1) {
+        page_size = 65536;
+    }
+    if (page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0) {
+        return 0;
+    }
+    return (uint64_t)page_size * read_be32(block + 28);
+}
+
+/**
+ * A binary property list ends with a 32-byte trailer that starts with six
+ * zero bytes, and gives the size of each offset, the number of objects, and
+ * the location of the offset table, which immediately precedes the trailer.
+ */
+static uint64_t get_bplist_end(const uint8_t* footer, uint64_t offset) {
+    uint8_t offset_size = footer[6];
+    uint8_t ref_size = footer[7];
+    uint64_t num_objects = read_be64(footer + 8);
+    uint64_t top_object = read_be64(footer + 16);
+    uint64_t offset_table = read_be64(footer + 24);
+    if (
+           offset_size == 0 || offset_size > 8
+        || ref_size == 0 || ref_size > 8
+        || num_objects == 0 || top_object >= num_objects
+        || offset_table < 8 || offset_table > offset
+        || num_objects > (offset - offset_table) / offset_size
+        || offset_table + num_objects * offset_size != offset
+    ) {
+        return 0;
+    }
+    return offset + 32;
+}
+
+/**
+ * The kinds of file that can be carved, in the order in which their headers
+ * are checked. There can be at most 32.
+ */
+const carve_signature_t carve_signatures[] = {
+    {
+        .name = "jpeg", .extension = "jpg",
+        .header = SIGNATURE("\xff\xd8\xff"),
+        .max_size = 32 * MiB,
+        .check_header = check_jpeg_header,
+        .walk = walk_jpeg,
+    },
+    {
+        .name = "png", .extension = "png",
+        .header = SIGNATURE("\x89PNG\r\n\x1a\n"),
+        .footer = SIGNATURE("IEND\xae\x42\x60\x82"), .footer_bytes = 8,
+        .max_size = 64 * MiB,
+    },
+    {
+        .name = "pdf", .extension = "pdf",
+        .header = SIGNATURE("%PDF-"),
+        .footer = SIGNATURE("%%EOF"), .footer_bytes = 7,
+        .max_size = 256 * MiB,
+        .get_end = get_pdf_end,
+        .last_footer = true,
+    },
+    {
+        .name = "zip", .extension = "zip",
+        .header = SIGNATURE("PK\x03\x04"),
+        .footer = SIGNATURE("PK\x05\x06"), .footer_bytes = 22,
+        .max_size = 256 * MiB,
+        .get_end = get_zip_end,
+    },
+    {
+        .name = "sqlite", .extension = "sqlite",
+        .header = SIGNATURE("SQLite format 3\0"),
+        .max_size = 1024 * MiB,
+        .get_size = get_sqlite_size,
+    },
+    {
+        .name = "bplist", .extension = "plist",
+        .header = SIGNATURE("bplist00"),
+        .footer = SIGNATURE("\0\0\0\0\0\0"), .footer_bytes = 32,
+        .max_size = 16 * MiB,
+        .get_end = get_bplist_end,
+    },
+    {
+        .name = "xml-plist", .extension = "plist",
+        .header = SIGNATURE("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE plist"),
+        .footer = SIGNATURE("</plist>\n"), .footer_bytes = 9,
+        .max_size = 16 * MiB,
+    },
+};
+
+const size_t num_carve_signatures = sizeof(carve_signatures) / sizeof(carve_signatures[0]);
+
+/**
+ * Enable a kind of file for carving.
+ */
+static void enable_carve_signature(carve_context_t* context, size_t index) {
+    context->signatures_by_byte[(uint8_t)carve_signatures[index].header[0]] |= 1u << index;
+}
+
+/**
+ * Initialise a carving context, with every kind of file enabled.
+ *
+ * output_dir:  The directory to write carved files to, or a NULL pointer to
+ *      only report them.
+ *
+ * allocated:   The blocks to exclude, or a NULL pointer to carve from every
+ *      block.
+ *
+ * num_blocks:  The number of blocks in the container.
+ */
+void init_carve_context(carve_context_t* context, const char* output_dir, allocation_bitmap_t* allocated, uint64_t num_blocks) {
+    memset(context, 0, sizeof(carve_context_t));
+    context->output_dir = output_dir;
+    context->allocated = allocated;
+    context->num_blocks = num_blocks;
+    for (size_t i = 0; i < num_carve_signatures; i++) {
+        enable_carve_signature(context, i);
+    }
+}
+
+/**
+ * Parse a value of `--types`, a comma-delimited list of the names of the
+ * kinds of file to carve, and enable only those.
+ *
+ * RETURN VALUE:    `true` if every name is valid, else `false`.
+ */
+bool parse_carve_types(const char* arg, carve_context_t* context) {
+    char* arg_copy = strdup(arg);
+    if (!arg_copy) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `arg_copy`.\n", __func__);
+        exit(-1);
+    }
+
+    memset(context->signatures_by_byte, 0, sizeof(context->signatures_by_byte));
+    bool success = true;
+    char* saveptr = NULL;
+    for (char* name = strtok_r(arg_copy, ",", &saveptr); name && success; name = strtok_r(NULL, ",", &saveptr)) {
+        success = false;
+        for (size_t i = 0; i < num_carve_signatures; i++) {
+            if (strcmp(name, carve_signatures[i].name) == 0) {
+                enable_carve_signature(context, i);
+                success = true;
+            }
+        }
+    }
+
+    free(arg_copy);
+    return success;
+}
+
+/**
+ * Search a window of a file for the first match of its footer that
+ * `get_end` accepts, or the last if the signature has `last_footer` set.
+ *
+ * window:  `window_len` bytes of the file, starting at byte `window_offset`.
+ *      Matches are only looked for from byte `search_start` of the window,
+ *      and only where `footer_bytes` bytes are available.
+ *
+ * RETURN VALUE:    The size of the file, or zero if it doesn't end within the
+ *      window.
+ */
+static uint64_t find_carve_end(const carve_signature_t* signature, const uint8_t* window, size_t window_len, uint64_t window_offset, size_t search_start) {
+    const uint8_t* cursor = window + search_start;
+    const uint8_t* window_end = window + window_len;
+    uint64_t last_end = 0;
+    while (cursor < window_end) {
+        const uint8_t* match = memmem(cursor, window_end - cursor, signature->footer, signature->footer_len);
+        if (!match || (size_t)(window_end - match) < signature->footer_bytes) {
+            break;
+        }
+
+        uint64_t offset = window_offset + (match - window);
+        uint64_t end = signature->get_end ? signature->get_end(match, offset) : offset + signature->footer_len;
+        if (end != 0) {
+            if (!signature->last_footer) {
+                return end;
+            }
+            last_end = end;
+        }
+        cursor = match + 1;
+    }
+    return last_end;
+}
+
+/**
+ * Carve a file whose header is at the start of a given block, reading the
+ * blocks after it until its end is found, and writing it to the output
+ * directory, if any.
+ *
+ * RETURN VALUE:    The size of the file, or zero if its end wasn't found.
+ */
+static uint64_t carve_file(carve_context_t* context, const carve_signature_t* signature, const uint8_t* first_block, paddr_t addr, const char* path) {
+    uint64_t max_blocks = (signature->max_size + nx_block_size - 1) / nx_block_size;
+    if (max_blocks > context->num_blocks - addr) {
+        max_blocks = context->num_blocks - addr;
+    }
+    if (context->allocated) {
+        max_blocks = get_free_run_length(context->allocated, addr, max_blocks);
+    }
+    uint64_t max_bytes = max_blocks * nx_block_size;
+
+    uint64_t end = 0;
+    if (signature->get_size) {
+        end = signature->get_size(first_block);
+        if (end > max_bytes) {
+            end = 0;
+        }
+        if (end == 0 || !path) {
+            return end;
+        }
+    }
+
+    int fd = -1;
+    if (path) {
+        if (!create_output_file(path, 0) || (fd = open_output_file(path)) == -1) {
+            return 0;
+        }
+    }
+
+    // Each window is preceded by the last bytes of the one before it, so that
+    // footers which straddle the two are found
+    size_t carry_capacity = CARVE_MAX_FOOTER_BYTES - 1;
+    uint8_t* buffer = malloc(carry_capacity + CARVE_WINDOW_BLOCKS * nx_block_size);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+    uint8_t* window = buffer + carry_capacity;
+    size_t carry = 0;
+    carve_walk_t walk = { 0 };
+
+    bool success = true;
+    bool next_header_found = false;
+    uint64_t num_written = 0;
+    for (uint64_t blocks_done = 0; success && !next_header_found && blocks_done < max_blocks; ) {
+        uint64_t num_blocks = max_blocks - blocks_done;
+        if (num_blocks > CARVE_WINDOW_BLOCKS) {
+            num_blocks = CARVE_WINDOW_BLOCKS;
+        }
+        size_t num_read = pread_blocks(window, addr + blocks_done, num_blocks);
+        if (num_read == 0) {
+            break;
+        }
+        uint64_t window_offset = blocks_done * nx_block_size;
+        size_t window_len = num_read * nx_block_size;
+
+        if (signature->walk) {
+            end = signature->walk(&walk, window, window_len, window_offset);
+            if (end == CARVE_WALK_INVALID || end > max_bytes) {
+                end = 0;
+                break;
+            }
+        } else if (signature->last_footer) {
+            // The file can't extend into another file of the same kind
+            for (size_t i = blocks_done == 0 ? 1 : 0; i < num_read; i++) {
+                if (memcmp(window + i * nx_block_size, signature->header, signature->header_len) == 0) {
+                    window_len = i * nx_block_size;
+                    next_header_found = true;
+                    break;
+                }
+            }
+            size_t search_start = blocks_done == 0 ? signature->header_len : 0;
+            uint64_t last_end = find_carve_end(signature, window - carry, carry + window_len, window_offset - carry, search_start);
+            if (last_end != 0 && last_end <= max_bytes) {
+                end = last_end;
+            }
+        } else if (end == 0) {
+            size_t search_start = blocks_done == 0 ? signature->header_len : 0;
+            end = find_carve_end(signature, window - carry, carry + window_len, window_offset - carry, search_start);
+            if (end > max_bytes) {
+                end = 0;
+                break;
+            }
+        }
+
+        // Files that end with their last footer are written in full, since a
+        // later footer may yet be found, and truncated once the scan is done
+        if (fd != -1) {
+            size_t write_len = window_len;
+            if (!signature->last_footer && end != 0 && end < window_offset + window_len) {
+                write_len = end > window_offset ? end - window_offset : 0;
+            }
+            success = append_output_fd(fd, window, write_len);
+            num_written += write_len;
+        }
+        if (!signature->last_footer && end != 0 && end <= window_offset + window_len) {
+            break;
+        }
+
+        if (signature->footer && (end == 0 || signature->last_footer) && window_len != 0) {
+            carry = signature->footer_bytes - 1;
+            memmove(window - carry, window + window_len - carry, carry);
+        }
+        blocks_done += num_read;
+        if (num_read < num_blocks) {
+            break;
+        }
+    }
+    free(buffer);
+
+    // A footer that straddles two windows may end before the data that was
+    // already written does. Otherwise, the file is only complete once all of
+    // it has been read.
+    if (fd != -1) {
+        if (end != 0 && num_written > end && ftruncate(fd, end) == 0) {
+            num_written = end;
+        }
+        if (!success || num_written != end) {
+            end = 0;
+        }
+        close(fd);
+        if (end == 0) {
+            unlink(path);
+        }
+    }
+    return end;
+}
+
+/**
+ * Check whether a block starts with the header of any enabled kind of file,
+ * and if so, carve that file and add a line describing it to `results`; see
+ * `block_scan_fn`.
+ */
+void carve_block(void* context, obj_phys_t* block, paddr_t addr, block_scan_results_t* results) {
+    carve_context_t* carve = context;
+    const uint8_t* bytes = (uint8_t*)block;
+
+    uint32_t candidates = carve->signatures_by_byte[bytes[0]];
+    if (candidates == 0 || (carve->allocated && is_block_allocated(carve->allocated, addr))) {
+        return;
+    }
+
+    for (size_t i = 0; candidates != 0; i++, candidates >>= 1) {
+        const carve_signature_t* signature = carve_signatures + i;
+        if (
+               !(candidates & 1)
+            || memcmp(bytes, signature->header, signature->header_len) != 0
+            || (signature->check_header && !signature->check_header(bytes))
+        ) {
+            continue;
+        }
+
+        char path[1024] = "";
+        if (carve->output_dir) {
+            snprintf(path, sizeof(path), "%s/%#"PRIx64".%s", carve->output_dir, addr, signature->extension);
+        }
+        uint64_t size = carve_file(carve, signature, bytes, addr, carve->output_dir ? path : NULL);
+        if (size == 0) {
+            add_block_scan_result(results, "%#"PRIx64"\t%s\t-\n", addr, signature->name);
+        } else if (carve->output_dir) {
+            add_block_scan_result(results, "%#"PRIx64"\t%s\t%"PRIu64"\t%s\n", addr, signature->name, size, path);
+        } else {
+            add_block_scan_result(results, "%#"PRIx64"\t%s\t%"PRIu64"\n", addr, signature->name, size);
+        }
+        return;
+    }
+}
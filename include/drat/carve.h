@@ -0,0 +1,128 @@
+#ifndef DRAT_CARVE_H
+#define DRAT_CARVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/general.h>   // paddr_t
+#include <apfs/object.h>    // obj_phys_t
+
+#include <drat/block-scan.h>
+#include <drat/allocation-bitmap.h>
+
+/**
+ * Carving of files out of raw blocks by their signatures, for the `carve`
+ * command; see `docs/commands/carve.md`.
+ *
+ * APFS always stores a file's data from the start of a block, so a file's
+ * header signature is only looked for at the start of each block, by way of
+ * a table giving the signatures that start with each possible byte. Each
+ * header that is found is then followed through the blocks after it, which
+ * are read in windows of `CARVE_WINDOW_BLOCKS` blocks, until the end of the
+ * file is found: either its size is given by its header, its structure is
+ * walked from the start, or its footer signature is searched for. The last
+ * few bytes of each window are kept, so that footers that straddle two
+ * windows are found. The carved data is
+ * written out as it is read, so files of any size are carved in constant
+ * memory.
+ */
+
+#define CARVE_WINDOW_BLOCKS     BLOCK_SCAN_CHUNK_BLOCKS
+
+/** Number of bytes from the start of a footer that `get_end` may look at */
+#define CARVE_MAX_FOOTER_BYTES  32
+
+/** Returned by a `walk` function when a file's structure is invalid */
+#define CARVE_WALK_INVALID      UINT64_MAX
+
+/**
+ * The progress of a walk through the structure of a file, carried from one
+ * window of it to the next.
+ *
+ * offset:  The offset within the file of the next byte to look at.
+ *
+ * state, remaining:    Format-specific state; initially zero.
+ */
+typedef struct {
+    uint64_t    offset;
+    uint32_t    state;
+    uint32_t    remaining;
+} carve_walk_t;
+
+/**
+ * A kind of file that can be carved.
+ *
+ * max_size:    The largest size that a file of this kind is assumed to have;
+ *      files whose end isn't found within this many bytes are reported, but
+ *      not carved.
+ *
+ * check_header:    If not a NULL pointer, checks the first block of a file
+ *      whose header signature matched, to rule out false positives.
+ *
+ * get_size:    If not a NULL pointer, gets the size of a file from its first
+ *      block, in which case there is no footer; zero if the header is
+ *      invalid.
+ *
+ * footer_bytes:    Number of bytes from the start of the footer that `get_end`
+ *      looks at, at least `footer_len`.
+ *
+ * get_end:     If not a NULL pointer, gets the size of a file given a match of
+ *      its footer signature at byte `offset` of the file, or zero if this
+ *      isn't the file's footer after all. Otherwise, the file ends with the
+ *      first match of the footer.
+ *
+ * last_footer:     Whether the file ends with the last match of its footer
+ *      rather than the first, for formats that can be appended to. Matches
+ *      are looked for up to `max_size` bytes, or the next block that starts
+ *      with the header, since that's the start of another such file.
+ *
+ * walk:    If not a NULL pointer, gets the size of a file by following its
+ *      structure, given successive windows of it, of `window_len` bytes
+ *      starting at byte `window_offset` of the file; zero if the end isn't
+ *      within the window, or `CARVE_WALK_INVALID`. This is used instead of a
+ *      footer.
+ */
+typedef struct {
+    const char*     name;
+    const char*     extension;
+    const char*     header;
+    size_t          header_len;
+    const char*     footer;
+    size_t          footer_len;
+    size_t          footer_bytes;
+    uint64_t        max_size;
+    bool            (*check_header)(const uint8_t* block);
+    uint64_t        (*get_size)(const uint8_t* block);
+    uint64_t        (*get_end)(const uint8_t* footer, uint64_t offset);
+    bool            last_footer;
+    uint64_t        (*walk)(carve_walk_t* walk, const uint8_t* window, size_t window_len, uint64_t window_offset);
+} carve_signature_t;
+
+/**
+ * signatures_by_byte:  For each byte, a bitmask of the enabled signatures
+ *      whose header starts with that byte, with bit `i` set for entry `i` of
+ *      `carve_signatures`.
+ *
+ * output_dir:  The directory to write carved files to, or a NULL pointer to
+ *      only report them.
+ *
+ * allocated:   If not a NULL pointer, the blocks that are allocated; headers in
+ *      these blocks are ignored, and files are only carved from the run of
+ *      free blocks that starts with their header.
+ */
+typedef struct {
+    uint32_t                signatures_by_byte[256];
+    const char*             output_dir;
+    allocation_bitmap_t*    allocated;
+    uint64_t                num_blocks;
+} carve_context_t;
+
+extern const carve_signature_t carve_signatures[];
+extern const size_t num_carve_signatures;
+
+void init_carve_context(carve_context_t* context, const char* output_dir, allocation_bitmap_t* allocated, uint64_t num_blocks);
+bool parse_carve_types(const char* arg, carve_context_t* context);
+void carve_block(void* context, obj_phys_t* block, paddr_t addr, block_scan_results_t* results);
+
+#endif // DRAT_CARVE_H
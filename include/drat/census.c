@@ -0,0 +1,228 @@
+/**
+ * Functions used to take a census of the objects in a container; see
+ * `census.h` for details.
+ */
+
+#include "census.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apfs/object.h>
+#include <apfs/btree.h>
+
+#include <drat/io.h>    // nx_block_size
+#include <drat/search-query.h>  // get_search_object_type()
+
+#include <drat/func/boolean.h>
+#include <drat/func/cksum.h>
+
+void init_census(census_t* census, xid_t xid_bucket_width, uint16_t num_xid_buckets) {
+    memset(census, 0, sizeof(census_t));
+    census->xid_bucket_width = xid_bucket_width ? xid_bucket_width : 1;
+    census->num_xid_buckets = num_xid_buckets;
+    pthread_mutex_init(&census->lock, NULL);
+}
+
+static uint64_t hash_census_key(const census_key_t* key) {
+    uint64_t hash = key->type;
+    hash = hash * 0x9e3779b97f4a7c15 + key->subtype;
+    hash = hash * 0x9e3779b97f4a7c15 + key->storage;
+    hash = hash * 0x9e3779b97f4a7c15 + ((uint64_t)key->level << 16 | key->xid_bucket);
+    return hash ^ (hash >> 29);
+}
+
+static bool census_keys_equal(const census_key_t* a, const census_key_t* b) {
+    return a->type == b->type
+        && a->subtype == b->subtype
+        && a->storage == b->storage
+        && a->level == b->level
+        && a->xid_bucket == b->xid_bucket;
+}
+
+static void init_census_table(census_table_t* table, size_t capacity) {
+    table->entries = calloc(capacity, sizeof(census_entry_t));
+    if (!table->entries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `table->entries`.\n", __func__);
+        exit(-1);
+    }
+    table->num_entries = 0;
+    table->capacity = capacity;
+}
+
+/**
+ * Find the entry of a census table with a given key, adding an empty one if
+ * there isn't one yet.
+ */
+static census_entry_t* get_census_table_entry(census_table_t* table, const census_key_t* key) {
+    if (2 * (table->num_entries + 1) > table->capacity) {
+        census_table_t old_table = *table;
+        init_census_table(table, old_table.capacity ? 2 * old_table.capacity : 64);
+        for (size_t i = 0; i < old_table.capacity; i++) {
+            if (old_table.entries[i].count != 0) {
+                *get_census_table_entry(table, &old_table.entries[i].key) = old_table.entries[i];
+            }
+        }
+        free(old_table.entries);
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t slot = hash_census_key(key) & mask;
+    while (table->entries[slot].count != 0 && !census_keys_equal(&table->entries[slot].key, key)) {
+        slot = (slot + 1) & mask;
+    }
+    census_entry_t* entry = table->entries + slot;
+    if (entry->count == 0) {
+        entry->key = *key;
+        table->num_entries++;
+    }
+    return entry;
+}
+
+/**
+ * Add the counts and ranges of one census entry to those of an entry of a
+ * census table with the same key.
+ */
+static void add_census_entry(census_table_t* table, const census_entry_t* source) {
+    census_entry_t* entry = get_census_table_entry(table, &source->key);
+    if (entry->count == 0) {
+        *entry = *source;
+        return;
+    }
+    entry->count += source->count;
+    if (source->first_addr < entry->first_addr) {
+        entry->first_addr = source->first_addr;
+    }
+    if (source->last_addr > entry->last_addr) {
+        entry->last_addr = source->last_addr;
+    }
+    if (source->min_xid < entry->min_xid) {
+        entry->min_xid = source->min_xid;
+    }
+    if (source->max_xid > entry->max_xid) {
+        entry->max_xid = source->max_xid;
+    }
+}
+
+static bool is_zeroed_block(const uint8_t* block) {
+    return block[0] == 0 && memcmp(block, block + 1, nx_block_size - 1) == 0;
+}
+
+/**
+ * Count the objects in a chunk of the container, then add the counts to the
+ * census; see `block_scan_chunk_fn`. Only blocks whose headers are plausible
+ * have their checksums computed; others are counted in `results->num_rejected`,
+ * unless they consist entirely of zeroes.
+ */
+void count_census_chunk(void* context, char* blocks, paddr_t addr, size_t num_blocks, block_scan_results_t* results) {
+    census_t* census = context;
+
+    census_table_t chunk_table;
+    init_census_table(&chunk_table, 64);
+    uint64_t num_objects = 0;
+    uint64_t num_zeroed = 0;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        obj_phys_t* block = (obj_phys_t*)(blocks + i * nx_block_size);
+        if (!is_obj_header_plausible(block)) {
+            if (is_zeroed_block((uint8_t*)block)) {
+                num_zeroed++;
+            } else {
+                results->num_rejected++;
+            }
+            continue;
+        }
+        if (!is_cksum_valid((uint32_t*)block)) {
+            results->num_invalid++;
+            continue;
+        }
+        num_objects++;
+
+        census_entry_t entry = {
+            .key = {
+                .type       = get_search_object_type(block->o_type),
+                .subtype    = block->o_subtype,
+                .storage    = block->o_type & OBJ_STORAGETYPE_MASK,
+                .level      = is_btree_node_phys(block) ? ((btree_node_phys_t*)block)->btn_level : CENSUS_NO_LEVEL,
+                .xid_bucket = block->o_xid / census->xid_bucket_width < census->num_xid_buckets
+                    ? block->o_xid / census->xid_bucket_width
+                    : census->num_xid_buckets,
+            },
+            .count      = 1,
+            .first_addr = addr + (paddr_t)i,
+            .last_addr  = addr + (paddr_t)i,
+            .min_xid    = block->o_xid,
+            .max_xid    = block->o_xid,
+        };
+        add_census_entry(&chunk_table, &entry);
+    }
+
+    pthread_mutex_lock(&census->lock);
+    for (size_t i = 0; i < chunk_table.capacity; i++) {
+        if (chunk_table.entries[i].count != 0) {
+            add_census_entry(&census->table, chunk_table.entries + i);
+        }
+    }
+    census->num_objects += num_objects;
+    census->num_zeroed += num_zeroed;
+    pthread_mutex_unlock(&census->lock);
+
+    free(chunk_table.entries);
+}
+
+/**
+ * Compare census entries by type, subtype, storage type, B-tree level, highest
+ * first, and XID bucket.
+ */
+static int compare_census_entries(const void* a, const void* b) {
+    const census_key_t* key_a = &((const census_entry_t*)a)->key;
+    const census_key_t* key_b = &((const census_entry_t*)b)->key;
+    if (key_a->type != key_b->type) {
+        return key_a->type < key_b->type ? -1 : 1;
+    }
+    if (key_a->subtype != key_b->subtype) {
+        return key_a->subtype < key_b->subtype ? -1 : 1;
+    }
+    if (key_a->storage != key_b->storage) {
+        return key_a->storage < key_b->storage ? -1 : 1;
+    }
+    if (key_a->level != key_b->level) {
+        return key_a->level > key_b->level ? -1 : 1;
+    }
+    if (key_a->xid_bucket != key_b->xid_bucket) {
+        return key_a->xid_bucket < key_b->xid_bucket ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Get the entries of a census, once the whole container has been counted.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_entries` entries, sorted by type, subtype, storage
+ *      type, B-tree level, highest first, and XID bucket. The caller must
+ *      free this array.
+ */
+census_entry_t* get_census_entries(census_t* census, size_t* num_entries) {
+    census_entry_t* entries = malloc((census->table.num_entries + 1) * sizeof(census_entry_t));
+    if (!entries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `entries`.\n", __func__);
+        exit(-1);
+    }
+
+    *num_entries = 0;
+    for (size_t i = 0; i < census->table.capacity; i++) {
+        if (census->table.entries[i].count != 0) {
+            entries[(*num_entries)++] = census->table.entries[i];
+        }
+    }
+    qsort(entries, *num_entries, sizeof(census_entry_t), compare_census_entries);
+    return entries;
+}
+
+void free_census(census_t* census) {
+    free(census->table.entries);
+    memset(&census->table, 0, sizeof(census_table_t));
+    pthread_mutex_destroy(&census->lock);
+}
@@ -0,0 +1,98 @@
+#ifndef DRAT_CENSUS_H
+#define DRAT_CENSUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <apfs/general.h>   // paddr_t, xid_t
+
+#include <drat/block-scan.h>
+
+/**
+ * A census of the objects in a container, for the `census` command: a count of
+ * the blocks with valid checksums, broken down by object type and subtype,
+ * storage type, B-tree level and XID bucket, along with the range of addresses
+ * at which each kind of object was found.
+ *
+ * XIDs are grouped into `num_xid_buckets` buckets of `xid_bucket_width` XIDs
+ * each, starting from zero; objects with larger XIDs, which shouldn't exist if
+ * the width was chosen from the container's next XID, fall into an extra
+ * bucket at the end.
+ *
+ * Each chunk of the container is counted on its own, and its counts are then
+ * merged into the census while holding `lock`, so the census is the same
+ * regardless of the number of threads.
+ */
+
+/**
+ * The level of objects that aren't B-tree nodes.
+ */
+#define CENSUS_NO_LEVEL     0xffff
+
+#define CENSUS_DEFAULT_XID_BUCKETS  16
+
+/**
+ * type:    The object's type as given by `get_search_object_type()`.
+ *
+ * storage:     The object's storage type, i.e. `o_type & OBJ_STORAGETYPE_MASK`.
+ *
+ * level:   The B-tree node's level, or `CENSUS_NO_LEVEL`.
+ */
+typedef struct {
+    uint32_t    type;
+    uint32_t    subtype;
+    uint32_t    storage;
+    uint16_t    level;
+    uint16_t    xid_bucket;
+} census_key_t;
+
+/**
+ * first_addr, last_addr:   The lowest and highest addresses at which such
+ *      objects were found.
+ *
+ * min_xid, max_xid:    The lowest and highest XIDs of such objects.
+ */
+typedef struct {
+    census_key_t    key;
+    uint64_t        count;
+    paddr_t         first_addr;
+    paddr_t         last_addr;
+    xid_t           min_xid;
+    xid_t           max_xid;
+} census_entry_t;
+
+/**
+ * entries:     An open-addressing hash table of `capacity` entries, of which
+ *      `num_entries` are in use; unused entries have a count of zero.
+ *      `capacity` is a power of two.
+ */
+typedef struct {
+    census_entry_t* entries;
+    size_t          num_entries;
+    size_t          capacity;
+} census_table_t;
+
+/**
+ * num_objects:     Number of blocks with valid checksums.
+ *
+ * num_zeroed:      Number of blocks consisting entirely of zeroes, including
+ *      those that couldn't be read, which the scan passes on as zeroes.
+ */
+typedef struct {
+    xid_t           xid_bucket_width;
+    uint16_t        num_xid_buckets;
+
+    pthread_mutex_t lock;
+    census_table_t  table;
+    uint64_t        num_objects;
+    uint64_t        num_zeroed;
+} census_t;
+
+void init_census(census_t* census, xid_t xid_bucket_width, uint16_t num_xid_buckets);
+void count_census_chunk(void* census, char* blocks, paddr_t addr, size_t num_blocks, block_scan_results_t* results);
+census_entry_t* get_census_entries(census_t* census, size_t* num_entries);
+void free_census(census_t* census);
+
+#endif // DRAT_CENSUS_H
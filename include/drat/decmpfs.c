@@ -0,0 +1,611 @@
+/**
+ * Functions used to decompress transparently compressed files; see
+ * `decmpfs.h` for details.
+ */
+
+#include "decmpfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <apfs/j.h>
+#include <apfs/jconst.h>
+#include <apfs/dstream.h>
+
+#include <drat/io.h>
+
+#include <drat/func/decompress.h>
+
+/** Chunks that are larger than this when compressed are considered corrupt */
+#define DECMPFS_MAX_COMPRESSED_CHUNK_SIZE   (4 * DECMPFS_CHUNK_SIZE)
+
+#define DECMPFS_MAX_SLOTS   (2 * DECMPFS_MAX_THREADS)
+
+/**
+ * A chunk of compressed data, `length` bytes at byte offset `offset` within
+ * the resource fork, or within `attr_data` for types that store the data in
+ * the decmpfs attribute.
+ */
+typedef struct {
+    uint64_t    offset;
+    uint32_t    length;
+} decmpfs_chunk_t;
+
+static bool is_attr_type(uint32_t type) {
+    return type == DECMPFS_TYPE_UNCOMPRESSED_ATTR
+        || type == DECMPFS_TYPE_ZLIB_ATTR
+        || type == DECMPFS_TYPE_LZVN_ATTR
+        || type == DECMPFS_TYPE_PLAIN_ATTR
+        || type == DECMPFS_TYPE_LZFSE_ATTR;
+}
+
+const char* get_decmpfs_type_name(uint32_t type) {
+    switch (type) {
+        case DECMPFS_TYPE_UNCOMPRESSED_ATTR:
+        case DECMPFS_TYPE_PLAIN_ATTR:
+        case DECMPFS_TYPE_PLAIN_RSRC:
+            return "uncompressed";
+        case DECMPFS_TYPE_ZLIB_ATTR:
+        case DECMPFS_TYPE_ZLIB_RSRC:
+            return "zlib";
+        case DECMPFS_TYPE_LZVN_ATTR:
+        case DECMPFS_TYPE_LZVN_RSRC:
+            return "LZVN";
+        case DECMPFS_TYPE_LZFSE_ATTR:
+        case DECMPFS_TYPE_LZFSE_RSRC:
+            return "LZFSE";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Find an extended attribute of a file by name.
+ *
+ * RETURN VALUE:
+ *      The attribute's value within `fs_records`, or a NULL pointer if the
+ *      file has no such attribute.
+ */
+static j_xattr_val_t* find_xattr(j_rec_t** fs_records, const char* name) {
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  !=  APFS_TYPE_XATTR ) {
+            continue;
+        }
+
+        j_xattr_key_t* key = fs_rec->data;
+        if (key->name_len == strlen(name) + 1 && strncmp((char*)key->name, name, key->name_len) == 0) {
+            return fs_rec->data + fs_rec->key_len;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the compressed data of a file from its file-system records, looking
+ * up the extents of its resource fork if the data is stored there. Problems
+ * with the compressed data itself, such as an unsupported compression type,
+ * are reported when the file is decompressed.
+ *
+ * RETURN VALUE:
+ *      A pointer to the compressed data, or a NULL pointer if the file isn't
+ *      compressed. The caller must free this with `free_decmpfs_file()`.
+ */
+decmpfs_file_t* get_decmpfs_file(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree, j_rec_t** fs_records) {
+    j_inode_val_t* inode = get_inode_from_fs_records(fs_records, NULL);
+    if (!inode || !(inode->bsd_flags & DECMPFS_UF_COMPRESSED)) {
+        return NULL;
+    }
+    j_xattr_val_t* attr = find_xattr(fs_records, DECMPFS_XATTR_NAME);
+    if (!attr) {
+        return NULL;
+    }
+
+    decmpfs_file_t* file = calloc(1, sizeof(decmpfs_file_t));
+    if (!file) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `file`.\n", __func__);
+        exit(-1);
+    }
+
+    // An attribute that isn't stored inline, or has no valid header, leaves
+    // the type as zero, i.e. unknown.
+    if ((attr->flags & XATTR_DATA_EMBEDDED) && attr->xdata_len >= sizeof(decmpfs_disk_header_t)) {
+        decmpfs_disk_header_t* header = (decmpfs_disk_header_t*)attr->xdata;
+        if (header->compression_magic == DECMPFS_MAGIC) {
+            file->type = header->compression_type;
+            file->size = header->uncompressed_size;
+            file->attr_len = attr->xdata_len - sizeof(decmpfs_disk_header_t);
+            file->attr_data = malloc(file->attr_len + 1);
+            if (!file->attr_data) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `file->attr_data`.\n", __func__);
+                exit(-1);
+            }
+            memcpy(file->attr_data, header->data, file->attr_len);
+        }
+    }
+    if (inode->internal_flags & INODE_HAS_UNCOMPRESSED_SIZE) {
+        file->size = inode->uncompressed_size;
+    }
+
+    // Data stored inline is a single chunk, so a larger size can only come
+    // from a corrupt header or inode, and mustn't be allocated as a buffer
+    if (is_attr_type(file->type) && file->size > DECMPFS_CHUNK_SIZE) {
+        file->corrupt_size = file->size;
+        file->size = 0;
+    }
+
+    if (file->type != 0 && !is_attr_type(file->type)) {
+        j_xattr_val_t* fork_attr = find_xattr(fs_records, RESOURCE_FORK_XATTR_NAME);
+        if (fork_attr && (fork_attr->flags & XATTR_DATA_STREAM) && fork_attr->xdata_len >= sizeof(j_xattr_dstream_t)) {
+            j_xattr_dstream_t* xattr_dstream = (j_xattr_dstream_t*)fork_attr->xdata;
+            j_rec_t** fork_records = get_fs_records(fs_omap_btree, fs_root_btree, xattr_dstream->xattr_obj_id, (xid_t)(~0) );
+            if (fork_records) {
+                file->fork_extents = get_file_extents_from_fs_records(fork_records, &(file->num_fork_extents));
+                file->fork_size = xattr_dstream->dstream.size;
+                free_j_rec_array(fork_records);
+            }
+        }
+    }
+
+    return file;
+}
+
+void free_decmpfs_file(decmpfs_file_t* file) {
+    if (file) {
+        free(file->attr_data);
+        free(file->fork_extents);
+        free(file);
+    }
+}
+
+/**
+ * Read a range of bytes of a file's resource fork. Sparse regions read as
+ * zeroes. This is thread-safe.
+ *
+ * RETURN VALUE:    `true` if the whole range was read, else `false`.
+ */
+static bool read_fork_bytes(decmpfs_file_t* file, void* buffer, uint64_t offset, size_t num_bytes) {
+    if (offset > file->fork_size || num_bytes > file->fork_size - offset) {
+        return false;
+    }
+
+    uint8_t* dst = buffer;
+    size_t i = find_file_extent(file->fork_extents, file->num_fork_extents, offset);
+    while (num_bytes != 0) {
+        file_extent_t* extent = i < file->num_fork_extents ? file->fork_extents + i : NULL;
+        if (!extent || extent->logical_addr > offset) {
+            // A gap before the next extent, or after the last one
+            size_t gap = num_bytes;
+            if (extent && extent->logical_addr - offset < gap) {
+                gap = extent->logical_addr - offset;
+            }
+            memset(dst, 0, gap);
+            dst += gap;
+            offset += gap;
+            num_bytes -= gap;
+            continue;
+        }
+
+        uint64_t offset_in_extent = offset - extent->logical_addr;
+        size_t chunk = num_bytes;
+        if (extent->length - offset_in_extent < chunk) {
+            chunk = extent->length - offset_in_extent;
+        }
+        if (extent->phys_block_num == 0) {
+            memset(dst, 0, chunk);
+        } else if (pread_bytes(dst, extent->phys_block_num * nx_block_size + offset_in_extent, chunk) != chunk) {
+            return false;
+        }
+        dst += chunk;
+        offset += chunk;
+        num_bytes -= chunk;
+        i++;
+    }
+    return true;
+}
+
+static uint32_t read_be32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+static uint32_t read_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * Read the table of chunks of a file's compressed data.
+ *
+ * zlib data in a resource fork follows the classic resource fork layout:
+ * a 256-byte header whose first big-endian word is the offset of the
+ * resource data, where a big-endian length is followed by a little-endian
+ * chunk count and an array of little-endian (offset, length) pairs, with
+ * offsets relative to the count. The other types start the fork with an
+ * array of little-endian offsets, one per chunk plus one for the end of the
+ * last chunk; the first offset is thus the size of the array.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_chunks` chunks, or a NULL pointer if the table
+ *      can't be read, in which case an explanation is printed to stderr.
+ */
+static decmpfs_chunk_t* get_decmpfs_chunks(decmpfs_file_t* file, size_t* num_chunks, const char* name) {
+    *num_chunks = 0;
+    decmpfs_chunk_t* chunks = NULL;
+
+    if (is_attr_type(file->type)) {
+        chunks = malloc(sizeof(decmpfs_chunk_t));
+        if (!chunks) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `chunks`.\n", __func__);
+            exit(-1);
+        }
+        chunks[0].offset = 0;
+        chunks[0].length = file->attr_len;
+        *num_chunks = 1;
+        return chunks;
+    }
+
+    uint8_t* table = NULL;
+    uint64_t table_offset = 0;
+    size_t count = 0;
+    if (file->type == DECMPFS_TYPE_ZLIB_RSRC) {
+        uint8_t header[4];
+        uint8_t data_header[8];
+        if (read_fork_bytes(file, header, 0, sizeof(header)) && read_fork_bytes(file, data_header, read_be32(header), sizeof(data_header))) {
+            table_offset = read_be32(header) + 4;
+            count = read_le32(data_header + 4);
+        }
+    } else {
+        uint8_t header[4];
+        if (read_fork_bytes(file, header, 0, sizeof(header)) && read_le32(header) >= 8) {
+            count = read_le32(header) / 4 - 1;
+        }
+    }
+
+    // Each chunk needs 8 bytes of table, so a valid count is bounded by the fork size
+    size_t table_len = (count + 1) * 8;
+    if (count == 0 || count > file->fork_size / 4 || !(table = malloc(table_len))) {
+        fprintf(stderr, "- Could not read the chunk table of the compressed file `%s`.\n", name);
+        return NULL;
+    }
+
+    chunks = malloc(count * sizeof(decmpfs_chunk_t));
+    if (!chunks) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `chunks`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success;
+    if (file->type == DECMPFS_TYPE_ZLIB_RSRC) {
+        success = read_fork_bytes(file, table, table_offset + 4, count * 8);
+        for (size_t i = 0; success && i < count; i++) {
+            chunks[i].offset = table_offset + read_le32(table + 8*i);
+            chunks[i].length = read_le32(table + 8*i + 4);
+        }
+    } else {
+        success = read_fork_bytes(file, table, 0, (count + 1) * 4);
+        for (size_t i = 0; success && i < count; i++) {
+            uint32_t start = read_le32(table + 4*i);
+            uint32_t end = read_le32(table + 4*i + 4);
+            success = end >= start;
+            chunks[i].offset = start;
+            chunks[i].length = end - start;
+        }
+    }
+    free(table);
+
+    if (!success) {
+        fprintf(stderr, "- Could not read the chunk table of the compressed file `%s`.\n", name);
+        free(chunks);
+        return NULL;
+    }
+    *num_chunks = count;
+    return chunks;
+}
+
+/**
+ * Decompress a single chunk.
+ *
+ * in:  The compressed data. For types whose chunks may be stored without
+ *      compression, a leading marker byte indicates this.
+ *
+ * out:     A buffer of at least `expected_len` bytes.
+ *
+ * RETURN VALUE:    `true` if the chunk decompressed to exactly
+ *              `expected_len` bytes, else `false`.
+ */
+static bool decompress_decmpfs_chunk(uint32_t type, const uint8_t* in, size_t in_len, uint8_t* out, size_t expected_len) {
+    size_t out_len = expected_len;
+    switch (type) {
+        case DECMPFS_TYPE_ZLIB_ATTR:
+        case DECMPFS_TYPE_ZLIB_RSRC:
+            if (in_len != 0 && (in[0] & 0x0f) == 0x0f) {
+                break;  // Stored without compression
+            }
+            return decompress_zlib(in, in_len, out, &out_len) && out_len == expected_len;
+
+        case DECMPFS_TYPE_LZVN_ATTR:
+        case DECMPFS_TYPE_LZVN_RSRC:
+            if (in_len != 0 && in[0] == 0x06) {
+                break;
+            }
+            return decompress_lzvn(in, in_len, out, &out_len) && out_len == expected_len;
+
+        case DECMPFS_TYPE_LZFSE_ATTR:
+        case DECMPFS_TYPE_LZFSE_RSRC:
+            if (in_len >= 3 && memcmp(in, "bvx", 3) == 0) {
+                return decompress_lzfse(in, in_len, out, &out_len) && out_len == expected_len;
+            }
+            break;
+
+        case DECMPFS_TYPE_UNCOMPRESSED_ATTR:
+        case DECMPFS_TYPE_PLAIN_ATTR:
+        case DECMPFS_TYPE_PLAIN_RSRC:
+            if (in_len == expected_len) {
+                memcpy(out, in, expected_len);
+                return true;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    // Data stored without compression, after a marker byte
+    if (in_len != expected_len + 1) {
+        return false;
+    }
+    memcpy(out, in + 1, expected_len);
+    return true;
+}
+
+/**
+ * Get the number of uncompressed bytes in a given chunk.
+ */
+static size_t get_chunk_size(decmpfs_file_t* file, size_t chunk_index) {
+    if (is_attr_type(file->type)) {
+        return file->size;
+    }
+    uint64_t remaining = file->size - chunk_index * (uint64_t)DECMPFS_CHUNK_SIZE;
+    return remaining < DECMPFS_CHUNK_SIZE ? remaining : DECMPFS_CHUNK_SIZE;
+}
+
+/**
+ * Read and decompress a chunk. If it can't be, the output is zero-filled.
+ *
+ * in_buffer:   A buffer to read the compressed data into, which is grown as
+ *      needed, of `*in_capacity` bytes.
+ *
+ * RETURN VALUE:    `true` if the chunk was decompressed, else `false`.
+ */
+static bool process_decmpfs_chunk(decmpfs_file_t* file, decmpfs_chunk_t* chunk, uint8_t** in_buffer, size_t* in_capacity, uint8_t* out, size_t out_len) {
+    bool success = false;
+    if (is_attr_type(file->type)) {
+        success = decompress_decmpfs_chunk(file->type, file->attr_data, file->attr_len, out, out_len);
+    } else if (chunk->length <= DECMPFS_MAX_COMPRESSED_CHUNK_SIZE) {
+        if (*in_capacity < chunk->length) {
+            *in_capacity = chunk->length;
+            *in_buffer = realloc(*in_buffer, *in_capacity);
+            if (!*in_buffer) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `*in_buffer`.\n", __func__);
+                exit(-1);
+            }
+        }
+        success = read_fork_bytes(file, *in_buffer, chunk->offset, chunk->length)
+            && decompress_decmpfs_chunk(file->type, *in_buffer, chunk->length, out, out_len);
+    }
+
+    if (!success) {
+        memset(out, 0, out_len);
+    }
+    return success;
+}
+
+/**
+ * State shared between the decompression threads and the writer. All fields
+ * other than the buffers are protected by `lock`.
+ *
+ * slot_chunks:     For each slot, the index of the chunk that has been
+ *      decompressed into it, plus one; zero if none has been yet.
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      chunk_ready;
+    pthread_cond_t      slot_free;
+
+    decmpfs_file_t*     file;
+    decmpfs_chunk_t*    chunks;
+    size_t              num_chunks;
+    size_t              num_slots;
+    uint8_t*            slots[DECMPFS_MAX_SLOTS];
+    size_t              slot_chunks[DECMPFS_MAX_SLOTS];
+    bool                slot_success[DECMPFS_MAX_SLOTS];
+
+    size_t              next_claim;
+    size_t              next_write;
+    bool                stopped;
+} decmpfs_pool_t;
+
+static void* decmpfs_worker(void* arg) {
+    decmpfs_pool_t* pool = arg;
+    uint8_t* in_buffer = NULL;
+    size_t in_capacity = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopped && pool->next_claim < pool->num_chunks) {
+        size_t chunk_index = pool->next_claim++;
+
+        // Wait until the writer has finished with the chunk that last used this slot
+        while (!pool->stopped && chunk_index >= pool->next_write + pool->num_slots) {
+            pthread_cond_wait(&pool->slot_free, &pool->lock);
+        }
+        if (pool->stopped) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t slot = chunk_index % pool->num_slots;
+        bool success = process_decmpfs_chunk(
+            pool->file, pool->chunks + chunk_index, &in_buffer, &in_capacity,
+            pool->slots[slot], get_chunk_size(pool->file, chunk_index)
+        );
+
+        pthread_mutex_lock(&pool->lock);
+        pool->slot_chunks[slot] = chunk_index + 1;
+        pool->slot_success[slot] = success;
+        pthread_cond_broadcast(&pool->chunk_ready);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(in_buffer);
+    return NULL;
+}
+
+/**
+ * Decompress a file's data, passing exactly `file->size` bytes to `output`
+ * in order. Chunks that can't be decompressed are output as zeroes, so that
+ * the rest of the data is still at the right offsets.
+ *
+ * num_threads:     The number of threads that decompress chunks. With one
+ *      thread, or a single chunk, the calling thread does all of the work.
+ *
+ * name:    The name of the file, used in error messages.
+ *
+ * RETURN VALUE:
+ *      `true` if all of the data was decompressed and output, else `false`,
+ *      in which case an explanation is printed to stderr. Decompression
+ *      stops as soon as `output` fails.
+ */
+bool decompress_decmpfs_file(decmpfs_file_t* file, uint32_t num_threads, decmpfs_output_fn output, void* context, const char* name) {
+    if (file->corrupt_size != 0) {
+        fprintf(
+            stderr, "- `%s` states a size of %"PRIu64" bytes for data stored inline, which can be at most %u; skipping its data as corrupt.\n",
+            name, file->corrupt_size, DECMPFS_CHUNK_SIZE
+        );
+        return false;
+    }
+    if (strcmp(get_decmpfs_type_name(file->type), "unknown") == 0) {
+        fprintf(stderr, "- `%s` is compressed with unsupported type %"PRIu32"; writing zeroes in place of its data.\n", name, file->type);
+        uint8_t zeroes[4096] = { 0 };
+        for (uint64_t remaining = file->size; remaining != 0; ) {
+            size_t chunk = remaining < sizeof(zeroes) ? remaining : sizeof(zeroes);
+            if (!output(context, zeroes, chunk)) {
+                return false;
+            }
+            remaining -= chunk;
+        }
+        return false;
+    }
+
+    size_t num_chunks = 0;
+    decmpfs_chunk_t* chunks = get_decmpfs_chunks(file, &num_chunks, name);
+    size_t num_expected = is_attr_type(file->type) ? 1 : (file->size + DECMPFS_CHUNK_SIZE - 1) / DECMPFS_CHUNK_SIZE;
+    if (chunks && num_chunks < num_expected) {
+        fprintf(stderr, "- The compressed file `%s` has %zu chunks rather than %zu; the rest will be zeroes.\n", name, num_chunks, num_expected);
+    }
+    if (num_chunks > num_expected) {
+        num_chunks = num_expected;
+    }
+
+    size_t max_chunk_size = is_attr_type(file->type) ? file->size : DECMPFS_CHUNK_SIZE;
+    if (num_threads == 0 || num_chunks <= 1) {
+        num_threads = 1;
+    }
+    if (num_threads > DECMPFS_MAX_THREADS) {
+        num_threads = DECMPFS_MAX_THREADS;
+    }
+
+    decmpfs_pool_t pool = {
+        .lock           = PTHREAD_MUTEX_INITIALIZER,
+        .chunk_ready    = PTHREAD_COND_INITIALIZER,
+        .slot_free      = PTHREAD_COND_INITIALIZER,
+        .file           = file,
+        .chunks         = chunks,
+        .num_chunks     = num_chunks,
+        .num_slots      = num_threads == 1 ? 1 : 2 * num_threads,
+    };
+    if (pool.num_slots > num_chunks && num_chunks != 0) {
+        pool.num_slots = num_chunks;
+    }
+    for (size_t i = 0; i < pool.num_slots; i++) {
+        pool.slots[i] = malloc(max_chunk_size ? max_chunk_size : 1);
+        if (!pool.slots[i]) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `pool.slots[i]`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    pthread_t threads[DECMPFS_MAX_THREADS];
+    uint32_t num_started = 0;
+    if (num_threads > 1) {
+        for (; num_started < num_threads; num_started++) {
+            if (pthread_create(threads + num_started, NULL, decmpfs_worker, &pool) != 0) {
+                break;
+            }
+        }
+    }
+
+    // Without worker threads, chunks are decompressed here, one at a time
+    uint8_t* in_buffer = NULL;
+    size_t in_capacity = 0;
+
+    bool all_decompressed = chunks != NULL;
+    bool output_ok = true;
+    for (size_t chunk_index = 0; output_ok && chunk_index < num_expected; chunk_index++) {
+        size_t chunk_size = get_chunk_size(file, chunk_index);
+        size_t slot = num_chunks == 0 ? 0 : chunk_index % pool.num_slots;
+        bool success = false;
+
+        if (chunk_index >= num_chunks) {
+            // Missing from the table
+            memset(pool.slots[0], 0, chunk_size);
+            slot = 0;
+        } else if (num_started == 0) {
+            success = process_decmpfs_chunk(file, chunks + chunk_index, &in_buffer, &in_capacity, pool.slots[slot], chunk_size);
+        } else {
+            pthread_mutex_lock(&pool.lock);
+            while (pool.slot_chunks[slot] != chunk_index + 1) {
+                pthread_cond_wait(&pool.chunk_ready, &pool.lock);
+            }
+            success = pool.slot_success[slot];
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        if (!success && chunks && chunk_index < num_chunks) {
+            fprintf(stderr, "- Could not decompress chunk %zu of `%s`; writing zeroes in its place.\n", chunk_index, name);
+        }
+        all_decompressed = all_decompressed && success;
+        output_ok = output(context, pool.slots[slot], chunk_size);
+
+        if (num_started != 0) {
+            pthread_mutex_lock(&pool.lock);
+            pool.next_write++;
+            pool.stopped = !output_ok;
+            pthread_cond_broadcast(&pool.slot_free);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+
+    if (num_started != 0) {
+        pthread_mutex_lock(&pool.lock);
+        pool.stopped = true;
+        pthread_cond_broadcast(&pool.slot_free);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    for (uint32_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < pool.num_slots; i++) {
+        free(pool.slots[i]);
+    }
+    free(in_buffer);
+    free(chunks);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.chunk_ready);
+    pthread_cond_destroy(&pool.slot_free);
+
+    return output_ok && all_decompressed;
+}
@@ -0,0 +1,98 @@
+#ifndef DRAT_DECMPFS_H
+#define DRAT_DECMPFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/btree.h>
+
+#include <drat/recover.h>       // file_extent_t
+#include <drat/func/btree.h>    // j_rec_t
+
+/**
+ * Transparently compressed files (decmpfs).
+ *
+ * A compressed file has the `UF_COMPRESSED` BSD flag and an empty data
+ * stream. Its `com.apple.decmpfs` extended attribute starts with a header
+ * giving the compression type and the uncompressed size. Depending on the
+ * type, the compressed data either follows the header within the attribute,
+ * or is stored in the file's resource fork, i.e. the data stream of its
+ * `com.apple.ResourceFork` extended attribute. Data in a resource fork is
+ * split into chunks of `DECMPFS_CHUNK_SIZE` uncompressed bytes, which are
+ * compressed independently and located by a table at the start of the fork.
+ *
+ * Since the chunks are independent, they are decompressed in parallel by a
+ * pool of threads, into a ring of buffers that the calling thread writes out
+ * in order. At most `2 * num_threads` chunks are held in memory at once.
+ */
+
+#define DECMPFS_XATTR_NAME          "com.apple.decmpfs"
+#define RESOURCE_FORK_XATTR_NAME    "com.apple.ResourceFork"
+#define DECMPFS_MAGIC               0x636d7066  // `fpmc` on disk
+#define DECMPFS_CHUNK_SIZE          0x10000
+#define DECMPFS_MAX_THREADS         64
+
+/** Value of `j_inode_val_t.bsd_flags` that marks a file as compressed */
+#define DECMPFS_UF_COMPRESSED       0x00000020
+
+typedef enum {
+    DECMPFS_TYPE_UNCOMPRESSED_ATTR  = 1,
+    DECMPFS_TYPE_ZLIB_ATTR          = 3,
+    DECMPFS_TYPE_ZLIB_RSRC          = 4,
+    DECMPFS_TYPE_LZVN_ATTR          = 7,
+    DECMPFS_TYPE_LZVN_RSRC          = 8,
+    DECMPFS_TYPE_PLAIN_ATTR         = 9,
+    DECMPFS_TYPE_PLAIN_RSRC         = 10,
+    DECMPFS_TYPE_LZFSE_ATTR         = 11,
+    DECMPFS_TYPE_LZFSE_RSRC         = 12,
+} decmpfs_type_t;
+
+typedef struct {
+    uint32_t    compression_magic;
+    uint32_t    compression_type;
+    uint64_t    uncompressed_size;
+    uint8_t     data[];
+} __attribute__((packed))   decmpfs_disk_header_t;
+
+/**
+ * The compressed data of a file, as found in its file-system records.
+ *
+ * size:    The uncompressed size of the file; taken from the inode if it
+ *      states it, else from the decmpfs header.
+ *
+ * corrupt_size:    If the data is stored inline, but `size` would exceed
+ *      `DECMPFS_CHUNK_SIZE`, that size, in which case the header is taken to
+ *      be corrupt, `size` is zero, and the data is skipped; else zero.
+ *
+ * attr_data:   A copy of the data following the header in the decmpfs
+ *      attribute, of `attr_len` bytes.
+ *
+ * fork_extents:    Array of `num_fork_extents` extents comprising the
+ *      resource fork, which is `fork_size` bytes long.
+ */
+typedef struct {
+    uint32_t        type;
+    uint64_t        size;
+    uint64_t        corrupt_size;
+    uint8_t*        attr_data;
+    size_t          attr_len;
+    file_extent_t*  fork_extents;
+    size_t          num_fork_extents;
+    uint64_t        fork_size;
+} decmpfs_file_t;
+
+/**
+ * A function that receives decompressed data, in order.
+ *
+ * RETURN VALUE:    `true` if the data was written, else `false`, which stops
+ *              the decompression.
+ */
+typedef bool (*decmpfs_output_fn)(void* context, const void* data, size_t num_bytes);
+
+decmpfs_file_t* get_decmpfs_file(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree, j_rec_t** fs_records);
+void free_decmpfs_file(decmpfs_file_t* file);
+const char* get_decmpfs_type_name(uint32_t type);
+bool decompress_decmpfs_file(decmpfs_file_t* file, uint32_t num_threads, decmpfs_output_fn output, void* context, const char* name);
+
+#endif // DRAT_DECMPFS_H
@@ -4,6 +4,9 @@
 
 #include "boolean.h"
 
+#include <apfs/btree.h>
+#include <drat/io.h>    // nx_block_size
+
 /**
  * Determine whether a given APFS object is of the Physical storage type.
  */
@@ -78,3 +81,51 @@ bool is_omap_tree(obj_phys_t* obj) {
 bool is_fs_tree(obj_phys_t* obj) {
     return obj->o_subtype == OBJECT_TYPE_FSTREE;
 }
+
+/**
+ * Determine whether a given object type or subtype is one defined by APFS,
+ * other than `OBJECT_TYPE_INVALID`.
+ */
+bool is_known_object_type(uint32_t type) {
+    return (type >= OBJECT_TYPE_NX_SUPERBLOCK && type <= OBJECT_TYPE_RESERVED_20) || type == OBJECT_TYPE_TEST;
+}
+
+/**
+ * Determine whether the header of a block could be that of an APFS object,
+ * without computing its checksum: its type, flags, and subtype must be ones
+ * defined by APFS, and if it is a B-tree node, its flags must agree with its
+ * type and level, and its table of contents must fit in the node and have
+ * room for all of its keys. This rejects most blocks that aren't objects,
+ * e.g. file data, at a fraction of the cost of computing the checksum.
+ */
+bool is_obj_header_plausible(obj_phys_t* obj) {
+    uint32_t type = obj->o_type & OBJECT_TYPE_MASK;
+    if (
+           obj->o_type == OBJECT_TYPE_CONTAINER_KEYBAG
+        || obj->o_type == OBJECT_TYPE_VOLUME_KEYBAG
+        || obj->o_type == OBJECT_TYPE_MEDIA_KEYBAG
+    ) {
+        return obj->o_subtype == 0;
+    }
+    if (
+           !is_known_object_type(type)
+        || (obj->o_type & OBJECT_TYPE_FLAGS_MASK & ~OBJECT_TYPE_FLAGS_DEFINED_MASK) != 0
+        || (obj->o_type & OBJ_STORAGETYPE_MASK) == OBJ_STORAGETYPE_MASK
+        || (obj->o_subtype != 0 && !is_known_object_type(obj->o_subtype))
+    ) {
+        return false;
+    }
+    if (type != OBJECT_TYPE_BTREE && type != OBJECT_TYPE_BTREE_NODE) {
+        return true;
+    }
+
+    btree_node_phys_t* node = (btree_node_phys_t*)obj;
+    bool is_root = type == OBJECT_TYPE_BTREE;
+    size_t toc_entry_size = (node->btn_flags & BTNODE_FIXED_KV_SIZE) ? sizeof(kvoff_t) : sizeof(kvloc_t);
+    size_t space = nx_block_size - sizeof(btree_node_phys_t) - (is_root ? sizeof(btree_info_t) : 0);
+    return (node->btn_flags & ~(BTNODE_ROOT | BTNODE_LEAF | BTNODE_FIXED_KV_SIZE | BTNODE_HASHED | BTNODE_NOHEADER | BTNODE_CHECK_KOFF_INVAL)) == 0
+        && !(node->btn_flags & BTNODE_ROOT) == !is_root
+        && !(node->btn_flags & BTNODE_LEAF) == (node->btn_level != 0)
+        && (size_t)node->btn_table_space.off + node->btn_table_space.len <= space
+        && (uint64_t)node->btn_nkeys * toc_entry_size <= node->btn_table_space.len;
+}
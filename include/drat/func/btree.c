@@ -13,6 +13,7 @@
 #include <apfs/j.h>     // j_key_t
 #include <drat/io.h>    // nx_block_size, read_blocks()
 #include <drat/func/cksum.h>
+#include <drat/func/omap-node.h>
 
 /**
  * Get the latest version of an object, up to a given XID, from an object map
@@ -44,110 +45,289 @@
  *      This pointer must be freed when it is no longer needed.
  */
 omap_entry_t* get_btree_phys_omap_entry(btree_node_phys_t* root_node, oid_t oid, xid_t max_xid) {
-    btree_info_t* bt_info = (char*)root_node + nx_block_size - sizeof(btree_info_t);
-    
-    // Create a copy of the root node to use as the current node we're working with
-    btree_node_phys_t* node = malloc(nx_block_size);
-    if (!node) {
-        fprintf(stderr, "\nABORT: get_btree_phys_omap_val: Could not allocate sufficient memory for `node`.\n");
-        exit(-1);
-    }
-    memcpy(node, root_node, nx_block_size);
-
-    // Pointers to areas of the node
-    char* toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
-    char* key_start = toc_start + node->btn_table_space.len;
-    char* val_end   = (char*)node + nx_block_size - sizeof(btree_info_t);
+    // Work with decoded nodes, whose keys are stored contiguously so that they
+    // can be searched quickly; these are cached, so repeated lookups in the
+    // same B-tree don't need to re-read or re-decode its nodes.
+    // Object map B-tree nodes are Physical objects, so the root node's OID is
+    // the address it was read from.
+    omap_node_t* node = get_omap_node(root_node, root_node->btn_o.o_oid);
 
     // Descend the B-tree to find the target key–value pair
     while (true) {
-        if (!(node->btn_flags & BTNODE_FIXED_KV_SIZE)) {
-            // TODO: Handle this case
-            fprintf(stderr, "\nget_btree_phys_omap_val: Object map B-trees don't have variable size keys and values ... do they?\n");
-            
-            free(node);
+        if (!node) {
             return NULL;
         }
 
-        // TOC entries are instances of `kvoff_t`
-        kvoff_t* toc_entry = toc_start;
-
         /**
-         * Find the correct TOC entry, i.e. the last TOC entry whose:
+         * Find the correct entry, i.e. the last entry whose:
          * - OID doesn't exceed the given OID; or
          * - OID matches the given OID, and XID doesn't exceed the given XID
-         */
-        for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
-            omap_key_t* key = key_start + toc_entry->k;
-            if (key->ok_oid > oid  ||  (key->ok_oid == oid && key->ok_xid > max_xid)) {
-                toc_entry--;
-                break;
-            }
-        }
-
-        /**
-         * One of the following is now true about `toc_entry`:
          * 
-         * (a) it points before `toc_start` if no matching records exist
-         *      in this B-tree.
-         * (b) it points directly after the last TOC entry if we should descend
-         *      the last entry.
-         * (c) it points to the correct entry to descend.
+         * If there is no such entry, then no matching records exist in this
+         * B-tree.
          */
-        
-        // Handle case (a)
-        if ((char*)toc_entry < toc_start) {
-            free(node);
+        uint32_t num_not_exceeding = count_omap_node_keys_not_exceeding(node, oid, max_xid);
+        if (num_not_exceeding == 0) {
+            release_omap_node(node);
             return NULL;
         }
-
-        // Convert case (b) into case (c)
-        if (toc_entry - (kvoff_t*)toc_start == node->btn_nkeys) {
-            toc_entry--;
-        }
-
-        // Handle case (c)
+        uint32_t i = num_not_exceeding - 1;
 
         // If this is a leaf node, return the object map entry
-        if (node->btn_flags & BTNODE_LEAF) {
-            // If the object doesn't have the specified OID or its XID exceeds
-            // the specifed maximum, then no matching object exists in the B-tree.
-            omap_key_t* key = key_start + toc_entry->k;
-            if (key->ok_oid != oid || key->ok_xid > max_xid) {
-                free(node);
+        if (node->flags & BTNODE_LEAF) {
+            // If the object doesn't have the specified OID, then no matching
+            // object exists in the B-tree.
+            if (node->oids[i] != oid) {
+                release_omap_node(node);
                 return NULL;
             }
 
-            omap_val_t* val = val_end - toc_entry->v;
-
             omap_entry_t* omap_entry = malloc(sizeof(omap_entry_t));
             if (!omap_entry) {
                 fprintf(stderr, "\nABORT: get_btree_phys_omap_val: Could not allocate sufficient memory for `omap_entry`.\n");
                 exit(-1);
             }
 
-            memcpy(&(omap_entry->key), key, sizeof(omap_key_t));
-            memcpy(&(omap_entry->val), val, sizeof(omap_val_t));
+            omap_entry->key.ok_oid = node->oids[i];
+            omap_entry->key.ok_xid = node->xids[i];
+            memcpy(&(omap_entry->val), node->vals + i, sizeof(omap_val_t));
             
-            free(node);
+            release_omap_node(node);
             return omap_entry;
         }
 
-        // Else, read the corresponding child node into memory and loop
-        paddr_t* child_node_addr = val_end - toc_entry->v;
-        
-        if (read_blocks(node, *child_node_addr, 1) != 1) {
-            fprintf(stderr, "\nABORT: get_btree_phys_omap_val: Failed to read block %#"PRIx64".\n", *child_node_addr);
+        // Else, get the corresponding child node and loop
+        paddr_t child_node_addr = node->vals[i].ov_paddr;
+        release_omap_node(node);
+        node = read_omap_node(child_node_addr);
+    }
+}
+
+/**
+ * Free memory allocated for an object map entries array that
+ * was created by a call to `get_btree_phys_omap_entries()`.
+ *
+ * entries_array:   A pointer to an array of pointers to instances of
+ *                  `omap_entry_t`, as returned by a call to
+ *                  `get_btree_phys_omap_entries()`.
+ */
+void free_omap_entry_array(omap_entry_t** entries_array) {
+    if (!entries_array) {
+        return;
+    }
+
+    for (omap_entry_t** cursor = entries_array; *cursor; cursor++) {
+        free(*cursor);
+    }
+    free(entries_array);
+}
+
+/**
+ * Get every version of an object that is still present in an object map
+ * B-tree that uses Physical OIDs to refer to its child nodes, i.e. every entry
+ * whose key has a given OID, regardless of its XID.
+ *
+ * Since object map keys are sorted by OID and then by XID, all such entries
+ * are adjacent in the tree. We thus descend the tree once to the position of
+ * the key `(oid, 0)`, and then walk forward along the leaf level (crossing
+ * into subsequent leaf nodes as necessary) until we encounter a different OID.
+ * Each node is read at most once.
+ *
+ * root_node:   A pointer to the root node of an object map B-tree that uses
+ *      Physical OIDs to refer to its child nodes.
+ *      It is the caller's responsibility to ensure that `root_node` satisfies
+ *      these criteria; if it does not, behaviour is undefined.
+ *
+ * oid:         The Virtual OID of the object whose versions are desired.
+ *
+ * RETURN VALUE:
+ *      A pointer to the head of an array of pointers to instances of
+ *      `omap_entry_t`, one for each version of the object, in ascending order
+ *      of XID. The length of this array is not explicitly returned to the
+ *      caller, but the last pointer in the array will be a NULL pointer; if no
+ *      versions of the object exist, this is the only pointer in the array.
+ *      If the B-tree cannot be walked, a NULL pointer is returned.
+ *
+ *      When the data in the array is no longer needed, it is the caller's
+ *      responsibility to free the associated memory by passing the pointer
+ *      that was returned by this function to `free_omap_entry_array()`.
+ */
+omap_entry_t** get_btree_phys_omap_entries(btree_node_phys_t* root_node, oid_t oid) {
+    uint16_t tree_height = root_node->btn_level + 1;
+
+    /**
+     * `nodes[i]` is the node we are currently looking at `i` levels beneath
+     * the root level, and `desc_path[i]` is the index of the entry we are
+     * currently looking at within that node. Retaining every node on the path
+     * lets us move on to the next leaf node without descending from the root
+     * again, since these B-trees do not contain pointers to their siblings.
+     */
+    char (*nodes)[nx_block_size] = malloc(tree_height * nx_block_size);
+    if (!nodes) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `nodes`.\n", __func__);
+        exit(-1);
+    }
+    memcpy(nodes[0], root_node, nx_block_size);
+
+    uint32_t desc_path[tree_height];
+
+    // Initialise the array of entries which will be returned to the caller
+    size_t num_entries = 0;
+    omap_entry_t** entries = malloc(sizeof(omap_entry_t*));
+    if (!entries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `entries`.\n", __func__);
+        exit(-1);
+    }
+    entries[0] = NULL;
+
+    /**
+     * DESCENT LOOP
+     * Descend the tree to the leaf node that would contain the key `(oid, 0)`.
+     * Since XIDs are never zero, that key itself never exists, so we descend
+     * the last entry of each non-leaf node whose OID is less than `oid`; if
+     * there is no such entry, we descend the first entry. Nodes of stale or
+     * damaged trees may disagree with the root node about their level, so we
+     * descend until we reach a leaf node, rather than trusting its level.
+     */
+    uint16_t leaf_level = 0;
+    for (uint16_t i = 0; i < tree_height; i++) {
+        btree_node_phys_t* node = nodes[i];
+
+        if (!(node->btn_flags & BTNODE_FIXED_KV_SIZE)) {
+            fprintf(stderr, "\n%s: Object map B-trees don't have variable size keys and values ... do they?\n", __func__);
+            free(nodes);
+            free_omap_entry_array(entries);
+            return NULL;
+        }
+
+        // TOC entries are instances of `kvoff_t`
+        kvoff_t* toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
+        char*    key_start = (char*)toc_start + node->btn_table_space.len;
+        char*    val_end   = (char*)node + nx_block_size;
+        if (i == 0) {
+            val_end -= sizeof(btree_info_t);
+        }
+
+        if (node->btn_flags & BTNODE_LEAF) {
+            // The walk loop will skip any entries whose OID is less than `oid`.
+            desc_path[i] = 0;
+            leaf_level = i;
+            break;
+        }
+        if (i + 1 == tree_height) {
+            fprintf(stderr, "\nERROR: %s: The B-tree is deeper than the level of its root node, %"PRIu16", says.\n", __func__, root_node->btn_level);
+            free(nodes);
+            free_omap_entry_array(entries);
+            return NULL;
+        }
+
+        desc_path[i] = 0;
+        for (uint32_t j = 1; j < node->btn_nkeys; j++) {
+            omap_key_t* key = key_start + toc_start[j].k;
+            if (key->ok_oid >= oid) {
+                break;
+            }
+            desc_path[i] = j;
+        }
+
+        paddr_t* child_node_addr = val_end - toc_start[desc_path[i]].v;
+        if (read_blocks(nodes[i + 1], *child_node_addr, 1) != 1) {
+            fprintf(stderr, "\nABORT: %s: Failed to read block %#"PRIx64".\n", __func__, *child_node_addr);
             exit(-1);
         }
+        if (!is_cksum_valid(nodes[i + 1])) {
+            fprintf(stderr, "\nWARNING: %s: Checksum of node at block %#"PRIx64" did not validate. Proceeding anyway as if it did.\n", __func__, *child_node_addr);
+        }
+    }
 
-        if (!is_cksum_valid(node)) {
-            fprintf(stderr, "\nWARNING: get_btree_phys_omap_val: Checksum of node at block %#"PRIx64" did not validate. Proceeding anyway as if it did.\n", *child_node_addr);
+    /**
+     * WALK LOOP
+     * Walk along the leaf level, collecting every entry with the given OID.
+     */
+    while (true) {
+        btree_node_phys_t* leaf = nodes[leaf_level];
+
+        kvoff_t* toc_start = (char*)(leaf->btn_data) + leaf->btn_table_space.off;
+        char*    key_start = (char*)toc_start + leaf->btn_table_space.len;
+        char*    val_end   = (char*)leaf + nx_block_size;
+        if (leaf_level == 0) {
+            val_end -= sizeof(btree_info_t);
         }
 
-        toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
-        key_start = toc_start + node->btn_table_space.len;
-        val_end   = (char*)node + nx_block_size;    // Always dealing with non-root node here
+        for (; desc_path[leaf_level] < leaf->btn_nkeys; desc_path[leaf_level]++) {
+            kvoff_t* toc_entry = toc_start + desc_path[leaf_level];
+            omap_key_t* key = key_start + toc_entry->k;
+
+            if (key->ok_oid < oid) {
+                continue;
+            }
+            if (key->ok_oid > oid) {
+                // We've gone past all of the entries with the given OID.
+                free(nodes);
+                return entries;
+            }
+
+            omap_val_t* val = val_end - toc_entry->v;
+
+            entries[num_entries] = malloc(sizeof(omap_entry_t));
+            if (!entries[num_entries]) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `entries[%zu]`.\n", __func__, num_entries);
+                exit(-1);
+            }
+            memcpy(&(entries[num_entries]->key), key, sizeof(omap_key_t));
+            memcpy(&(entries[num_entries]->val), val, sizeof(omap_val_t));
+            num_entries++;
+
+            entries = realloc(entries, (num_entries + 1) * sizeof(omap_entry_t*));
+            if (!entries) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `entries`.\n", __func__);
+                exit(-1);
+            }
+            entries[num_entries] = NULL;
+        }
+
+        /**
+         * We've run off the end of this leaf node. Find the lowest ancestor
+         * that has an entry after the one we descended, move on to that
+         * entry, and descend its leftmost path to the next leaf node.
+         */
+        int32_t level = leaf_level - 1;
+        while (level >= 0 && desc_path[level] + 1 >= ((btree_node_phys_t*)nodes[level])->btn_nkeys) {
+            level--;
+        }
+        if (level < 0) {
+            // There are no more leaf nodes.
+            free(nodes);
+            return entries;
+        }
+        desc_path[level]++;
+
+        for (; level < leaf_level; level++) {
+            btree_node_phys_t* node = nodes[level];
+
+            kvoff_t* toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
+            char*    val_end   = (char*)node + nx_block_size;
+            if (level == 0) {
+                val_end -= sizeof(btree_info_t);
+            }
+
+            paddr_t* child_node_addr = val_end - toc_start[desc_path[level]].v;
+            if (read_blocks(nodes[level + 1], *child_node_addr, 1) != 1) {
+                fprintf(stderr, "\nABORT: %s: Failed to read block %#"PRIx64".\n", __func__, *child_node_addr);
+                exit(-1);
+            }
+            if (!is_cksum_valid(nodes[level + 1])) {
+                fprintf(stderr, "\nWARNING: %s: Checksum of node at block %#"PRIx64" did not validate. Proceeding anyway as if it did.\n", __func__, *child_node_addr);
+            }
+            bool is_leaf = ((btree_node_phys_t*)nodes[level + 1])->btn_flags & BTNODE_LEAF;
+            if (is_leaf != (level + 1 == leaf_level)) {
+                fprintf(stderr, "\nERROR: %s: The node at block %#"PRIx64" isn't at the same depth as the B-tree's other leaf nodes.\n", __func__, *child_node_addr);
+                free(nodes);
+                free_omap_entry_array(entries);
+                return NULL;
+            }
+            desc_path[level + 1] = 0;
+        }
     }
 }
 
@@ -15,6 +15,10 @@ typedef struct {
 
 omap_entry_t* get_btree_phys_omap_entry(btree_node_phys_t* root_node, oid_t oid, xid_t max_xid);
 
+void free_omap_entry_array(omap_entry_t** entries_array);
+
+omap_entry_t** get_btree_phys_omap_entries(btree_node_phys_t* root_node, oid_t oid);
+
 /**
  * Custom data structure used to store a full file-system record (i.e. a single
  * key–value pair from a file-system root tree) alongside each other for easier
@@ -0,0 +1,1012 @@
+/**
+ * Decoders for the compression formats used by APFS transparent compression;
+ * see `decompress.h` for details.
+ */
+
+#include "decompress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Huffman codes of at most this many bits are decoded with a single lookup */
+#define INFLATE_FAST_BITS   10
+#define INFLATE_MAX_BITS    15
+
+/**
+ * A canonical Huffman code, as described in RFC 1951.
+ *
+ * counts:  The number of codes of each length.
+ *
+ * symbols:     The symbols, in order of their codes.
+ *
+ * fast:    Lookup table indexed by the next `INFLATE_FAST_BITS` bits of input,
+ *      giving `(length << 9) | symbol` for codes of at most that length, or
+ *      zero for longer codes.
+ */
+typedef struct {
+    uint16_t    counts[INFLATE_MAX_BITS + 1];
+    uint16_t    symbols[288];
+    uint16_t    fast[1 << INFLATE_FAST_BITS];
+} inflate_huffman_t;
+
+/**
+ * State of a DEFLATE decoder. Bits are consumed from the least significant
+ * end of `bits`. If the input runs out, zero bytes are fed in and counted in
+ * `num_phantom_bytes`; the stream is invalid if any of their bits are used.
+ */
+typedef struct {
+    const uint8_t*  in;
+    size_t          in_len;
+    size_t          in_pos;
+    uint64_t        bits;
+    uint32_t        num_bits;
+    uint32_t        num_phantom_bytes;
+
+    uint8_t*        out;
+    size_t          out_len;
+    size_t          out_pos;
+} inflate_state_t;
+
+static const uint16_t inflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t inflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t inflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t inflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static void refill_bits(inflate_state_t* s) {
+    while (s->num_bits <= 56) {
+        uint64_t byte = 0;
+        if (s->in_pos < s->in_len) {
+            byte = s->in[s->in_pos++];
+        } else {
+            s->num_phantom_bytes++;
+        }
+        s->bits |= byte << s->num_bits;
+        s->num_bits += 8;
+    }
+}
+
+static uint32_t get_bits(inflate_state_t* s, uint32_t n) {
+    if (s->num_bits < n) {
+        refill_bits(s);
+    }
+    uint32_t value = s->bits & ((UINT64_C(1) << n) - 1);
+    s->bits >>= n;
+    s->num_bits -= n;
+    return value;
+}
+
+/**
+ * Determine whether any bits that were fed in past the end of the input have
+ * been consumed.
+ */
+static bool has_overrun(inflate_state_t* s) {
+    return s->num_bits < 8 * s->num_phantom_bytes;
+}
+
+/**
+ * Build a canonical Huffman code from the code length of each symbol.
+ *
+ * RETURN VALUE:    `false` if the lengths are over-subscribed, else `true`.
+ *      Incomplete codes are allowed, as RFC 1951 permits for a single
+ *      distance code; the missing codes just fail to decode.
+ */
+static bool build_huffman(inflate_huffman_t* h, const uint8_t* lengths, uint32_t num_symbols) {
+    memset(h->counts, 0, sizeof(h->counts));
+    for (uint32_t i = 0; i < num_symbols; i++) {
+        h->counts[lengths[i]]++;
+    }
+    h->counts[0] = 0;
+
+    int32_t left = 1;
+    uint16_t offsets[INFLATE_MAX_BITS + 1];
+    offsets[1] = 0;
+    for (uint32_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left = 2 * left - h->counts[len];
+        if (left < 0) {
+            return false;
+        }
+        if (len < INFLATE_MAX_BITS) {
+            offsets[len + 1] = offsets[len] + h->counts[len];
+        }
+    }
+    for (uint32_t i = 0; i < num_symbols; i++) {
+        if (lengths[i] != 0) {
+            h->symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+
+    // Codes are stored starting with their most significant bit, so the
+    // lookup table is indexed by the bit-reversed code.
+    memset(h->fast, 0, sizeof(h->fast));
+    uint32_t code = 0;
+    uint32_t index = 0;
+    for (uint32_t len = 1; len <= INFLATE_FAST_BITS; len++) {
+        for (uint32_t i = 0; i < h->counts[len]; i++, index++, code++) {
+            uint32_t reversed = 0;
+            for (uint32_t bit = 0; bit < len; bit++) {
+                reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+            }
+            for (uint32_t fill = reversed; fill < (1 << INFLATE_FAST_BITS); fill += 1 << len) {
+                h->fast[fill] = (len << 9) | h->symbols[index];
+            }
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+/**
+ * Decode a symbol.
+ *
+ * RETURN VALUE:    The symbol, or -1 if the input isn't a valid code.
+ */
+static int decode_symbol(inflate_state_t* s, const inflate_huffman_t* h) {
+    if (s->num_bits < INFLATE_MAX_BITS) {
+        refill_bits(s);
+    }
+    uint16_t entry = h->fast[s->bits & ((1 << INFLATE_FAST_BITS) - 1)];
+    if (entry != 0) {
+        s->bits >>= entry >> 9;
+        s->num_bits -= entry >> 9;
+        return entry & 0x1ff;
+    }
+
+    // Slow path for long codes, one bit at a time
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    for (uint32_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= get_bits(s, 1);
+        int32_t count = h->counts[len];
+        if (code - count < first) {
+            return h->symbols[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+/**
+ * Decode the compressed data of a block, up to and including its
+ * end-of-block symbol.
+ */
+static bool inflate_codes(inflate_state_t* s, const inflate_huffman_t* lit_codes, const inflate_huffman_t* dist_codes) {
+    for (;;) {
+        int symbol = decode_symbol(s, lit_codes);
+        if (symbol < 0 || has_overrun(s)) {
+            return false;
+        }
+        if (symbol < 256) {
+            if (s->out_pos == s->out_len) {
+                return false;
+            }
+            s->out[s->out_pos++] = symbol;
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        uint32_t length = inflate_length_base[symbol] + get_bits(s, inflate_length_extra[symbol]);
+
+        symbol = decode_symbol(s, dist_codes);
+        if (symbol < 0 || symbol >= 30) {
+            return false;
+        }
+        uint32_t distance = inflate_dist_base[symbol] + get_bits(s, inflate_dist_extra[symbol]);
+        if (has_overrun(s) || distance > s->out_pos || length > s->out_len - s->out_pos) {
+            return false;
+        }
+
+        uint8_t* dst = s->out + s->out_pos;
+        const uint8_t* src = dst - distance;
+        if (distance >= length) {
+            memcpy(dst, src, length);
+        } else {
+            for (uint32_t i = 0; i < length; i++) {
+                dst[i] = src[i];
+            }
+        }
+        s->out_pos += length;
+    }
+}
+
+static bool inflate_stored(inflate_state_t* s) {
+    // Discard the rest of the current byte
+    get_bits(s, s->num_bits % 8);
+    uint32_t length = get_bits(s, 16);
+    uint32_t complement = get_bits(s, 16);
+    if (has_overrun(s) || length != (~complement & 0xffff) || length > s->out_len - s->out_pos) {
+        return false;
+    }
+
+    // Use up the whole bytes that are already buffered, then copy directly
+    while (length != 0 && s->num_bits >= 8) {
+        s->out[s->out_pos++] = get_bits(s, 8);
+        length--;
+    }
+    if (has_overrun(s) || length > s->in_len - s->in_pos) {
+        return false;
+    }
+    memcpy(s->out + s->out_pos, s->in + s->in_pos, length);
+    s->in_pos += length;
+    s->out_pos += length;
+    return true;
+}
+
+static bool inflate_fixed(inflate_state_t* s) {
+    uint8_t lengths[288];
+    memset(lengths,         8, 144);
+    memset(lengths + 144,   9, 112);
+    memset(lengths + 256,   7, 24);
+    memset(lengths + 280,   8, 8);
+    inflate_huffman_t lit_codes;
+    build_huffman(&lit_codes, lengths, 288);
+
+    memset(lengths, 5, 30);
+    inflate_huffman_t dist_codes;
+    build_huffman(&dist_codes, lengths, 30);
+
+    return inflate_codes(s, &lit_codes, &dist_codes);
+}
+
+static bool inflate_dynamic(inflate_state_t* s) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    uint32_t num_lit_codes  = get_bits(s, 5) + 257;
+    uint32_t num_dist_codes = get_bits(s, 5) + 1;
+    uint32_t num_len_codes  = get_bits(s, 4) + 4;
+    if (num_lit_codes > 286 || num_dist_codes > 30) {
+        return false;
+    }
+
+    uint8_t lengths[286 + 30] = { 0 };
+    for (uint32_t i = 0; i < num_len_codes; i++) {
+        lengths[order[i]] = get_bits(s, 3);
+    }
+    inflate_huffman_t len_codes;
+    if (has_overrun(s) || !build_huffman(&len_codes, lengths, 19)) {
+        return false;
+    }
+
+    memset(lengths, 0, sizeof(lengths));
+    for (uint32_t i = 0; i < num_lit_codes + num_dist_codes; ) {
+        int symbol = decode_symbol(s, &len_codes);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        uint8_t length = 0;
+        uint32_t repeat;
+        if (symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+            length = lengths[i - 1];
+            repeat = 3 + get_bits(s, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(s, 3);
+        } else {
+            repeat = 11 + get_bits(s, 7);
+        }
+        if (i + repeat > num_lit_codes + num_dist_codes) {
+            return false;
+        }
+        while (repeat--) {
+            lengths[i++] = length;
+        }
+    }
+    if (has_overrun(s) || lengths[256] == 0) {
+        return false;
+    }
+
+    inflate_huffman_t lit_codes;
+    inflate_huffman_t dist_codes;
+    if (
+           !build_huffman(&lit_codes,  lengths,                 num_lit_codes)
+        || !build_huffman(&dist_codes, lengths + num_lit_codes, num_dist_codes)
+    ) {
+        return false;
+    }
+    return inflate_codes(s, &lit_codes, &dist_codes);
+}
+
+static uint32_t adler32(const uint8_t* data, size_t num_bytes) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (num_bytes != 0) {
+        // Largest number of bytes that can be summed before `b` could overflow
+        size_t chunk = num_bytes < 5552 ? num_bytes : 5552;
+        num_bytes -= chunk;
+        while (chunk--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+bool decompress_zlib(const void* in, size_t in_len, void* out, size_t* out_len) {
+    const uint8_t* bytes = in;
+    // Compression method 8 (DEFLATE), a valid header check, and no preset dictionary
+    if (in_len < 2 || (bytes[0] & 0x0f) != 8 || ((bytes[0] << 8) | bytes[1]) % 31 != 0 || (bytes[1] & 0x20)) {
+        return false;
+    }
+
+    inflate_state_t s = {
+        .in         = bytes,
+        .in_len     = in_len,
+        .in_pos     = 2,
+        .out        = out,
+        .out_len    = *out_len,
+    };
+
+    bool is_last = false;
+    while (!is_last) {
+        is_last = get_bits(&s, 1);
+        uint32_t type = get_bits(&s, 2);
+        bool success = false;
+        if (type == 0) {
+            success = inflate_stored(&s);
+        } else if (type == 1) {
+            success = inflate_fixed(&s);
+        } else if (type == 2) {
+            success = inflate_dynamic(&s);
+        }
+        if (!success || has_overrun(&s)) {
+            return false;
+        }
+    }
+
+    // Check the Adler-32 trailer, which follows on the next byte boundary
+    get_bits(&s, s.num_bits % 8);
+    uint8_t trailer[4];
+    uint32_t num_trailer_bytes = 0;
+    while (num_trailer_bytes < 4 && s.num_bits >= 8 * (s.num_phantom_bytes + 1)) {
+        trailer[num_trailer_bytes++] = get_bits(&s, 8);
+    }
+    if (num_trailer_bytes == 4) {
+        uint32_t expected = (uint32_t)trailer[0] << 24 | (uint32_t)trailer[1] << 16 | (uint32_t)trailer[2] << 8 | trailer[3];
+        if (adler32(s.out, s.out_pos) != expected) {
+            return false;
+        }
+    }
+
+    *out_len = s.out_pos;
+    return true;
+}
+
+bool decompress_lzvn(const void* in, size_t in_len, void* out, size_t* out_len) {
+    const uint8_t* src = in;
+    uint8_t* dst = out;
+    size_t pos = 0;
+    size_t out_pos = 0;
+    size_t out_capacity = *out_len;
+    size_t prev_distance = 0;
+
+    // Each opcode gives a number of literal bytes `L`, which follow it, then
+    // a match of `M` bytes at distance `D`, which may be the previous distance.
+    while (pos < in_len && out_pos < out_capacity) {
+        uint8_t op = src[pos];
+        size_t op_len = 1;
+        size_t L = 0;
+        size_t M = 0;
+        size_t D = prev_distance;
+
+        if (op == 0x06) {
+            break;  // End of stream
+        } else if (op == 0x0e || op == 0x16) {
+            pos++;  // No-op
+            continue;
+        } else if (op >= 0xf0) {
+            // 1111MMMM, or 11110000 MMMMMMMM; match at the previous distance
+            if (op == 0xf0) {
+                if (pos + 2 > in_len) {
+                    return false;
+                }
+                M = src[pos + 1] + 16;
+                op_len = 2;
+            } else {
+                M = op & 0x0f;
+            }
+        } else if (op >= 0xe0) {
+            // 1110LLLL, or 11100000 LLLLLLLL; literals only
+            if (op == 0xe0) {
+                if (pos + 2 > in_len) {
+                    return false;
+                }
+                L = src[pos + 1] + 16;
+                op_len = 2;
+            } else {
+                L = op & 0x0f;
+            }
+        } else if (op >= 0xd0 || (op & 0xf0) == 0x70) {
+            return false;   // Undefined
+        } else if ((op & 0xe0) == 0xa0) {
+            // 101LLMMM DDDDDDMM DDDDDDDD
+            if (pos + 3 > in_len) {
+                return false;
+            }
+            L = (op >> 3) & 3;
+            M = (((op & 7) << 2) | (src[pos + 1] & 3)) + 3;
+            D = (src[pos + 1] >> 2) | ((size_t)src[pos + 2] << 6);
+            op_len = 3;
+        } else {
+            L = op >> 6;
+            M = ((op >> 3) & 7) + 3;
+            if ((op & 7) == 6) {
+                // LLMMM110; match at the previous distance
+                if (L == 0) {
+                    return false;   // Undefined
+                }
+            } else if ((op & 7) == 7) {
+                // LLMMM111 DDDDDDDD DDDDDDDD
+                if (pos + 3 > in_len) {
+                    return false;
+                }
+                D = src[pos + 1] | ((size_t)src[pos + 2] << 8);
+                op_len = 3;
+            } else {
+                // LLMMMDDD DDDDDDDD
+                if (pos + 2 > in_len) {
+                    return false;
+                }
+                D = ((size_t)(op & 7) << 8) | src[pos + 1];
+                op_len = 2;
+            }
+        }
+        pos += op_len;
+
+        if (L > in_len - pos || L > out_capacity - out_pos) {
+            return false;
+        }
+        memcpy(dst + out_pos, src + pos, L);
+        pos += L;
+        out_pos += L;
+
+        if (M != 0) {
+            if (D == 0 || D > out_pos || M > out_capacity - out_pos) {
+                return false;
+            }
+            for (size_t i = 0; i < M; i++, out_pos++) {
+                dst[out_pos] = dst[out_pos - D];
+            }
+            prev_distance = D;
+        }
+    }
+
+    *out_len = out_pos;
+    return true;
+}
+
+#define LZFSE_MAGIC_END             0x24787662  // `bvx$`
+#define LZFSE_MAGIC_UNCOMPRESSED    0x2d787662  // `bvx-`
+#define LZFSE_MAGIC_LZVN            0x6e787662  // `bvxn`
+#define LZFSE_MAGIC_V1              0x31787662  // `bvx1`
+#define LZFSE_MAGIC_V2              0x32787662  // `bvx2`
+
+#define LZFSE_L_SYMBOLS             20
+#define LZFSE_M_SYMBOLS             20
+#define LZFSE_D_SYMBOLS             64
+#define LZFSE_LITERAL_SYMBOLS       256
+#define LZFSE_NUM_FREQS             (LZFSE_L_SYMBOLS + LZFSE_M_SYMBOLS + LZFSE_D_SYMBOLS + LZFSE_LITERAL_SYMBOLS)
+
+#define LZFSE_L_STATES              64
+#define LZFSE_M_STATES              64
+#define LZFSE_D_STATES              256
+#define LZFSE_LITERAL_STATES        1024
+
+#define LZFSE_MATCHES_PER_BLOCK     10000
+#define LZFSE_LITERALS_PER_BLOCK    (4 * LZFSE_MATCHES_PER_BLOCK)
+
+/**
+ * Size of a `bvx1` block header, including the two bytes of padding at the
+ * end of the structure that the reference implementation writes it from.
+ */
+#define LZFSE_V1_HEADER_SIZE        772
+/** Size of a `bvx2` block header, excluding its frequency tables */
+#define LZFSE_V2_HEADER_SIZE        32
+
+static const uint8_t lzfse_l_extra[LZFSE_L_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 5, 8,
+};
+static const int32_t lzfse_l_base[LZFSE_L_SYMBOLS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 20, 28, 60,
+};
+static const uint8_t lzfse_m_extra[LZFSE_M_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 5, 8, 11,
+};
+static const int32_t lzfse_m_base[LZFSE_M_SYMBOLS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 24, 56, 312,
+};
+static const uint8_t lzfse_d_extra[LZFSE_D_SYMBOLS] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+    8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+};
+static const int32_t lzfse_d_base[LZFSE_D_SYMBOLS] = {
+    0, 1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 28, 36, 44, 52,
+    60, 76, 92, 108, 124, 156, 188, 220, 252, 316, 380, 444, 508, 636, 764, 892,
+    1020, 1276, 1532, 1788, 2044, 2556, 3068, 3580, 4092, 5116, 6140, 7164, 8188, 10236, 12284, 14332,
+    16380, 20476, 24572, 28668, 32764, 40956, 49148, 57340, 65532, 81916, 98300, 114684, 131068, 163836, 196604, 229372,
+};
+
+/**
+ * An entry of an FSE decoding table for states that decode to a value, i.e.
+ * a base value plus `value_bits` extra bits read from the stream. Literal
+ * tables use the same entries with no extra bits.
+ *
+ * total_bits:  The number of bits to read from the stream, which are the
+ *      bits to add to `delta` to get the next state, followed by the
+ *      `value_bits` extra bits.
+ */
+typedef struct {
+    uint8_t     total_bits;
+    uint8_t     value_bits;
+    int16_t     delta;
+    int32_t     base;
+} lzfse_decoder_entry_t;
+
+/**
+ * An FSE bit stream, which is read backwards from its end. Bits are
+ * consumed from the most significant end of the lowest `num_bits` bits of
+ * `bits`, and whole bytes are fed in below them.
+ *
+ * start, pos:  The bounds of the bytes that haven't been fed in yet.
+ */
+typedef struct {
+    const uint8_t*  start;
+    const uint8_t*  pos;
+    uint64_t        bits;
+    int32_t         num_bits;
+} lzfse_stream_t;
+
+/**
+ * The header of a `bvx1` or `bvx2` block, in the form of the former.
+ *
+ * literal_bits, lmd_bits:  The number of bits of the last byte of each
+ *      stream that aren't used, negated; from -7 to 0.
+ *
+ * freqs:   The normalized frequencies of the L, M and D symbols, and of the
+ *      literal symbols, in that order.
+ */
+typedef struct {
+    uint32_t    num_raw_bytes;
+    uint32_t    num_literals;
+    uint32_t    num_matches;
+    uint32_t    num_literal_payload_bytes;
+    uint32_t    num_lmd_payload_bytes;
+    int32_t     literal_bits;
+    uint16_t    literal_states[4];
+    int32_t     lmd_bits;
+    uint16_t    l_state;
+    uint16_t    m_state;
+    uint16_t    d_state;
+    uint16_t    freqs[LZFSE_NUM_FREQS];
+} lzfse_block_header_t;
+
+typedef struct {
+    lzfse_decoder_entry_t   l_table[LZFSE_L_STATES];
+    lzfse_decoder_entry_t   m_table[LZFSE_M_STATES];
+    lzfse_decoder_entry_t   d_table[LZFSE_D_STATES];
+    lzfse_decoder_entry_t   literal_table[LZFSE_LITERAL_STATES];
+    uint8_t                 literals[LZFSE_LITERALS_PER_BLOCK];
+} lzfse_block_state_t;
+
+static uint32_t read_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t read_le64(const uint8_t* bytes) {
+    return (uint64_t)read_le32(bytes) | (uint64_t)read_le32(bytes + 4) << 32;
+}
+
+static uint32_t get_packed_field(uint64_t packed, uint32_t offset, uint32_t num_bits) {
+    return (uint32_t)((packed >> offset) & ((1ULL << num_bits) - 1));
+}
+
+/**
+ * Build an FSE decoding table from the normalized frequencies of its symbols.
+ * Each symbol gets as many consecutive states as its frequency.
+ *
+ * extra, base:     The number of extra bits and base value of each symbol, or
+ *      NULL for tables that decode to the symbols themselves.
+ *
+ * RETURN VALUE:    `false` if the frequencies add up to more than the number
+ *      of states, else `true`.
+ */
+static bool build_lzfse_table(lzfse_decoder_entry_t* table, uint32_t num_states, const uint16_t* freqs, uint32_t num_symbols, const uint8_t* extra, const int32_t* base) {
+    memset(table, 0, num_states * sizeof(lzfse_decoder_entry_t));
+
+    uint32_t num_used = 0;
+    for (uint32_t i = 0; i < num_symbols; i++) {
+        uint32_t freq = freqs[i];
+        if (freq == 0) {
+            continue;
+        }
+        if (freq > num_states - num_used) {
+            return false;
+        }
+
+        // `k` is chosen so that `num_states <= freq << k < 2 * num_states`
+        uint32_t k = 0;
+        while ((freq << k) < num_states) {
+            k++;
+        }
+        uint32_t j0 = ((2 * num_states) >> k) - freq;
+        for (uint32_t j = 0; j < freq; j++) {
+            lzfse_decoder_entry_t* entry = table + num_used + j;
+            entry->value_bits = extra ? extra[i] : 0;
+            entry->base = base ? base[i] : (int32_t)i;
+            if (j < j0) {
+                entry->total_bits = k + entry->value_bits;
+                entry->delta = ((freq + j) << k) - num_states;
+            } else {
+                entry->total_bits = k - 1 + entry->value_bits;
+                entry->delta = (j - j0) << (k - 1);
+            }
+        }
+        num_used += freq;
+    }
+    return true;
+}
+
+/**
+ * Start reading an FSE stream that ends at `end`, of which the first
+ * `-num_unused_bits` bits of the last byte aren't used.
+ */
+static bool init_lzfse_stream(lzfse_stream_t* stream, const uint8_t* start, const uint8_t* end, int32_t num_unused_bits) {
+    size_t num_bytes = num_unused_bits == 0 ? 7 : 8;
+    if ((size_t)(end - start) < num_bytes) {
+        return false;
+    }
+    stream->start = start;
+    stream->pos = end - num_bytes;
+    stream->bits = 0;
+    for (size_t i = 0; i < num_bytes; i++) {
+        stream->bits |= (uint64_t)stream->pos[i] << (8 * i);
+    }
+    stream->num_bits = (int32_t)(8 * num_bytes) + num_unused_bits;
+    return stream->num_bits >= 56 && stream->num_bits < 64 && (stream->bits >> stream->num_bits) == 0;
+}
+
+/**
+ * Feed in as many whole bytes as fit, so that at least 56 bits are available.
+ */
+static bool refill_lzfse_stream(lzfse_stream_t* stream) {
+    uint32_t num_bytes = (uint32_t)(63 - stream->num_bits) >> 3;
+    if ((size_t)(stream->pos - stream->start) < num_bytes) {
+        return false;
+    }
+    stream->pos -= num_bytes;
+    for (uint32_t i = num_bytes; i > 0; i--) {
+        stream->bits = stream->bits << 8 | stream->pos[i - 1];
+    }
+    stream->num_bits += 8 * num_bytes;
+    return true;
+}
+
+static uint32_t pull_lzfse_bits(lzfse_stream_t* stream, uint32_t n) {
+    stream->num_bits -= n;
+    uint32_t result = (uint32_t)(stream->bits >> stream->num_bits);
+    stream->bits &= (1ULL << stream->num_bits) - 1;
+    return result;
+}
+
+/**
+ * Decode a value and move to the next state.
+ */
+static int32_t decode_lzfse_value(uint16_t* state, const lzfse_decoder_entry_t* table, lzfse_stream_t* stream) {
+    const lzfse_decoder_entry_t* entry = table + *state;
+    uint32_t bits = pull_lzfse_bits(stream, entry->total_bits);
+    *state = (uint16_t)(entry->delta + (bits >> entry->value_bits));
+    return entry->base + (int32_t)(bits & ((1U << entry->value_bits) - 1));
+}
+
+/**
+ * Read a `bvx1` block header.
+ */
+static void read_lzfse_v1_header(const uint8_t* bytes, lzfse_block_header_t* header) {
+    header->num_raw_bytes               = read_le32(bytes + 4);
+    header->num_literals                = read_le32(bytes + 12);
+    header->num_matches                 = read_le32(bytes + 16);
+    header->num_literal_payload_bytes   = read_le32(bytes + 20);
+    header->num_lmd_payload_bytes       = read_le32(bytes + 24);
+    header->literal_bits                = (int32_t)read_le32(bytes + 28);
+    for (int i = 0; i < 4; i++) {
+        header->literal_states[i]       = bytes[32 + 2*i] | bytes[33 + 2*i] << 8;
+    }
+    header->lmd_bits                    = (int32_t)read_le32(bytes + 40);
+    header->l_state                     = bytes[44] | bytes[45] << 8;
+    header->m_state                     = bytes[46] | bytes[47] << 8;
+    header->d_state                     = bytes[48] | bytes[49] << 8;
+    for (int i = 0; i < LZFSE_NUM_FREQS; i++) {
+        header->freqs[i]                = bytes[50 + 2*i] | bytes[51 + 2*i] << 8;
+    }
+}
+
+/**
+ * Read a `bvx2` block header, whose fields are packed into three 64-bit words
+ * and whose frequencies are variable-length coded, or omitted if all zero.
+ *
+ * header_size:     The size of the header, including its frequency tables.
+ *
+ * RETURN VALUE:    `false` if the frequencies don't end exactly at the end
+ *      of the header, else `true`.
+ */
+static bool read_lzfse_v2_header(const uint8_t* bytes, uint32_t header_size, lzfse_block_header_t* header) {
+    uint64_t fields[3] = { read_le64(bytes + 8), read_le64(bytes + 16), read_le64(bytes + 24) };
+    header->num_raw_bytes               = read_le32(bytes + 4);
+    header->num_literals                = get_packed_field(fields[0], 0, 20);
+    header->num_literal_payload_bytes   = get_packed_field(fields[0], 20, 20);
+    header->num_matches                 = get_packed_field(fields[0], 40, 20);
+    header->literal_bits                = (int32_t)get_packed_field(fields[0], 60, 3) - 7;
+    for (int i = 0; i < 4; i++) {
+        header->literal_states[i]       = get_packed_field(fields[1], 10 * i, 10);
+    }
+    header->num_lmd_payload_bytes       = get_packed_field(fields[1], 40, 20);
+    header->lmd_bits                    = (int32_t)get_packed_field(fields[1], 60, 3) - 7;
+    header->l_state                     = get_packed_field(fields[2], 32, 10);
+    header->m_state                     = get_packed_field(fields[2], 42, 10);
+    header->d_state                     = get_packed_field(fields[2], 52, 10);
+
+    // Each frequency takes 2, 3 or 5 bits for the values 0 to 7, given by the
+    // lowest 5 bits; 8 bits for 8 to 23; or 14 bits for 24 to 1047.
+    static const uint8_t freq_num_bits[32] = {
+        2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14,
+        2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14,
+    };
+    static const uint8_t freq_values[32] = {
+        0, 2, 1, 4, 0, 3, 1, 0, 0, 2, 1, 5, 0, 3, 1, 0,
+        0, 2, 1, 6, 0, 3, 1, 0, 0, 2, 1, 7, 0, 3, 1, 0,
+    };
+
+    memset(header->freqs, 0, sizeof(header->freqs));
+    size_t pos = LZFSE_V2_HEADER_SIZE;
+    if (pos == header_size) {
+        return true;
+    }
+    uint32_t bits = 0;
+    uint32_t num_bits = 0;
+    for (int i = 0; i < LZFSE_NUM_FREQS; i++) {
+        while (pos < header_size && num_bits + 8 <= 32) {
+            bits |= (uint32_t)bytes[pos++] << num_bits;
+            num_bits += 8;
+        }
+        uint32_t n = freq_num_bits[bits & 31];
+        if (n > num_bits) {
+            return false;
+        }
+        if (n == 8) {
+            header->freqs[i] = 8 + ((bits >> 4) & 0xf);
+        } else if (n == 14) {
+            header->freqs[i] = 24 + ((bits >> 4) & 0x3ff);
+        } else {
+            header->freqs[i] = freq_values[bits & 31];
+        }
+        bits >>= n;
+        num_bits -= n;
+    }
+    return num_bits < 8 && pos == header_size;
+}
+
+/**
+ * Decode the payload of a `bvx1` or `bvx2` block: first the literals, four
+ * interleaved FSE streams' worth, then the sequence of (L, M, D) triples that
+ * each copy `L` literals and then `M` bytes from `D` bytes back.
+ *
+ * payload:     The payload, of the size given by the header.
+ *
+ * dst, out_pos:    The output, of which `*out_pos` bytes have been written;
+ *      the block's bytes are written after them, and `*out_pos` is updated.
+ */
+static bool decode_lzfse_block(const lzfse_block_header_t* header, const uint8_t* in, const uint8_t* payload, lzfse_block_state_t* state, uint8_t* dst, size_t* out_pos, size_t out_capacity) {
+    if (header->num_literals > LZFSE_LITERALS_PER_BLOCK || header->num_matches > LZFSE_MATCHES_PER_BLOCK
+        || header->literal_bits < -7 || header->literal_bits > 0 || header->lmd_bits < -7 || header->lmd_bits > 0
+        || header->l_state >= LZFSE_L_STATES || header->m_state >= LZFSE_M_STATES || header->d_state >= LZFSE_D_STATES
+        || header->num_raw_bytes > out_capacity - *out_pos
+    ) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (header->literal_states[i] >= LZFSE_LITERAL_STATES) {
+            return false;
+        }
+    }
+
+    const uint16_t* freqs = header->freqs;
+    if (!build_lzfse_table(state->l_table, LZFSE_L_STATES, freqs, LZFSE_L_SYMBOLS, lzfse_l_extra, lzfse_l_base)
+        || !build_lzfse_table(state->m_table, LZFSE_M_STATES, freqs + LZFSE_L_SYMBOLS, LZFSE_M_SYMBOLS, lzfse_m_extra, lzfse_m_base)
+        || !build_lzfse_table(state->d_table, LZFSE_D_STATES, freqs + LZFSE_L_SYMBOLS + LZFSE_M_SYMBOLS, LZFSE_D_SYMBOLS, lzfse_d_extra, lzfse_d_base)
+        || !build_lzfse_table(state->literal_table, LZFSE_LITERAL_STATES, freqs + LZFSE_L_SYMBOLS + LZFSE_M_SYMBOLS + LZFSE_D_SYMBOLS, LZFSE_LITERAL_SYMBOLS, NULL, NULL)
+    ) {
+        return false;
+    }
+
+    // Literals, which are padded to a multiple of four
+    const uint8_t* lmd_payload = payload + header->num_literal_payload_bytes;
+    lzfse_stream_t stream;
+    if (!init_lzfse_stream(&stream, payload, lmd_payload, header->literal_bits)) {
+        return false;
+    }
+    uint16_t literal_states[4];
+    memcpy(literal_states, header->literal_states, sizeof(literal_states));
+    for (uint32_t i = 0; i < header->num_literals; i += 4) {
+        if (!refill_lzfse_stream(&stream)) {
+            return false;
+        }
+        for (int j = 0; j < 4; j++) {
+            state->literals[i + j] = (uint8_t)decode_lzfse_value(literal_states + j, state->literal_table, &stream);
+        }
+    }
+
+    // L, M, D triples. As in the reference implementation, the stream may be
+    // refilled from before its start, which only happens if it's corrupt.
+    if (!init_lzfse_stream(&stream, in, lmd_payload + header->num_lmd_payload_bytes, header->lmd_bits)) {
+        return false;
+    }
+    uint16_t l_state = header->l_state;
+    uint16_t m_state = header->m_state;
+    uint16_t d_state = header->d_state;
+    const uint8_t* literal = state->literals;
+    const uint8_t* literals_end = state->literals + header->num_literals;
+    size_t block_end = *out_pos + header->num_raw_bytes;
+    size_t D = 0;
+    for (uint32_t i = 0; i < header->num_matches; i++) {
+        if (!refill_lzfse_stream(&stream)) {
+            return false;
+        }
+        size_t L = (size_t)decode_lzfse_value(&l_state, state->l_table, &stream);
+        size_t M = (size_t)decode_lzfse_value(&m_state, state->m_table, &stream);
+        size_t new_D = (size_t)decode_lzfse_value(&d_state, state->d_table, &stream);
+        if (new_D != 0) {
+            D = new_D;
+        }
+
+        if (L > (size_t)(literals_end - literal) || L > block_end - *out_pos) {
+            return false;
+        }
+        memcpy(dst + *out_pos, literal, L);
+        literal += L;
+        *out_pos += L;
+
+        if (M != 0) {
+            if (D == 0 || D > *out_pos || M > block_end - *out_pos) {
+                return false;
+            }
+            for (size_t j = 0; j < M; j++, (*out_pos)++) {
+                dst[*out_pos] = dst[*out_pos - D];
+            }
+        }
+    }
+    return *out_pos == block_end;
+}
+
+bool decompress_lzfse(const void* in, size_t in_len, void* out, size_t* out_len) {
+    const uint8_t* src = in;
+    uint8_t* dst = out;
+    size_t pos = 0;
+    size_t out_pos = 0;
+    lzfse_block_state_t* state = NULL;
+    bool success = false;
+
+    for (;;) {
+        if (in_len - pos < 4) {
+            goto cleanup;
+        }
+        uint32_t magic = read_le32(src + pos);
+
+        if (magic == LZFSE_MAGIC_END) {
+            success = true;
+            break;
+        }
+
+        if (magic == LZFSE_MAGIC_UNCOMPRESSED) {
+            if (in_len - pos < 8) {
+                goto cleanup;
+            }
+            size_t num_raw_bytes = read_le32(src + pos + 4);
+            pos += 8;
+            if (num_raw_bytes > in_len - pos || num_raw_bytes > *out_len - out_pos) {
+                goto cleanup;
+            }
+            memcpy(dst + out_pos, src + pos, num_raw_bytes);
+            pos += num_raw_bytes;
+            out_pos += num_raw_bytes;
+            continue;
+        }
+
+        if (magic == LZFSE_MAGIC_LZVN) {
+            if (in_len - pos < 12) {
+                goto cleanup;
+            }
+            size_t num_raw_bytes        = read_le32(src + pos + 4);
+            size_t num_payload_bytes    = read_le32(src + pos + 8);
+            pos += 12;
+            if (num_payload_bytes > in_len - pos || num_raw_bytes > *out_len - out_pos) {
+                goto cleanup;
+            }
+            size_t num_decoded = num_raw_bytes;
+            if (!decompress_lzvn(src + pos, num_payload_bytes, dst + out_pos, &num_decoded) || num_decoded != num_raw_bytes) {
+                goto cleanup;
+            }
+            pos += num_payload_bytes;
+            out_pos += num_raw_bytes;
+            continue;
+        }
+
+        if (magic != LZFSE_MAGIC_V1 && magic != LZFSE_MAGIC_V2) {
+            goto cleanup;
+        }
+
+        lzfse_block_header_t header;
+        size_t header_size = 0;
+        if (magic == LZFSE_MAGIC_V1) {
+            header_size = LZFSE_V1_HEADER_SIZE;
+            if (in_len - pos < header_size) {
+                goto cleanup;
+            }
+            read_lzfse_v1_header(src + pos, &header);
+        } else {
+            if (in_len - pos < LZFSE_V2_HEADER_SIZE) {
+                goto cleanup;
+            }
+            header_size = get_packed_field(read_le64(src + pos + 24), 0, 32);
+            if (header_size < LZFSE_V2_HEADER_SIZE || header_size > in_len - pos
+                || !read_lzfse_v2_header(src + pos, header_size, &header)
+            ) {
+                goto cleanup;
+            }
+        }
+        pos += header_size;
+
+        size_t num_payload_bytes = (size_t)header.num_literal_payload_bytes + header.num_lmd_payload_bytes;
+        if (num_payload_bytes > in_len - pos) {
+            goto cleanup;
+        }
+        if (!state) {
+            state = malloc(sizeof(lzfse_block_state_t));
+            if (!state) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `state`.\n", __func__);
+                exit(-1);
+            }
+        }
+        if (!decode_lzfse_block(&header, src, src + pos, state, dst, &out_pos, *out_len)) {
+            goto cleanup;
+        }
+        pos += num_payload_bytes;
+    }
+
+    *out_len = out_pos;
+
+cleanup:
+    free(state);
+    return success;
+}
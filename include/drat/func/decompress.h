@@ -0,0 +1,25 @@
+#ifndef DRAT_FUNC_DECOMPRESS_H
+#define DRAT_FUNC_DECOMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Decoders for the compression formats used by APFS transparent compression
+ * (decmpfs). Each one decompresses a whole buffer into another, and never
+ * writes beyond `*out_len` bytes of `out`; on success, `*out_len` is set to
+ * the number of bytes produced.
+ *
+ * - zlib (RFC 1950) wrapping DEFLATE (RFC 1951); the Adler-32 trailer is
+ *      verified if present.
+ * - LZVN.
+ * - LZFSE streams, whose blocks may be uncompressed (`bvx-`), LZVN (`bvxn`),
+ *      or FSE-coded (`bvx1`, `bvx2`).
+ */
+
+bool decompress_zlib (const void* in, size_t in_len, void* out, size_t* out_len);
+bool decompress_lzvn (const void* in, size_t in_len, void* out, size_t* out_len);
+bool decompress_lzfse(const void* in, size_t in_len, void* out, size_t* out_len);
+
+#endif // DRAT_FUNC_DECOMPRESS_H
@@ -0,0 +1,431 @@
+#include "digest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DIGEST_HAVE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL64(x, n)    (((x) << (n)) | ((x) >> (64 - (n))))
+
+/**
+ * Process a whole number of 64-byte blocks with the portable implementation.
+ */
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+    for (; num_blocks != 0; num_blocks--, data += SHA256_BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[4*i] << 24 | (uint32_t)data[4*i + 1] << 16 | (uint32_t)data[4*i + 2] << 8 | data[4*i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+            uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;  g = f;  f = e;  e = d + t1;
+            d = c;  c = b;  b = a;  a = t1 + t2;
+        }
+
+        state[0] += a;  state[1] += b;  state[2] += c;  state[3] += d;
+        state[4] += e;  state[5] += f;  state[6] += g;  state[7] += h;
+    }
+}
+
+#ifdef DIGEST_HAVE_SHA_NI
+/**
+ * Process a whole number of 64-byte blocks with the x86 SHA extensions. Each
+ * iteration of the inner loop performs four rounds; the message schedule is
+ * kept in a rotating window of four vectors.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_sha_ni(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+    const __m128i byte_swap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions expect the state as ABEF and CDGH
+    __m128i tmp     = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1  = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp     = _mm_shuffle_epi32(tmp, 0xb1);         // CDAB
+    state1  = _mm_shuffle_epi32(state1, 0x1b);      // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1  = _mm_blend_epi16(state1, tmp, 0xf0);   // CDGH
+
+    for (; num_blocks != 0; num_blocks--, data += SHA256_BLOCK_SIZE) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 16; i++) {
+            __m128i msg;
+            if (i < 4) {
+                msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16*i)), byte_swap_mask);
+            } else {
+                __m128i w0 = w[i % 4], w1 = w[(i + 1) % 4], w2 = w[(i + 2) % 4], w3 = w[(i + 3) % 4];
+                msg = _mm_sha256msg1_epu32(w0, w1);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(w3, w2, 4));
+                msg = _mm_sha256msg2_epu32(msg, w3);
+            }
+            w[i % 4] = msg;
+
+            msg     = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&sha256_k[4*i]));
+            state1  = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg     = _mm_shuffle_epi32(msg, 0x0e);
+            state0  = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp     = _mm_shuffle_epi32(state0, 0x1b);      // FEBA
+    state1  = _mm_shuffle_epi32(state1, 0xb1);      // DCHG
+    state0  = _mm_blend_epi16(tmp, state1, 0xf0);   // DCBA
+    state1  = _mm_alignr_epi8(state1, tmp, 8);      // HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif
+
+/**
+ * Determine whether SHA-256 is computed with the CPU's SHA extensions.
+ */
+bool sha256_uses_cpu_extensions(void) {
+#ifdef DIGEST_HAVE_SHA_NI
+    static int supported = -1;
+    if (supported == -1) {
+        unsigned int eax, ebx, ecx, edx;
+        bool has_sse41 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1) && (ecx & bit_SSSE3);
+        bool has_sha = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29));
+        supported = has_sse41 && has_sha;
+    }
+    return supported;
+#else
+    return false;
+#endif
+}
+
+static void sha256_blocks(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+#ifdef DIGEST_HAVE_SHA_NI
+    if (sha256_uses_cpu_extensions()) {
+        sha256_blocks_sha_ni(state, data, num_blocks);
+        return;
+    }
+#endif
+    sha256_blocks_portable(state, data, num_blocks);
+}
+
+void sha256_init(sha256_ctx_t* ctx) {
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial_state, sizeof(initial_state));
+    ctx->num_bytes = 0;
+    ctx->buffer_len = 0;
+}
+
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t num_bytes) {
+    const uint8_t* bytes = data;
+    ctx->num_bytes += num_bytes;
+
+    if (ctx->buffer_len != 0) {
+        size_t fill = SHA256_BLOCK_SIZE - ctx->buffer_len;
+        if (fill > num_bytes) {
+            fill = num_bytes;
+        }
+        memcpy(ctx->buffer + ctx->buffer_len, bytes, fill);
+        ctx->buffer_len += fill;
+        bytes += fill;
+        num_bytes -= fill;
+        if (ctx->buffer_len < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_blocks(ctx->state, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    size_t num_blocks = num_bytes / SHA256_BLOCK_SIZE;
+    if (num_blocks != 0) {
+        sha256_blocks(ctx->state, bytes, num_blocks);
+        bytes += num_blocks * SHA256_BLOCK_SIZE;
+        num_bytes -= num_blocks * SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buffer, bytes, num_bytes);
+    ctx->buffer_len = num_bytes;
+}
+
+void sha256_final(sha256_ctx_t* ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t num_bits = ctx->num_bytes * 8;
+
+    uint8_t padding[2 * SHA256_BLOCK_SIZE] = { 0x80 };
+    size_t padding_len = (ctx->buffer_len < 56 ? 56 : 120) - ctx->buffer_len;
+    for (int i = 0; i < 8; i++) {
+        padding[padding_len + i] = num_bits >> (56 - 8*i);
+    }
+    sha256_update(ctx, padding, padding_len + 8);
+
+    for (int i = 0; i < 8; i++) {
+        digest[4*i]     = ctx->state[i] >> 24;
+        digest[4*i + 1] = ctx->state[i] >> 16;
+        digest[4*i + 2] = ctx->state[i] >> 8;
+        digest[4*i + 3] = ctx->state[i];
+    }
+}
+
+#define XXH64_PRIME_1   0x9e3779b185ebca87ULL
+#define XXH64_PRIME_2   0xc2b2ae3d27d4eb4fULL
+#define XXH64_PRIME_3   0x165667b19e3779f9ULL
+#define XXH64_PRIME_4   0x85ebca77c2b2ae63ULL
+#define XXH64_PRIME_5   0x27d4eb2f165667c5ULL
+
+static uint64_t read_le64(const uint8_t* bytes) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+static uint32_t read_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH64_PRIME_2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH64_PRIME_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t hash, uint64_t acc) {
+    hash ^= xxh64_round(0, acc);
+    return hash * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+static void xxh64_stripes(xxh64_ctx_t* ctx, const uint8_t* data, size_t num_stripes) {
+    uint64_t acc0 = ctx->acc[0], acc1 = ctx->acc[1], acc2 = ctx->acc[2], acc3 = ctx->acc[3];
+    for (; num_stripes != 0; num_stripes--, data += XXH64_STRIPE_SIZE) {
+        acc0 = xxh64_round(acc0, read_le64(data));
+        acc1 = xxh64_round(acc1, read_le64(data + 8));
+        acc2 = xxh64_round(acc2, read_le64(data + 16));
+        acc3 = xxh64_round(acc3, read_le64(data + 24));
+    }
+    ctx->acc[0] = acc0;  ctx->acc[1] = acc1;  ctx->acc[2] = acc2;  ctx->acc[3] = acc3;
+}
+
+void xxh64_init(xxh64_ctx_t* ctx, uint64_t seed) {
+    ctx->acc[0] = seed + XXH64_PRIME_1 + XXH64_PRIME_2;
+    ctx->acc[1] = seed + XXH64_PRIME_2;
+    ctx->acc[2] = seed;
+    ctx->acc[3] = seed - XXH64_PRIME_1;
+    ctx->seed = seed;
+    ctx->num_bytes = 0;
+    ctx->buffer_len = 0;
+}
+
+void xxh64_update(xxh64_ctx_t* ctx, const void* data, size_t num_bytes) {
+    const uint8_t* bytes = data;
+    ctx->num_bytes += num_bytes;
+
+    if (ctx->buffer_len != 0) {
+        size_t fill = XXH64_STRIPE_SIZE - ctx->buffer_len;
+        if (fill > num_bytes) {
+            fill = num_bytes;
+        }
+        memcpy(ctx->buffer + ctx->buffer_len, bytes, fill);
+        ctx->buffer_len += fill;
+        bytes += fill;
+        num_bytes -= fill;
+        if (ctx->buffer_len < XXH64_STRIPE_SIZE) {
+            return;
+        }
+        xxh64_stripes(ctx, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    size_t num_stripes = num_bytes / XXH64_STRIPE_SIZE;
+    if (num_stripes != 0) {
+        xxh64_stripes(ctx, bytes, num_stripes);
+        bytes += num_stripes * XXH64_STRIPE_SIZE;
+        num_bytes -= num_stripes * XXH64_STRIPE_SIZE;
+    }
+
+    memcpy(ctx->buffer, bytes, num_bytes);
+    ctx->buffer_len = num_bytes;
+}
+
+uint64_t xxh64_final(xxh64_ctx_t* ctx) {
+    uint64_t hash;
+    if (ctx->num_bytes >= XXH64_STRIPE_SIZE) {
+        hash = ROTL64(ctx->acc[0], 1) + ROTL64(ctx->acc[1], 7) + ROTL64(ctx->acc[2], 12) + ROTL64(ctx->acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = xxh64_merge_round(hash, ctx->acc[i]);
+        }
+    } else {
+        hash = ctx->seed + XXH64_PRIME_5;
+    }
+    hash += ctx->num_bytes;
+
+    const uint8_t* bytes = ctx->buffer;
+    size_t num_bytes = ctx->buffer_len;
+    for (; num_bytes >= 8; bytes += 8, num_bytes -= 8) {
+        hash ^= xxh64_round(0, read_le64(bytes));
+        hash = ROTL64(hash, 27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+    }
+    if (num_bytes >= 4) {
+        hash ^= (uint64_t)read_le32(bytes) * XXH64_PRIME_1;
+        hash = ROTL64(hash, 23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+        bytes += 4;
+        num_bytes -= 4;
+    }
+    for (; num_bytes != 0; bytes++, num_bytes--) {
+        hash ^= *bytes * XXH64_PRIME_5;
+        hash = ROTL64(hash, 11) * XXH64_PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH64_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= XXH64_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Parse a comma-separated list of digest names, like `sha256,xxh64`.
+ *
+ * RETURN VALUE:    A bitmask of `DIGEST_*` values, or zero if the list is
+ *              empty or contains an unknown name.
+ */
+uint32_t parse_digest_types(const char* list) {
+    uint32_t types = 0;
+    const char* cursor = list;
+    while (*cursor) {
+        size_t name_len = strcspn(cursor, ",");
+        if (name_len == 6 && strncmp(cursor, "sha256", 6) == 0) {
+            types |= DIGEST_SHA256;
+        } else if (name_len == 5 && strncmp(cursor, "xxh64", 5) == 0) {
+            types |= DIGEST_XXH64;
+        } else {
+            return 0;
+        }
+        cursor += name_len;
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return types;
+}
+
+/**
+ * Get the name of a digest type, as used in BSD-style checksum lines like
+ * `SHA256 (file) = ...`.
+ */
+const char* get_digest_name(uint32_t type) {
+    switch (type) {
+        case DIGEST_SHA256:
+            return "SHA256";
+        case DIGEST_XXH64:
+            return "XXH64";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+void init_digests(digest_ctx_t* ctx, uint32_t types) {
+    ctx->types = types;
+    if (types & DIGEST_SHA256) {
+        sha256_init(&ctx->sha256);
+    }
+    if (types & DIGEST_XXH64) {
+        xxh64_init(&ctx->xxh64, 0);
+    }
+}
+
+void update_digests(digest_ctx_t* ctx, const void* data, size_t num_bytes) {
+    if (ctx->types & DIGEST_SHA256) {
+        sha256_update(&ctx->sha256, data, num_bytes);
+    }
+    if (ctx->types & DIGEST_XXH64) {
+        xxh64_update(&ctx->xxh64, data, num_bytes);
+    }
+}
+
+/**
+ * Update a set of digests with a run of zeroes, e.g. a hole in a file.
+ */
+void update_digests_with_zeroes(digest_ctx_t* ctx, uint64_t num_bytes) {
+    static const uint8_t zeroes[64 * 1024];
+    if (ctx->types == 0) {
+        return;
+    }
+    while (num_bytes != 0) {
+        size_t slice = num_bytes < sizeof(zeroes) ? num_bytes : sizeof(zeroes);
+        update_digests(ctx, zeroes, slice);
+        num_bytes -= slice;
+    }
+}
+
+/**
+ * Finish computing one of a set of digests and get it in hexadecimal, in the
+ * byte order used by `sha256sum` and `xxhsum`. Each digest can only be
+ * finished once.
+ */
+void finish_digest(digest_ctx_t* ctx, uint32_t type, char hex[DIGEST_MAX_HEX_SIZE]) {
+    hex[0] = '\0';
+    if (type == DIGEST_SHA256) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_final(&ctx->sha256, digest);
+        for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+            sprintf(hex + 2*i, "%02x", digest[i]);
+        }
+    } else if (type == DIGEST_XXH64) {
+        sprintf(hex, "%016"PRIx64"", xxh64_final(&ctx->xxh64));
+    }
+}
+
+/**
+ * Finish computing a set of digests, and print each of them as a BSD-style
+ * checksum line, like `SHA256 (name) = ...`, which `sha256sum -c` and
+ * `xxhsum -c` accept. The lines for one set of digests are printed together,
+ * even if several threads print to the same stream at once.
+ *
+ * name:    The name of the data, normally the path of the output file.
+ */
+void print_digests(FILE* stream, digest_ctx_t* ctx, const char* name) {
+    flockfile(stream);
+    for (uint32_t type = 1; type <= ctx->types; type <<= 1) {
+        if (ctx->types & type) {
+            char hex[DIGEST_MAX_HEX_SIZE];
+            finish_digest(ctx, type, hex);
+            fprintf(stream, "%s (%s) = %s\n", get_digest_name(type), name, hex);
+        }
+    }
+    fflush(stream);
+    funlockfile(stream);
+}
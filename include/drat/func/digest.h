@@ -0,0 +1,73 @@
+#ifndef DRAT_FUNC_DIGEST_H
+#define DRAT_FUNC_DIGEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Streaming content digests of recovered data.
+ *
+ * SHA-256 uses the x86 SHA extensions (SHA-NI) when the CPU supports them,
+ * and a portable implementation otherwise. XXH64 is a fast, non-cryptographic
+ * hash, useful for checking integrity when a cryptographic digest isn't
+ * needed; it is written in the same format as `xxhsum`.
+ */
+
+#define SHA256_DIGEST_SIZE  32
+#define SHA256_BLOCK_SIZE   64
+
+typedef struct {
+    uint32_t    state[8];
+    uint64_t    num_bytes;
+    uint8_t     buffer[SHA256_BLOCK_SIZE];
+    size_t      buffer_len;
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t* ctx);
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t num_bytes);
+void sha256_final(sha256_ctx_t* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+bool sha256_uses_cpu_extensions(void);
+
+#define XXH64_STRIPE_SIZE   32
+
+typedef struct {
+    uint64_t    acc[4];
+    uint64_t    seed;
+    uint64_t    num_bytes;
+    uint8_t     buffer[XXH64_STRIPE_SIZE];
+    size_t      buffer_len;
+} xxh64_ctx_t;
+
+void xxh64_init(xxh64_ctx_t* ctx, uint64_t seed);
+void xxh64_update(xxh64_ctx_t* ctx, const void* data, size_t num_bytes);
+uint64_t xxh64_final(xxh64_ctx_t* ctx);
+
+/**
+ * A set of digests computed over the same data at once.
+ *
+ * types:   Bitmask of `DIGEST_*` values.
+ */
+#define DIGEST_SHA256   0x1
+#define DIGEST_XXH64    0x2
+
+/** Length of the hexadecimal form of the longest digest, plus a terminator */
+#define DIGEST_MAX_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1)
+
+typedef struct {
+    uint32_t        types;
+    sha256_ctx_t    sha256;
+    xxh64_ctx_t     xxh64;
+} digest_ctx_t;
+
+uint32_t parse_digest_types(const char* list);
+const char* get_digest_name(uint32_t type);
+
+void init_digests(digest_ctx_t* ctx, uint32_t types);
+void update_digests(digest_ctx_t* ctx, const void* data, size_t num_bytes);
+void update_digests_with_zeroes(digest_ctx_t* ctx, uint64_t num_bytes);
+void finish_digest(digest_ctx_t* ctx, uint32_t type, char hex[DIGEST_MAX_HEX_SIZE]);
+void print_digests(FILE* stream, digest_ctx_t* ctx, const char* name);
+
+#endif // DRAT_FUNC_DIGEST_H
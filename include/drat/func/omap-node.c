@@ -0,0 +1,414 @@
+/**
+ * Functions used to decode object map B-tree nodes into a form that can be
+ * searched quickly, to cache decoded nodes, and to search them.
+ */
+
+#include "omap-node.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drat/io.h>    // nx_block_size, read_blocks()
+#include <drat/func/cksum.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OMAP_KEY_SEARCH_AVX2
+#include <immintrin.h>
+#endif
+
+/**
+ * Number of slots in the decoded node cache. The cache is direct-mapped by
+ * block address, so each slot holds at most one node.
+ */
+#define OMAP_NODE_CACHE_NUM_SLOTS   1024
+
+/**
+ * The node cache may be used by several threads at once, e.g. by the workers
+ * of `recover`, so the slots, each cached node's `cached` and `refs` fields,
+ * and whether the cache is enabled are only accessed while holding
+ * `omap_node_cache_lock`. A node that is evicted while in use is only freed
+ * once the last of its users releases it.
+ */
+static pthread_mutex_t omap_node_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static omap_node_t* omap_node_cache[OMAP_NODE_CACHE_NUM_SLOTS] = { NULL };
+static bool omap_node_cache_enabled = true;
+
+static bool omap_key_search_simd_enabled = true;
+
+/**
+ * Decode a given object map B-tree node, unpacking its keys into contiguous
+ * arrays of OIDs and XIDs, and its values into a contiguous array of values.
+ *
+ * node:    A pointer to an object map B-tree node.
+ *
+ * paddr:   The block address that `node` was read from.
+ *
+ * RETURN VALUE:
+ *      A pointer to the decoded node, which is not owned by the node cache and
+ *      must be freed with `release_omap_node()`. If the node does not have
+ *      fixed-size keys and values, or its TOC refers to data outside of the
+ *      node, a NULL pointer is returned.
+ */
+omap_node_t* decode_omap_node(btree_node_phys_t* node, paddr_t paddr) {
+    if (!(node->btn_flags & BTNODE_FIXED_KV_SIZE)) {
+        // TODO: Handle this case
+        fprintf(stderr, "\n%s: Object map B-trees don't have variable size keys and values ... do they?\n", __func__);
+        return NULL;
+    }
+
+    bool is_leaf = node->btn_flags & BTNODE_LEAF;
+    size_t val_size = is_leaf ? sizeof(omap_val_t) : sizeof(paddr_t);
+
+    // Pointers to areas of the node
+    char* toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
+    char* key_start = toc_start + node->btn_table_space.len;
+    char* val_end   = (char*)node + nx_block_size;
+    if (node->btn_flags & BTNODE_ROOT) {
+        val_end -= sizeof(btree_info_t);
+    }
+
+    if (
+           key_start > val_end
+        || node->btn_nkeys * sizeof(kvoff_t) > node->btn_table_space.len
+    ) {
+        fprintf(stderr, "\nERROR: %s: The TOC of the node at block %#"PRIx64" is malformed.\n", __func__, paddr);
+        return NULL;
+    }
+
+    uint32_t nkeys = node->btn_nkeys;
+    omap_node_t* decoded = malloc(sizeof(omap_node_t) + nkeys * (sizeof(oid_t) + sizeof(xid_t) + sizeof(omap_val_t)));
+    if (!decoded) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `decoded`.\n", __func__);
+        exit(-1);
+    }
+
+    decoded->paddr  = paddr;
+    decoded->xid    = node->btn_o.o_xid;
+    memcpy(&(decoded->cksum), node->btn_o.o_cksum, sizeof(decoded->cksum));
+    decoded->flags  = node->btn_flags;
+    decoded->level  = node->btn_level;
+    decoded->nkeys  = nkeys;
+    decoded->oids   = (oid_t*)(decoded + 1);
+    decoded->xids   = (xid_t*)(decoded->oids + nkeys);
+    decoded->vals   = (omap_val_t*)(decoded->xids + nkeys);
+    decoded->cached = false;
+    decoded->refs   = 0;
+
+    kvoff_t* toc_entry = toc_start;
+    for (uint32_t i = 0;    i < nkeys;    i++, toc_entry++) {
+        if (
+               key_start + toc_entry->k + sizeof(omap_key_t) > val_end
+            || toc_entry->v < val_size
+            || val_end - toc_entry->v < key_start
+        ) {
+            fprintf(stderr, "\nERROR: %s: TOC entry %"PRIu32" of the node at block %#"PRIx64" is malformed.\n", __func__, i, paddr);
+            free(decoded);
+            return NULL;
+        }
+
+        omap_key_t* key = key_start + toc_entry->k;
+        decoded->oids[i] = key->ok_oid;
+        decoded->xids[i] = key->ok_xid;
+
+        if (is_leaf) {
+            memcpy(decoded->vals + i, val_end - toc_entry->v, sizeof(omap_val_t));
+        } else {
+            decoded->vals[i].ov_flags = 0;
+            decoded->vals[i].ov_size  = 0;
+            memcpy(&(decoded->vals[i].ov_paddr), val_end - toc_entry->v, sizeof(paddr_t));
+        }
+    }
+
+    return decoded;
+}
+
+/**
+ * Release a decoded node obtained from `decode_omap_node()`, `get_omap_node()`,
+ * or `read_omap_node()`. The node is freed unless it is still owned by the node
+ * cache or in use elsewhere.
+ */
+void release_omap_node(omap_node_t* node) {
+    if (!node) {
+        return;
+    }
+
+    pthread_mutex_lock(&omap_node_cache_lock);
+    bool in_use = false;
+    if (node->refs != 0) {
+        node->refs--;
+        in_use = node->cached || node->refs != 0;
+    }
+    pthread_mutex_unlock(&omap_node_cache_lock);
+
+    if (!in_use) {
+        free(node);
+    }
+}
+
+/**
+ * Remove a node from the node cache, freeing it unless it is in use, in which
+ * case its last user frees it. The caller must hold `omap_node_cache_lock`.
+ */
+static void evict_omap_node_from_cache(omap_node_t** slot) {
+    omap_node_t* node = *slot;
+    *slot = NULL;
+    if (!node) {
+        return;
+    }
+    node->cached = false;
+    if (node->refs == 0) {
+        free(node);
+    }
+}
+
+/**
+ * Get the cached node for a given block address, if there is one, counting
+ * the caller as one of its users.
+ *
+ * node:    A pointer to the raw node read from `paddr`, which the cached node
+ *      must match, or a NULL pointer to accept any cached node.
+ */
+static omap_node_t* get_cached_omap_node(btree_node_phys_t* node, paddr_t paddr) {
+    omap_node_t* result = NULL;
+    pthread_mutex_lock(&omap_node_cache_lock);
+    omap_node_t* cached = omap_node_cache_enabled ? omap_node_cache[paddr % OMAP_NODE_CACHE_NUM_SLOTS] : NULL;
+    if (
+           cached
+        && cached->paddr == paddr
+        && (
+               !node
+            || (
+                   cached->xid == node->btn_o.o_xid
+                && memcmp(&(cached->cksum), node->btn_o.o_cksum, sizeof(cached->cksum)) == 0
+            )
+        )
+    ) {
+        cached->refs++;
+        result = cached;
+    }
+    pthread_mutex_unlock(&omap_node_cache_lock);
+    return result;
+}
+
+/**
+ * Insert a decoded node into the node cache, if it is enabled, evicting
+ * whichever node currently occupies its slot, and count the caller as one of
+ * the new node's users.
+ */
+static void insert_omap_node_into_cache(omap_node_t* node) {
+    pthread_mutex_lock(&omap_node_cache_lock);
+    if (omap_node_cache_enabled) {
+        omap_node_t** slot = omap_node_cache + (node->paddr % OMAP_NODE_CACHE_NUM_SLOTS);
+        evict_omap_node_from_cache(slot);
+        node->cached = true;
+        node->refs = 1;
+        *slot = node;
+    }
+    pthread_mutex_unlock(&omap_node_cache_lock);
+}
+
+/**
+ * Get the decoded form of a given object map B-tree node, using the node cache
+ * if it is enabled.
+ *
+ * node:    A pointer to an object map B-tree node.
+ *
+ * paddr:   The block address that `node` was read from.
+ *
+ * RETURN VALUE:
+ *      A pointer to the decoded node, or a NULL pointer if it could not be
+ *      decoded. The caller must pass this pointer to `release_omap_node()`
+ *      when it is no longer needed; until then, it remains valid even if the
+ *      node is evicted from the cache.
+ */
+omap_node_t* get_omap_node(btree_node_phys_t* node, paddr_t paddr) {
+    omap_node_t* cached = get_cached_omap_node(node, paddr);
+    if (cached) {
+        return cached;
+    }
+
+    omap_node_t* decoded = decode_omap_node(node, paddr);
+    if (decoded) {
+        insert_omap_node_into_cache(decoded);
+    }
+    return decoded;
+}
+
+/**
+ * Get the decoded form of the object map B-tree node at a given block address.
+ * If the node cache is enabled and contains a node for that address, no I/O is
+ * performed; otherwise, the node is read from disk and decoded.
+ *
+ * RETURN VALUE:
+ *      As for `get_omap_node()`.
+ */
+omap_node_t* read_omap_node(paddr_t paddr) {
+    omap_node_t* cached = get_cached_omap_node(NULL, paddr);
+    if (cached) {
+        return cached;
+    }
+
+    btree_node_phys_t* node = malloc(nx_block_size);
+    if (!node) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `node`.\n", __func__);
+        exit(-1);
+    }
+
+    if (read_blocks(node, paddr, 1) != 1) {
+        fprintf(stderr, "\nABORT: %s: Failed to read block %#"PRIx64".\n", __func__, paddr);
+        exit(-1);
+    }
+
+    if (!is_cksum_valid(node)) {
+        fprintf(stderr, "\nWARNING: %s: Checksum of node at block %#"PRIx64" did not validate. Proceeding anyway as if it did.\n", __func__, paddr);
+    }
+
+    omap_node_t* decoded = get_omap_node(node, paddr);
+    free(node);
+    return decoded;
+}
+
+/**
+ * Enable or disable the node cache. Disabling it also empties it.
+ */
+void set_omap_node_cache_enabled(bool enabled) {
+    if (!enabled) {
+        clear_omap_node_cache();
+    }
+    pthread_mutex_lock(&omap_node_cache_lock);
+    omap_node_cache_enabled = enabled;
+    pthread_mutex_unlock(&omap_node_cache_lock);
+}
+
+/**
+ * Empty the node cache, e.g. after modifying object map nodes on disk. Nodes
+ * that are still in use are freed once they are released.
+ */
+void clear_omap_node_cache(void) {
+    pthread_mutex_lock(&omap_node_cache_lock);
+    for (size_t i = 0; i < OMAP_NODE_CACHE_NUM_SLOTS; i++) {
+        evict_omap_node_from_cache(omap_node_cache + i);
+    }
+    pthread_mutex_unlock(&omap_node_cache_lock);
+}
+
+/**
+ * Determine whether the CPU that we're running on supports the SIMD
+ * instructions used by `count_omap_node_keys_not_exceeding()`.
+ */
+bool is_omap_key_search_simd_available(void) {
+#ifdef OMAP_KEY_SEARCH_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+/**
+ * Enable or disable the use of SIMD instructions when searching decoded nodes.
+ * SIMD instructions are only ever used if they are available.
+ */
+void set_omap_key_search_simd_enabled(bool enabled) {
+    omap_key_search_simd_enabled = enabled;
+}
+
+#ifdef OMAP_KEY_SEARCH_AVX2
+/**
+ * Whether the CPU supports AVX2. This is determined only once, when a node is
+ * first searched, since nodes may be searched by several threads at once.
+ */
+static pthread_once_t omap_key_search_simd_once = PTHREAD_ONCE_INIT;
+static bool omap_key_search_simd_available = false;
+
+static void detect_omap_key_search_simd(void) {
+    omap_key_search_simd_available = is_omap_key_search_simd_available();
+}
+
+/**
+ * AVX2 implementation of `count_omap_node_keys_not_exceeding()`. AVX2 only
+ * has signed 64-bit comparisons, so the sign bit of each operand is flipped
+ * beforehand, which makes the signed comparisons order the operands as if
+ * they were unsigned.
+ */
+__attribute__((target("avx2")))
+static uint32_t count_keys_not_exceeding_avx2(omap_node_t* node, oid_t oid, xid_t max_xid) {
+    const __m256i sign_bit      = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i target_oid    = _mm256_xor_si256(_mm256_set1_epi64x(oid),     sign_bit);
+    const __m256i target_xid    = _mm256_xor_si256(_mm256_set1_epi64x(max_xid), sign_bit);
+
+    // Narrow the search down to a window of at most 16 keys with a binary
+    // search, then compare the keys in that window four at a time.
+    uint32_t lo = 0;
+    uint32_t hi = node->nkeys;
+    while (hi - lo > 16) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (node->oids[mid] > oid || (node->oids[mid] == oid && node->xids[mid] > max_xid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    uint32_t i = lo;
+    for (; i + 4 <= hi; i += 4) {
+        __m256i oids = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(node->oids + i)), sign_bit);
+        __m256i xids = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(node->xids + i)), sign_bit);
+
+        // key <= target  iff  key.oid < oid  ||  (key.oid == oid && !(key.xid > max_xid))
+        __m256i oid_lt = _mm256_cmpgt_epi64(target_oid, oids);
+        __m256i oid_eq = _mm256_cmpeq_epi64(target_oid, oids);
+        __m256i xid_gt = _mm256_cmpgt_epi64(xids, target_xid);
+        __m256i not_exceeding = _mm256_or_si256(oid_lt, _mm256_andnot_si256(xid_gt, oid_eq));
+
+        // Keys are sorted, so the first key that exceeds the target ends the search
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(not_exceeding));
+        if (mask != 0xf) {
+            return i + __builtin_popcount(mask);
+        }
+    }
+
+    for (; i < hi; i++) {
+        if (node->oids[i] > oid || (node->oids[i] == oid && node->xids[i] > max_xid)) {
+            break;
+        }
+    }
+    return i;
+}
+#endif
+
+/**
+ * Count the keys in a decoded node that don't exceed a given key, i.e. whose:
+ * - OID is less than the given OID; or
+ * - OID matches the given OID, and XID doesn't exceed the given XID.
+ *
+ * Since the keys in a node are sorted, the result minus one is the index of
+ * the last such key, which is the entry that should be descended (in a
+ * non-leaf node) or checked (in a leaf node) when looking up the given key.
+ *
+ * RETURN VALUE:
+ *      The number of such keys; zero if there are none.
+ */
+uint32_t count_omap_node_keys_not_exceeding(omap_node_t* node, oid_t oid, xid_t max_xid) {
+#ifdef OMAP_KEY_SEARCH_AVX2
+    pthread_once(&omap_key_search_simd_once, detect_omap_key_search_simd);
+    if (omap_key_search_simd_enabled && omap_key_search_simd_available) {
+        return count_keys_not_exceeding_avx2(node, oid, max_xid);
+    }
+#endif
+
+    // Binary search for the first key that exceeds the given key
+    uint32_t lo = 0;
+    uint32_t hi = node->nkeys;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (node->oids[mid] > oid || (node->oids[mid] == oid && node->xids[mid] > max_xid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
@@ -0,0 +1,67 @@
+#ifndef DRAT_FUNC_OMAP_NODE_H
+#define DRAT_FUNC_OMAP_NODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <apfs/general.h>   // paddr_t
+#include <apfs/object.h>    // oid_t, xid_t
+#include <apfs/btree.h>
+#include <apfs/omap.h>
+
+/**
+ * Custom data structure used to store a decoded object map B-tree node, i.e.
+ * a node whose keys have been unpacked from the TOC-indirected layout used on
+ * disk into contiguous arrays of OIDs and XIDs, so that they can be searched
+ * quickly (and with SIMD instructions where available).
+ *
+ * paddr:   The block address that the node was read from.
+ *
+ * xid, cksum:  The XID and checksum from the node's object header, used to
+ *      check whether a cached decoded node still matches a given raw node.
+ *
+ * flags, level, nkeys: Copied from the node's `btree_node_phys_t` header.
+ *
+ * oids, xids:  Arrays of `nkeys` OIDs and XIDs; the i-th key of the node is
+ *      `(oids[i], xids[i])`.
+ *
+ * vals:    Array of `nkeys` values. For leaf nodes, these are the object map
+ *      values; for non-leaf nodes, only `ov_paddr` is meaningful and is the
+ *      address of the corresponding child node.
+ *
+ * cached:  Whether this node is owned by the node cache.
+ *
+ * refs:    The number of users of a node obtained from the node cache that
+ *      haven't yet released it. A node is freed when it is released by its
+ *      last user and is no longer owned by the cache. Every node must be
+ *      passed to `release_omap_node()` after use.
+ */
+typedef struct {
+    paddr_t     paddr;
+    xid_t       xid;
+    uint64_t    cksum;
+    uint16_t    flags;
+    uint16_t    level;
+    uint32_t    nkeys;
+    oid_t*      oids;
+    xid_t*      xids;
+    omap_val_t* vals;
+    bool        cached;
+    uint32_t    refs;
+} omap_node_t;
+
+omap_node_t* decode_omap_node(btree_node_phys_t* node, paddr_t paddr);
+void release_omap_node(omap_node_t* node);
+
+omap_node_t* get_omap_node(btree_node_phys_t* node, paddr_t paddr);
+omap_node_t* read_omap_node(paddr_t paddr);
+
+void set_omap_node_cache_enabled(bool enabled);
+void clear_omap_node_cache(void);
+
+bool is_omap_key_search_simd_available(void);
+void set_omap_key_search_simd_enabled(bool enabled);
+
+uint32_t count_omap_node_keys_not_exceeding(omap_node_t* node, oid_t oid, xid_t max_xid);
+
+#endif // DRAT_FUNC_OMAP_NODE_H
@@ -5,6 +5,8 @@
 
 #include "io.h"
 
+#include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 
 #include <apfs/nx.h>    // for NX_DEFAULT_BLOCK_SIZE
@@ -172,3 +174,133 @@ size_t write_blocks(void* buffer, long start_block, size_t num_blocks) {
     }
     return num_blocks_written;
 }
+
+typedef struct {
+    uint64_t    addr;
+    size_t      index;
+} batch_block_t;
+
+static int compare_batch_blocks(const void* a, const void* b) {
+    const batch_block_t* block_a = a;
+    const batch_block_t* block_b = b;
+    if (block_a->addr != block_b->addr) {
+        return block_a->addr < block_b->addr ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Read a given set of blocks, which need not be contiguous or in any order,
+ * from the APFS container. The blocks are sorted by address and coalesced into
+ * as few reads as possible; runs of blocks separated by small gaps are merged
+ * into a single read, with the blocks in the gap being discarded.
+ *
+ * - buffer:        The location where data that is read will be stored; the
+ *      block at address `addrs[i]` is stored at offset `i * nx_block_size`.
+ *      It is the caller's responsibility to ensure that sufficient memory is
+ *      allocated to read the desired number of blocks.
+ * - addrs:         Array of the APFS physical block addresses to read.
+ * - num_blocks:    The number of addresses in `addrs`.
+ *
+ * RETURN VALUE:    The number of blocks that were successfully read. If this
+ *              is less than `num_blocks`, the contents of the blocks that
+ *              weren't read are undefined.
+ */
+size_t read_blocks_batch(void* buffer, const uint64_t* addrs, size_t num_blocks) {
+    if (num_blocks == 0) {
+        return 0;
+    }
+
+    batch_block_t* blocks = malloc(num_blocks * sizeof(batch_block_t));
+    if (!blocks) {
+        fprintf(stderr, "\nABORT: read_blocks_batch: Could not allocate sufficient memory for `blocks`.\n");
+        exit(-1);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        blocks[i].addr = addrs[i];
+        blocks[i].index = i;
+    }
+    qsort(blocks, num_blocks, sizeof(batch_block_t), compare_batch_blocks);
+
+    char* run_buffer = NULL;
+    size_t run_buffer_blocks = 0;
+    size_t num_blocks_read = 0;
+
+    size_t run_start = 0;
+    while (run_start < num_blocks) {
+        // Extend the run whilst the next block is close enough to merge
+        size_t run_end = run_start + 1;
+        while (
+               run_end < num_blocks
+            && blocks[run_end].addr - blocks[run_end - 1].addr <= READ_BATCH_MAX_GAP_BLOCKS + 1
+        ) {
+            run_end++;
+        }
+
+        uint64_t first_addr = blocks[run_start].addr;
+        size_t run_len = blocks[run_end - 1].addr - first_addr + 1;
+        if (run_len > run_buffer_blocks) {
+            run_buffer = realloc(run_buffer, run_len * nx_block_size);
+            if (!run_buffer) {
+                fprintf(stderr, "\nABORT: read_blocks_batch: Could not allocate sufficient memory for `run_buffer`.\n");
+                exit(-1);
+            }
+            run_buffer_blocks = run_len;
+        }
+
+        size_t run_len_read = read_blocks(run_buffer, first_addr, run_len);
+        if (run_len_read == (size_t)-1) {
+            run_len_read = 0;
+        }
+
+        for (size_t i = run_start; i < run_end; i++) {
+            uint64_t offset = blocks[i].addr - first_addr;
+            if (offset < run_len_read) {
+                memcpy((char*)buffer + blocks[i].index * nx_block_size, run_buffer + offset * nx_block_size, nx_block_size);
+                num_blocks_read++;
+            }
+        }
+
+        run_start = run_end;
+    }
+
+    free(run_buffer);
+    free(blocks);
+    return num_blocks_read;
+}
+
+/**
+ * Read given number of bytes from a given byte offset within the APFS
+ * container, without using the file position shared by all users of `nx`, so
+ * that several threads can read from the container at once. Nothing is
+ * printed.
+ *
+ * RETURN VALUE:    The number of bytes read, which is less than `num_bytes`
+ *              if end-of-file was reached or an error occurred.
+ */
+size_t pread_bytes(void* buffer, uint64_t offset, size_t num_bytes) {
+    int fd = fileno(nx);
+    size_t num_bytes_read = 0;
+    while (num_bytes_read < num_bytes) {
+        ssize_t result = pread(fd, (char*)buffer + num_bytes_read, num_bytes - num_bytes_read, offset + num_bytes_read);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        num_bytes_read += result;
+    }
+    return num_bytes_read;
+}
+
+/**
+ * Read given number of blocks from the APFS container, like `read_blocks()`,
+ * but thread-safe and silent; see `pread_bytes()`.
+ *
+ * RETURN VALUE:    The number of blocks read, which is less than `num_blocks`
+ *              if end-of-file was reached or an error occurred.
+ */
+size_t pread_blocks(void* buffer, uint64_t start_block, size_t num_blocks) {
+    return pread_bytes(buffer, start_block * nx_block_size, num_blocks * nx_block_size) / nx_block_size;
+}
@@ -15,5 +15,16 @@ void report_fopen_error(void);
 
 size_t read_blocks (void* buffer, long start_block, size_t num_blocks);
 size_t write_blocks(void* buffer, long start_block, size_t num_blocks);
+size_t pread_bytes (void* buffer, uint64_t offset, size_t num_bytes);
+size_t pread_blocks(void* buffer, uint64_t start_block, size_t num_blocks);
+
+/**
+ * Maximum number of unrequested blocks that will be read through in order to
+ * merge two reads into one. Reading a few extra blocks is far cheaper than an
+ * extra round trip on high-latency storage, or an extra seek on a hard disk.
+ */
+#define READ_BATCH_MAX_GAP_BLOCKS   16
+
+size_t read_blocks_batch(void* buffer, const uint64_t* addrs, size_t num_blocks);
 
 #endif // DRAT_IO_H
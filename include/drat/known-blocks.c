@@ -0,0 +1,303 @@
+/**
+ * Functions used to look for the blocks of known files in a container; see
+ * `known-blocks.h` for details.
+ */
+
+#include "known-blocks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <drat/io.h>    // nx_block_size
+
+/**
+ * Number of blocks of a reference file that are read at once.
+ */
+#define KNOWN_FILE_READ_BLOCKS  256
+
+known_blocks_t* create_known_blocks(void) {
+    known_blocks_t* known = calloc(1, sizeof(known_blocks_t));
+    if (!known) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `known`.\n", __func__);
+        exit(-1);
+    }
+    pthread_mutex_init(&known->lock, NULL);
+    return known;
+}
+
+/**
+ * Determine whether a block consists of a single repeated byte.
+ */
+static bool is_uniform_block(const uint8_t* block) {
+    return block[0] == block[nx_block_size - 1] && memcmp(block, block + 1, nx_block_size - 1) == 0;
+}
+
+static uint64_t hash_known_block(const void* block) {
+    xxh64_ctx_t ctx;
+    xxh64_init(&ctx, 0);
+    xxh64_update(&ctx, block, nx_block_size);
+    return xxh64_final(&ctx);
+}
+
+static void add_known_block(known_blocks_t* known, const uint8_t* block, uint32_t file_index, uint32_t block_index) {
+    if (known->num_blocks == known->blocks_capacity) {
+        known->blocks_capacity = known->blocks_capacity ? 2 * known->blocks_capacity : 1024;
+        known->blocks = realloc(known->blocks, known->blocks_capacity * sizeof(known_block_t));
+        if (!known->blocks) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `known->blocks`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    known_block_t* entry = known->blocks + known->num_blocks++;
+    entry->hash = hash_known_block(block);
+    entry->file_index = file_index;
+    entry->block_index = block_index;
+
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, block, nx_block_size);
+    sha256_final(&ctx, entry->sha256);
+}
+
+/**
+ * Read a reference file and add each of its blocks to the set of known
+ * blocks. The last block is padded with zeroes, as it would be on disk.
+ *
+ * RETURN VALUE:    `true` if the file was read, else `false`, in which case
+ *      an explanation is printed to stderr.
+ */
+bool add_known_file(known_blocks_t* known, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "\nERROR: %s: Could not open `%s`: %s.\n", __func__, path, strerror(errno));
+        return false;
+    }
+
+    char* buffer = malloc(KNOWN_FILE_READ_BLOCKS * nx_block_size);
+    char* path_copy = strdup(path);
+    known->paths = realloc(known->paths, (known->num_files + 1) * sizeof(char*));
+    known->file_blocks = realloc(known->file_blocks, (known->num_files + 1) * sizeof(uint64_t));
+    known->file_known_blocks = realloc(known->file_known_blocks, (known->num_files + 1) * sizeof(uint64_t));
+    if (!buffer || !path_copy || !known->paths || !known->file_blocks || !known->file_known_blocks) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+    uint32_t file_index = known->num_files;
+    size_t first_block = known->num_blocks;
+    uint64_t num_skipped = known->num_skipped;
+
+    uint64_t num_blocks = 0;
+    size_t num_read;
+    do {
+        num_read = fread(buffer, 1, KNOWN_FILE_READ_BLOCKS * nx_block_size, file);
+        memset(buffer + num_read, 0, KNOWN_FILE_READ_BLOCKS * nx_block_size - num_read);
+        for (size_t offset = 0; offset < num_read; offset += nx_block_size, num_blocks++) {
+            const uint8_t* block = (uint8_t*)buffer + offset;
+            if (is_uniform_block(block)) {
+                known->num_skipped++;
+            } else {
+                add_known_block(known, block, file_index, num_blocks);
+            }
+        }
+    } while (num_read == KNOWN_FILE_READ_BLOCKS * nx_block_size);
+
+    bool success = !ferror(file);
+    if (!success) {
+        fprintf(stderr, "\nERROR: %s: Could not read `%s`: %s.\n", __func__, path, strerror(errno));
+        known->num_blocks = first_block;
+        known->num_skipped = num_skipped;
+        free(path_copy);
+    } else {
+        known->paths[file_index] = path_copy;
+        known->file_blocks[file_index] = num_blocks;
+        known->file_known_blocks[file_index] = known->num_blocks - first_block;
+        known->num_files++;
+    }
+
+    free(buffer);
+    fclose(file);
+    return success;
+}
+
+/**
+ * Build the hash table of known blocks, once all reference files have been
+ * added.
+ */
+void index_known_blocks(known_blocks_t* known) {
+    known->table_capacity = 16;
+    while (known->table_capacity < 2 * known->num_blocks) {
+        known->table_capacity *= 2;
+    }
+    free(known->table);
+    known->table = calloc(known->table_capacity, sizeof(uint32_t));
+    if (!known->table) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `known->table`.\n", __func__);
+        exit(-1);
+    }
+
+    size_t mask = known->table_capacity - 1;
+    for (size_t i = 0; i < known->num_blocks; i++) {
+        size_t slot = known->blocks[i].hash & mask;
+        while (known->table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        known->table[slot] = i + 1;
+    }
+}
+
+static void add_known_block_match(known_blocks_t* known, paddr_t addr, known_block_t* entry) {
+    pthread_mutex_lock(&known->lock);
+    if (known->num_matches == known->matches_capacity) {
+        known->matches_capacity = known->matches_capacity ? 2 * known->matches_capacity : 256;
+        known->matches = realloc(known->matches, known->matches_capacity * sizeof(known_block_match_t));
+        if (!known->matches) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `known->matches`.\n", __func__);
+            exit(-1);
+        }
+    }
+    known_block_match_t* match = known->matches + known->num_matches++;
+    match->addr = addr;
+    match->file_index = entry->file_index;
+    match->block_index = entry->block_index;
+    pthread_mutex_unlock(&known->lock);
+}
+
+/**
+ * Look a block of the container up in the table of known blocks, adding a
+ * line to `results` for each block of a reference file that it matches; see
+ * `block_scan_fn`.
+ */
+void find_known_block(void* context, obj_phys_t* block, paddr_t addr, block_scan_results_t* results) {
+    known_blocks_t* known = context;
+
+    uint64_t hash = hash_known_block(block);
+    size_t mask = known->table_capacity - 1;
+    bool have_sha256 = false;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    for (size_t slot = hash & mask; known->table[slot] != 0; slot = (slot + 1) & mask) {
+        known_block_t* entry = known->blocks + known->table[slot] - 1;
+        if (entry->hash != hash) {
+            continue;
+        }
+
+        // Confirm the match with a cryptographic hash
+        if (!have_sha256) {
+            sha256_ctx_t ctx;
+            sha256_init(&ctx);
+            sha256_update(&ctx, block, nx_block_size);
+            sha256_final(&ctx, sha256);
+            have_sha256 = true;
+        }
+        if (memcmp(sha256, entry->sha256, SHA256_DIGEST_SIZE) != 0) {
+            continue;
+        }
+
+        char sha256_hex[2 * SHA256_DIGEST_SIZE + 1];
+        for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+            snprintf(sha256_hex + 2 * i, 3, "%02x", sha256[i]);
+        }
+        add_block_scan_result(
+            results, "block\t%#"PRIx64"\t%s\t%"PRIu64"\t%s\n",
+            addr, known->paths[entry->file_index], (uint64_t)entry->block_index * nx_block_size, sha256_hex
+        );
+        add_known_block_match(known, addr, entry);
+    }
+}
+
+/**
+ * Compare matches by file, then by where the file's first block would be if
+ * the file were stored contiguously, then by block index.
+ */
+static int compare_known_block_matches(const void* a, const void* b) {
+    const known_block_match_t* match_a = a;
+    const known_block_match_t* match_b = b;
+    if (match_a->file_index != match_b->file_index) {
+        return match_a->file_index < match_b->file_index ? -1 : 1;
+    }
+    paddr_t start_a = match_a->addr - match_a->block_index;
+    paddr_t start_b = match_b->addr - match_b->block_index;
+    if (start_a != start_b) {
+        return start_a < start_b ? -1 : 1;
+    }
+    if (match_a->block_index != match_b->block_index) {
+        return match_a->block_index < match_b->block_index ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Compare locations by file, then by the number of matches, most first.
+ */
+static int compare_known_file_locations(const void* a, const void* b) {
+    const known_file_location_t* location_a = a;
+    const known_file_location_t* location_b = b;
+    if (location_a->file_index != location_b->file_index) {
+        return location_a->file_index < location_b->file_index ? -1 : 1;
+    }
+    if (location_a->num_matches != location_b->num_matches) {
+        return location_a->num_matches > location_b->num_matches ? -1 : 1;
+    }
+    return location_a->first_addr < location_b->first_addr ? -1 : location_a->first_addr > location_b->first_addr;
+}
+
+/**
+ * Group the matches found by a sweep of the container into the likely
+ * locations of each reference file.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_locations` locations, sorted by file, then by the
+ *      number of matches, most first. The caller must free this array.
+ */
+known_file_location_t* get_known_file_locations(known_blocks_t* known, size_t* num_locations) {
+    qsort(known->matches, known->num_matches, sizeof(known_block_match_t), compare_known_block_matches);
+
+    known_file_location_t* locations = malloc(known->num_matches * sizeof(known_file_location_t));
+    if (known->num_matches != 0 && !locations) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `locations`.\n", __func__);
+        exit(-1);
+    }
+
+    *num_locations = 0;
+    known_file_location_t* location = NULL;
+    for (size_t i = 0; i < known->num_matches; i++) {
+        known_block_match_t* match = known->matches + i;
+        if (
+               !location
+            || match->file_index != location->file_index
+            || match->addr - match->block_index != location->first_addr - location->first_block_index
+        ) {
+            location = locations + (*num_locations)++;
+            location->file_index = match->file_index;
+            location->first_addr = match->addr;
+            location->first_block_index = match->block_index;
+            location->num_matches = 0;
+        }
+        location->last_addr = match->addr;
+        location->last_block_index = match->block_index;
+        location->num_matches++;
+    }
+
+    qsort(locations, *num_locations, sizeof(known_file_location_t), compare_known_file_locations);
+    return locations;
+}
+
+void free_known_blocks(known_blocks_t* known) {
+    if (!known) {
+        return;
+    }
+    for (size_t i = 0; i < known->num_files; i++) {
+        free(known->paths[i]);
+    }
+    free(known->paths);
+    free(known->file_blocks);
+    free(known->file_known_blocks);
+    free(known->blocks);
+    free(known->table);
+    free(known->matches);
+    pthread_mutex_destroy(&known->lock);
+    free(known);
+}
@@ -0,0 +1,123 @@
+#ifndef DRAT_KNOWN_BLOCKS_H
+#define DRAT_KNOWN_BLOCKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <apfs/general.h>   // paddr_t
+#include <apfs/object.h>    // obj_phys_t
+
+#include <drat/block-scan.h>
+#include <drat/func/digest.h>
+
+/**
+ * Lookup of the blocks of known files, for the `find-known-files` command.
+ *
+ * Each reference file is split into blocks of the container's block size, the
+ * last one padded with zeroes, and each block is hashed twice: with XXH64,
+ * which is cheap enough to compute for every block of the container, and with
+ * SHA-256, to confirm a match. The blocks are held in an open-addressing hash
+ * table keyed by their XXH64 hash, so each block of the container costs one
+ * XXH64 computation and usually a single probe; SHA-256 is only computed for
+ * blocks whose XXH64 hash is found.
+ *
+ * Blocks consisting of a single repeated byte, e.g. all zeroes, are common to
+ * many unrelated files, so they are left out of the table.
+ *
+ * Each block of the container that matches is recorded, and once the whole
+ * container has been swept, the matches are grouped into the likely locations
+ * of each file: matches of blocks of the same file that lie the same distance
+ * from where the file's first block would be, i.e. those that could belong to
+ * the same contiguous copy of the file.
+ */
+
+/**
+ * A block of a reference file.
+ *
+ * file_index:      The index of the reference file in `known_blocks_t.paths`.
+ *
+ * block_index:     The index of the block within the file.
+ */
+typedef struct {
+    uint64_t    hash;
+    uint32_t    file_index;
+    uint32_t    block_index;
+    uint8_t     sha256[SHA256_DIGEST_SIZE];
+} known_block_t;
+
+/**
+ * A block of the container that matches a block of a reference file.
+ */
+typedef struct {
+    paddr_t     addr;
+    uint32_t    file_index;
+    uint32_t    block_index;
+} known_block_match_t;
+
+/**
+ * A likely location of a reference file: a run of matches of its blocks which
+ * are consistent with the file being stored contiguously.
+ *
+ * first_addr, last_addr:   The addresses of the first and last matching
+ *      blocks.
+ *
+ * num_matches:     The number of the file's blocks that matched.
+ */
+typedef struct {
+    uint32_t    file_index;
+    paddr_t     first_addr;
+    paddr_t     last_addr;
+    uint32_t    first_block_index;
+    uint32_t    last_block_index;
+    uint64_t    num_matches;
+} known_file_location_t;
+
+/**
+ * paths, file_blocks:  The path and number of blocks of each of the
+ *      `num_files` reference files.
+ *
+ * file_known_blocks:   The number of blocks of each reference file that were
+ *      added to the table, i.e. those that can be matched.
+ *
+ * blocks:      All of the blocks of the reference files that were added to the
+ *      table, of which there are `num_blocks`.
+ *
+ * table:   A table of `table_capacity` indices into `blocks` plus one, or zero
+ *      for an empty slot; `table_capacity` is a power of two. Only built by
+ *      `index_known_blocks()`.
+ *
+ * num_skipped:     Number of blocks of the reference files that were left out
+ *      because they consist of a single repeated byte.
+ *
+ * matches:     The matches found by `find_known_block()`, in no particular
+ *      order; `lock` must be held to add to them.
+ */
+typedef struct {
+    char**              paths;
+    uint64_t*           file_blocks;
+    uint64_t*           file_known_blocks;
+    size_t              num_files;
+
+    known_block_t*      blocks;
+    size_t              num_blocks;
+    size_t              blocks_capacity;
+    uint32_t*           table;
+    size_t              table_capacity;
+    uint64_t            num_skipped;
+
+    pthread_mutex_t     lock;
+    known_block_match_t*    matches;
+    size_t              num_matches;
+    size_t              matches_capacity;
+} known_blocks_t;
+
+known_blocks_t* create_known_blocks(void);
+bool add_known_file(known_blocks_t* known, const char* path);
+void index_known_blocks(known_blocks_t* known);
+void find_known_block(void* known, obj_phys_t* block, paddr_t addr, block_scan_results_t* results);
+known_file_location_t* get_known_file_locations(known_blocks_t* known, size_t* num_locations);
+void free_known_blocks(known_blocks_t* known);
+
+#endif // DRAT_KNOWN_BLOCKS_H
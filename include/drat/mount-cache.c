@@ -0,0 +1,185 @@
+/**
+ * Functions used to store and load mount caches; see `mount-cache.h` for a
+ * description of what these are.
+ */
+
+#include "mount-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <drat/io.h>    // nx_block_size
+
+/**
+ * Create an empty mount cache for a given checkpoint of a given container.
+ *
+ * nx_uuid:     The UUID of the container.
+ *
+ * nxsb_paddr, nxsb_xid:    The address and XID of the checkpoint's container
+ *      superblock, i.e. the most recent well-formed one in the checkpoint
+ *      descriptor area.
+ *
+ * RETURN VALUE:
+ *      A pointer to the new cache. The caller must free this pointer with
+ *      `free_mount_cache()` when it is no longer needed.
+ */
+mount_cache_t* create_mount_cache(uuid_t nx_uuid, paddr_t nxsb_paddr, xid_t nxsb_xid) {
+    mount_cache_t* cache = calloc(1, sizeof(mount_cache_t));
+    if (!cache) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `cache`.\n", __func__);
+        exit(-1);
+    }
+
+    memcpy(cache->header.mch_magic, MOUNT_CACHE_MAGIC, sizeof(cache->header.mch_magic));
+    cache->header.mch_version = MOUNT_CACHE_VERSION;
+    cache->header.mch_block_size = nx_block_size;
+    memcpy(cache->header.mch_nx_uuid, nx_uuid, sizeof(uuid_t));
+    cache->header.mch_nxsb_paddr = nxsb_paddr;
+    cache->header.mch_nxsb_xid = nxsb_xid;
+
+    return cache;
+}
+
+void free_mount_cache(mount_cache_t* cache) {
+    if (cache) {
+        free(cache->xp_obj_paddrs);
+        free(cache);
+    }
+}
+
+/**
+ * Create a directory if it doesn't already exist.
+ *
+ * RETURN VALUE:    `true` if the directory exists, else `false`.
+ */
+static bool make_directory(const char* path) {
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+/**
+ * Get the directory that mount caches are stored in, per `mount-cache.h`.
+ *
+ * RETURN VALUE:
+ *      `true` if mount caches are enabled and the directory could be
+ *      determined, else `false`.
+ */
+static bool get_mount_cache_dir(char* dir, size_t dir_size) {
+    const char* env = getenv("DRAT_MOUNT_CACHE_DIR");
+    return env && *env && snprintf(dir, dir_size, "%s", env) < (int)dir_size;
+}
+
+/**
+ * Get the path of the mount cache of a given container.
+ *
+ * RETURN VALUE:
+ *      `true` if mount caches are enabled and the path fits in `path_size`
+ *      bytes, else `false`.
+ */
+bool get_mount_cache_path(uuid_t nx_uuid, char* path, size_t path_size) {
+    char dir[1024];
+    if (!get_mount_cache_dir(dir, sizeof(dir))) {
+        return false;
+    }
+
+    char uuid_string[33];
+    for (int i = 0; i < 16; i++) {
+        sprintf(uuid_string + 2*i, "%02x", nx_uuid[i]);
+    }
+
+    return snprintf(path, path_size, "%s/%s.mount", dir, uuid_string) < (int)path_size;
+}
+
+/**
+ * Read a mount cache from a file. A missing or malformed cache isn't an
+ * error, since the container can simply be mounted in full instead, so no
+ * messages are printed.
+ *
+ * RETURN VALUE:
+ *      A pointer to the cache, or a NULL pointer if the file doesn't exist or
+ *      isn't a valid mount cache. The caller must free this pointer with
+ *      `free_mount_cache()` when it is no longer needed.
+ */
+mount_cache_t* read_mount_cache(const char* path) {
+    FILE* cache_file = fopen(path, "rb");
+    if (!cache_file) {
+        return NULL;
+    }
+
+    mount_cache_t* cache = calloc(1, sizeof(mount_cache_t));
+    if (!cache) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `cache`.\n", __func__);
+        exit(-1);
+    }
+
+    if (
+           fread(&(cache->header), sizeof(mount_cache_header_t), 1, cache_file) != 1
+        || memcmp(cache->header.mch_magic, MOUNT_CACHE_MAGIC, sizeof(cache->header.mch_magic)) != 0
+        || cache->header.mch_version != MOUNT_CACHE_VERSION
+    ) {
+        goto error;
+    }
+
+    uint32_t count = cache->header.mch_xp_obj_count;
+    cache->xp_obj_paddrs = malloc(count * sizeof(paddr_t));
+    if (count != 0 && !cache->xp_obj_paddrs) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `cache->xp_obj_paddrs`.\n", __func__);
+        exit(-1);
+    }
+    if (fread(cache->xp_obj_paddrs, sizeof(paddr_t), count, cache_file) != count) {
+        goto error;
+    }
+
+    fclose(cache_file);
+    return cache;
+
+error:
+    fclose(cache_file);
+    free_mount_cache(cache);
+    return NULL;
+}
+
+/**
+ * Write a mount cache to a file, creating the cache directory if needed. The
+ * cache is written to a temporary file which then replaces `path`, so
+ * concurrent invocations never see a partially written cache.
+ *
+ * RETURN VALUE:    `true` if the cache was written, else `false`.
+ */
+bool write_mount_cache(mount_cache_t* cache, const char* path) {
+    char dir[1024];
+    if (!get_mount_cache_dir(dir, sizeof(dir))) {
+        return false;
+    }
+    if (!make_directory(dir)) {
+        return false;
+    }
+
+    char tmp_path[1100];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(tmp_path)) {
+        return false;
+    }
+
+    FILE* cache_file = fopen(tmp_path, "wb");
+    if (!cache_file) {
+        return false;
+    }
+
+    uint32_t count = cache->header.mch_xp_obj_count;
+    bool success =
+           fwrite(&(cache->header), sizeof(mount_cache_header_t), 1, cache_file) == 1
+        && fwrite(cache->xp_obj_paddrs, sizeof(paddr_t), count, cache_file) == count;
+    if (fclose(cache_file) != 0) {
+        success = false;
+    }
+
+    if (!success || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
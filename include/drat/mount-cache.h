@@ -0,0 +1,72 @@
+#ifndef DRAT_MOUNT_CACHE_H
+#define DRAT_MOUNT_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/general.h>   // paddr_t, uuid_t
+#include <apfs/object.h>    // xid_t
+#include <apfs/nx.h>        // NX_MAX_FILE_SYSTEMS
+
+/**
+ * A mount cache is a small file recording where the structures resolved while
+ * mounting a container (see `nx-session.h`) lie on disk, so that later
+ * sessions for the same container can read each structure directly instead
+ * of locating it via the checkpoint descriptor area and object maps.
+ *
+ * Each container has at most one mount cache, named after the container's
+ * UUID. It is only valid for the checkpoint whose container superblock lies
+ * at `mch_nxsb_paddr` with XID `mch_nxsb_xid`. The checkpoint descriptor area
+ * is always read to find the most recent well-formed container superblock, as
+ * block 0x0 needn't be up to date, and the cache is only used if that
+ * superblock is the one that the cache records; otherwise, it is ignored and
+ * overwritten.
+ *
+ * Mount caches are opt-in, since a forensic tool shouldn't write anywhere that
+ * it wasn't asked to: they are only used if the environment variable
+ * `DRAT_MOUNT_CACHE_DIR` names the directory to store them in.
+ *
+ * The file consists of an instance of `mount_cache_header_t`, followed by
+ * `mch_xp_obj_count` block addresses of the checkpoint's Ephemeral objects.
+ * A zero address means that the corresponding structure hasn't been resolved.
+ */
+
+#define MOUNT_CACHE_MAGIC       "DRATMNTC"
+#define MOUNT_CACHE_VERSION     2
+
+/** `mch_flags` */
+#define MOUNT_CACHE_HAS_XP_OBJ  0x00000001  // `mch_xp_obj_count` is meaningful
+
+typedef struct {
+    paddr_t     mcv_apsb_paddr;
+    paddr_t     mcv_omap_btree_paddr;
+    paddr_t     mcv_fs_root_paddr;
+} mount_cache_volume_t;
+
+typedef struct {
+    char        mch_magic[8];
+    uint32_t    mch_version;
+    uint32_t    mch_block_size;
+    uuid_t      mch_nx_uuid;
+    paddr_t     mch_nxsb_paddr;         // Address of the container superblock that was mounted
+    xid_t       mch_nxsb_xid;
+    paddr_t     mch_nx_omap_btree_paddr;
+    uint32_t    mch_flags;
+    uint32_t    mch_xp_obj_count;
+    mount_cache_volume_t    mch_volumes[NX_MAX_FILE_SYSTEMS];
+} mount_cache_header_t;
+
+typedef struct {
+    mount_cache_header_t    header;
+    paddr_t*                xp_obj_paddrs;
+} mount_cache_t;
+
+mount_cache_t* create_mount_cache(uuid_t nx_uuid, paddr_t nxsb_paddr, xid_t nxsb_xid);
+void free_mount_cache(mount_cache_t* cache);
+
+bool get_mount_cache_path(uuid_t nx_uuid, char* path, size_t path_size);
+mount_cache_t* read_mount_cache(const char* path);
+bool write_mount_cache(mount_cache_t* cache, const char* path);
+
+#endif // DRAT_MOUNT_CACHE_H
@@ -0,0 +1,213 @@
+/**
+ * Functions used to match item names against many names or patterns at once;
+ * see `name-match.h` for a description of how this is done.
+ */
+
+#include "name-match.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Fold an ASCII upper-case letter to lower case; other bytes, including those
+ * of multi-byte UTF-8 sequences, are left as they are.
+ */
+static uint8_t fold_name_byte(uint8_t byte) {
+    return (byte >= 'A' && byte <= 'Z') ? byte - 'A' + 'a' : byte;
+}
+
+/**
+ * Compute the FNV-1a hash of a name, ignoring ASCII case.
+ */
+static uint64_t hash_name(const char* name, size_t name_len) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < name_len; i++) {
+        hash ^= fold_name_byte((uint8_t)name[i]);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * Determine whether two names of the same length are equal, ignoring ASCII
+ * case.
+ */
+static bool names_equal(const char* a, const char* b, size_t name_len) {
+    for (size_t i = 0; i < name_len; i++) {
+        if (fold_name_byte((uint8_t)a[i]) != fold_name_byte((uint8_t)b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Build a set of names to be matched exactly, except for ASCII case.
+ *
+ * names:   An array of `num_names` NUL-terminated names, which must outlive
+ *      the set. Names that differ only in ASCII case are stored only once.
+ */
+void init_name_set(name_set_t* set, char** names, size_t num_names) {
+    set->capacity = 16;
+    while (set->capacity < 2 * num_names) {
+        set->capacity *= 2;
+    }
+    set->num_names = 0;
+    set->slots = calloc(set->capacity, sizeof(name_set_slot_t));
+    if (!set->slots) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `set->slots`.\n", __func__);
+        exit(-1);
+    }
+
+    for (size_t i = 0; i < num_names; i++) {
+        size_t name_len = strlen(names[i]);
+        if (name_set_contains(set, names[i], name_len)) {
+            continue;
+        }
+
+        uint64_t hash = hash_name(names[i], name_len);
+        size_t slot = hash & (set->capacity - 1);
+        while (set->slots[slot].name) {
+            slot = (slot + 1) & (set->capacity - 1);
+        }
+        set->slots[slot].name = names[i];
+        set->slots[slot].name_len = name_len;
+        set->slots[slot].hash = hash;
+        set->num_names++;
+    }
+}
+
+/**
+ * Determine whether a name is in a set, ignoring ASCII case. The name needn't
+ * be NUL-terminated.
+ */
+bool name_set_contains(const name_set_t* set, const char* name, size_t name_len) {
+    uint64_t hash = hash_name(name, name_len);
+    for (size_t slot = hash & (set->capacity - 1); set->slots[slot].name; slot = (slot + 1) & (set->capacity - 1)) {
+        const name_set_slot_t* entry = set->slots + slot;
+        if (entry->hash == hash && entry->name_len == name_len && names_equal(entry->name, name, name_len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void free_name_set(name_set_t* set) {
+    free(set->slots);
+    memset(set, 0, sizeof(name_set_t));
+}
+
+/**
+ * Build an automaton that matches names containing any of a set of patterns,
+ * ignoring ASCII case.
+ *
+ * patterns:    An array of `num_patterns` NUL-terminated patterns, none of
+ *      which may be empty.
+ */
+void init_name_automaton(name_automaton_t* automaton, char** patterns, size_t num_patterns) {
+    memset(automaton, 0, sizeof(name_automaton_t));
+
+    // Give each distinct folded byte of the patterns its own column, shared
+    // by both cases of a letter
+    size_t max_states = 1;
+    automaton->num_classes = 1;
+    for (size_t i = 0; i < num_patterns; i++) {
+        for (const uint8_t* byte = (uint8_t*)patterns[i]; *byte; byte++, max_states++) {
+            uint8_t folded = fold_name_byte(*byte);
+            if (automaton->byte_classes[folded] == 0) {
+                automaton->byte_classes[folded] = automaton->num_classes++;
+            }
+        }
+    }
+    for (uint32_t byte = 'A'; byte <= 'Z'; byte++) {
+        automaton->byte_classes[byte] = automaton->byte_classes[fold_name_byte(byte)];
+    }
+
+    uint32_t num_classes = automaton->num_classes;
+    automaton->transitions = calloc(max_states * num_classes, sizeof(uint32_t));
+    automaton->matches = calloc(max_states, sizeof(uint32_t));
+    uint32_t* failures = calloc(max_states, sizeof(uint32_t));
+    uint32_t* queue = malloc(max_states * sizeof(uint32_t));
+    if (!automaton->transitions || !automaton->matches || !failures || !queue) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `automaton->transitions`.\n", __func__);
+        exit(-1);
+    }
+
+    // Build a trie of the patterns; whilst doing so, a transition to state
+    // zero means that there is no such child
+    automaton->num_states = 1;
+    for (size_t i = 0; i < num_patterns; i++) {
+        uint32_t state = 0;
+        for (const uint8_t* byte = (uint8_t*)patterns[i]; *byte; byte++) {
+            uint32_t* next = automaton->transitions + (size_t)state * num_classes + automaton->byte_classes[*byte];
+            if (*next == 0) {
+                *next = automaton->num_states++;
+            }
+            state = *next;
+        }
+        if (automaton->matches[state] == 0) {
+            automaton->matches[state] = i + 1;
+        }
+    }
+
+    // Visit the states in breadth-first order, so that each state's failure
+    // state, which is shallower, already has all of its transitions. Missing
+    // transitions are then taken from the failure state, and each state
+    // inherits the failure state's match, if it has none of its own.
+    size_t queue_start = 0;
+    size_t queue_end = 0;
+    for (uint32_t column = 0; column < num_classes; column++) {
+        uint32_t child = automaton->transitions[column];
+        if (child != 0) {
+            queue[queue_end++] = child;
+        }
+    }
+    while (queue_start < queue_end) {
+        uint32_t state = queue[queue_start++];
+        uint32_t* row = automaton->transitions + (size_t)state * num_classes;
+        uint32_t* failure_row = automaton->transitions + (size_t)failures[state] * num_classes;
+        for (uint32_t column = 0; column < num_classes; column++) {
+            if (row[column] == 0) {
+                row[column] = failure_row[column];
+                continue;
+            }
+            uint32_t child = row[column];
+            failures[child] = failure_row[column];
+            if (automaton->matches[child] == 0) {
+                automaton->matches[child] = automaton->matches[failures[child]];
+            }
+            queue[queue_end++] = child;
+        }
+    }
+
+    free(failures);
+    free(queue);
+}
+
+/**
+ * Determine whether a name contains any of an automaton's patterns, ignoring
+ * ASCII case. The name needn't be NUL-terminated.
+ *
+ * pattern_index:   If not a NULL pointer, set to the index of the first
+ *      pattern to be found in the name.
+ */
+bool name_automaton_match(const name_automaton_t* automaton, const char* name, size_t name_len, size_t* pattern_index) {
+    uint32_t state = 0;
+    for (size_t i = 0; i < name_len; i++) {
+        state = automaton->transitions[(size_t)state * automaton->num_classes + automaton->byte_classes[(uint8_t)name[i]]];
+        if (automaton->matches[state] != 0) {
+            if (pattern_index) {
+                *pattern_index = automaton->matches[state] - 1;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void free_name_automaton(name_automaton_t* automaton) {
+    free(automaton->transitions);
+    free(automaton->matches);
+    memset(automaton, 0, sizeof(name_automaton_t));
+}
@@ -0,0 +1,69 @@
+#ifndef DRAT_NAME_MATCH_H
+#define DRAT_NAME_MATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Matching of item names against many names or patterns at once, so that a
+ * single scan can look for thousands of file names.
+ *
+ * A name set holds names that must be matched exactly, except for ASCII case,
+ * in an open-addressing hash table, so that looking a name up costs one hash
+ * and usually one comparison, regardless of how many names there are.
+ *
+ * A name automaton matches names that contain any of a set of patterns,
+ * ignoring ASCII case. The patterns are compiled with the Aho-Corasick
+ * algorithm into a deterministic automaton, so that each name is matched in a
+ * single pass over its bytes. Only bytes that occur in some pattern get a
+ * column of their own in the transition table; all other bytes share a single
+ * column, which leads back to the start state.
+ */
+
+/**
+ * A slot of a name set; `name` is a NULL pointer if the slot is empty.
+ */
+typedef struct {
+    const char* name;
+    size_t      name_len;
+    uint64_t    hash;
+} name_set_slot_t;
+
+/**
+ * slots:   A table of `capacity` slots, which is a power of two, and at most
+ *      half full. The names themselves are owned by the caller.
+ */
+typedef struct {
+    name_set_slot_t*    slots;
+    size_t              capacity;
+    size_t              num_names;
+} name_set_t;
+
+/**
+ * byte_classes:    The column of the transition table for each byte; column
+ *      zero is shared by all bytes that don't occur in any pattern.
+ *
+ * transitions:     For each state, the state that each column leads to, in
+ *      rows of `num_classes` entries. State zero is the start state.
+ *
+ * matches:     For each state, one more than the index of a pattern that has
+ *      been matched on reaching it, or zero if none has.
+ */
+typedef struct {
+    uint8_t     byte_classes[256];
+    uint32_t    num_classes;
+    uint32_t    num_states;
+    uint32_t*   transitions;
+    uint32_t*   matches;
+} name_automaton_t;
+
+void init_name_set(name_set_t* set, char** names, size_t num_names);
+bool name_set_contains(const name_set_t* set, const char* name, size_t name_len);
+void free_name_set(name_set_t* set);
+
+void init_name_automaton(name_automaton_t* automaton, char** patterns, size_t num_patterns);
+bool name_automaton_match(const name_automaton_t* automaton, const char* name, size_t name_len, size_t* pattern_index);
+void free_name_automaton(name_automaton_t* automaton);
+
+#endif // DRAT_NAME_MATCH_H
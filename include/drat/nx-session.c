@@ -0,0 +1,1040 @@
+/**
+ * Functions used to simulate a mount of an APFS container, reading each
+ * structure lazily; see `nx-session.h` for details.
+ */
+
+#include "nx-session.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+
+#include <drat/io.h>
+
+#include <drat/func/boolean.h>
+#include <drat/func/cksum.h>
+#include <drat/func/btree.h>
+
+/**
+ * Open the APFS container at a given path, read-only, and start a session
+ * for it. No structures are read from the container yet.
+ *
+ * path:    The path of the (device special) file corresponding to the APFS
+ *      container. The globals `nx_path` and `nx` are set accordingly.
+ *
+ * log:     The stream that progress messages will be written to.
+ *
+ * RETURN VALUE:
+ *      A pointer to the new session, or a NULL pointer if the container could
+ *      not be opened, in which case `errno` describes the error. The caller
+ *      must pass this pointer to `close_nx_session()` when it is no longer
+ *      needed.
+ */
+nx_session_t* open_nx_session(char* path, FILE* log) {
+    nx_path = path;
+
+    // Open (device special) file corresponding to an APFS container, read-only
+    fprintf(log, "Opening file at `%s` in read-only mode ... ", nx_path);
+    nx = fopen(nx_path, "rb");
+    if (!nx) {
+        int fopen_errno = errno;
+        fprintf(stderr, "\nABORT: ");
+        report_fopen_error();
+        errno = fopen_errno;
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    nx_session_t* session = calloc(1, sizeof(nx_session_t));
+    if (!session) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `session`.\n", __func__);
+        exit(-1);
+    }
+    session->log = log;
+    session->max_xid = ~0;
+
+    return session;
+}
+
+/**
+ * End a session, freeing every structure that was read during it, and close
+ * the container.
+ */
+void close_nx_session(nx_session_t* session) {
+    if (!session) {
+        return;
+    }
+
+    if (session->mount_cache && session->mount_cache_dirty) {
+        char path[1200];
+        if (get_mount_cache_path(session->mount_cache->header.mch_nx_uuid, path, sizeof(path))) {
+            write_mount_cache(session->mount_cache, path);
+        }
+    }
+    free_mount_cache(session->mount_cache);
+
+    for (uint32_t i = 0; i < NX_MAX_FILE_SYSTEMS; i++) {
+        free(session->volumes[i].apsb);
+        free(session->volumes[i].omap);
+        free(session->volumes[i].omap_btree);
+        free(session->volumes[i].fs_root_btree);
+    }
+    free(session->nx_omap_btree);
+    free(session->nx_omap);
+    free(session->xp_obj);
+    free(session->xp);
+    free(session->xp_desc);
+    free(session->nxsb);
+    free(session->volume_superblocks);
+    free(session->readahead);
+    free(session);
+
+    fclose(nx);
+    nx = NULL;
+}
+
+/**
+ * Allocate a single block of memory, aborting if this is not possible.
+ */
+static void* malloc_block(const char* var_name) {
+    void* block = malloc(nx_block_size);
+    if (!block) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `%s`.\n", var_name);
+        exit(-1);
+    }
+    return block;
+}
+
+/**
+ * Number of blocks read in a single request when reading a mount structure
+ * that doesn't lie within the session's read-ahead window.
+ */
+#define SESSION_READAHEAD_BLOCKS    32
+
+/**
+ * Read blocks containing a mount structure, using the session's read-ahead
+ * window. If the blocks lie within the window, no I/O is performed; otherwise,
+ * the window is moved to start at `addr` and filled in a single request.
+ *
+ * RETURN VALUE:    `true` if all `num_blocks` blocks were read, else `false`.
+ */
+static bool read_session_blocks(nx_session_t* session, void* buffer, uint64_t addr, uint32_t num_blocks) {
+    if (
+           session->readahead_len != 0
+        && addr >= session->readahead_start
+        && addr + num_blocks <= session->readahead_start + session->readahead_len
+    ) {
+        memcpy(buffer, session->readahead + (addr - session->readahead_start) * nx_block_size, num_blocks * nx_block_size);
+        return true;
+    }
+
+    if (num_blocks > SESSION_READAHEAD_BLOCKS) {
+        return read_blocks(buffer, addr, num_blocks) == num_blocks;
+    }
+
+    // Don't read speculatively beyond the end of the container
+    uint32_t window_len = SESSION_READAHEAD_BLOCKS;
+    if (session->block_count != 0 && addr < session->block_count && session->block_count - addr < window_len) {
+        window_len = session->block_count - addr;
+    }
+    if (window_len < num_blocks) {
+        window_len = num_blocks;
+    }
+
+    if (!session->readahead) {
+        session->readahead = malloc(SESSION_READAHEAD_BLOCKS * nx_block_size);
+        if (!session->readahead) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `session->readahead`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    size_t num_read = read_blocks(session->readahead, addr, window_len);
+    if (num_read == (size_t)-1 || num_read < num_blocks) {
+        session->readahead_len = 0;
+        return false;
+    }
+    session->readahead_start = addr;
+    session->readahead_len = num_read;
+
+    memcpy(buffer, session->readahead, num_blocks * nx_block_size);
+    return true;
+}
+
+/**
+ * Start using the mount cache (see `mount-cache.h`) of the session's
+ * container, or start recording a new one if there is no cache for the
+ * session's checkpoint.
+ *
+ * nxsb:    The most recent well-formed container superblock in the checkpoint
+ *      descriptor area.
+ *
+ * nxsb_paddr:  The address of `nxsb`.
+ */
+static void use_mount_cache(nx_session_t* session, nx_superblock_t* nxsb, paddr_t nxsb_paddr) {
+    char path[1200];
+    if (!get_mount_cache_path(nxsb->nx_uuid, path, sizeof(path))) {
+        return;
+    }
+
+    mount_cache_t* cache = read_mount_cache(path);
+    if (
+        cache && (
+               cache->header.mch_nxsb_paddr != nxsb_paddr
+            || cache->header.mch_nxsb_xid != nxsb->nx_o.o_xid
+            || cache->header.mch_block_size != nx_block_size
+            || memcmp(cache->header.mch_nx_uuid, nxsb->nx_uuid, sizeof(uuid_t)) != 0
+        )
+    ) {
+        // The cache describes another checkpoint
+        free_mount_cache(cache);
+        cache = NULL;
+    }
+
+    if (cache) {
+        fprintf(session->log, "Using the mount cache for this checkpoint.\n");
+    } else {
+        cache = create_mount_cache(nxsb->nx_uuid, nxsb_paddr, nxsb->nx_o.o_xid);
+        session->mount_cache_dirty = true;
+    }
+    session->mount_cache = cache;
+}
+
+/**
+ * Read an object from an address recorded in the session's mount cache, and
+ * check that it is still the object that was recorded.
+ *
+ * paddr:   The address recorded in the mount cache, or zero if none was.
+ *
+ * oid:     The OID that the object should have.
+ *
+ * description:     A description of the object, for progress messages.
+ *
+ * RETURN VALUE:
+ *      A pointer to the object, which the caller must free, or a NULL pointer
+ *      if there is no valid object at the recorded address, in which case the
+ *      object must be located as usual.
+ */
+static void* read_cached_object(nx_session_t* session, paddr_t paddr, oid_t oid, const char* description) {
+    if (!session->mount_cache || paddr == 0) {
+        return NULL;
+    }
+    FILE* log = session->log;
+
+    fprintf(log, "Reading the %s at %#"PRIx64", as recorded in the mount cache ... ", description, paddr);
+    obj_phys_t* obj = malloc_block("obj");
+    if (
+           !read_session_blocks(session, obj, paddr, 1)
+        || !is_cksum_valid(obj)
+        || obj->o_oid != oid
+        || obj->o_xid > session->nxsb->nx_o.o_xid
+    ) {
+        fprintf(log, "FAILED; locating it instead.\n");
+        free(obj);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+    return obj;
+}
+
+/**
+ * Get the most recent well-formed container superblock in the checkpoint
+ * descriptor area whose XID doesn't exceed `session->max_xid`. Reading this
+ * entails reading block 0x0 (and adopting the block size that it states) and
+ * the whole checkpoint descriptor area.
+ *
+ * RETURN VALUE:
+ *      A pointer to the container superblock, which is owned by the session,
+ *      or a NULL pointer if no suitable container superblock exists.
+ */
+nx_superblock_t* get_session_nx_superblock(nx_session_t* session) {
+    if (session->nxsb) {
+        return session->nxsb;
+    }
+    FILE* log = session->log;
+
+    fprintf(log, "Simulating a mount of the APFS container.\n");
+
+    // Using `nx_superblock_t*`, but allocating a whole block of memory.
+    // This way, we can read the entire block and validate its checksum,
+    // but still have direct access to the fields in `nx_superblock_t`
+    // without needing to explicitly cast to that datatype.
+    fprintf(log, "Reading container superblock at address 0x0 ... ");
+    nx_superblock_t* nxsb = malloc_block("nxsb");
+    if (!read_session_blocks(session, nxsb, 0x0, 1)) {
+        fprintf(stderr, "\nABORT: Failed to successfully read block 0x0.\n");
+        free(nxsb);
+        return NULL;
+    }
+
+    if (is_nx_superblock(nxsb) && nxsb->nx_magic == NX_MAGIC && nx_block_size != nxsb->nx_block_size) {
+        nx_block_size = nxsb->nx_block_size;
+        fprintf(log, "actual block size stated in container superblock is %"PRIu32" bytes; re-reading block 0x0 using new block size ... ", nx_block_size);
+        free(nxsb);
+        nxsb = malloc_block("nxsb");
+
+        // The read-ahead window was filled using the old block size
+        free(session->readahead);
+        session->readahead = NULL;
+        session->readahead_len = 0;
+
+        if (!read_session_blocks(session, nxsb, 0x0, 1)) {
+            fprintf(stderr, "\nABORT: Failed to successfully read block 0x0.\n");
+            free(nxsb);
+            return NULL;
+        }
+    }
+
+    fprintf(log, "validating checksum ... ");
+    if (is_cksum_valid(nxsb)) {
+        fprintf(log, "OK.\n");
+    } else {
+        fprintf(log, "FAILED.\n!! APFS ERROR !! Checksum of block 0x0 should validate, but it doesn't. Proceeding as if it does.\n");
+    }
+
+    session->block_count = nxsb->nx_block_count;
+
+    if (!is_nx_superblock(nxsb)) {
+        fprintf(log, "!! APFS ERROR !! Block 0x0 should be a container superblock, but it isn't. Proceeding as if it is.\n");
+    }
+    if (nxsb->nx_magic != NX_MAGIC) {
+        fprintf(log, "!! APFS ERROR !! Container superblock at 0x0 doesn't have the correct magic number. Proceeding as if it does.\n");
+    }
+
+    fprintf(log, "Locating the checkpoint descriptor area:\n");
+
+    uint32_t xp_desc_blocks = nxsb->nx_xp_desc_blocks & ~(1 << 31);
+    fprintf(log, "- Its length is %"PRIu32" blocks.\n", xp_desc_blocks);
+
+    if (nxsb->nx_xp_desc_blocks >> 31) {
+        fprintf(log, "- It is not contiguous.\n");
+        fprintf(log, "- The Physical OID of the B-tree representing it is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
+        fprintf(log, "END: The ability to handle this case has not yet been implemented.\n\n");   // TODO: implement case when xp_desc area is not contiguous
+        free(nxsb);
+        return NULL;
+    }
+    fprintf(log, "- It is contiguous.\n");
+    fprintf(log, "- The address of its first block is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
+
+    char (*xp_desc)[nx_block_size] = malloc(xp_desc_blocks * nx_block_size);
+    if (!xp_desc) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for %"PRIu32" blocks.\n", xp_desc_blocks);
+        exit(-1);
+    }
+
+    fprintf(log, "Loading the checkpoint descriptor area into memory ... ");
+    if (!read_session_blocks(session, xp_desc, nxsb->nx_xp_desc_base, xp_desc_blocks)) {
+        fprintf(stderr, "\nABORT: Failed to read all blocks in the checkpoint descriptor area.\n");
+        free(xp_desc);
+        free(nxsb);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Locating the most recent well-formed container superblock in the checkpoint descriptor area:\n");
+
+    uint32_t i_latest_nx = 0;
+    xid_t xid_latest_nx = 0;
+
+    for (uint32_t i = 0; i < xp_desc_blocks; i++) {
+        if (!is_cksum_valid(xp_desc[i])) {
+            fprintf(log, "- Block at index %"PRIu32" within this area failed checksum validation. Skipping it.\n", i);
+            continue;
+        }
+
+        if (is_nx_superblock(xp_desc[i])) {
+            if ( ((nx_superblock_t*)xp_desc[i])->nx_magic  !=  NX_MAGIC ) {
+                fprintf(log, "- Container superblock at index %"PRIu32" within this area is malformed; incorrect magic number. Skipping it.\n", i);
+                continue;
+            }
+
+            if (
+                    ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  >  xid_latest_nx )
+                    && ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  <= session->max_xid  )
+            ) {
+                i_latest_nx = i;
+                xid_latest_nx = ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid;
+            }
+        } else if (!is_checkpoint_map_phys(xp_desc[i])) {
+            fprintf(log, "- Block at index %"PRIu32" within this area is not a container superblock or checkpoint map. Skipping it.\n", i);
+            continue;
+        }
+    }
+
+    if (xid_latest_nx == 0) {
+        fprintf(log, "No container superblock with an XID that doesn't exceed %#"PRIx64" exists in the checkpoint descriptor area.\n", session->max_xid);
+        free(xp_desc);
+        free(nxsb);
+        return NULL;
+    }
+
+    // Don't need a copy of the block 0x0 NXSB anymore; replace that data with
+    // the latest NXSB.
+    memcpy(nxsb, xp_desc[i_latest_nx], nx_block_size);
+
+    fprintf(log, "- It lies at index %"PRIu32" within the checkpoint descriptor area.\n", i_latest_nx);
+    fprintf(
+        log,
+        "- The corresponding checkpoint starts at index %"PRIu32" within"
+        " the checkpoint descriptor area, and spans %"PRIu32" blocks.\n\n",
+        nxsb->nx_xp_desc_index,
+        nxsb->nx_xp_desc_len
+    );
+
+    // The mount cache is keyed on this superblock rather than that at block
+    // 0x0, which needn't be up to date
+    if (session->max_xid == (xid_t)~0ULL) {
+        use_mount_cache(session, nxsb, nxsb->nx_xp_desc_base + i_latest_nx);
+    }
+
+    // We retain our copy of the checkpoint descriptor area, since the
+    // checkpoint itself is contained within it.
+    session->xp_desc_blocks = xp_desc_blocks;
+    session->xp_desc = xp_desc;
+    session->nxsb = nxsb;
+    return nxsb;
+}
+
+/**
+ * Get the blocks comprising the checkpoint that the session's container
+ * superblock belongs to, in order.
+ *
+ * num_blocks:  Set to the number of blocks in the checkpoint.
+ *
+ * RETURN VALUE:
+ *      A pointer to `*num_blocks` contiguous blocks, owned by the session, or
+ *      a NULL pointer if the container superblock couldn't be obtained.
+ */
+char* get_session_checkpoint(nx_session_t* session, uint32_t* num_blocks) {
+    if (session->xp) {
+        *num_blocks = session->xp_len;
+        return session->xp;
+    }
+
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        return NULL;
+    }
+
+    // Copy the contents of the checkpoint we are currently considering to its
+    // own array for easy access. The checkpoint descriptor area is a ring
+    // buffer stored as an array, so doing this also allows us to handle the
+    // case where the checkpoint we're considering wraps around the ring buffer.
+    fprintf(session->log, "Loading the corresponding checkpoint ... ");
+
+    // The array `xp` will comprise the blocks in the checkpoint, in order.
+    char (*xp)[nx_block_size] = malloc(nxsb->nx_xp_desc_len * nx_block_size);
+    if (!xp) {
+        fprintf(stderr, "\nABORT: Couldn't allocate sufficient memory.\n");
+        exit(-1);
+    }
+
+    char (*xp_desc)[nx_block_size] = session->xp_desc;
+    if (nxsb->nx_xp_desc_index + nxsb->nx_xp_desc_len <= session->xp_desc_blocks) {
+        // The simple case: the checkpoint is already contiguous in `xp_desc`.
+        memcpy(xp, xp_desc[nxsb->nx_xp_desc_index], nxsb->nx_xp_desc_len * nx_block_size);
+    } else {
+        // The case where the checkpoint wraps around from the end of the
+        // checkpoint descriptor area to the start.
+        uint32_t segment_1_len = session->xp_desc_blocks - nxsb->nx_xp_desc_index;
+        uint32_t segment_2_len = nxsb->nx_xp_desc_len - segment_1_len;
+        memcpy(xp,                 xp_desc + nxsb->nx_xp_desc_index, segment_1_len * nx_block_size);
+        memcpy(xp + segment_1_len, xp_desc,                          segment_2_len * nx_block_size);
+    }
+    fprintf(session->log, "OK.\n");
+
+    session->xp_len = nxsb->nx_xp_desc_len;
+    session->xp = xp;
+
+    *num_blocks = session->xp_len;
+    return session->xp;
+}
+
+/**
+ * Get the Ephemeral objects used by the session's checkpoint, i.e. the
+ * objects that the checkpoint's checkpoint-mappings refer to, in order. Each
+ * object is validated.
+ *
+ * num_objects: Set to the number of Ephemeral objects.
+ *
+ * RETURN VALUE:
+ *      A pointer to `*num_objects` contiguous blocks, owned by the session, or
+ *      a NULL pointer if they couldn't be read or any of them is malformed.
+ */
+char* get_session_ephemeral_objects(nx_session_t* session, uint32_t* num_objects) {
+    if (session->xp_obj) {
+        *num_objects = session->xp_obj_len;
+        return session->xp_obj;
+    }
+    FILE* log = session->log;
+
+    if (!get_session_nx_superblock(session)) {
+        return NULL;
+    }
+    mount_cache_t* cache = session->mount_cache;
+    bool use_cache = cache && (cache->header.mch_flags & MOUNT_CACHE_HAS_XP_OBJ);
+
+    uint32_t xp_obj_len = 0;    // This variable will equal the number of
+    // checkpoint-mappings = no. of Ephemeral objects used by this checkpoint.
+    uint64_t* xp_obj_addrs = NULL;
+
+    if (use_cache) {
+        xp_obj_len = cache->header.mch_xp_obj_count;
+        fprintf(log, "- There are %"PRIu32" checkpoint-mappings in this checkpoint, as recorded in the mount cache.\n", xp_obj_len);
+
+        xp_obj_addrs = malloc(xp_obj_len * sizeof(uint64_t));
+        if (xp_obj_len != 0 && !xp_obj_addrs) {
+            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `xp_obj_addrs`.\n");
+            exit(-1);
+        }
+        memcpy(xp_obj_addrs, cache->xp_obj_paddrs, xp_obj_len * sizeof(uint64_t));
+    } else {
+        uint32_t xp_len = 0;
+        char (*xp)[nx_block_size] = get_session_checkpoint(session, &xp_len);
+        if (!xp) {
+            return NULL;
+        }
+
+        for (uint32_t i = 0; i < xp_len; i++) {
+            if (is_checkpoint_map_phys(xp[i])) {
+                xp_obj_len += ((checkpoint_map_phys_t*)xp[i])->cpm_count;
+            }
+        }
+        fprintf(log, "- There are %"PRIu32" checkpoint-mappings in this checkpoint.\n", xp_obj_len);
+
+        xp_obj_addrs = malloc(xp_obj_len * sizeof(uint64_t));
+        if (xp_obj_len != 0 && !xp_obj_addrs) {
+            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `xp_obj_addrs`.\n");
+            exit(-1);
+        }
+        uint32_t num_addrs = 0;
+        for (uint32_t i = 0; i < xp_len; i++) {
+            if (is_checkpoint_map_phys(xp[i])) {
+                checkpoint_map_phys_t* xp_map = xp[i];  // Avoid lots of casting
+                for (uint32_t j = 0; j < xp_map->cpm_count; j++) {
+                    xp_obj_addrs[num_addrs] = xp_map->cpm_map[j].cpm_paddr;
+                    num_addrs++;
+                }
+            }
+        }
+    }
+
+    fprintf(log, "Reading the Ephemeral objects used by this checkpoint ... ");
+    char (*xp_obj)[nx_block_size] = malloc(xp_obj_len * nx_block_size);
+    if (xp_obj_len != 0 && !xp_obj) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `xp_obj`.\n");
+        exit(-1);
+    }
+    // Read all of the Ephemeral objects in a single batch
+    bool read_success = read_blocks_batch(xp_obj, xp_obj_addrs, xp_obj_len) == xp_obj_len;
+    if (read_success) {
+        fprintf(log, "OK.\n");
+        fprintf(log, "Validating the Ephemeral objects ... ");
+    }
+
+    for (uint32_t i = 0; read_success && i < xp_obj_len; i++) {
+        if (!is_cksum_valid(xp_obj[i])) {
+            read_success = false;
+        }
+    }
+
+    if (!read_success) {
+        free(xp_obj_addrs);
+        free(xp_obj);
+
+        if (use_cache) {
+            fprintf(log, "FAILED; locating them instead.\n");
+            cache->header.mch_flags &= ~MOUNT_CACHE_HAS_XP_OBJ;
+            return get_session_ephemeral_objects(session, num_objects);
+        }
+
+        fprintf(log, "FAILED.\n");
+        fprintf(log, "An Ephemeral object used by this checkpoint is malformed or couldn't be read. Going back to look at the previous checkpoint instead.\n");
+
+        // TODO: Handle case where data for a given checkpoint is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    if (cache && !use_cache) {
+        free(cache->xp_obj_paddrs);
+        cache->xp_obj_paddrs = (paddr_t*)xp_obj_addrs;
+        cache->header.mch_xp_obj_count = xp_obj_len;
+        cache->header.mch_flags |= MOUNT_CACHE_HAS_XP_OBJ;
+        session->mount_cache_dirty = true;
+    } else {
+        free(xp_obj_addrs);
+    }
+
+    session->xp_obj_len = xp_obj_len;
+    session->xp_obj = xp_obj;
+
+    *num_objects = session->xp_obj_len;
+    return session->xp_obj;
+}
+
+/**
+ * Get the container object map.
+ *
+ * RETURN VALUE:
+ *      A pointer to the container object map, owned by the session, or a NULL
+ *      pointer if it couldn't be read or is malformed.
+ */
+omap_phys_t* get_session_nx_omap(nx_session_t* session) {
+    if (session->nx_omap) {
+        return session->nx_omap;
+    }
+    FILE* log = session->log;
+
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        return NULL;
+    }
+
+    fprintf(log, "The container superblock states that the container object map has Physical OID %#"PRIx64".\n", nxsb->nx_omap_oid);
+
+    fprintf(log, "Loading the container object map ... ");
+    omap_phys_t* nx_omap = malloc_block("nx_omap");
+    if (!read_session_blocks(session, nx_omap, nxsb->nx_omap_oid, 1)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", nxsb->nx_omap_oid);
+        free(nx_omap);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Validating the container object map ... ");
+    if (!is_cksum_valid(nx_omap)) {
+        fprintf(log, "FAILED.\n");
+        fprintf(log, "This container object map is malformed. Going back to look at the previous checkpoint instead.\n");
+
+        // TODO: Handle case where a given container object map is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        free(nx_omap);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    session->nx_omap = nx_omap;
+    return nx_omap;
+}
+
+/**
+ * Get the root node of the container object map B-tree.
+ *
+ * RETURN VALUE:
+ *      A pointer to the root node, owned by the session, or a NULL pointer if
+ *      it couldn't be located or read.
+ */
+btree_node_phys_t* get_session_nx_omap_btree(nx_session_t* session) {
+    if (session->nx_omap_btree) {
+        return session->nx_omap_btree;
+    }
+    FILE* log = session->log;
+
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        return NULL;
+    }
+
+    if (session->mount_cache) {
+        paddr_t paddr = session->mount_cache->header.mch_nx_omap_btree_paddr;
+        btree_node_phys_t* cached = read_cached_object(session, paddr, paddr, "root node of the container object map B-tree");
+        if (cached) {
+            session->nx_omap_btree = cached;
+            return cached;
+        }
+    }
+
+    omap_phys_t* nx_omap = get_session_nx_omap(session);
+    if (!nx_omap) {
+        return NULL;
+    }
+
+    if ((nx_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
+        fprintf(log, "END: The container object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
+        return NULL;
+    }
+
+    fprintf(log, "Reading the root node of the container object map B-tree ... ");
+    btree_node_phys_t* nx_omap_btree = malloc_block("nx_omap_btree");
+    if (!read_session_blocks(session, nx_omap_btree, nx_omap->om_tree_oid, 1)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", nx_omap->om_tree_oid);
+        free(nx_omap_btree);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Validating the root node of the container object map B-tree ... ");
+    if (!is_cksum_valid(nx_omap_btree)) {
+        fprintf(log, "FAILED.\n");
+    } else {
+        fprintf(log, "OK.\n");
+    }
+
+    if (session->mount_cache) {
+        session->mount_cache->header.mch_nx_omap_btree_paddr = nx_omap->om_tree_oid;
+        session->mount_cache_dirty = true;
+    }
+
+    session->nx_omap_btree = nx_omap_btree;
+    return nx_omap_btree;
+}
+
+/**
+ * Get the number of volumes that the session's container superblock lists.
+ *
+ * RETURN VALUE:
+ *      The number of volumes, or zero if the container superblock couldn't be
+ *      obtained.
+ */
+uint32_t get_session_num_volumes(nx_session_t* session) {
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        return 0;
+    }
+
+    if (session->num_volumes == 0) {
+        for (uint32_t i = 0; i < NX_MAX_FILE_SYSTEMS; i++) {
+            if (nxsb->nx_fs_oid[i] == 0) {
+                break;
+            }
+            session->num_volumes++;
+        }
+    }
+    return session->num_volumes;
+}
+
+/**
+ * Read the superblocks of all volumes in the container in a single batch and
+ * store them in `session->volume_superblocks`, so that the volumes of a
+ * container with many volumes can be inspected without a round trip per
+ * volume. Volumes whose Virtual OID can't be resolved are left zeroed.
+ *
+ * RETURN VALUE:    `true` if all the superblocks were read, else `false`.
+ */
+static bool read_session_volume_superblocks(nx_session_t* session) {
+    nx_superblock_t* nxsb = session->nxsb;
+    btree_node_phys_t* nx_omap_btree = session->nx_omap_btree;
+    uint32_t num_volumes = session->num_volumes;
+
+    session->volume_superblocks = calloc(num_volumes, nx_block_size);
+    uint64_t* addrs = malloc(num_volumes * sizeof(uint64_t));
+    uint64_t* indices = malloc(num_volumes * sizeof(uint64_t));
+    if (!session->volume_superblocks || !addrs || !indices) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for the volume superblocks.\n", __func__);
+        exit(-1);
+    }
+
+    uint32_t num_addrs = 0;
+    for (uint32_t i = 0; i < num_volumes; i++) {
+        omap_entry_t* fs_entry = get_btree_phys_omap_entry(nx_omap_btree, nxsb->nx_fs_oid[i], nxsb->nx_o.o_xid);
+        if (fs_entry) {
+            addrs[num_addrs] = fs_entry->val.ov_paddr;
+            indices[num_addrs] = i;
+            if (session->mount_cache) {
+                session->mount_cache->header.mch_volumes[i].mcv_apsb_paddr = fs_entry->val.ov_paddr;
+                session->mount_cache_dirty = true;
+            }
+            num_addrs++;
+            free(fs_entry);
+        }
+    }
+
+    char* blocks = malloc(num_addrs * nx_block_size);
+    if (num_addrs != 0 && !blocks) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `blocks`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success = read_blocks_batch(blocks, addrs, num_addrs) == num_addrs;
+    if (success) {
+        for (uint32_t i = 0; i < num_addrs; i++) {
+            memcpy(session->volume_superblocks + indices[i] * nx_block_size, blocks + i * nx_block_size, nx_block_size);
+        }
+    } else {
+        free(session->volume_superblocks);
+        session->volume_superblocks = NULL;
+    }
+
+    free(blocks);
+    free(indices);
+    free(addrs);
+    return success;
+}
+
+/**
+ * Get the superblock of a given volume.
+ *
+ * volume_id:   The index of the volume within the container superblock's list
+ *      of volumes.
+ *
+ * RETURN VALUE:
+ *      A pointer to the volume superblock, owned by the session, or a NULL
+ *      pointer if the volume doesn't exist, or its superblock couldn't be read
+ *      or is malformed.
+ */
+apfs_superblock_t* get_session_volume_superblock(nx_session_t* session, uint32_t volume_id) {
+    if (volume_id < NX_MAX_FILE_SYSTEMS && session->volumes[volume_id].apsb) {
+        return session->volumes[volume_id].apsb;
+    }
+    FILE* log = session->log;
+
+    uint32_t num_volumes = get_session_num_volumes(session);
+    if (volume_id >= num_volumes) {
+        fprintf(log, "The specified volume ID (%"PRIu32") does not exist; the container has %"PRIu32" volumes.\n", volume_id, num_volumes);
+        return NULL;
+    }
+
+    if (session->mount_cache) {
+        apfs_superblock_t* cached = read_cached_object(
+            session,
+            session->mount_cache->header.mch_volumes[volume_id].mcv_apsb_paddr,
+            session->nxsb->nx_fs_oid[volume_id],
+            "volume superblock"
+        );
+        if (cached && cached->apfs_magic == APFS_MAGIC) {
+            session->volumes[volume_id].apsb = cached;
+            return cached;
+        }
+        free(cached);
+    }
+
+    btree_node_phys_t* nx_omap_btree = get_session_nx_omap_btree(session);
+    if (!nx_omap_btree) {
+        return NULL;
+    }
+
+    nx_superblock_t* nxsb = session->nxsb;
+    oid_t fs_oid = nxsb->nx_fs_oid[volume_id];
+
+    fprintf(log, "Reading the superblock of volume %"PRIu32", which has Virtual OID %#"PRIx64" ... ", volume_id, fs_oid);
+    omap_entry_t* fs_entry = get_btree_phys_omap_entry(nx_omap_btree, fs_oid, nxsb->nx_o.o_xid);
+    if (!fs_entry) {
+        fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `nx_omap_btree`.\n", fs_oid, nxsb->nx_o.o_xid);
+        return NULL;
+    }
+
+    if (!session->volume_superblocks && !read_session_volume_superblocks(session)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_entry->val.ov_paddr);
+        free(fs_entry);
+        return NULL;
+    }
+    free(fs_entry);
+
+    apfs_superblock_t* apsb = malloc_block("apsb");
+    memcpy(apsb, session->volume_superblocks + volume_id * nx_block_size, nx_block_size);
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Validating the superblock of volume %"PRIu32" ... ", volume_id);
+    if (!is_cksum_valid(apsb)) {
+        fprintf(
+            log,
+            "FAILED.\n- The checksum of the APFS volume with OID %#"PRIx64" did not validate."
+            "\n- Going back to look at the previous checkpoint instead.\n",
+            fs_oid
+        );
+
+        // TODO: Handle case where data for a given checkpoint is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        free(apsb);
+        return NULL;
+    }
+    if (apsb->apfs_magic != APFS_MAGIC) {
+        fprintf(
+            log,
+            "FAILED.\n- The magic string of the APFS volume with OID %#"PRIx64" did not validate."
+            "\n- Going back to look at the previous checkpoint instead.\n",
+            fs_oid
+        );
+
+        // TODO: Handle case where data for a given checkpoint is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        free(apsb);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    session->volumes[volume_id].apsb = apsb;
+    return apsb;
+}
+
+/**
+ * Get the object map of a given volume.
+ *
+ * RETURN VALUE:
+ *      A pointer to the volume object map, owned by the session, or a NULL
+ *      pointer if it couldn't be read or is malformed.
+ */
+omap_phys_t* get_session_volume_omap(nx_session_t* session, uint32_t volume_id) {
+    if (volume_id < NX_MAX_FILE_SYSTEMS && session->volumes[volume_id].omap) {
+        return session->volumes[volume_id].omap;
+    }
+    FILE* log = session->log;
+
+    apfs_superblock_t* apsb = get_session_volume_superblock(session, volume_id);
+    if (!apsb) {
+        return NULL;
+    }
+
+    fprintf(log, "The volume object map has Physical OID %#"PRIx64".\n", apsb->apfs_omap_oid);
+
+    fprintf(log, "Reading the volume object map ... ");
+    omap_phys_t* fs_omap = malloc_block("fs_omap");
+    if (!read_session_blocks(session, fs_omap, apsb->apfs_omap_oid, 1)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", apsb->apfs_omap_oid);
+        free(fs_omap);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Validating the volume object map ... ");
+    if (!is_cksum_valid(fs_omap)) {
+        fprintf(log, "FAILED.\n- The checksum did not validate.\n- Going back to look at the previous checkpoint instead.\n");
+
+        // TODO: Handle case where data for a given checkpoint is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        free(fs_omap);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    session->volumes[volume_id].omap = fs_omap;
+    return fs_omap;
+}
+
+/**
+ * Get the root node of the object map B-tree of a given volume.
+ *
+ * RETURN VALUE:
+ *      A pointer to the root node, owned by the session, or a NULL pointer if
+ *      it couldn't be located or read.
+ */
+btree_node_phys_t* get_session_volume_omap_btree(nx_session_t* session, uint32_t volume_id) {
+    if (volume_id < NX_MAX_FILE_SYSTEMS && session->volumes[volume_id].omap_btree) {
+        return session->volumes[volume_id].omap_btree;
+    }
+    FILE* log = session->log;
+
+    if (!get_session_volume_superblock(session, volume_id)) {
+        return NULL;
+    }
+
+    if (session->mount_cache) {
+        paddr_t paddr = session->mount_cache->header.mch_volumes[volume_id].mcv_omap_btree_paddr;
+        btree_node_phys_t* cached = read_cached_object(session, paddr, paddr, "root node of the volume object map B-tree");
+        if (cached) {
+            session->volumes[volume_id].omap_btree = cached;
+            return cached;
+        }
+    }
+
+    omap_phys_t* fs_omap = get_session_volume_omap(session, volume_id);
+    if (!fs_omap) {
+        return NULL;
+    }
+
+    if ((fs_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
+        fprintf(log, "END: The volume object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
+        return NULL;
+    }
+
+    fprintf(log, "Reading the root node of the volume object map B-tree ... ");
+    btree_node_phys_t* fs_omap_btree = malloc_block("fs_omap_btree");
+    if (!read_session_blocks(session, fs_omap_btree, fs_omap->om_tree_oid, 1)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_omap->om_tree_oid);
+        free(fs_omap_btree);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    fprintf(log, "Validating the root node of the volume object map B-tree ... ");
+    if (!is_cksum_valid(fs_omap_btree)) {
+        fprintf(log, "FAILED.\n");
+    } else {
+        fprintf(log, "OK.\n");
+    }
+
+    if (session->mount_cache) {
+        session->mount_cache->header.mch_volumes[volume_id].mcv_omap_btree_paddr = fs_omap->om_tree_oid;
+        session->mount_cache_dirty = true;
+    }
+
+    session->volumes[volume_id].omap_btree = fs_omap_btree;
+    return fs_omap_btree;
+}
+
+/**
+ * Get the root node of the file-system records B-tree of a given volume.
+ *
+ * RETURN VALUE:
+ *      A pointer to the root node, owned by the session, or a NULL pointer if
+ *      it couldn't be located or read, or is malformed.
+ */
+btree_node_phys_t* get_session_volume_fs_root_btree(nx_session_t* session, uint32_t volume_id) {
+    if (volume_id < NX_MAX_FILE_SYSTEMS && session->volumes[volume_id].fs_root_btree) {
+        return session->volumes[volume_id].fs_root_btree;
+    }
+    FILE* log = session->log;
+
+    apfs_superblock_t* apsb = get_session_volume_superblock(session, volume_id);
+    if (!apsb) {
+        return NULL;
+    }
+
+    if (session->mount_cache) {
+        btree_node_phys_t* cached = read_cached_object(
+            session,
+            session->mount_cache->header.mch_volumes[volume_id].mcv_fs_root_paddr,
+            apsb->apfs_root_tree_oid,
+            "file-system tree root node"
+        );
+        if (cached) {
+            session->volumes[volume_id].fs_root_btree = cached;
+            return cached;
+        }
+    }
+
+    btree_node_phys_t* fs_omap_btree = get_session_volume_omap_btree(session, volume_id);
+    if (!fs_omap_btree) {
+        return NULL;
+    }
+
+    fprintf(log, "The file-system tree root for this volume has Virtual OID %#"PRIx64".\n", apsb->apfs_root_tree_oid);
+    fprintf(log, "Looking up this Virtual OID in the volume object map ... ");
+    omap_entry_t* fs_root_entry = get_btree_phys_omap_entry(fs_omap_btree, apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
+    if (!fs_root_entry) {
+        fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `fs_omap_btree`.\n", apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
+        return NULL;
+    }
+    fprintf(log, "corresponding block address is %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
+
+    fprintf(log, "Reading ... ");
+    btree_node_phys_t* fs_root_btree = malloc_block("fs_root_btree");
+    if (!read_session_blocks(session, fs_root_btree, fs_root_entry->val.ov_paddr, 1)) {
+        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
+        free(fs_root_entry);
+        free(fs_root_btree);
+        return NULL;
+    }
+    if (session->mount_cache) {
+        session->mount_cache->header.mch_volumes[volume_id].mcv_fs_root_paddr = fs_root_entry->val.ov_paddr;
+        session->mount_cache_dirty = true;
+    }
+    free(fs_root_entry);  // No longer need the block address of the file-system root.
+
+    fprintf(log, "validating ... ");
+    if (!is_cksum_valid(fs_root_btree)) {
+        fprintf(log, "FAILED.\nGoing back to look at the previous checkpoint instead.\n");
+
+        // TODO: Handle case where data for a given checkpoint is malformed
+        fprintf(log, "END: Handling of this case has not yet been implemented.\n");
+        free(fs_root_btree);
+        return NULL;
+    }
+    fprintf(log, "OK.\n");
+
+    session->volumes[volume_id].fs_root_btree = fs_root_btree;
+    return fs_root_btree;
+}
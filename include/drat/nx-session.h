@@ -0,0 +1,112 @@
+#ifndef DRAT_NX_SESSION_H
+#define DRAT_NX_SESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+#include <apfs/omap.h>
+#include <apfs/fs.h>
+#include <apfs/btree.h>
+
+#include <drat/mount-cache.h>
+
+/**
+ * A session represents a (simulated) mount of an APFS container. Rather than
+ * reading every structure involved in a mount up front, each structure is
+ * read and validated the first time it is requested via one of the
+ * `get_session_*()` functions, and is then kept for the rest of the session.
+ * Commands thus only read the structures that they actually need; e.g.
+ * recovering a file from one volume doesn't require the checkpoint's
+ * Ephemeral objects or any other volume's superblock to be read.
+ *
+ * Progress messages are written to `log` in the same style that commands
+ * use, i.e. "Reading ... OK.", so that a command's output is the same
+ * regardless of which command first caused a structure to be read.
+ */
+
+/**
+ * Structures pertaining to a single volume in a session. Each pointer is NULL
+ * until the corresponding structure has been read.
+ */
+typedef struct {
+    apfs_superblock_t*  apsb;
+    omap_phys_t*        omap;
+    btree_node_phys_t*  omap_btree;
+    btree_node_phys_t*  fs_root_btree;
+} nx_session_volume_t;
+
+/**
+ * log:     The stream that progress messages are written to. Commands that
+ *      write recovered data to stdout should use stderr.
+ *
+ * max_xid: The highest XID to consider when choosing which checkpoint to
+ *      mount; defaults to `~0`, i.e. the latest checkpoint. Can be changed
+ *      before the container superblock is first requested.
+ *
+ * readahead:   A window of `readahead_len` blocks starting at block address
+ *      `readahead_start`. Mount structures tend to lie close together, so when
+ *      one is read, the blocks following it are read in the same request, and
+ *      later reads of mount structures that lie within the window don't need
+ *      any I/O. This greatly reduces the number of round trips needed to mount
+ *      a container on high-latency storage.
+ *
+ * volume_superblocks:  The (unvalidated) superblocks of all volumes, which
+ *      are read together in one batch the first time any one is requested.
+ *
+ * mount_cache:   Where the structures of this checkpoint lie on disk, as
+ *      recorded by an earlier session (see `mount-cache.h`), or NULL if mount
+ *      caches are disabled or `max_xid` was changed. Addresses in the cache
+ *      are used in place of resolving structures via the checkpoint-mappings
+ *      and object maps, and each structure read from a cached
+ *      address is still validated, falling back to resolving it if needed.
+ *      If `mount_cache_dirty` is set, the cache is written back when the
+ *      session is closed.
+ *
+ * All other fields are NULL (or zero) until the corresponding structure has
+ * been read, and should be accessed via the `get_session_*()` functions.
+ */
+typedef struct {
+    FILE*               log;
+    xid_t               max_xid;
+
+    uint64_t            block_count;
+    uint64_t            readahead_start;
+    uint32_t            readahead_len;
+    char*               readahead;
+    char*               volume_superblocks;
+
+    mount_cache_t*      mount_cache;
+    bool                mount_cache_dirty;
+
+    nx_superblock_t*    nxsb;
+    uint32_t            xp_desc_blocks;
+    char*               xp_desc;
+    uint32_t            xp_len;
+    char*               xp;
+    uint32_t            xp_obj_len;
+    char*               xp_obj;
+    omap_phys_t*        nx_omap;
+    btree_node_phys_t*  nx_omap_btree;
+    uint32_t            num_volumes;
+    nx_session_volume_t volumes[NX_MAX_FILE_SYSTEMS];
+} nx_session_t;
+
+nx_session_t* open_nx_session(char* path, FILE* log);
+void close_nx_session(nx_session_t* session);
+
+nx_superblock_t*    get_session_nx_superblock       (nx_session_t* session);
+char*               get_session_checkpoint          (nx_session_t* session, uint32_t* num_blocks);
+char*               get_session_ephemeral_objects   (nx_session_t* session, uint32_t* num_objects);
+omap_phys_t*        get_session_nx_omap             (nx_session_t* session);
+btree_node_phys_t*  get_session_nx_omap_btree       (nx_session_t* session);
+
+uint32_t            get_session_num_volumes         (nx_session_t* session);
+apfs_superblock_t*  get_session_volume_superblock   (nx_session_t* session, uint32_t volume_id);
+omap_phys_t*        get_session_volume_omap         (nx_session_t* session, uint32_t volume_id);
+btree_node_phys_t*  get_session_volume_omap_btree   (nx_session_t* session, uint32_t volume_id);
+btree_node_phys_t*  get_session_volume_fs_root_btree(nx_session_t* session, uint32_t volume_id);
+
+#endif // DRAT_NX_SESSION_H
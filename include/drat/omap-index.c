@@ -0,0 +1,323 @@
+/**
+ * Functions used to build, store, and query object map indexes; see
+ * `omap-index.h` for a description of what these are.
+ */
+
+#include "omap-index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/omap.h>
+
+#include <drat/io.h>    // nx_block_size
+
+/**
+ * Create an empty object map index for a given container.
+ *
+ * nx_uuid:     The UUID of the container that the index will describe.
+ *
+ * RETURN VALUE:
+ *      A pointer to the new index. The caller must free this pointer with
+ *      `free_omap_index()` when it is no longer needed.
+ */
+omap_index_t* create_omap_index(uuid_t nx_uuid) {
+    omap_index_t* index = calloc(1, sizeof(omap_index_t));
+    if (!index) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index`.\n", __func__);
+        exit(-1);
+    }
+
+    memcpy(index->header.oih_magic, OMAP_INDEX_MAGIC, sizeof(index->header.oih_magic));
+    index->header.oih_version = OMAP_INDEX_VERSION;
+    index->header.oih_block_size = nx_block_size;
+    memcpy(index->header.oih_nx_uuid, nx_uuid, sizeof(uuid_t));
+
+    return index;
+}
+
+void free_omap_index(omap_index_t* index) {
+    if (!index) {
+        return;
+    }
+    free(index->entries);
+    free(index);
+}
+
+/**
+ * Add all of the object mappings contained in a given object map B-tree leaf
+ * node to an object map index. The index is left unsorted and may contain
+ * duplicates until `finalize_omap_index()` is called.
+ *
+ * index:       The index to add the mappings to.
+ *
+ * node:        A pointer to an object map B-tree leaf node that has fixed-size
+ *      keys and values. It is the caller's responsibility to ensure that `node`
+ *      satisfies these criteria.
+ *
+ * node_paddr:  The block address that `node` was read from.
+ *
+ * RETURN VALUE:
+ *      The number of mappings that were added. If the node's table of contents
+ *      or any of its entries lie outside of the node, no mappings are added.
+ */
+size_t add_omap_leaf_to_index(omap_index_t* index, btree_node_phys_t* node, paddr_t node_paddr) {
+    char* toc_start = (char*)(node->btn_data) + node->btn_table_space.off;
+    char* key_start = toc_start + node->btn_table_space.len;
+    char* val_end   = (char*)node + nx_block_size;
+    if (node->btn_flags & BTNODE_ROOT) {
+        val_end -= sizeof(btree_info_t);
+    }
+
+    // Sanity-check the node geometry, since stale nodes may be partially
+    // overwritten or otherwise malformed despite having a valid checksum.
+    if (
+           key_start > val_end
+        || node->btn_nkeys * sizeof(kvoff_t) > node->btn_table_space.len
+    ) {
+        return 0;
+    }
+    kvoff_t* toc_entry = toc_start;
+    for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
+        if (
+               key_start + toc_entry->k + sizeof(omap_key_t) > val_end
+            || toc_entry->v < sizeof(omap_val_t)
+            || val_end - toc_entry->v < key_start
+        ) {
+            return 0;
+        }
+    }
+
+    if (index->header.oih_entry_count + node->btn_nkeys > index->capacity) {
+        index->capacity = 2 * (index->capacity + node->btn_nkeys);
+        index->entries = realloc(index->entries, index->capacity * sizeof(omap_index_entry_t));
+        if (!index->entries) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index->entries`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    toc_entry = toc_start;
+    for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
+        omap_key_t* key = key_start + toc_entry->k;
+        omap_val_t* val = val_end   - toc_entry->v;
+
+        omap_index_entry_t* entry = index->entries + index->header.oih_entry_count;
+        entry->oie_oid          = key->ok_oid;
+        entry->oie_xid          = key->ok_xid;
+        entry->oie_paddr        = val->ov_paddr;
+        entry->oie_flags        = val->ov_flags;
+        entry->oie_size         = val->ov_size;
+        entry->oie_node_xid     = node->btn_o.o_xid;
+        entry->oie_node_paddr   = node_paddr;
+        entry->oie_node_count   = 1;
+
+        index->header.oih_entry_count++;
+    }
+    index->header.oih_node_count++;
+
+    return node->btn_nkeys;
+}
+
+/**
+ * Comparison function used to sort index entries by OID, then by XID, then
+ * by physical address.
+ */
+static int compare_omap_index_entries(const void* a, const void* b) {
+    const omap_index_entry_t* entry_a = a;
+    const omap_index_entry_t* entry_b = b;
+
+    if (entry_a->oie_oid != entry_b->oie_oid) {
+        return entry_a->oie_oid < entry_b->oie_oid ? -1 : 1;
+    }
+    if (entry_a->oie_xid != entry_b->oie_xid) {
+        return entry_a->oie_xid < entry_b->oie_xid ? -1 : 1;
+    }
+    if (entry_a->oie_paddr != entry_b->oie_paddr) {
+        return entry_a->oie_paddr < entry_b->oie_paddr ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Sort the entries of an object map index, and merge entries that describe
+ * the same mapping (i.e. have the same OID, XID, and physical address) into a
+ * single entry whose provenance is the newest leaf node it was found in.
+ */
+void finalize_omap_index(omap_index_t* index) {
+    if (index->header.oih_entry_count == 0) {
+        return;
+    }
+
+    qsort(index->entries, index->header.oih_entry_count, sizeof(omap_index_entry_t), compare_omap_index_entries);
+
+    size_t num_unique = 1;
+    for (size_t i = 1; i < index->header.oih_entry_count; i++) {
+        omap_index_entry_t* last  = index->entries + num_unique - 1;
+        omap_index_entry_t* entry = index->entries + i;
+
+        if (compare_omap_index_entries(last, entry) == 0) {
+            if (entry->oie_node_xid > last->oie_node_xid) {
+                last->oie_flags         = entry->oie_flags;
+                last->oie_size          = entry->oie_size;
+                last->oie_node_xid      = entry->oie_node_xid;
+                last->oie_node_paddr    = entry->oie_node_paddr;
+            }
+            last->oie_node_count += entry->oie_node_count;
+            continue;
+        }
+
+        index->entries[num_unique] = *entry;
+        num_unique++;
+    }
+    index->header.oih_entry_count = num_unique;
+}
+
+/**
+ * Write an object map index to a file.
+ *
+ * RETURN VALUE:    `true` on success, `false` on failure.
+ */
+bool write_omap_index(omap_index_t* index, const char* path) {
+    FILE* index_file = fopen(path, "wb");
+    if (!index_file) {
+        fprintf(stderr, "\nERROR: %s: Could not open `%s` for writing.\n", __func__, path);
+        return false;
+    }
+
+    if (
+           fwrite(&(index->header), sizeof(omap_index_header_t), 1, index_file) != 1
+        || fwrite(index->entries, sizeof(omap_index_entry_t), index->header.oih_entry_count, index_file) != index->header.oih_entry_count
+    ) {
+        fprintf(stderr, "\nERROR: %s: Could not write to `%s`.\n", __func__, path);
+        fclose(index_file);
+        return false;
+    }
+
+    if (fclose(index_file) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not finish writing to `%s`.\n", __func__, path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read an object map index from a file that was created by `write_omap_index()`.
+ *
+ * RETURN VALUE:
+ *      A pointer to the index, or NULL if the file could not be read or is not
+ *      an object map index. The caller must free this pointer with
+ *      `free_omap_index()` when it is no longer needed.
+ */
+omap_index_t* read_omap_index(const char* path) {
+    FILE* index_file = fopen(path, "rb");
+    if (!index_file) {
+        fprintf(stderr, "\nERROR: %s: Could not open `%s` for reading.\n", __func__, path);
+        return NULL;
+    }
+
+    omap_index_t* index = calloc(1, sizeof(omap_index_t));
+    if (!index) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index`.\n", __func__);
+        exit(-1);
+    }
+
+    if (fread(&(index->header), sizeof(omap_index_header_t), 1, index_file) != 1) {
+        fprintf(stderr, "\nERROR: %s: Could not read the header of `%s`.\n", __func__, path);
+        goto error;
+    }
+    if (memcmp(index->header.oih_magic, OMAP_INDEX_MAGIC, sizeof(index->header.oih_magic)) != 0) {
+        fprintf(stderr, "\nERROR: %s: `%s` is not an object map index.\n", __func__, path);
+        goto error;
+    }
+    if (index->header.oih_version != OMAP_INDEX_VERSION) {
+        fprintf(stderr, "\nERROR: %s: `%s` has unsupported version %"PRIu32".\n", __func__, path, index->header.oih_version);
+        goto error;
+    }
+
+    index->capacity = index->header.oih_entry_count;
+    index->entries = malloc(index->capacity * sizeof(omap_index_entry_t));
+    if (index->capacity != 0 && !index->entries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `index->entries`.\n", __func__);
+        exit(-1);
+    }
+    if (fread(index->entries, sizeof(omap_index_entry_t), index->capacity, index_file) != index->capacity) {
+        fprintf(stderr, "\nERROR: %s: `%s` is truncated.\n", __func__, path);
+        goto error;
+    }
+
+    fclose(index_file);
+    return index;
+
+error:
+    fclose(index_file);
+    free_omap_index(index);
+    return NULL;
+}
+
+/**
+ * Get all of the entries in a finalized object map index that have a given OID.
+ *
+ * num_entries: Set to the number of matching entries.
+ *
+ * RETURN VALUE:
+ *      A pointer to the first matching entry within the index; the matching
+ *      entries are contiguous and sorted by XID. If there are no matching
+ *      entries, NULL is returned.
+ */
+omap_index_entry_t* get_omap_index_entries(omap_index_t* index, oid_t oid, size_t* num_entries) {
+    *num_entries = 0;
+
+    // Binary search for the first entry whose OID is at least `oid`
+    size_t lo = 0;
+    size_t hi = index->header.oih_entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->entries[mid].oie_oid < oid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t end = lo;
+    while (end < index->header.oih_entry_count && index->entries[end].oie_oid == oid) {
+        end++;
+    }
+
+    if (end == lo) {
+        return NULL;
+    }
+    *num_entries = end - lo;
+    return index->entries + lo;
+}
+
+/**
+ * Get the entry in a finalized object map index that a given Virtual OID
+ * resolves to as of a given XID, i.e. the entry with that OID whose XID is the
+ * highest among those that don't exceed `max_xid`. If several such entries
+ * exist with different physical addresses, the one found in the newest leaf
+ * node is chosen.
+ *
+ * RETURN VALUE:
+ *      A pointer to the entry within the index, or NULL if there is no such
+ *      entry.
+ */
+omap_index_entry_t* get_omap_index_entry(omap_index_t* index, oid_t oid, xid_t max_xid) {
+    size_t num_entries = 0;
+    omap_index_entry_t* entries = get_omap_index_entries(index, oid, &num_entries);
+
+    omap_index_entry_t* result = NULL;
+    for (size_t i = 0; i < num_entries && entries[i].oie_xid <= max_xid; i++) {
+        if (
+               !result
+            || entries[i].oie_xid > result->oie_xid
+            || entries[i].oie_node_xid > result->oie_node_xid
+        ) {
+            result = entries + i;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,72 @@
+#ifndef DRAT_OMAP_INDEX_H
+#define DRAT_OMAP_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/general.h>   // paddr_t, uuid_t
+#include <apfs/object.h>    // oid_t, xid_t
+#include <apfs/btree.h>     // btree_node_phys_t
+
+/**
+ * An object map index is a file containing every object mapping found in the
+ * object map B-tree leaf nodes that exist anywhere in a container, including
+ * stale nodes which are no longer part of any live object map. This lets us
+ * resolve Virtual OIDs as of any point in time without needing to scan the
+ * container for old object map nodes each time.
+ *
+ * The file consists of an instance of `omap_index_header_t`, followed by
+ * `oih_entry_count` instances of `omap_index_entry_t`, sorted by OID, then by
+ * XID, then by physical address. No two entries have the same
+ * (OID, XID, physical address) triple.
+ */
+
+#define OMAP_INDEX_MAGIC    "DRATOMIX"
+#define OMAP_INDEX_VERSION  1
+
+typedef struct {
+    char        oih_magic[8];
+    uint32_t    oih_version;
+    uint32_t    oih_block_size;
+    uuid_t      oih_nx_uuid;
+    paddr_t     oih_start_paddr;    // First block address that was scanned
+    paddr_t     oih_end_paddr;      // Block address after the last one that was scanned
+    uint64_t    oih_node_count;     // Number of object map leaf nodes found
+    uint64_t    oih_entry_count;
+} omap_index_header_t;
+
+/**
+ * A single object mapping, along with the provenance of the newest object map
+ * leaf node that it was found in.
+ */
+typedef struct {
+    oid_t       oie_oid;
+    xid_t       oie_xid;
+    paddr_t     oie_paddr;
+    uint32_t    oie_flags;
+    uint32_t    oie_size;
+    xid_t       oie_node_xid;       // XID of the newest leaf node containing this mapping
+    paddr_t     oie_node_paddr;     // Block address of that leaf node
+    uint64_t    oie_node_count;     // Number of leaf nodes containing this mapping
+} omap_index_entry_t;
+
+typedef struct {
+    omap_index_header_t     header;
+    omap_index_entry_t*     entries;
+    size_t                  capacity;
+} omap_index_t;
+
+omap_index_t* create_omap_index(uuid_t nx_uuid);
+void free_omap_index(omap_index_t* index);
+
+size_t add_omap_leaf_to_index(omap_index_t* index, btree_node_phys_t* node, paddr_t node_paddr);
+void finalize_omap_index(omap_index_t* index);
+
+bool write_omap_index(omap_index_t* index, const char* path);
+omap_index_t* read_omap_index(const char* path);
+
+omap_index_entry_t* get_omap_index_entries(omap_index_t* index, oid_t oid, size_t* num_entries);
+omap_index_entry_t* get_omap_index_entry(omap_index_t* index, oid_t oid, xid_t max_xid);
+
+#endif // DRAT_OMAP_INDEX_H
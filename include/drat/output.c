@@ -0,0 +1,645 @@
+/**
+ * Functions used to write recovered items to the local file system; see
+ * `output.h` for details.
+ */
+
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/**
+ * Create a directory and any of its ancestors that don't already exist, like
+ * `mkdir -p`.
+ *
+ * RETURN VALUE:    `true` if the directory exists, else `false`.
+ */
+bool make_directories(const char* path) {
+    char* path_copy = strdup(path);
+    if (!path_copy) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `path_copy`.\n", __func__);
+        exit(-1);
+    }
+
+    for (char* cursor = path_copy + 1; *cursor; cursor++) {
+        if (*cursor == '/') {
+            *cursor = '\0';
+            if (mkdir(path_copy, 0755) != 0 && errno != EEXIST) {
+                free(path_copy);
+                return false;
+            }
+            *cursor = '/';
+        }
+    }
+    bool success = mkdir(path_copy, 0755) == 0 || errno == EEXIST;
+
+    free(path_copy);
+    return success;
+}
+
+/**
+ * Create every directory that is needed for a file to be created at `path`.
+ *
+ * RETURN VALUE:    `true` if the parent directory exists, else `false`.
+ */
+bool make_parent_directories(const char* path) {
+    const char* last_slash = strrchr(path, '/');
+    if (!last_slash || last_slash == path) {
+        return true;
+    }
+
+    char* parent = strndup(path, last_slash - path);
+    if (!parent) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `parent`.\n", __func__);
+        exit(-1);
+    }
+    bool success = make_directories(parent);
+    free(parent);
+    return success;
+}
+
+/**
+ * Create an output file of a given size, along with any directories needed
+ * to contain it. If the file already exists, it is truncated first, so it
+ * initially reads as all zeroes.
+ *
+ * RETURN VALUE:    `true` if the file was created, else `false`.
+ */
+bool create_output_file(const char* path, uint64_t size) {
+    if (!make_parent_directories(path)) {
+        fprintf(stderr, "\nERROR: %s: Could not create the parent directories of `%s`: %s.\n", __func__, path, strerror(errno));
+        return false;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "\nERROR: %s: Could not create `%s`: %s.\n", __func__, path, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not set the size of `%s`: %s.\n", __func__, path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    return close(fd) == 0;
+}
+
+/**
+ * Open an existing output file for writing.
+ *
+ * RETURN VALUE:    A file descriptor, or -1 if the file couldn't be opened,
+ *              in which case an explanation is printed to stderr.
+ */
+int open_output_file(const char* path) {
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) {
+        fprintf(stderr, "\nERROR: %s: Could not open `%s` for writing: %s.\n", __func__, path, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Open an output file written by an earlier run, e.g. to check what it
+ * contains before resuming a recovery, without creating or truncating it.
+ *
+ * size:    Set to the size of the file in bytes.
+ *
+ * RETURN VALUE:    A file descriptor open for reading and writing, or -1 if
+ *              the file doesn't exist or couldn't be opened. Nothing is
+ *              printed.
+ */
+int open_existing_output_file(const char* path, uint64_t* size) {
+    int fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    *size = file_stat.st_size;
+    return fd;
+}
+
+/**
+ * Read data from a given offset within an open output file, retrying until
+ * all of it has been read.
+ *
+ * RETURN VALUE:    `true` if all `num_bytes` bytes were read, else `false`.
+ *              Nothing is printed.
+ */
+bool read_output_fd(int fd, void* buffer, size_t num_bytes, uint64_t offset) {
+    char* cursor = buffer;
+    while (num_bytes != 0) {
+        ssize_t num_read = pread(fd, cursor, num_bytes, offset);
+        if (num_read <= 0) {
+            if (num_read == -1 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        cursor += num_read;
+        offset += num_read;
+        num_bytes -= num_read;
+    }
+    return true;
+}
+
+/**
+ * Write data to a given offset within an open output file, retrying until
+ * all of it has been written.
+ *
+ * path:    The path of the file, used in error messages.
+ *
+ * RETURN VALUE:    `true` if all `num_bytes` bytes were written, else `false`.
+ */
+bool write_output_fd(int fd, const void* buffer, size_t num_bytes, uint64_t offset, const char* path) {
+    const char* cursor = buffer;
+    while (num_bytes != 0) {
+        ssize_t num_written = pwrite(fd, cursor, num_bytes, offset);
+        if (num_written <= 0) {
+            if (num_written == -1 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "\nERROR: %s: Could not write to `%s`: %s.\n", __func__, path, strerror(errno));
+            return false;
+        }
+        cursor += num_written;
+        offset += num_written;
+        num_bytes -= num_written;
+    }
+    return true;
+}
+
+/**
+ * Create a symbolic link, replacing any existing file at `path`.
+ *
+ * RETURN VALUE:    `true` if the link was created, else `false`.
+ */
+bool create_output_symlink(const char* target, const char* path) {
+    if (symlink(target, path) != 0) {
+        if (errno != EEXIST || unlink(path) != 0 || symlink(target, path) != 0) {
+            fprintf(stderr, "\nERROR: %s: Could not create a symbolic link at `%s`: %s.\n", __func__, path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Set the permissions and timestamps of a recovered item.
+ *
+ * mode:    The APFS file mode; only the permission bits are used. Ignored
+ *      for symbolic links, whose permissions can't be set portably.
+ *
+ * access_time, mod_time:   Timestamps in nanoseconds since the Unix epoch,
+ *      as stored in APFS inodes.
+ *
+ * is_symlink:  Whether the item is a symbolic link, in which case the link
+ *      itself rather than its target is modified.
+ *
+ * RETURN VALUE:    `true` if all metadata was set, else `false`.
+ */
+bool set_output_metadata(const char* path, uint16_t mode, uint64_t access_time, uint64_t mod_time, bool is_symlink) {
+    bool success = true;
+
+    if (!is_symlink && chmod(path, mode & 07777) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not set the permissions of `%s`: %s.\n", __func__, path, strerror(errno));
+        success = false;
+    }
+
+    struct timespec times[2] = {
+        { .tv_sec = access_time / 1000000000, .tv_nsec = access_time % 1000000000 },
+        { .tv_sec = mod_time    / 1000000000, .tv_nsec = mod_time    % 1000000000 },
+    };
+    if (utimensat(AT_FDCWD, path, times, is_symlink ? AT_SYMLINK_NOFOLLOW : 0) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not set the timestamps of `%s`: %s.\n", __func__, path, strerror(errno));
+        success = false;
+    }
+
+    return success;
+}
+
+/**
+ * Write data to the current position of a file descriptor, which needn't be
+ * seekable, retrying until all of it has been written.
+ *
+ * RETURN VALUE:    `true` if all `num_bytes` bytes were written, else `false`,
+ *              in which case an explanation is printed to stderr.
+ */
+bool append_output_fd(int fd, const void* buffer, size_t num_bytes) {
+    const char* cursor = buffer;
+    while (num_bytes != 0) {
+        ssize_t num_written = write(fd, cursor, num_bytes);
+        if (num_written <= 0) {
+            if (num_written == -1 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "\nERROR: %s: Could not write the output: %s.\n", __func__, strerror(errno));
+            return false;
+        }
+        cursor += num_written;
+        num_bytes -= num_written;
+    }
+    return true;
+}
+
+#ifdef __linux__
+/**
+ * The ways in which `copy_to_output_fd()` can have the kernel copy data from
+ * one file descriptor to another without it passing through userspace.
+ */
+typedef enum {
+    COPY_FILE_RANGE,
+    SPLICE,
+    SENDFILE,
+} copy_method_t;
+
+/**
+ * Copy data using a given zero-copy method, writing it at the current
+ * position of `out_fd`.
+ *
+ * in_offset, num_bytes:    Updated to reflect the data that was copied, even
+ *      if not all of it could be.
+ *
+ * RETURN VALUE:
+ *      0 if all of the data was copied;
+ *      -1 if the method can't be used for these file descriptors, or failed
+ *          part way, in which case `errno` is set and the caller should copy
+ *          the rest some other way;
+ *      -2 if the end of the input was reached before all of the data was
+ *          copied.
+ */
+static int copy_fd_range(copy_method_t method, int out_fd, int in_fd, uint64_t* in_offset, uint64_t* num_bytes) {
+    while (*num_bytes != 0) {
+        size_t slice = *num_bytes < OUTPUT_MAX_COPY_BYTES ? *num_bytes : OUTPUT_MAX_COPY_BYTES;
+        off_t offset = *in_offset;
+
+        ssize_t num_copied;
+        switch (method) {
+            case COPY_FILE_RANGE:
+                num_copied = copy_file_range(in_fd, &offset, out_fd, NULL, slice, 0);
+                break;
+            case SPLICE:
+                num_copied = splice(in_fd, &offset, out_fd, NULL, slice, SPLICE_F_MORE);
+                break;
+            case SENDFILE:
+            default:
+                num_copied = sendfile(out_fd, in_fd, &offset, slice);
+                break;
+        }
+
+        if (num_copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (num_copied == 0) {
+            return -2;
+        }
+        *in_offset += num_copied;
+        *num_bytes -= num_copied;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * Copy a range of bytes from one file descriptor to the current position of
+ * another, e.g. from the container to stdout.
+ *
+ * Where possible, the kernel is asked to copy the data directly, so that it
+ * never passes through userspace: `copy_file_range()` is used when the output
+ * is a regular file, `splice()` when it is a pipe, and `sendfile()` otherwise.
+ * If none of these are available, or they fail, the data is read into a
+ * buffer and written out in slices of at most `OUTPUT_MAX_COPY_BYTES`.
+ *
+ * in_offset:   The byte offset within `in_fd` at which the data starts. The
+ *      file position of `in_fd` isn't used or changed.
+ *
+ * RETURN VALUE:    `true` if all `num_bytes` bytes were copied, else `false`,
+ *              in which case an explanation is printed to stderr.
+ */
+bool copy_to_output_fd(int out_fd, int in_fd, uint64_t in_offset, uint64_t num_bytes) {
+    if (num_bytes == 0) {
+        return true;
+    }
+
+#ifdef __linux__
+    struct stat out_stat;
+    if (fstat(out_fd, &out_stat) == 0) {
+        copy_method_t methods[2];
+        size_t num_methods = 0;
+        if (S_ISREG(out_stat.st_mode)) {
+            methods[num_methods++] = COPY_FILE_RANGE;
+        } else if (S_ISFIFO(out_stat.st_mode)) {
+            methods[num_methods++] = SPLICE;
+        }
+        methods[num_methods++] = SENDFILE;
+
+        for (size_t i = 0; i < num_methods; i++) {
+            int result = copy_fd_range(methods[i], out_fd, in_fd, &in_offset, &num_bytes);
+            if (result == 0) {
+                return true;
+            }
+            if (result == -2) {
+                fprintf(stderr, "\nERROR: %s: Reached the end of the input before all data was copied.\n", __func__);
+                return false;
+            }
+            // Otherwise, fall back to the next method for the remaining data
+        }
+    }
+#endif
+
+    size_t buffer_size = num_bytes < OUTPUT_MAX_COPY_BYTES ? num_bytes : OUTPUT_MAX_COPY_BYTES;
+    char* buffer = malloc(buffer_size);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success = true;
+    while (success && num_bytes != 0) {
+        size_t slice = num_bytes < buffer_size ? num_bytes : buffer_size;
+        ssize_t num_read = pread(in_fd, buffer, slice, in_offset);
+        if (num_read <= 0) {
+            if (num_read == -1 && errno == EINTR) {
+                continue;
+            }
+            if (num_read == 0) {
+                fprintf(stderr, "\nERROR: %s: Reached the end of the input before all data was copied.\n", __func__);
+            } else {
+                fprintf(stderr, "\nERROR: %s: Could not read the input: %s.\n", __func__, strerror(errno));
+            }
+            success = false;
+            break;
+        }
+
+        if (!append_output_fd(out_fd, buffer, num_read)) {
+            success = false;
+            break;
+        }
+
+        in_offset += num_read;
+        num_bytes -= num_read;
+    }
+
+    free(buffer);
+    return success;
+}
+
+/**
+ * Advance the current position of a file descriptor over a run of zeroes
+ * without writing them, if possible.
+ *
+ * If the output is a regular file, the run becomes a hole: any part of it
+ * that lies beyond the current end of the file is simply seeked over, and
+ * any part that lies within the file, e.g. when overwriting an existing file
+ * in place, is deallocated with `fallocate()` where supported. For any other
+ * kind of output, such as a pipe or a file opened for appending, the zeroes
+ * are written out.
+ *
+ * RETURN VALUE:    `true` if successful, else `false`, in which case an
+ *              explanation is printed to stderr.
+ */
+bool skip_output_hole(int fd, uint64_t num_bytes) {
+    if (num_bytes == 0) {
+        return true;
+    }
+
+    struct stat out_stat;
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    int flags = fcntl(fd, F_GETFL);
+    if (position != -1 && fstat(fd, &out_stat) == 0 && S_ISREG(out_stat.st_mode) && flags != -1 && !(flags & O_APPEND)) {
+        if (position < out_stat.st_size) {
+            // Part of the hole overlaps existing data, which must be zeroed
+            uint64_t overlap = out_stat.st_size - position;
+            if (overlap > num_bytes) {
+                overlap = num_bytes;
+            }
+
+            bool punched = false;
+#ifdef __linux__
+            punched = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, overlap) == 0;
+#endif
+            if (!punched) {
+                char* zeroes = calloc(1, OUTPUT_MAX_COPY_BYTES);
+                if (!zeroes) {
+                    fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `zeroes`.\n", __func__);
+                    exit(-1);
+                }
+                for (uint64_t offset = 0; offset < overlap; offset += OUTPUT_MAX_COPY_BYTES) {
+                    size_t slice = overlap - offset < OUTPUT_MAX_COPY_BYTES ? overlap - offset : OUTPUT_MAX_COPY_BYTES;
+                    if (!write_output_fd(fd, zeroes, slice, position + offset, "the output")) {
+                        free(zeroes);
+                        return false;
+                    }
+                }
+                free(zeroes);
+            }
+        }
+
+        if (lseek(fd, num_bytes, SEEK_CUR) == -1) {
+            fprintf(stderr, "\nERROR: %s: Could not seek over a hole in the output: %s.\n", __func__, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    char* zeroes = calloc(1, num_bytes < OUTPUT_MAX_COPY_BYTES ? num_bytes : OUTPUT_MAX_COPY_BYTES);
+    if (!zeroes) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `zeroes`.\n", __func__);
+        exit(-1);
+    }
+    bool success = true;
+    while (success && num_bytes != 0) {
+        size_t slice = num_bytes < OUTPUT_MAX_COPY_BYTES ? num_bytes : OUTPUT_MAX_COPY_BYTES;
+        success = append_output_fd(fd, zeroes, slice);
+        num_bytes -= slice;
+    }
+    free(zeroes);
+    return success;
+}
+
+/**
+ * Make sure that a regular output file extends to at least the current
+ * position of its file descriptor. This is needed if the output ends with a
+ * hole that was seeked over by `skip_output_hole()`; other kinds of output
+ * are left as they are.
+ *
+ * RETURN VALUE:    `true` if successful, else `false`, in which case an
+ *              explanation is printed to stderr.
+ */
+bool finish_output_holes(int fd) {
+    struct stat out_stat;
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    if (position == -1 || fstat(fd, &out_stat) != 0 || !S_ISREG(out_stat.st_mode) || position <= out_stat.st_size) {
+        return true;
+    }
+
+    if (ftruncate(fd, position) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not extend the output over a trailing hole: %s.\n", __func__, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Determine whether a name read from disk, e.g. that of a dentry, can safely be
+ * joined to an output path as a single path component. Names that are empty,
+ * `.`, or `..`, or that contain a slash, would otherwise let a corrupt or
+ * crafted container write outside of the output directory.
+ */
+bool is_safe_output_name(const char* name) {
+    return name[0] != '\0'
+        && strcmp(name, ".") != 0
+        && strcmp(name, "..") != 0
+        && !strchr(name, '/');
+}
+
+/**
+ * Determine whether a buffer contains only zeroes. Rather than testing each
+ * byte in turn, the buffer is compared against itself offset by one byte,
+ * which lets the C library's vectorised `memcmp()` do the work.
+ */
+bool is_zero_filled(const void* buffer, size_t num_bytes) {
+    const unsigned char* bytes = buffer;
+    return num_bytes == 0 || (bytes[0] == 0 && memcmp(bytes, bytes + 1, num_bytes - 1) == 0);
+}
+
+/**
+ * Write data to the current position of a file descriptor, like
+ * `append_output_fd()`, but turn each block that contains only zeroes into a
+ * hole rather than writing it out; see `skip_output_hole()`.
+ *
+ * block_size:  The granularity at which zeroes are detected. The last block
+ *      may be shorter than this.
+ *
+ * RETURN VALUE:    `true` if successful, else `false`, in which case an
+ *              explanation is printed to stderr.
+ */
+bool append_output_skipping_zero_blocks(int fd, const void* buffer, size_t num_bytes, size_t block_size) {
+    const char* bytes = buffer;
+
+    // Write out each run of blocks that aren't all zeroes, and skip over each
+    // run of blocks that are.
+    size_t run_start = 0;
+    bool run_is_zero = false;
+    for (size_t block_start = 0; ; block_start += block_size) {
+        bool at_end = block_start >= num_bytes;
+        bool block_is_zero = false;
+        if (!at_end) {
+            size_t block_bytes = num_bytes - block_start < block_size ? num_bytes - block_start : block_size;
+            block_is_zero = is_zero_filled(bytes + block_start, block_bytes);
+            if (block_start == 0) {
+                run_is_zero = block_is_zero;
+            }
+        }
+
+        if (at_end || block_is_zero != run_is_zero) {
+            size_t run_end = at_end ? num_bytes : block_start;
+            bool success = run_is_zero
+                ? skip_output_hole(fd, run_end - run_start)
+                : append_output_fd(fd, bytes + run_start, run_end - run_start);
+            if (!success || at_end) {
+                return success;
+            }
+            run_start = block_start;
+            run_is_zero = block_is_zero;
+        }
+    }
+}
+
+void init_output_files(output_files_t* files, char** paths, size_t num_paths) {
+    memset(files, 0, sizeof(output_files_t));
+    files->paths = paths;
+    files->num_paths = num_paths;
+}
+
+/**
+ * Get an open file descriptor for a given output file, opening it if needed
+ * and closing the least recently used one if too many are open.
+ *
+ * RETURN VALUE:    The file descriptor, or -1 if the file couldn't be opened.
+ */
+static int get_output_fd(output_files_t* files, size_t file_index) {
+    files->clock++;
+
+    size_t i_oldest = 0;
+    for (size_t i = 0; i < files->num_fds; i++) {
+        if (files->fds[i].file_index == file_index) {
+            files->fds[i].last_use = files->clock;
+            return files->fds[i].fd;
+        }
+        if (files->fds[i].last_use < files->fds[i_oldest].last_use) {
+            i_oldest = i;
+        }
+    }
+
+    size_t i_slot = files->num_fds;
+    if (files->num_fds == OUTPUT_MAX_OPEN_FILES) {
+        i_slot = i_oldest;
+        if (close(files->fds[i_slot].fd) != 0) {
+            fprintf(stderr, "\nERROR: %s: Could not finish writing to `%s`: %s.\n", __func__, files->paths[files->fds[i_slot].file_index], strerror(errno));
+        }
+    } else {
+        files->num_fds++;
+    }
+
+    int fd = open_output_file(files->paths[file_index]);
+    if (fd == -1) {
+        // Free up the slot
+        files->num_fds--;
+        files->fds[i_slot] = files->fds[files->num_fds];
+        return -1;
+    }
+
+    files->fds[i_slot].file_index = file_index;
+    files->fds[i_slot].fd = fd;
+    files->fds[i_slot].last_use = files->clock;
+    return fd;
+}
+
+/**
+ * Write data to a given offset within an output file.
+ *
+ * RETURN VALUE:    `true` if all `num_bytes` bytes were written, else `false`.
+ */
+bool write_output_file(output_files_t* files, size_t file_index, const void* buffer, size_t num_bytes, uint64_t offset) {
+    int fd = get_output_fd(files, file_index);
+    if (fd == -1) {
+        return false;
+    }
+
+    return write_output_fd(fd, buffer, num_bytes, offset, files->paths[file_index]);
+}
+
+/**
+ * Close all output files that are still open.
+ *
+ * RETURN VALUE:    `true` if all of them were closed successfully, else `false`.
+ */
+bool close_output_files(output_files_t* files) {
+    bool success = true;
+    for (size_t i = 0; i < files->num_fds; i++) {
+        if (close(files->fds[i].fd) != 0) {
+            fprintf(stderr, "\nERROR: %s: Could not finish writing to `%s`: %s.\n", __func__, files->paths[files->fds[i].file_index], strerror(errno));
+            success = false;
+        }
+    }
+    files->num_fds = 0;
+    return success;
+}
@@ -0,0 +1,73 @@
+#ifndef DRAT_OUTPUT_H
+#define DRAT_OUTPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Functions used to write recovered items to the local file system.
+ *
+ * These are kept apart from the code that parses APFS structures, since
+ * <apfs/jconst.h> defines `S_IF*` constants that clash with those defined by
+ * the host's <sys/stat.h>; only this translation unit includes the latter.
+ */
+
+bool make_directories(const char* path);
+bool make_parent_directories(const char* path);
+bool create_output_file(const char* path, uint64_t size);
+int  open_output_file(const char* path);
+int  open_existing_output_file(const char* path, uint64_t* size);
+bool read_output_fd(int fd, void* buffer, size_t num_bytes, uint64_t offset);
+bool write_output_fd(int fd, const void* buffer, size_t num_bytes, uint64_t offset, const char* path);
+bool create_output_symlink(const char* target, const char* path);
+bool set_output_metadata(const char* path, uint16_t mode, uint64_t access_time, uint64_t mod_time, bool is_symlink);
+bool is_safe_output_name(const char* name);
+
+/**
+ * Maximum number of bytes that are copied by a single system call, or held in
+ * memory at once when the data has to pass through userspace.
+ */
+#define OUTPUT_MAX_COPY_BYTES   (8 * 1024 * 1024)
+
+bool append_output_fd(int fd, const void* buffer, size_t num_bytes);
+bool copy_to_output_fd(int out_fd, int in_fd, uint64_t in_offset, uint64_t num_bytes);
+bool skip_output_hole(int fd, uint64_t num_bytes);
+bool finish_output_holes(int fd);
+bool is_zero_filled(const void* buffer, size_t num_bytes);
+bool append_output_skipping_zero_blocks(int fd, const void* buffer, size_t num_bytes, size_t block_size);
+
+/**
+ * Maximum number of output files that are kept open at once when writing to
+ * many files in an arbitrary order.
+ */
+#define OUTPUT_MAX_OPEN_FILES   64
+
+typedef struct {
+    size_t      file_index;
+    int         fd;
+    uint64_t    last_use;
+} output_fd_t;
+
+/**
+ * A set of output files which are written to in an arbitrary order, e.g. in
+ * the order that their data lies on disk. At most `OUTPUT_MAX_OPEN_FILES` are
+ * open at once; the least recently used one is closed to make room for
+ * another.
+ *
+ * paths:   Array of `num_paths` output paths, not owned by this structure.
+ *      Files are referred to by their index in this array.
+ */
+typedef struct {
+    char**      paths;
+    size_t      num_paths;
+    output_fd_t fds[OUTPUT_MAX_OPEN_FILES];
+    size_t      num_fds;
+    uint64_t    clock;
+} output_files_t;
+
+void init_output_files(output_files_t* files, char** paths, size_t num_paths);
+bool write_output_file(output_files_t* files, size_t file_index, const void* buffer, size_t num_bytes, uint64_t offset);
+bool close_output_files(output_files_t* files);
+
+#endif // DRAT_OUTPUT_H
@@ -0,0 +1,353 @@
+/**
+ * Functions used to record the progress of long-running recoveries so that
+ * they can be resumed; see `recover-journal.h` for details.
+ */
+
+#include "recover-journal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <drat/output.h>
+
+/**
+ * Get the path of the journal for a recovery whose output is at a given path.
+ * Trailing slashes are ignored, so that the journal of a directory tree lies
+ * beside the directory rather than within it.
+ *
+ * RETURN VALUE:
+ *      The path. The caller must free this pointer when it is no longer
+ *      needed.
+ */
+char* get_recover_journal_path(const char* output_path) {
+    size_t path_len = strlen(output_path);
+    while (path_len > 1 && output_path[path_len - 1] == '/') {
+        path_len--;
+    }
+
+    char* path = malloc(path_len + strlen(RECOVER_JOURNAL_SUFFIX) + 1);
+    if (!path) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `path`.\n", __func__);
+        exit(-1);
+    }
+    memcpy(path, output_path, path_len);
+    strcpy(path + path_len, RECOVER_JOURNAL_SUFFIX);
+    return path;
+}
+
+static int compare_recover_journal_entries(const void* a, const void* b) {
+    const recover_journal_entry_t* entry_a = a;
+    const recover_journal_entry_t* entry_b = b;
+    if (entry_a->key != entry_b->key) {
+        return entry_a->key < entry_b->key ? -1 : 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    recover_journal_entry_t entry;
+    size_t                  position;
+} tagged_entry_t;
+
+static int compare_tagged_entries(const void* a, const void* b) {
+    const tagged_entry_t* tagged_a = a;
+    const tagged_entry_t* tagged_b = b;
+    int result = compare_recover_journal_entries(&tagged_a->entry, &tagged_b->entry);
+    if (result == 0 && tagged_a->position != tagged_b->position) {
+        result = tagged_a->position < tagged_b->position ? -1 : 1;
+    }
+    return result;
+}
+
+/**
+ * Read the entries of an existing journal, if it is for the given item.
+ *
+ * RETURN VALUE:    `true` if the journal exists and is for the given item,
+ *              else `false`.
+ */
+static bool read_recover_journal(recover_journal_t* journal, oid_t fs_oid, uint64_t size) {
+    FILE* file = fopen(journal->path, "r");
+    if (!file) {
+        return false;
+    }
+
+    char magic[32];
+    uint32_t version = 0;
+    uint64_t journal_oid = 0;
+    uint64_t journal_size = 0;
+    if (
+           fscanf(file, "%31s %"SCNu32" %"SCNx64" %"SCNx64"", magic, &version, &journal_oid, &journal_size) != 4
+        || strcmp(magic, RECOVER_JOURNAL_MAGIC) != 0
+        || version != RECOVER_JOURNAL_VERSION
+        || journal_oid != fs_oid
+        || journal_size != size
+    ) {
+        fclose(file);
+        return false;
+    }
+
+    size_t capacity = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        // Skip lines that were only partly written, which lack a newline
+        size_t line_len = strlen(line);
+        if (line_len == 0 || line[line_len - 1] != '\n') {
+            continue;
+        }
+
+        recover_journal_entry_t entry;
+        if (sscanf(line, "%"SCNx64" %"SCNx64" %"SCNx64"", &entry.key, &entry.length, &entry.hash) != 3) {
+            continue;
+        }
+
+        if (journal->num_entries == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            journal->entries = realloc(journal->entries, capacity * sizeof(recover_journal_entry_t));
+            if (!journal->entries) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `journal->entries`.\n", __func__);
+                exit(-1);
+            }
+        }
+        journal->entries[journal->num_entries++] = entry;
+    }
+    fclose(file);
+
+    // Sort the entries for lookup. Where a unit was recorded more than once,
+    // keep only the last entry, since the unit was rewritten; to tell which
+    // entry came last, they are sorted along with their position in the file.
+    tagged_entry_t* tagged = malloc((journal->num_entries + 1) * sizeof(tagged_entry_t));
+    if (!tagged) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `tagged`.\n", __func__);
+        exit(-1);
+    }
+    for (size_t i = 0; i < journal->num_entries; i++) {
+        tagged[i].entry     = journal->entries[i];
+        tagged[i].position  = i;
+    }
+    qsort(tagged, journal->num_entries, sizeof(tagged_entry_t), compare_tagged_entries);
+
+    size_t num_unique = 0;
+    for (size_t i = 0; i < journal->num_entries; i++) {
+        if (i + 1 < journal->num_entries && tagged[i + 1].entry.key == tagged[i].entry.key) {
+            continue;
+        }
+        journal->entries[num_unique++] = tagged[i].entry;
+    }
+    journal->num_entries = num_unique;
+    free(tagged);
+
+    return true;
+}
+
+/**
+ * Open the journal for a recovery.
+ *
+ * output_path:     The path of the recovery's output file or directory.
+ *
+ * fs_oid, size:    The file-system object ID of the item being recovered, and
+ *      its size, or zero for a directory. An existing journal is only used if
+ *      it was written for the same item.
+ *
+ * resume:  Whether to read the entries of an existing journal, and append to
+ *      it. Otherwise, any existing journal is replaced with an empty one.
+ *
+ * log:     The stream that progress messages are written to.
+ *
+ * RETURN VALUE:
+ *      A pointer to the journal, or a NULL pointer if it couldn't be created,
+ *      in which case an explanation is printed to stderr. The caller must
+ *      close it with `close_recover_journal()`.
+ */
+recover_journal_t* open_recover_journal(const char* output_path, oid_t fs_oid, uint64_t size, bool resume, FILE* log) {
+    recover_journal_t* journal = calloc(1, sizeof(recover_journal_t));
+    if (!journal) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `journal`.\n", __func__);
+        exit(-1);
+    }
+    journal->path = get_recover_journal_path(output_path);
+    pthread_mutex_init(&journal->lock, NULL);
+
+    bool appending = false;
+    if (resume) {
+        if (read_recover_journal(journal, fs_oid, size)) {
+            fprintf(log, "Resuming from the journal `%s`, which records %zu completed units of work.\n", journal->path, journal->num_entries);
+            appending = true;
+        } else {
+            fprintf(log, "There is no journal for this item at `%s`; starting from the beginning.\n", journal->path);
+        }
+    }
+
+    if (appending) {
+        // The previous run may have been interrupted part way through writing
+        // a line, so start on a new one; blank lines are ignored.
+        if ((journal->file = fopen(journal->path, "a"))) {
+            fputc('\n', journal->file);
+        }
+    } else if ((journal->file = fopen(journal->path, "w"))) {
+        fprintf(journal->file, "%s %d %#"PRIx64" %#"PRIx64"\n", RECOVER_JOURNAL_MAGIC, RECOVER_JOURNAL_VERSION, fs_oid, size);
+    }
+    if (!journal->file || fflush(journal->file) != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not open the journal `%s` for writing: %s.\n", __func__, journal->path, strerror(errno));
+        if (journal->file) {
+            fclose(journal->file);
+        }
+        pthread_mutex_destroy(&journal->lock);
+        free(journal->entries);
+        free(journal->path);
+        free(journal);
+        return NULL;
+    }
+    journal->last_flush = time(NULL);
+
+    return journal;
+}
+
+/**
+ * Find the entry for a given unit of work among those read from an existing
+ * journal when resuming.
+ *
+ * RETURN VALUE:    A pointer to the entry, or a NULL pointer if there is none.
+ */
+recover_journal_entry_t* find_recover_journal_entry(recover_journal_t* journal, uint64_t key) {
+    recover_journal_entry_t target = { .key = key };
+    return bsearch(&target, journal->entries, journal->num_entries, sizeof(recover_journal_entry_t), compare_recover_journal_entries);
+}
+
+/**
+ * Record that a unit of work has been completed. The journal is flushed to
+ * disk if it hasn't been for `RECOVER_JOURNAL_FLUSH_INTERVAL` seconds.
+ *
+ * RETURN VALUE:    `true` if the entry was recorded, else `false`, in which
+ *              case an explanation is printed to stderr.
+ */
+bool add_recover_journal_entry(recover_journal_t* journal, uint64_t key, uint64_t length, uint64_t hash) {
+    pthread_mutex_lock(&journal->lock);
+
+    bool success = fprintf(journal->file, "%#"PRIx64" %#"PRIx64" %#"PRIx64"\n", key, length, hash) > 0;
+
+    time_t now = time(NULL);
+    if (success && now - journal->last_flush >= RECOVER_JOURNAL_FLUSH_INTERVAL) {
+        success = fflush(journal->file) == 0 && fsync(fileno(journal->file)) == 0;
+        journal->last_flush = now;
+    }
+    if (!success) {
+        fprintf(stderr, "\nERROR: %s: Could not write to the journal `%s`: %s.\n", __func__, journal->path, strerror(errno));
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+    return success;
+}
+
+/**
+ * Close a journal.
+ *
+ * completed:   Whether the recovery has completed, in which case the journal
+ *      is no longer needed and is deleted.
+ *
+ * RETURN VALUE:    `true` if successful, else `false`.
+ */
+bool close_recover_journal(recover_journal_t* journal, bool completed) {
+    bool success = fflush(journal->file) == 0 && fsync(fileno(journal->file)) == 0;
+    success = fclose(journal->file) == 0 && success;
+    if (completed) {
+        success = unlink(journal->path) == 0 && success;
+    }
+    if (!success) {
+        fprintf(stderr, "\nERROR: %s: Could not finish writing the journal `%s`: %s.\n", __func__, journal->path, strerror(errno));
+    }
+
+    pthread_mutex_destroy(&journal->lock);
+    free(journal->entries);
+    free(journal->path);
+    free(journal);
+    return success;
+}
+
+/**
+ * Update a journal hash with more data. The hash is 64-bit FNV-1a, which
+ * works a byte at a time, so the result doesn't depend on how the data is
+ * split up. Start with `RECOVER_JOURNAL_HASH_INIT`.
+ */
+uint64_t update_recover_journal_hash(uint64_t hash, const void* data, size_t num_bytes) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < num_bytes; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;  // FNV prime
+    }
+    return hash;
+}
+
+/**
+ * Update a journal hash with a range of bytes read from an output file.
+ *
+ * digests:     A set of content digests to update with the same data, or a
+ *      NULL pointer.
+ *
+ * RETURN VALUE:    `true` if the whole range could be read, else `false`.
+ */
+bool hash_output_range(int fd, uint64_t offset, uint64_t num_bytes, uint64_t* hash, digest_ctx_t* digests) {
+    size_t buffer_size = num_bytes < OUTPUT_MAX_COPY_BYTES ? num_bytes : OUTPUT_MAX_COPY_BYTES;
+    char* buffer = malloc(buffer_size ? buffer_size : 1);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success = true;
+    while (num_bytes != 0) {
+        size_t slice = num_bytes < buffer_size ? num_bytes : buffer_size;
+        if (!read_output_fd(fd, buffer, slice, offset)) {
+            success = false;
+            break;
+        }
+        *hash = update_recover_journal_hash(*hash, buffer, slice);
+        if (digests) {
+            update_digests(digests, buffer, slice);
+        }
+        offset += slice;
+        num_bytes -= slice;
+    }
+
+    free(buffer);
+    return success;
+}
+
+/**
+ * Compute the journal hash of a recovered file from its output file. Only
+ * the data that comes from the container is hashed, i.e. that of each
+ * extent that isn't sparse, in logical order and clipped to the file size;
+ * the hash of a file that is being written is computed in the same way.
+ *
+ * digests:     A set of content digests to update with the whole content of
+ *      the file, including any holes, or a NULL pointer.
+ *
+ * RETURN VALUE:    `true` if all of the data could be read, else `false`.
+ */
+bool hash_output_file_data(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, uint64_t* hash, digest_ctx_t* digests) {
+    *hash = RECOVER_JOURNAL_HASH_INIT;
+    uint64_t position = 0;
+    for (size_t i = 0; i < num_extents; i++) {
+        file_extent_t* extent = extents + i;
+        if (extent->phys_block_num == 0 || extent->logical_addr >= file_size) {
+            continue;
+        }
+        uint64_t extent_bytes = extent->length;
+        if (extent_bytes > file_size - extent->logical_addr) {
+            extent_bytes = file_size - extent->logical_addr;
+        }
+        if (digests && extent->logical_addr > position) {
+            update_digests_with_zeroes(digests, extent->logical_addr - position);
+        }
+        if (!hash_output_range(fd, extent->logical_addr, extent_bytes, hash, digests)) {
+            return false;
+        }
+        position = extent->logical_addr + extent_bytes;
+    }
+    if (digests && file_size > position) {
+        update_digests_with_zeroes(digests, file_size - position);
+    }
+    return true;
+}
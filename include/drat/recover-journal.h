@@ -0,0 +1,88 @@
+#ifndef DRAT_RECOVER_JOURNAL_H
+#define DRAT_RECOVER_JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <apfs/object.h>    // oid_t
+
+#include <drat/recover.h>   // file_extent_t
+
+#include <drat/func/digest.h>
+
+/**
+ * A recovery journal records which parts of a long-running recovery have
+ * been completed, so that if the recovery is interrupted, it can be resumed
+ * without reading those parts from the container again. This matters when
+ * the container is on a failing disk, where every read risks further damage.
+ *
+ * The journal of a recovery whose output is at `<path>` is kept at
+ * `<path>.drat-journal`, and is deleted once the recovery completes. It is a
+ * text file: a header line identifying the item being recovered, followed by
+ * one line per completed unit of work, each giving a key, a length, and a
+ * hash of the data that was written to the output, all in hexadecimal:
+ *
+ *      drat-recover-journal 1 <file-system object ID> <size>
+ *      <key> <length> <hash>
+ *      ...
+ *
+ * When recovering a single file, each unit is a range of the output file,
+ * keyed by its byte offset. When recovering a directory tree, each unit is a
+ * whole regular file, keyed by its file-system object ID, with the file's
+ * size as the length; the header gives the directory's object ID and a size
+ * of zero.
+ *
+ * Entries are only trusted once the output has been checked against their
+ * hash, so a journal that was flushed ahead of the output data it describes,
+ * or output that was modified afterwards, just causes the affected units to
+ * be recovered again. Lines that were only partly written when the recovery
+ * was interrupted are ignored.
+ */
+
+#define RECOVER_JOURNAL_MAGIC           "drat-recover-journal"
+#define RECOVER_JOURNAL_VERSION         1
+#define RECOVER_JOURNAL_SUFFIX          ".drat-journal"
+
+/** Minimum number of seconds between flushes of the journal to disk */
+#define RECOVER_JOURNAL_FLUSH_INTERVAL  5
+
+/** Size of each unit of work when recovering a single file */
+#define RECOVER_JOURNAL_RANGE_BYTES     (16 * 1024 * 1024)
+
+#define RECOVER_JOURNAL_HASH_INIT       0xcbf29ce484222325  // FNV-1a offset basis
+
+typedef struct {
+    uint64_t    key;
+    uint64_t    length;
+    uint64_t    hash;
+} recover_journal_entry_t;
+
+/**
+ * An open journal. `entries` holds the entries read from an existing journal
+ * when resuming, sorted by key; new entries are only appended to the file.
+ * Adding entries is thread-safe.
+ */
+typedef struct {
+    char*                       path;
+    FILE*                       file;
+    recover_journal_entry_t*    entries;
+    size_t                      num_entries;
+    time_t                      last_flush;
+    pthread_mutex_t             lock;
+} recover_journal_t;
+
+char* get_recover_journal_path(const char* output_path);
+recover_journal_t* open_recover_journal(const char* output_path, oid_t fs_oid, uint64_t size, bool resume, FILE* log);
+recover_journal_entry_t* find_recover_journal_entry(recover_journal_t* journal, uint64_t key);
+bool add_recover_journal_entry(recover_journal_t* journal, uint64_t key, uint64_t length, uint64_t hash);
+bool close_recover_journal(recover_journal_t* journal, bool completed);
+
+uint64_t update_recover_journal_hash(uint64_t hash, const void* data, size_t num_bytes);
+bool hash_output_range(int fd, uint64_t offset, uint64_t num_bytes, uint64_t* hash, digest_ctx_t* digests);
+bool hash_output_file_data(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, uint64_t* hash, digest_ctx_t* digests);
+
+#endif // DRAT_RECOVER_JOURNAL_H
@@ -0,0 +1,346 @@
+/**
+ * Functions used to recover a single file with a pipeline of reader threads
+ * and a writer; see `recover-pipeline.h` for details.
+ */
+
+#include "recover-pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <drat/io.h>
+#include <drat/output.h>
+
+/**
+ * A chunk of the output, which is either `length` bytes of data read from
+ * byte offset `in_offset` within the container, or, if `in_offset` is zero, a
+ * hole of `length` bytes. Holes aren't split up, since they need no buffer.
+ */
+typedef struct {
+    uint64_t    in_offset;
+    uint64_t    length;
+} recover_chunk_t;
+
+/**
+ * State shared between the reader threads and the writer. All fields other
+ * than `chunks` and `buffers` are protected by `lock`.
+ *
+ * buffer_chunks:   For each buffer, the index of the chunk that has been
+ *      read into it, plus one; zero if none has been read into it yet.
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      chunk_ready;
+    pthread_cond_t      buffer_free;
+
+    recover_chunk_t*    chunks;
+    size_t              num_chunks;
+    char*               buffers[RECOVER_PIPELINE_NUM_BUFFERS];
+    size_t              buffer_chunks[RECOVER_PIPELINE_NUM_BUFFERS];
+
+    size_t              next_read;
+    size_t              next_write;
+    bool                failed;
+
+    uint64_t            bytes_read;
+    double              last_read_time;
+    double              reader_wait_seconds;
+} recover_pipeline_t;
+
+static double get_monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Append a chunk to a growable array of chunks.
+ */
+static void add_recover_chunk(recover_chunk_t** chunks, size_t* num_chunks, size_t* capacity, uint64_t in_offset, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    // Merge adjacent holes
+    if (in_offset == 0 && *num_chunks != 0 && (*chunks)[*num_chunks - 1].in_offset == 0) {
+        (*chunks)[*num_chunks - 1].length += length;
+        return;
+    }
+
+    if (*num_chunks == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 256;
+        *chunks = realloc(*chunks, *capacity * sizeof(recover_chunk_t));
+        if (!*chunks) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `*chunks`.\n", __func__);
+            exit(-1);
+        }
+    }
+    (*chunks)[*num_chunks].in_offset    = in_offset;
+    (*chunks)[*num_chunks].length       = length;
+    (*num_chunks)++;
+}
+
+/**
+ * Split a range of a file into chunks, in logical order. This mirrors how
+ * `write_file_range_to_fd()` walks the file's extents.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_chunks` chunks. The caller must free this array when
+ *      it is no longer needed.
+ */
+static recover_chunk_t* get_recover_chunks(file_extent_t* extents, size_t num_extents, uint64_t file_size, uint64_t range_start, uint64_t range_length, size_t* num_chunks) {
+    recover_chunk_t* chunks = NULL;
+    size_t capacity = 0;
+    *num_chunks = 0;
+
+    if (range_start >= file_size) {
+        return chunks;
+    }
+    uint64_t range_end = file_size;
+    if (range_length < file_size - range_start) {
+        range_end = range_start + range_length;
+    }
+
+    uint64_t position = range_start;
+    for (size_t i = find_file_extent(extents, num_extents, range_start); i < num_extents && position < range_end; i++) {
+        file_extent_t* extent = extents + i;
+        if (extent->logical_addr >= range_end) {
+            break;
+        }
+        uint64_t extent_end = extent->logical_addr + extent->length;
+        if (extent_end <= position) {
+            fprintf(stderr, "\nERROR: %s: Extent %zu of %zu overlaps the previous one; skipping it.\n", __func__, i+1, num_extents);
+            continue;
+        }
+
+        if (extent->logical_addr > position) {
+            add_recover_chunk(&chunks, num_chunks, &capacity, 0, extent->logical_addr - position);
+            position = extent->logical_addr;
+        }
+
+        uint64_t num_bytes = (extent_end < range_end ? extent_end : range_end) - position;
+        if (extent->phys_block_num == 0) {
+            add_recover_chunk(&chunks, num_chunks, &capacity, 0, num_bytes);
+        } else {
+            uint64_t in_offset = extent->phys_block_num * nx_block_size + (position - extent->logical_addr);
+            for (uint64_t offset = 0; offset < num_bytes; offset += RECOVER_PIPELINE_CHUNK_BYTES) {
+                uint64_t chunk_bytes = num_bytes - offset;
+                if (chunk_bytes > RECOVER_PIPELINE_CHUNK_BYTES) {
+                    chunk_bytes = RECOVER_PIPELINE_CHUNK_BYTES;
+                }
+                add_recover_chunk(&chunks, num_chunks, &capacity, in_offset + offset, chunk_bytes);
+            }
+        }
+        position += num_bytes;
+    }
+    add_recover_chunk(&chunks, num_chunks, &capacity, 0, range_end - position);
+
+    return chunks;
+}
+
+static void* recover_pipeline_reader(void* arg) {
+    recover_pipeline_t* pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->failed && pipeline->next_read < pipeline->num_chunks) {
+        size_t chunk_index = pipeline->next_read++;
+        size_t buffer_index = chunk_index % RECOVER_PIPELINE_NUM_BUFFERS;
+        recover_chunk_t* chunk = pipeline->chunks + chunk_index;
+
+        // Wait until the writer has finished with the chunk that last used
+        // this chunk's buffer
+        double wait_start = get_monotonic_seconds();
+        while (!pipeline->failed && chunk_index >= pipeline->next_write + RECOVER_PIPELINE_NUM_BUFFERS) {
+            pthread_cond_wait(&pipeline->buffer_free, &pipeline->lock);
+        }
+        pipeline->reader_wait_seconds += get_monotonic_seconds() - wait_start;
+        if (pipeline->failed) {
+            break;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        bool success = true;
+        if (chunk->in_offset != 0) {
+            success = pread_bytes(pipeline->buffers[buffer_index], chunk->in_offset, chunk->length) == chunk->length;
+            if (!success) {
+                fprintf(stderr, "\nERROR: %s: Could not read %"PRIu64" bytes at byte offset %#"PRIx64".\n", __func__, chunk->length, chunk->in_offset);
+            }
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (success) {
+            pipeline->buffer_chunks[buffer_index] = chunk_index + 1;
+            if (chunk->in_offset != 0) {
+                pipeline->bytes_read += chunk->length;
+            }
+            pipeline->last_read_time = get_monotonic_seconds();
+        } else {
+            pipeline->failed = true;
+            pthread_cond_broadcast(&pipeline->buffer_free);
+        }
+        pthread_cond_broadcast(&pipeline->chunk_ready);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/**
+ * Write a range of bytes of a file's data to the current position of a file
+ * descriptor, like `write_file_range_to_fd()`, but with reads from the
+ * container done by a pool of reader threads ahead of the writes.
+ *
+ * num_readers:     The number of reader threads.
+ *
+ * digests:     A set of content digests to update with the data as it is
+ *      written, or a NULL pointer.
+ *
+ * stats:   Set to the throughput of each stage.
+ *
+ * RETURN VALUE:    `true` if all of the data was written, else `false`, in
+ *              which case an explanation is printed to stderr.
+ */
+bool recover_file_pipelined(
+    int                         fd,
+    file_extent_t*              extents,
+    size_t                      num_extents,
+    uint64_t                    file_size,
+    uint64_t                    range_start,
+    uint64_t                    range_length,
+    bool                        skip_zero_blocks,
+    uint32_t                    num_readers,
+    digest_ctx_t*               digests,
+    recover_pipeline_stats_t*   stats
+) {
+    memset(stats, 0, sizeof(recover_pipeline_stats_t));
+    double start_time = get_monotonic_seconds();
+
+    recover_pipeline_t pipeline = {
+        .lock           = PTHREAD_MUTEX_INITIALIZER,
+        .chunk_ready    = PTHREAD_COND_INITIALIZER,
+        .buffer_free    = PTHREAD_COND_INITIALIZER,
+        .last_read_time = start_time,
+    };
+    pipeline.chunks = get_recover_chunks(extents, num_extents, file_size, range_start, range_length, &pipeline.num_chunks);
+
+    for (size_t i = 0; i < RECOVER_PIPELINE_NUM_BUFFERS && i < pipeline.num_chunks; i++) {
+        pipeline.buffers[i] = malloc(RECOVER_PIPELINE_CHUNK_BYTES);
+        if (!pipeline.buffers[i]) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `pipeline.buffers[i]`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    if (num_readers == 0) {
+        num_readers = 1;
+    }
+    if (num_readers > RECOVER_PIPELINE_MAX_READERS) {
+        num_readers = RECOVER_PIPELINE_MAX_READERS;
+    }
+    if (num_readers > pipeline.num_chunks) {
+        num_readers = pipeline.num_chunks ? pipeline.num_chunks : 1;
+    }
+
+    pthread_t threads[RECOVER_PIPELINE_MAX_READERS];
+    uint32_t num_started = 0;
+    for (; num_started < num_readers; num_started++) {
+        if (pthread_create(threads + num_started, NULL, recover_pipeline_reader, &pipeline) != 0) {
+            break;
+        }
+    }
+    if (num_started == 0 && pipeline.num_chunks != 0) {
+        fprintf(stderr, "\nERROR: %s: Could not start any reader threads.\n", __func__);
+        pipeline.failed = true;
+    }
+
+    // Drain the ring in logical order
+    bool success = !pipeline.failed;
+    for (size_t chunk_index = 0; success && chunk_index < pipeline.num_chunks; chunk_index++) {
+        size_t buffer_index = chunk_index % RECOVER_PIPELINE_NUM_BUFFERS;
+        recover_chunk_t* chunk = pipeline.chunks + chunk_index;
+
+        double wait_start = get_monotonic_seconds();
+        pthread_mutex_lock(&pipeline.lock);
+        while (!pipeline.failed && pipeline.buffer_chunks[buffer_index] != chunk_index + 1) {
+            pthread_cond_wait(&pipeline.chunk_ready, &pipeline.lock);
+        }
+        success = !pipeline.failed;
+        pthread_mutex_unlock(&pipeline.lock);
+        double write_start = get_monotonic_seconds();
+        stats->writer_wait_seconds += write_start - wait_start;
+        if (!success) {
+            break;
+        }
+
+        if (digests) {
+            if (chunk->in_offset == 0) {
+                update_digests_with_zeroes(digests, chunk->length);
+            } else {
+                update_digests(digests, pipeline.buffers[buffer_index], chunk->length);
+            }
+        }
+
+        if (chunk->in_offset == 0) {
+            success = skip_output_hole(fd, chunk->length);
+        } else if (skip_zero_blocks) {
+            success = append_output_skipping_zero_blocks(fd, pipeline.buffers[buffer_index], chunk->length, nx_block_size);
+        } else {
+            success = append_output_fd(fd, pipeline.buffers[buffer_index], chunk->length);
+        }
+        if (success) {
+            stats->bytes_written += chunk->length;
+        }
+        stats->write_seconds += get_monotonic_seconds() - write_start;
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.next_write++;
+        if (!success) {
+            pipeline.failed = true;
+        }
+        pthread_cond_broadcast(&pipeline.buffer_free);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+    if (success) {
+        success = finish_output_holes(fd);
+    }
+
+    for (uint32_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    stats->num_readers          = num_started;
+    stats->bytes_read           = pipeline.bytes_read;
+    stats->read_seconds         = pipeline.last_read_time - start_time;
+    stats->reader_wait_seconds  = pipeline.reader_wait_seconds;
+
+    for (size_t i = 0; i < RECOVER_PIPELINE_NUM_BUFFERS; i++) {
+        free(pipeline.buffers[i]);
+    }
+    free(pipeline.chunks);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.chunk_ready);
+    pthread_cond_destroy(&pipeline.buffer_free);
+
+    return success;
+}
+
+/**
+ * Print the throughput of each stage of a pipelined recovery.
+ */
+void print_recover_pipeline_stats(FILE* stream, recover_pipeline_stats_t* stats) {
+    double megabytes_read       = stats->bytes_read     / 1e6;
+    double megabytes_written    = stats->bytes_written  / 1e6;
+    fprintf(
+        stream,
+        "Read %.1f MB with %"PRIu32" threads in %.2f s (%.1f MB/s); wrote %.1f MB in %.2f s (%.1f MB/s).\n"
+        "The writer waited %.2f s for data, and the readers waited %.2f s in total for free buffers.\n",
+        megabytes_read, stats->num_readers, stats->read_seconds,
+        stats->read_seconds > 0 ? megabytes_read / stats->read_seconds : 0,
+        megabytes_written, stats->write_seconds,
+        stats->write_seconds > 0 ? megabytes_written / stats->write_seconds : 0,
+        stats->writer_wait_seconds, stats->reader_wait_seconds
+    );
+}
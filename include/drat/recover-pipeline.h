@@ -0,0 +1,72 @@
+#ifndef DRAT_RECOVER_PIPELINE_H
+#define DRAT_RECOVER_PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <drat/recover.h>   // file_extent_t
+
+#include <drat/func/digest.h>
+
+/**
+ * Pipelined recovery of a single file, so that the container and the output
+ * are kept busy at the same time rather than alternately.
+ *
+ * The requested range of the file is split into chunks of at most
+ * `RECOVER_PIPELINE_CHUNK_BYTES`, each of which is either data to be read
+ * from the container or a hole. Reader threads claim chunks in logical order
+ * and read them into a ring of `RECOVER_PIPELINE_NUM_BUFFERS` buffers, so
+ * several chunks of a large file are read in parallel. The calling thread
+ * acts as the writer, draining the ring in logical order; a reader that gets
+ * too far ahead of the writer waits for its buffer to be freed, which bounds
+ * memory use to the size of the ring. Since the writer sees the data in
+ * logical order, it can also compute content digests of it as it goes.
+ */
+
+#define RECOVER_PIPELINE_CHUNK_BYTES    (1024 * 1024)
+#define RECOVER_PIPELINE_NUM_BUFFERS    32
+#define RECOVER_PIPELINE_MAX_READERS    64
+
+/**
+ * Throughput of each stage of the pipeline.
+ *
+ * read_seconds:    Wall-clock time from the start of the recovery until the
+ *      last chunk was read.
+ *
+ * write_seconds:   Time that the writer spent writing, excluding the time it
+ *      spent waiting for chunks to be read.
+ *
+ * reader_wait_seconds:     Total time that readers spent waiting for a free
+ *      buffer, i.e. for the writer; a large value means that the output is the
+ *      bottleneck.
+ *
+ * writer_wait_seconds:     Time that the writer spent waiting for chunks to be
+ *      read; a large value means that the container is the bottleneck.
+ */
+typedef struct {
+    uint32_t    num_readers;
+    uint64_t    bytes_read;
+    uint64_t    bytes_written;
+    double      read_seconds;
+    double      write_seconds;
+    double      reader_wait_seconds;
+    double      writer_wait_seconds;
+} recover_pipeline_stats_t;
+
+bool recover_file_pipelined(
+    int                         fd,
+    file_extent_t*              extents,
+    size_t                      num_extents,
+    uint64_t                    file_size,
+    uint64_t                    range_start,
+    uint64_t                    range_length,
+    bool                        skip_zero_blocks,
+    uint32_t                    num_readers,
+    digest_ctx_t*               digests,
+    recover_pipeline_stats_t*   stats
+);
+void print_recover_pipeline_stats(FILE* stream, recover_pipeline_stats_t* stats);
+
+#endif // DRAT_RECOVER_PIPELINE_H
@@ -0,0 +1,678 @@
+/**
+ * Functions used to recover a whole directory tree as a tar archive; see
+ * `recover-tar.h` for details.
+ */
+
+#include "recover-tar.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/j.h>
+#include <apfs/jconst.h>
+
+#include <drat/io.h>
+#include <drat/decmpfs.h>
+#include <drat/output.h>
+#include <drat/recover.h>
+
+#include <drat/func/btree.h>
+#include <drat/func/j.h>
+
+/**
+ * A ustar header block, as defined by POSIX. Numeric fields are octal
+ * strings, terminated by a NUL character.
+ */
+typedef struct {
+    char    name[100];
+    char    mode[8];
+    char    uid[8];
+    char    gid[8];
+    char    size[12];
+    char    mtime[12];
+    char    chksum[8];
+    char    typeflag;
+    char    linkname[100];
+    char    magic[6];
+    char    version[2];
+    char    uname[32];
+    char    gname[32];
+    char    devmajor[8];
+    char    devminor[8];
+    char    prefix[155];
+    char    padding[12];
+} tar_header_t;
+
+#define TAR_TYPE_REGULAR    '0'
+#define TAR_TYPE_HARDLINK   '1'
+#define TAR_TYPE_SYMLINK    '2'
+#define TAR_TYPE_DIRECTORY  '5'
+#define TAR_TYPE_PAX        'x'
+
+/**
+ * A regular file with more than one link, which has already been written to
+ * the archive under `path`.
+ */
+typedef struct {
+    oid_t   fs_oid;
+    char*   path;
+} tar_link_t;
+
+typedef struct {
+    btree_node_phys_t*      fs_omap_btree;
+    btree_node_phys_t*      fs_root_btree;
+    recover_tar_stats_t*    stats;
+    uint32_t                num_threads;
+
+    int         fd;
+    char*       buffer;
+    size_t      buffer_used;
+    uint64_t    bytes_written;
+    bool        write_failed;
+
+    /** Open-addressed hash table of `links_capacity` entries, keyed by OID */
+    tar_link_t* links;
+    size_t      num_links;
+    size_t      links_capacity;
+} tar_walk_t;
+
+/**
+ * Write out the contents of the output buffer.
+ */
+static bool flush_tar_buffer(tar_walk_t* walk) {
+    if (walk->write_failed) {
+        return false;
+    }
+    if (walk->buffer_used != 0 && !append_output_fd(walk->fd, walk->buffer, walk->buffer_used)) {
+        walk->write_failed = true;
+        return false;
+    }
+    walk->bytes_written += walk->buffer_used;
+    walk->buffer_used = 0;
+    return true;
+}
+
+/**
+ * Append bytes to the archive via the output buffer. If `data` is a NULL
+ * pointer, zeroes are appended instead.
+ */
+static bool write_tar_bytes(tar_walk_t* walk, const void* data, uint64_t num_bytes) {
+    const char* bytes = data;
+    while (num_bytes != 0) {
+        if (walk->buffer_used == RECOVER_TAR_BUFFER_BYTES && !flush_tar_buffer(walk)) {
+            return false;
+        }
+        size_t chunk = RECOVER_TAR_BUFFER_BYTES - walk->buffer_used;
+        if (chunk > num_bytes) {
+            chunk = num_bytes;
+        }
+        if (bytes) {
+            memcpy(walk->buffer + walk->buffer_used, bytes, chunk);
+            bytes += chunk;
+        } else {
+            memset(walk->buffer + walk->buffer_used, 0, chunk);
+        }
+        walk->buffer_used += chunk;
+        num_bytes -= chunk;
+    }
+    return !walk->write_failed;
+}
+
+/**
+ * Append zeroes to the archive up to the next multiple of `alignment` bytes.
+ */
+static bool pad_tar_output(tar_walk_t* walk, uint64_t alignment) {
+    uint64_t position = walk->bytes_written + walk->buffer_used;
+    return write_tar_bytes(walk, NULL, (alignment - position % alignment) % alignment);
+}
+
+/**
+ * Append data from the container to the archive, reading it directly into
+ * the output buffer. If the data can't be read, zeroes are written in its
+ * place, so that the archive remains well-formed.
+ *
+ * read_failed:     Set to `true` if any of the data couldn't be read.
+ *
+ * RETURN VALUE:    `false` if writing to the archive failed, else `true`.
+ */
+static bool copy_tar_data(tar_walk_t* walk, uint64_t in_offset, uint64_t num_bytes, bool* read_failed) {
+    while (num_bytes != 0) {
+        if (walk->buffer_used == RECOVER_TAR_BUFFER_BYTES && !flush_tar_buffer(walk)) {
+            return false;
+        }
+        size_t chunk = RECOVER_TAR_BUFFER_BYTES - walk->buffer_used;
+        if (chunk > num_bytes) {
+            chunk = num_bytes;
+        }
+        size_t num_read = pread_bytes(walk->buffer + walk->buffer_used, in_offset, chunk);
+        if (num_read != chunk) {
+            memset(walk->buffer + walk->buffer_used + num_read, 0, chunk - num_read);
+            *read_failed = true;
+        }
+        walk->buffer_used += chunk;
+        in_offset += chunk;
+        num_bytes -= chunk;
+    }
+    return !walk->write_failed;
+}
+
+/**
+ * Append a file's data to the archive in logical order, with zeroes for
+ * sparse extents and gaps between extents, followed by padding to a whole
+ * number of blocks. Exactly `file_size` bytes of data are written.
+ *
+ * read_failed:     Set to `true` if any of the data couldn't be read.
+ *
+ * RETURN VALUE:    `false` if writing to the archive failed, else `true`.
+ */
+static bool write_tar_file_data(tar_walk_t* walk, file_extent_t* extents, size_t num_extents, uint64_t file_size, bool* read_failed) {
+    uint64_t position = 0;
+    for (size_t i = 0; i < num_extents && position < file_size; i++) {
+        file_extent_t* extent = extents + i;
+        if (extent->logical_addr >= file_size) {
+            break;
+        }
+        uint64_t extent_end = extent->logical_addr + extent->length;
+        if (extent_end <= position) {
+            continue;
+        }
+        if (extent_end > file_size) {
+            extent_end = file_size;
+        }
+
+        if (extent->logical_addr > position) {
+            if (!write_tar_bytes(walk, NULL, extent->logical_addr - position)) {
+                return false;
+            }
+            position = extent->logical_addr;
+        }
+
+        bool success = extent->phys_block_num == 0
+            ? write_tar_bytes(walk, NULL, extent_end - position)
+            : copy_tar_data(walk, extent->phys_block_num * nx_block_size + (position - extent->logical_addr), extent_end - position, read_failed);
+        if (!success) {
+            return false;
+        }
+        position = extent_end;
+    }
+
+    return write_tar_bytes(walk, NULL, file_size - position) && pad_tar_output(walk, RECOVER_TAR_BLOCK_SIZE);
+}
+
+/**
+ * Append decompressed data to the archive; see `decompress_decmpfs_file()`.
+ */
+static bool write_tar_decompressed_data(void* context, const void* data, size_t num_bytes) {
+    return write_tar_bytes(context, data, num_bytes);
+}
+
+/**
+ * Determine whether a value fits in an octal field of a ustar header, which
+ * holds one fewer digits than its length, to leave room for a terminator.
+ */
+static bool fits_tar_field(uint64_t value, size_t field_len) {
+    return (field_len - 1) * 3 >= 64 || value < (UINT64_C(1) << ((field_len - 1) * 3));
+}
+
+static void set_tar_field(char* field, size_t field_len, uint64_t value) {
+    snprintf(field, field_len, "%0*"PRIo64"", (int)(field_len - 1), value);
+}
+
+/**
+ * Append a record to the data of a pax extended header. Each record is of
+ * the form `<length> <key>=<value>\n`, where the length counts itself.
+ */
+static void add_pax_record(char** records, size_t* records_len, const char* key, const char* value) {
+    size_t base_len = strlen(key) + strlen(value) + 3;  // Space, `=`, and newline
+    size_t len = base_len + 1;
+    for (;;) {
+        size_t num_digits = 1;
+        for (size_t n = len; n >= 10; n /= 10) {
+            num_digits++;
+        }
+        if (base_len + num_digits == len) {
+            break;
+        }
+        len = base_len + num_digits;
+    }
+
+    *records = realloc(*records, *records_len + len + 1);
+    if (!*records) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `*records`.\n", __func__);
+        exit(-1);
+    }
+    sprintf(*records + *records_len, "%zu %s=%s\n", len, key, value);
+    *records_len += len;
+}
+
+/**
+ * Split a path between the `prefix` and `name` fields of a ustar header.
+ *
+ * RETURN VALUE:    `true` if the path fits, else `false`.
+ */
+static bool set_tar_path(tar_header_t* header, const char* path) {
+    size_t len = strlen(path);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, path, len);
+        return true;
+    }
+
+    // Split at a slash such that both parts fit, ignoring a trailing slash
+    for (size_t i = len - 1; i > 0; i--) {
+        if (path[i] != '/' || i == len - 1) {
+            continue;
+        }
+        if (len - i - 1 > sizeof(header->name)) {
+            return false;
+        }
+        if (i <= sizeof(header->prefix)) {
+            memcpy(header->prefix, path, i);
+            memcpy(header->name, path + i + 1, len - i - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Append the header of an item to the archive, preceded by a pax extended
+ * header if any of its fields don't fit in a ustar header.
+ *
+ * linkname:    The target of a symbolic or hard link, or a NULL pointer.
+ */
+static bool write_tar_header(tar_walk_t* walk, char typeflag, const char* path, const char* linkname, j_inode_val_t* inode, uint64_t size) {
+    tar_header_t header;
+    memset(&header, 0, sizeof(header));
+    char* records = NULL;
+    size_t records_len = 0;
+    char number[32];
+
+    if (!set_tar_path(&header, path)) {
+        add_pax_record(&records, &records_len, "path", path);
+        strncpy(header.name, path, sizeof(header.name));
+    }
+    if (linkname) {
+        if (strlen(linkname) > sizeof(header.linkname)) {
+            add_pax_record(&records, &records_len, "linkpath", linkname);
+        }
+        strncpy(header.linkname, linkname, sizeof(header.linkname));
+    }
+
+    if (!fits_tar_field(size, sizeof(header.size))) {
+        sprintf(number, "%"PRIu64"", size);
+        add_pax_record(&records, &records_len, "size", number);
+        size = 0;
+    }
+    uint64_t uid = inode->owner;
+    uint64_t gid = inode->group;
+    if (!fits_tar_field(uid, sizeof(header.uid))) {
+        sprintf(number, "%"PRIu64"", uid);
+        add_pax_record(&records, &records_len, "uid", number);
+        uid = 0;
+    }
+    if (!fits_tar_field(gid, sizeof(header.gid))) {
+        sprintf(number, "%"PRIu64"", gid);
+        add_pax_record(&records, &records_len, "gid", number);
+        gid = 0;
+    }
+
+    set_tar_field(header.mode,  sizeof(header.mode),    inode->mode & 07777);
+    set_tar_field(header.uid,   sizeof(header.uid),     uid);
+    set_tar_field(header.gid,   sizeof(header.gid),     gid);
+    set_tar_field(header.size,  sizeof(header.size),    size);
+    set_tar_field(header.mtime, sizeof(header.mtime),   inode->mod_time / 1000000000);
+    header.typeflag = typeflag;
+    memcpy(header.magic,    "ustar",    sizeof(header.magic));
+    memcpy(header.version,  "00",       sizeof(header.version));
+
+    if (records) {
+        tar_header_t pax_header = header;
+        memset(pax_header.name,     0, sizeof(pax_header.name));
+        memset(pax_header.prefix,   0, sizeof(pax_header.prefix));
+        memset(pax_header.linkname, 0, sizeof(pax_header.linkname));
+        strcpy(pax_header.name, "././@PaxHeader");
+        set_tar_field(pax_header.size, sizeof(pax_header.size), records_len);
+        pax_header.typeflag = TAR_TYPE_PAX;
+
+        memset(pax_header.chksum, ' ', sizeof(pax_header.chksum));
+        uint32_t checksum = 0;
+        for (size_t i = 0; i < sizeof(pax_header); i++) {
+            checksum += ((unsigned char*)&pax_header)[i];
+        }
+        snprintf(pax_header.chksum, sizeof(pax_header.chksum), "%06"PRIo32"", checksum);
+
+        bool success = write_tar_bytes(walk, &pax_header, sizeof(pax_header))
+            && write_tar_bytes(walk, records, records_len)
+            && pad_tar_output(walk, RECOVER_TAR_BLOCK_SIZE);
+        free(records);
+        if (!success) {
+            return false;
+        }
+    }
+
+    // The checksum is computed with the checksum field set to spaces
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        checksum += ((unsigned char*)&header)[i];
+    }
+    snprintf(header.chksum, sizeof(header.chksum), "%06"PRIo32"", checksum);
+
+    return write_tar_bytes(walk, &header, sizeof(header));
+}
+
+static size_t get_tar_link_index(tar_walk_t* walk, oid_t fs_oid) {
+    size_t mask = walk->links_capacity - 1;
+    size_t i = (fs_oid * UINT64_C(0x9e3779b97f4a7c15)) >> 32 & mask;
+    while (walk->links[i].path && walk->links[i].fs_oid != fs_oid) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * Look up the path under which a file with more than one link was first
+ * written to the archive, recording `path` as that path if it hasn't been
+ * written yet.
+ *
+ * RETURN VALUE:
+ *      The earlier path, or a NULL pointer if this is the first time.
+ */
+static const char* find_tar_link(tar_walk_t* walk, oid_t fs_oid, const char* path) {
+    if (walk->links_capacity != 0) {
+        tar_link_t* link = walk->links + get_tar_link_index(walk, fs_oid);
+        if (link->path) {
+            return link->path;
+        }
+    }
+
+    // Keep the table at most half full
+    if (2 * (walk->num_links + 1) > walk->links_capacity) {
+        tar_link_t* old_links = walk->links;
+        size_t old_capacity = walk->links_capacity;
+        walk->links_capacity = old_capacity ? 2 * old_capacity : 1024;
+        walk->links = calloc(walk->links_capacity, sizeof(tar_link_t));
+        if (!walk->links) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `walk->links`.\n", __func__);
+            exit(-1);
+        }
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_links[i].path) {
+                walk->links[get_tar_link_index(walk, old_links[i].fs_oid)] = old_links[i];
+            }
+        }
+        free(old_links);
+    }
+
+    tar_link_t* link = walk->links + get_tar_link_index(walk, fs_oid);
+    link->fs_oid = fs_oid;
+    link->path = strdup(path);
+    if (!link->path) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `link->path`.\n", __func__);
+        exit(-1);
+    }
+    walk->num_links++;
+    return NULL;
+}
+
+/**
+ * Determine whether a file may have more than one link, either according to
+ * its link count or because it has sibling-link records. Only such files are
+ * remembered in order to detect hard links, so that the table stays small.
+ */
+static bool has_multiple_links(j_rec_t** fs_records, j_inode_val_t* inode) {
+    if (inode->nlink > 1) {
+        return true;
+    }
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_key_t* hdr = (*fs_rec_cursor)->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_SIBLING_LINK ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A directory entry, copied out of the directory's file-system records so
+ * that they can be freed before its subdirectories are walked.
+ */
+typedef struct {
+    char*       name;
+    oid_t       fs_oid;
+    uint16_t    type;
+} tar_dentry_t;
+
+/**
+ * Append the item with a given file-system object ID to the archive,
+ * recursing into it if it is a directory.
+ *
+ * type:    The item's type, as stated by the dentry that refers to it, i.e.
+ *      one of the `DT_*` constants.
+ *
+ * path:    The item's path within the archive.
+ *
+ * RETURN VALUE:    `false` if writing to the archive failed, else `true`.
+ *      Problems with individual items are counted and reported on stderr.
+ */
+static bool walk_tar_item(tar_walk_t* walk, oid_t fs_oid, uint16_t type, const char* path) {
+    recover_tar_stats_t* stats = walk->stats;
+
+    if (type != DT_DIR && type != DT_REG && type != DT_LNK) {
+        fprintf(stderr, "- `%s` is not a directory, regular file, or symbolic link; skipping it.\n", path);
+        stats->num_skipped++;
+        return true;
+    }
+
+    j_rec_t** fs_records = get_fs_records(walk->fs_omap_btree, walk->fs_root_btree, fs_oid, (xid_t)(~0) );
+    if (!fs_records) {
+        fprintf(stderr, "- No records found with OID %#"PRIx64" for `%s`; skipping it.\n", fs_oid, path);
+        stats->num_failed++;
+        return true;
+    }
+
+    uint16_t inode_len = 0;
+    j_inode_val_t* inode = get_inode_from_fs_records(fs_records, &inode_len);
+    if (!inode) {
+        fprintf(stderr, "- No inode found with OID %#"PRIx64" for `%s`; skipping it.\n", fs_oid, path);
+        free_j_rec_array(fs_records);
+        stats->num_failed++;
+        return true;
+    }
+
+    if (type == DT_REG) {
+        const char* link_path = has_multiple_links(fs_records, inode) ? find_tar_link(walk, fs_oid, path) : NULL;
+        if (link_path) {
+            bool success = write_tar_header(walk, TAR_TYPE_HARDLINK, path, link_path, inode, 0);
+            free_j_rec_array(fs_records);
+            stats->num_hardlinks++;
+            return success;
+        }
+
+        uint64_t file_size = inode_len == sizeof(j_inode_val_t) ? 0 : get_file_size(inode, inode_len);
+        size_t num_extents = 0;
+        file_extent_t* extents = get_file_extents_from_fs_records(fs_records, &num_extents);
+        decmpfs_file_t* compressed = get_decmpfs_file(walk->fs_omap_btree, walk->fs_root_btree, fs_records);
+        bool read_failed = false;
+        bool success;
+        if (compressed) {
+            // The archive holds the decompressed data
+            file_size = compressed->size;
+            success = write_tar_header(walk, TAR_TYPE_REGULAR, path, NULL, inode, file_size);
+            if (success && !decompress_decmpfs_file(compressed, walk->num_threads, write_tar_decompressed_data, walk, path)) {
+                success = !walk->write_failed;
+                read_failed = success;
+            }
+            success = success && pad_tar_output(walk, RECOVER_TAR_BLOCK_SIZE);
+            free_decmpfs_file(compressed);
+        } else {
+            success = write_tar_header(walk, TAR_TYPE_REGULAR, path, NULL, inode, file_size)
+                && write_tar_file_data(walk, extents, num_extents, file_size, &read_failed);
+        }
+        free(extents);
+        free_j_rec_array(fs_records);
+
+        if (read_failed) {
+            fprintf(stderr, "- Could not read all of the data of `%s`; the missing parts are zeroes in the archive.\n", path);
+            stats->num_failed++;
+        } else {
+            stats->num_files++;
+            stats->num_bytes += file_size;
+        }
+        return success;
+    }
+
+    if (type == DT_LNK) {
+        char* target = get_symlink_target_from_fs_records(fs_records);
+        bool success = true;
+        if (!target) {
+            fprintf(stderr, "- Could not find the target of the symbolic link `%s`; skipping it.\n", path);
+            stats->num_failed++;
+        } else {
+            success = write_tar_header(walk, TAR_TYPE_SYMLINK, path, target, inode, 0);
+            stats->num_symlinks++;
+        }
+        free_j_rec_array(fs_records);
+        return success;
+    }
+
+    // The item is a directory, whose entry in the archive ends with a slash
+    char* dir_path = NULL;
+    if (asprintf(&dir_path, "%s/", path) == -1) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dir_path`.\n", __func__);
+        exit(-1);
+    }
+    bool success = write_tar_header(walk, TAR_TYPE_DIRECTORY, dir_path, NULL, inode, 0);
+    free(dir_path);
+    stats->num_directories++;
+
+    size_t num_dentries = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_key_t* hdr = (*fs_rec_cursor)->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
+            num_dentries++;
+        }
+    }
+
+    tar_dentry_t* dentries = malloc((num_dentries + 1) * sizeof(tar_dentry_t));
+    if (!dentries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dentries`.\n", __func__);
+        exit(-1);
+    }
+
+    size_t i = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
+            j_drec_hashed_key_t* key = fs_rec->data;
+            j_drec_val_t* val = fs_rec->data + fs_rec->key_len;
+            // The name's length includes its NUL terminator, which a corrupt
+            // record may lack, so the name is bounded by the record too
+            size_t max_name_len = fs_rec->key_len > sizeof(j_drec_hashed_key_t) ? fs_rec->key_len - sizeof(j_drec_hashed_key_t) : 0;
+            size_t name_len = key->name_len_and_hash & J_DREC_LEN_MASK;
+            if (name_len > max_name_len) {
+                name_len = max_name_len;
+            }
+            dentries[i].name = strndup((char*)key->name, name_len);
+            if (!dentries[i].name) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dentries[i].name`.\n", __func__);
+                exit(-1);
+            }
+            dentries[i].fs_oid  = val->file_id;
+            dentries[i].type    = val->flags & DREC_TYPE_MASK;
+            i++;
+        }
+    }
+    free_j_rec_array(fs_records);
+
+    for (i = 0; i < num_dentries; i++) {
+        if (success && !is_safe_output_name(dentries[i].name)) {
+            fprintf(stderr, "- The directory `%s` has an entry with the invalid name `%s`; skipping it.\n", path, dentries[i].name);
+            stats->num_failed++;
+        } else if (success) {
+            char* child_path = NULL;
+            if (asprintf(&child_path, "%s/%s", path, dentries[i].name) == -1) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `child_path`.\n", __func__);
+                exit(-1);
+            }
+            success = walk_tar_item(walk, dentries[i].fs_oid, dentries[i].type, child_path);
+            free(child_path);
+        }
+        free(dentries[i].name);
+    }
+    free(dentries);
+    return success;
+}
+
+/**
+ * Write a directory and everything within it to a file descriptor as a tar
+ * archive.
+ *
+ * dir_oid:     The file-system object ID of the directory.
+ *
+ * root_name:   The path of the directory within the archive, e.g. `john`;
+ *      every other item's path within the archive starts with this.
+ *
+ * fd:  The file descriptor to write the archive to, e.g. that of stdout.
+ *
+ * num_threads:     The number of threads used to decompress each compressed
+ *      file's data.
+ *
+ * log:     The stream that progress messages are written to.
+ *
+ * stats:   Set to the number of items written, skipped, and failed.
+ *
+ * RETURN VALUE:
+ *      `true` if every item was recovered, else `false`. If an item's data
+ *      can't be read, zeroes are written in its place and the others are
+ *      still recovered; if writing the archive fails, it is abandoned.
+ */
+bool recover_tree_as_tar(
+    btree_node_phys_t*      fs_omap_btree,
+    btree_node_phys_t*      fs_root_btree,
+    oid_t                   dir_oid,
+    const char*             root_name,
+    int                     fd,
+    uint32_t                num_threads,
+    FILE*                   log,
+    recover_tar_stats_t*    stats
+) {
+    memset(stats, 0, sizeof(recover_tar_stats_t));
+
+    tar_walk_t walk = {
+        .fs_omap_btree  = fs_omap_btree,
+        .fs_root_btree  = fs_root_btree,
+        .stats          = stats,
+        .num_threads    = num_threads,
+        .fd             = fd,
+    };
+    walk.buffer = malloc(RECOVER_TAR_BUFFER_BYTES);
+    if (!walk.buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `walk.buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    fprintf(log, "Writing the directory tree as a tar archive ... ");
+    bool success = walk_tar_item(&walk, dir_oid, DT_DIR, root_name);
+
+    // The archive ends with two zeroed blocks, padded to a whole record
+    success = success
+        && write_tar_bytes(&walk, NULL, 2 * RECOVER_TAR_BLOCK_SIZE)
+        && pad_tar_output(&walk, RECOVER_TAR_RECORD_SIZE)
+        && flush_tar_buffer(&walk);
+    if (success) {
+        fprintf(log, "OK.\n");
+    } else {
+        fprintf(stderr, "\nERROR: %s: Could not write the archive; it is incomplete.\n", __func__);
+    }
+
+    for (size_t i = 0; i < walk.links_capacity; i++) {
+        free(walk.links[i].path);
+    }
+    free(walk.links);
+    free(walk.buffer);
+
+    return success && stats->num_failed == 0;
+}
@@ -0,0 +1,57 @@
+#ifndef DRAT_RECOVER_TAR_H
+#define DRAT_RECOVER_TAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <apfs/object.h>    // oid_t
+#include <apfs/btree.h>
+
+/**
+ * Recovery of a whole directory tree as a POSIX tar archive (pax interchange
+ * format), written to a file descriptor such as stdout, so that it can be
+ * piped into a compressor or to another host without creating any files
+ * locally.
+ *
+ * The tree is walked depth-first, and each item is written as soon as it is
+ * encountered: directories, regular files with their data, symbolic links,
+ * and hard links. Items are written as plain ustar entries, preceded by a pax
+ * extended header only when a path, link target, size, or ID doesn't fit in
+ * the ustar fields. A regular file with more than one link, according to its
+ * link count or its sibling links, is written in full the first time that its
+ * inode is encountered, and as a hard link to that entry every later time.
+ *
+ * Output is gathered into a buffer of `RECOVER_TAR_BUFFER_BYTES` and written
+ * in large writes. File data is read from the container straight into that
+ * buffer, so at most one buffer's worth of any file's data is held in memory.
+ * Transparently compressed files are written with their decompressed data,
+ * whose chunks are decompressed by `num_threads` threads.
+ */
+
+#define RECOVER_TAR_BLOCK_SIZE      512
+#define RECOVER_TAR_RECORD_SIZE     (20 * RECOVER_TAR_BLOCK_SIZE)
+#define RECOVER_TAR_BUFFER_BYTES    (4 * 1024 * 1024)
+
+typedef struct {
+    uint64_t    num_directories;
+    uint64_t    num_files;
+    uint64_t    num_hardlinks;
+    uint64_t    num_symlinks;
+    uint64_t    num_skipped;
+    uint64_t    num_failed;
+    uint64_t    num_bytes;
+} recover_tar_stats_t;
+
+bool recover_tree_as_tar(
+    btree_node_phys_t*      fs_omap_btree,
+    btree_node_phys_t*      fs_root_btree,
+    oid_t                   dir_oid,
+    const char*             root_name,
+    int                     fd,
+    uint32_t                num_threads,
+    FILE*                   log,
+    recover_tar_stats_t*    stats
+);
+
+#endif // DRAT_RECOVER_TAR_H
@@ -0,0 +1,651 @@
+/**
+ * Functions used to recover a whole directory tree; see `recover-tree.h` for
+ * details.
+ */
+
+#include "recover-tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <apfs/j.h>
+#include <apfs/jconst.h>
+
+#include <drat/io.h>
+#include <drat/decmpfs.h>
+#include <drat/output.h>
+#include <drat/recover.h>
+
+#include <drat/func/btree.h>
+#include <drat/func/j.h>
+
+/**
+ * Maximum number of blocks that a worker reads from the container in a
+ * single request.
+ */
+#define RECOVER_TREE_MAX_READ_BLOCKS    256
+
+/**
+ * A regular file whose data is to be copied by a worker thread.
+ *
+ * compressed:  The file's compressed data if it is transparently compressed,
+ *      in which case `file_size` is its uncompressed size; else a NULL
+ *      pointer.
+ */
+typedef struct recover_job {
+    struct recover_job* next;
+    char*               output_path;
+    oid_t               fs_oid;
+    uint64_t            file_size;
+    file_extent_t*      extents;
+    size_t              num_extents;
+    decmpfs_file_t*     compressed;
+    uint16_t            mode;
+    uint64_t            access_time;
+    uint64_t            mod_time;
+} recover_job_t;
+
+/**
+ * State shared between the thread walking the tree and the worker threads.
+ * All fields are protected by `lock`.
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      job_available;
+    pthread_cond_t      space_available;
+    recover_job_t*      head;
+    recover_job_t*      tail;
+    uint64_t            in_flight_bytes;
+    bool                done;
+    recover_journal_t*  journal;
+    uint32_t            digest_types;
+    FILE*               digest_stream;
+    recover_tree_stats_t*   stats;
+} recover_pool_t;
+
+/**
+ * A directory whose permissions and timestamps are to be restored once the
+ * whole tree has been recovered.
+ */
+typedef struct {
+    char*       output_path;
+    uint16_t    mode;
+    uint64_t    access_time;
+    uint64_t    mod_time;
+} recover_dir_t;
+
+typedef struct {
+    btree_node_phys_t*  fs_omap_btree;
+    btree_node_phys_t*  fs_root_btree;
+    recover_pool_t*     pool;
+    FILE*               log;
+    recover_dir_t*      dirs;
+    size_t              num_dirs;
+    size_t              dirs_capacity;
+} recover_walk_t;
+
+/**
+ * Get a sensible number of worker threads for this machine.
+ */
+uint32_t get_default_recover_thread_count(void) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        return 1;
+    }
+    if (num_cpus > 8) {
+        // More threads than this don't help, since the container is the bottleneck
+        return 8;
+    }
+    return num_cpus;
+}
+
+/**
+ * Determine whether a regular file's output file is intact, i.e. already
+ * contains the data that a journal entry says was written to it.
+ */
+static bool is_output_file_intact(recover_job_t* job, uint64_t expected_hash, digest_ctx_t* digests) {
+    uint64_t size = 0;
+    int fd = open_existing_output_file(job->output_path, &size);
+    if (fd == -1) {
+        return false;
+    }
+
+    // A compressed file's output is hashed in full, as though it were a
+    // single extent, since that is how its hash was computed.
+    file_extent_t whole_file = { .logical_addr = 0, .length = job->file_size, .phys_block_num = 1 };
+    file_extent_t* extents = job->compressed ? &whole_file : job->extents;
+    size_t num_extents = job->compressed ? 1 : job->num_extents;
+
+    uint64_t hash = 0;
+    bool intact = size == job->file_size
+        && hash_output_file_data(fd, extents, num_extents, job->file_size, &hash, digests)
+        && hash == expected_hash;
+    close(fd);
+    return intact;
+}
+
+/**
+ * Where the decompressed data of a compressed file is written; see
+ * `write_decompressed_data()`.
+ */
+typedef struct {
+    int             fd;
+    const char*     output_path;
+    uint64_t        position;
+    uint64_t        hash;
+    digest_ctx_t*   digests;
+} decompressed_output_t;
+
+/**
+ * Write decompressed data to the next position of an output file, updating
+ * the file's journal hash and content digests. Runs of zeroes are left as
+ * holes, since the output file is created at its full size.
+ */
+static bool write_decompressed_data(void* context, const void* data, size_t num_bytes) {
+    decompressed_output_t* output = context;
+    if (!is_zero_filled(data, num_bytes) && !write_output_fd(output->fd, data, num_bytes, output->position, output->output_path)) {
+        return false;
+    }
+    output->hash = update_recover_journal_hash(output->hash, data, num_bytes);
+    if (output->digests) {
+        update_digests(output->digests, data, num_bytes);
+    }
+    output->position += num_bytes;
+    return true;
+}
+
+/**
+ * Copy a regular file's data from the container to its output file, and
+ * restore its permissions and timestamps.
+ *
+ * buffer:  Memory for `RECOVER_TREE_MAX_READ_BLOCKS` blocks, private to the
+ *      calling thread.
+ *
+ * journal:     The journal to record the file in once it has been recovered,
+ *      or a NULL pointer. If the journal says that the file was recovered by
+ *      an earlier run and its output file is intact, its data isn't copied.
+ *
+ * digests:     A set of content digests to update with the file's content,
+ *      or a NULL pointer.
+ *
+ * resumed:     Set to whether the file's data was already recovered.
+ *
+ * RETURN VALUE:    `true` if the file was recovered in full, else `false`.
+ */
+static bool run_recover_job(recover_job_t* job, char* buffer, recover_journal_t* journal, digest_ctx_t* digests, bool* resumed) {
+    *resumed = false;
+    if (journal) {
+        recover_journal_entry_t* entry = find_recover_journal_entry(journal, job->fs_oid);
+        digest_ctx_t initial_digests;
+        if (digests) {
+            initial_digests = *digests;
+        }
+        if (entry && entry->length == job->file_size && is_output_file_intact(job, entry->hash, digests)) {
+            *resumed = true;
+            return set_output_metadata(job->output_path, job->mode, job->access_time, job->mod_time, false);
+        }
+        if (digests) {
+            *digests = initial_digests;
+        }
+    }
+
+    if (!create_output_file(job->output_path, job->file_size)) {
+        return false;
+    }
+
+    int fd = open_output_file(job->output_path);
+    if (fd == -1) {
+        return false;
+    }
+
+    uint64_t hash = RECOVER_JOURNAL_HASH_INIT;
+    uint64_t digested_bytes = 0;
+    bool success = true;
+    if (job->compressed) {
+        // The worker threads already recover many files in parallel, so each
+        // file's chunks are decompressed by the worker itself.
+        decompressed_output_t output = {
+            .fd             = fd,
+            .output_path    = job->output_path,
+            .hash           = RECOVER_JOURNAL_HASH_INIT,
+            .digests        = digests,
+        };
+        success = decompress_decmpfs_file(job->compressed, 1, write_decompressed_data, &output, job->output_path);
+        hash = output.hash;
+        digested_bytes = output.position;
+    }
+    for (size_t i = 0; success && !job->compressed && i < job->num_extents; i++) {
+        file_extent_t* extent = job->extents + i;
+
+        // Sparse extents, and data beyond the end of the file, are skipped;
+        // the output file is already the right size and reads as zeroes there.
+        if (extent->phys_block_num == 0 || extent->logical_addr >= job->file_size) {
+            continue;
+        }
+        uint64_t extent_bytes = extent->length;
+        if (extent_bytes > job->file_size - extent->logical_addr) {
+            extent_bytes = job->file_size - extent->logical_addr;
+        }
+
+        for (uint64_t offset = 0; offset < extent_bytes; offset += RECOVER_TREE_MAX_READ_BLOCKS * nx_block_size) {
+            uint64_t num_bytes = extent_bytes - offset;
+            if (num_bytes > RECOVER_TREE_MAX_READ_BLOCKS * nx_block_size) {
+                num_bytes = RECOVER_TREE_MAX_READ_BLOCKS * nx_block_size;
+            }
+            uint64_t num_blocks = (num_bytes + nx_block_size - 1) / nx_block_size;
+            uint64_t block_addr = extent->phys_block_num + offset / nx_block_size;
+
+            if (pread_blocks(buffer, block_addr, num_blocks) != num_blocks) {
+                fprintf(stderr, "\nERROR: Failed to read blocks %#"PRIx64" to %#"PRIx64" of `%s`.\n", block_addr, block_addr + num_blocks - 1, job->output_path);
+                success = false;
+                break;
+            }
+            if (!write_output_fd(fd, buffer, num_bytes, extent->logical_addr + offset, job->output_path)) {
+                success = false;
+                break;
+            }
+            if (journal) {
+                hash = update_recover_journal_hash(hash, buffer, num_bytes);
+            }
+            if (digests) {
+                update_digests_with_zeroes(digests, extent->logical_addr + offset - digested_bytes);
+                update_digests(digests, buffer, num_bytes);
+                digested_bytes = extent->logical_addr + offset + num_bytes;
+            }
+        }
+    }
+    if (digests) {
+        update_digests_with_zeroes(digests, job->file_size - digested_bytes);
+    }
+
+    if (close(fd) != 0) {
+        success = false;
+    }
+    if (success && journal && !add_recover_journal_entry(journal, job->fs_oid, job->file_size, hash)) {
+        success = false;
+    }
+    if (success && !set_output_metadata(job->output_path, job->mode, job->access_time, job->mod_time, false)) {
+        success = false;
+    }
+    return success;
+}
+
+static void free_recover_job(recover_job_t* job) {
+    free(job->output_path);
+    free(job->extents);
+    free_decmpfs_file(job->compressed);
+    free(job);
+}
+
+static void* recover_worker(void* arg) {
+    recover_pool_t* pool = arg;
+
+    char* buffer = malloc(RECOVER_TREE_MAX_READ_BLOCKS * nx_block_size);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->head && !pool->done) {
+            pthread_cond_wait(&pool->job_available, &pool->lock);
+        }
+        if (!pool->head) {
+            break;  // No more jobs will be submitted
+        }
+
+        recover_job_t* job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        digest_ctx_t digests;
+        init_digests(&digests, pool->digest_types);
+        bool resumed = false;
+        bool success = run_recover_job(job, buffer, pool->journal, pool->digest_types ? &digests : NULL, &resumed);
+        if (success && pool->digest_types) {
+            print_digests(pool->digest_stream, &digests, job->output_path);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->in_flight_bytes -= job->file_size;
+        if (success && resumed) {
+            pool->stats->num_resumed++;
+        } else if (success) {
+            pool->stats->num_files++;
+            pool->stats->num_bytes += job->file_size;
+        } else {
+            fprintf(stderr, "- Failed to fully recover file-system object %#"PRIx64" to `%s`.\n", job->fs_oid, job->output_path);
+            pool->stats->num_failed++;
+        }
+        pthread_cond_signal(&pool->space_available);
+
+        free_recover_job(job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Hand a regular file to the worker threads, first waiting for the total size
+ * of the files in flight to drop low enough. A file larger than the limit is
+ * still accepted once nothing else is in flight.
+ */
+static void submit_recover_job(recover_pool_t* pool, recover_job_t* job) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->in_flight_bytes != 0 && pool->in_flight_bytes + job->file_size > RECOVER_TREE_MAX_IN_FLIGHT_BYTES) {
+        pthread_cond_wait(&pool->space_available, &pool->lock);
+    }
+
+    job->next = NULL;
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->in_flight_bytes += job->file_size;
+
+    pthread_cond_signal(&pool->job_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Update the statistics shared with the worker threads.
+ */
+static void count_item(recover_pool_t* pool, uint64_t* counter) {
+    pthread_mutex_lock(&pool->lock);
+    (*counter)++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void add_recover_dir(recover_walk_t* walk, const char* output_path, j_inode_val_t* inode) {
+    if (walk->num_dirs == walk->dirs_capacity) {
+        walk->dirs_capacity = walk->dirs_capacity ? 2 * walk->dirs_capacity : 64;
+        walk->dirs = realloc(walk->dirs, walk->dirs_capacity * sizeof(recover_dir_t));
+        if (!walk->dirs) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `walk->dirs`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    recover_dir_t* dir = walk->dirs + walk->num_dirs;
+    dir->output_path = strdup(output_path);
+    if (!dir->output_path) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dir->output_path`.\n", __func__);
+        exit(-1);
+    }
+    dir->mode           = inode->mode;
+    dir->access_time    = inode->access_time;
+    dir->mod_time       = inode->mod_time;
+    walk->num_dirs++;
+}
+
+/**
+ * A directory entry, copied out of the directory's file-system records so
+ * that they can be freed before its subdirectories are walked.
+ */
+typedef struct {
+    char*       name;
+    oid_t       fs_oid;
+    uint16_t    type;
+} recover_dentry_t;
+
+/**
+ * Recover the item with a given file-system object ID, recursing into it if
+ * it is a directory.
+ *
+ * type:    The item's type, as stated by the dentry that refers to it, i.e.
+ *      one of the `DT_*` constants.
+ */
+static void walk_item(recover_walk_t* walk, oid_t fs_oid, uint16_t type, const char* output_path) {
+    recover_pool_t* pool = walk->pool;
+
+    if (type != DT_DIR && type != DT_REG && type != DT_LNK) {
+        fprintf(stderr, "- `%s` is not a directory, regular file, or symbolic link; skipping it.\n", output_path);
+        count_item(pool, &pool->stats->num_skipped);
+        return;
+    }
+
+    j_rec_t** fs_records = get_fs_records(walk->fs_omap_btree, walk->fs_root_btree, fs_oid, (xid_t)(~0) );
+    if (!fs_records) {
+        fprintf(stderr, "- No records found with OID %#"PRIx64" for `%s`; skipping it.\n", fs_oid, output_path);
+        count_item(pool, &pool->stats->num_failed);
+        return;
+    }
+
+    uint16_t inode_len = 0;
+    j_inode_val_t* inode = get_inode_from_fs_records(fs_records, &inode_len);
+    if (!inode) {
+        fprintf(stderr, "- No inode found with OID %#"PRIx64" for `%s`; skipping it.\n", fs_oid, output_path);
+        free_j_rec_array(fs_records);
+        count_item(pool, &pool->stats->num_failed);
+        return;
+    }
+
+    if (type == DT_REG) {
+        recover_job_t* job = calloc(1, sizeof(recover_job_t));
+        if (!job) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `job`.\n", __func__);
+            exit(-1);
+        }
+        job->output_path = strdup(output_path);
+        if (!job->output_path) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `job->output_path`.\n", __func__);
+            exit(-1);
+        }
+        job->fs_oid         = fs_oid;
+        job->file_size      = inode_len == sizeof(j_inode_val_t) ? 0 : get_file_size(inode, inode_len);
+        job->extents        = get_file_extents_from_fs_records(fs_records, &(job->num_extents));
+        job->compressed     = get_decmpfs_file(walk->fs_omap_btree, walk->fs_root_btree, fs_records);
+        job->mode           = inode->mode;
+        job->access_time    = inode->access_time;
+        job->mod_time       = inode->mod_time;
+        free_j_rec_array(fs_records);
+        if (job->compressed) {
+            job->file_size = job->compressed->size;
+        }
+
+        submit_recover_job(pool, job);
+        return;
+    }
+
+    if (type == DT_LNK) {
+        char* target = get_symlink_target_from_fs_records(fs_records);
+        if (!target) {
+            fprintf(stderr, "- Could not find the target of the symbolic link `%s`; skipping it.\n", output_path);
+            count_item(pool, &pool->stats->num_failed);
+        } else if (
+               create_output_symlink(target, output_path)
+            && set_output_metadata(output_path, inode->mode, inode->access_time, inode->mod_time, true)
+        ) {
+            count_item(pool, &pool->stats->num_symlinks);
+        } else {
+            count_item(pool, &pool->stats->num_failed);
+        }
+        free_j_rec_array(fs_records);
+        return;
+    }
+
+    // The item is a directory
+    if (!make_directories(output_path)) {
+        fprintf(stderr, "- Could not create the directory `%s`; skipping it and its contents.\n", output_path);
+        free_j_rec_array(fs_records);
+        count_item(pool, &pool->stats->num_failed);
+        return;
+    }
+    add_recover_dir(walk, output_path, inode);
+    count_item(pool, &pool->stats->num_directories);
+
+    size_t num_dentries = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_key_t* hdr = (*fs_rec_cursor)->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
+            num_dentries++;
+        }
+    }
+
+    recover_dentry_t* dentries = malloc((num_dentries + 1) * sizeof(recover_dentry_t));
+    if (!dentries) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dentries`.\n", __func__);
+        exit(-1);
+    }
+
+    size_t i = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
+            j_drec_hashed_key_t* key = fs_rec->data;
+            j_drec_val_t* val = fs_rec->data + fs_rec->key_len;
+            // The name's length includes its NUL terminator, which a corrupt
+            // record may lack, so the name is bounded by the record too
+            size_t max_name_len = fs_rec->key_len > sizeof(j_drec_hashed_key_t) ? fs_rec->key_len - sizeof(j_drec_hashed_key_t) : 0;
+            size_t name_len = key->name_len_and_hash & J_DREC_LEN_MASK;
+            if (name_len > max_name_len) {
+                name_len = max_name_len;
+            }
+            dentries[i].name = strndup((char*)key->name, name_len);
+            if (!dentries[i].name) {
+                fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `dentries[i].name`.\n", __func__);
+                exit(-1);
+            }
+            dentries[i].fs_oid  = val->file_id;
+            dentries[i].type    = val->flags & DREC_TYPE_MASK;
+            i++;
+        }
+    }
+    free_j_rec_array(fs_records);
+
+    for (i = 0; i < num_dentries; i++) {
+        if (!is_safe_output_name(dentries[i].name)) {
+            fprintf(stderr, "- The directory `%s` has an entry with the invalid name `%s`; skipping it.\n", output_path, dentries[i].name);
+            count_item(pool, &pool->stats->num_failed);
+            free(dentries[i].name);
+            continue;
+        }
+        char* child_path = NULL;
+        if (asprintf(&child_path, "%s/%s", output_path, dentries[i].name) == -1) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `child_path`.\n", __func__);
+            exit(-1);
+        }
+        walk_item(walk, dentries[i].fs_oid, dentries[i].type, child_path);
+        free(child_path);
+        free(dentries[i].name);
+    }
+    free(dentries);
+}
+
+/**
+ * Recover a directory and everything within it.
+ *
+ * dir_oid:     The file-system object ID of the directory.
+ *
+ * output_dir:  The local path that the directory is recovered to; it is
+ *      created if it doesn't exist, and existing items within it that have
+ *      the same names as recovered items are overwritten.
+ *
+ * num_threads:     The number of worker threads that copy file data.
+ *
+ * journal:     The journal in which to record recovered files, and from
+ *      which to resume an earlier recovery, or a NULL pointer.
+ *
+ * digest_types:    Bitmask of the `DIGEST_*` content digests to compute for
+ *      each regular file, or zero for none.
+ *
+ * digest_stream:   The stream that the digests are printed to.
+ *
+ * log:     The stream that progress messages are written to.
+ *
+ * stats:   Set to the number of items recovered, skipped, and failed.
+ *
+ * RETURN VALUE:
+ *      `true` if every item was recovered, else `false`. Errors pertaining to
+ *      individual items are printed to stderr, and don't stop the others from
+ *      being recovered.
+ */
+bool recover_tree(
+    btree_node_phys_t*      fs_omap_btree,
+    btree_node_phys_t*      fs_root_btree,
+    oid_t                   dir_oid,
+    const char*             output_dir,
+    uint32_t                num_threads,
+    recover_journal_t*      journal,
+    uint32_t                digest_types,
+    FILE*                   digest_stream,
+    FILE*                   log,
+    recover_tree_stats_t*   stats
+) {
+    memset(stats, 0, sizeof(recover_tree_stats_t));
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    if (num_threads > RECOVER_TREE_MAX_THREADS) {
+        num_threads = RECOVER_TREE_MAX_THREADS;
+    }
+
+    recover_pool_t pool = {
+        .lock               = PTHREAD_MUTEX_INITIALIZER,
+        .job_available      = PTHREAD_COND_INITIALIZER,
+        .space_available    = PTHREAD_COND_INITIALIZER,
+        .journal            = journal,
+        .digest_types       = digest_types,
+        .digest_stream      = digest_stream,
+        .stats              = stats,
+    };
+
+    pthread_t threads[RECOVER_TREE_MAX_THREADS];
+    uint32_t num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+        if (pthread_create(threads + num_started, NULL, recover_worker, &pool) != 0) {
+            break;
+        }
+    }
+    if (num_started == 0) {
+        fprintf(stderr, "\nERROR: %s: Could not start any worker threads.\n", __func__);
+        return false;
+    }
+
+    fprintf(log, "Recovering the directory tree with %"PRIu32" worker threads ... ", num_started);
+    recover_walk_t walk = {
+        .fs_omap_btree  = fs_omap_btree,
+        .fs_root_btree  = fs_root_btree,
+        .pool           = &pool,
+        .log            = log,
+    };
+    walk_item(&walk, dir_oid, DT_DIR, output_dir);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.done = true;
+    pthread_cond_broadcast(&pool.job_available);
+    pthread_mutex_unlock(&pool.lock);
+    for (uint32_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    fprintf(log, "OK.\n");
+
+    // Restore directory metadata deepest-first, since setting the metadata of
+    // a directory's children would otherwise change its modification time.
+    fprintf(log, "Restoring the permissions and timestamps of %zu directories ... ", walk.num_dirs);
+    for (size_t i = walk.num_dirs; i > 0; i--) {
+        recover_dir_t* dir = walk.dirs + i - 1;
+        set_output_metadata(dir->output_path, dir->mode, dir->access_time, dir->mod_time, false);
+        free(dir->output_path);
+    }
+    free(walk.dirs);
+    fprintf(log, "OK.\n");
+
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.job_available);
+    pthread_cond_destroy(&pool.space_available);
+
+    return stats->num_failed == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef DRAT_RECOVER_TREE_H
+#define DRAT_RECOVER_TREE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <apfs/object.h>    // oid_t
+#include <apfs/btree.h>
+
+#include <drat/recover-journal.h>
+
+/**
+ * Recovery of a whole directory tree to the local file system.
+ *
+ * The tree is walked on the calling thread, since the B-tree functions that
+ * read file-system records aren't thread-safe. Directories and symbolic links
+ * are created as they are encountered, and each regular file is handed to a
+ * pool of worker threads which copy its data from the container. To bound
+ * the work that is queued up ahead of the workers, the walk pauses whilst the
+ * total size of the files that are queued or being copied exceeds
+ * `RECOVER_TREE_MAX_IN_FLIGHT_BYTES`.
+ *
+ * Permissions and timestamps are restored for every item; those of
+ * directories are restored last, since creating items within a directory
+ * changes its modification time.
+ *
+ * If a journal is given, each regular file is recorded in it once it has been
+ * recovered, and files that a previous, interrupted run already recorded are
+ * not copied again if their output still matches; see `recover-journal.h`.
+ *
+ * If digests are requested, the content of each regular file is hashed as it
+ * is written, and the digests are printed once the file is complete.
+ */
+
+#define RECOVER_TREE_MAX_IN_FLIGHT_BYTES    (64 * 1024 * 1024)
+#define RECOVER_TREE_MAX_THREADS            64
+
+typedef struct {
+    uint64_t    num_directories;
+    uint64_t    num_files;
+    uint64_t    num_resumed;
+    uint64_t    num_symlinks;
+    uint64_t    num_skipped;
+    uint64_t    num_failed;
+    uint64_t    num_bytes;
+} recover_tree_stats_t;
+
+uint32_t get_default_recover_thread_count(void);
+
+bool recover_tree(
+    btree_node_phys_t*      fs_omap_btree,
+    btree_node_phys_t*      fs_root_btree,
+    oid_t                   dir_oid,
+    const char*             output_dir,
+    uint32_t                num_threads,
+    recover_journal_t*      journal,
+    uint32_t                digest_types,
+    FILE*                   digest_stream,
+    FILE*                   log,
+    recover_tree_stats_t*   stats
+);
+
+#endif // DRAT_RECOVER_TREE_H
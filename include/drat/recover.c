@@ -0,0 +1,597 @@
+/**
+ * Functions used to locate the data of files within a volume and recover it;
+ * see `recover.h` for details.
+ */
+
+#include "recover.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/dstream.h>
+
+#include <drat/io.h>
+#include <drat/decmpfs.h>
+#include <drat/output.h>
+
+#include <drat/func/j.h>
+
+/**
+ * Get the file-system object ID of the item at a given path within a volume.
+ *
+ * path:    An absolute path within the volume, like `/Users/john`. Empty path
+ *      elements are ignored, so `/` and `` both refer to the root directory.
+ *
+ * RETURN VALUE:
+ *      The file-system object ID, or zero if no item exists at that path.
+ */
+oid_t get_fs_oid_for_path(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree, const char* path) {
+    oid_t fs_oid = 0x2;     // Root directory
+
+    char* path_copy = strdup(path);
+    if (!path_copy) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `path_copy`.\n", __func__);
+        exit(-1);
+    }
+
+    char* path_remaining = path_copy;
+    char* path_element;
+    while ( (path_element = strsep(&path_remaining, "/")) != NULL ) {
+        // If path element is empty string, skip it
+        if (*path_element == '\0') {
+            continue;
+        }
+
+        j_rec_t** fs_records = get_fs_records(fs_omap_btree, fs_root_btree, fs_oid, (xid_t)(~0) );
+        if (!fs_records) {
+            fs_oid = 0;
+            break;
+        }
+
+        oid_t child_oid = 0;
+        for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+            j_rec_t* fs_rec = *fs_rec_cursor;
+            j_key_t* hdr = fs_rec->data;
+            if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
+                j_drec_hashed_key_t* key = fs_rec->data;
+                if (strcmp((char*)key->name, path_element) == 0) {
+                    j_drec_val_t* val = fs_rec->data + fs_rec->key_len;
+                    child_oid = val->file_id;
+                    break;
+                }
+            }
+        }
+        free_j_rec_array(fs_records);
+
+        fs_oid = child_oid;
+        if (fs_oid == 0) {
+            break;
+        }
+    }
+
+    free(path_copy);
+    return fs_oid;
+}
+
+/**
+ * Get the inode record from a given array of file-system records.
+ *
+ * inode_len:   If not NULL, set to the length of the inode record's value.
+ *
+ * RETURN VALUE:
+ *      A pointer to the inode record's value within `fs_records`, or a NULL
+ *      pointer if there is no inode record.
+ */
+j_inode_val_t* get_inode_from_fs_records(j_rec_t** fs_records, uint16_t* inode_len) {
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_INODE ) {
+            if (inode_len) {
+                *inode_len = fs_rec->val_len;
+            }
+            return fs_rec->data + fs_rec->key_len;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the target of a symbolic link from its file-system records, i.e. the
+ * value of its `SYMLINK_EA_NAME` extended attribute.
+ *
+ * RETURN VALUE:
+ *      A pointer to the target within `fs_records`, or a NULL pointer if the
+ *      attribute doesn't exist or isn't stored inline.
+ */
+char* get_symlink_target_from_fs_records(j_rec_t** fs_records) {
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  !=  APFS_TYPE_XATTR ) {
+            continue;
+        }
+
+        j_xattr_key_t* key = fs_rec->data;
+        if (strncmp((char*)key->name, SYMLINK_EA_NAME, key->name_len) != 0) {
+            continue;
+        }
+
+        j_xattr_val_t* val = fs_rec->data + fs_rec->key_len;
+        if (!(val->flags & XATTR_DATA_EMBEDDED) || val->xdata_len == 0 || val->xdata[val->xdata_len - 1] != '\0') {
+            return NULL;
+        }
+        return (char*)val->xdata;
+    }
+    return NULL;
+}
+
+/**
+ * Get the file extents described by a given array of file-system records, in
+ * the order that they appear in the array, i.e. in logical order.
+ *
+ * num_extents:     Set to the number of extents found.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_extents` file extents. The caller must free this
+ *      array when it is no longer needed.
+ */
+file_extent_t* get_file_extents_from_fs_records(j_rec_t** fs_records, size_t* num_extents) {
+    size_t count = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_key_t* hdr = (*fs_rec_cursor)->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_FILE_EXTENT ) {
+            count++;
+        }
+    }
+
+    file_extent_t* extents = malloc((count + 1) * sizeof(file_extent_t));
+    if (!extents) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `extents`.\n", __func__);
+        exit(-1);
+    }
+
+    size_t i = 0;
+    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
+        j_rec_t* fs_rec = *fs_rec_cursor;
+        j_key_t* hdr = fs_rec->data;
+        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_FILE_EXTENT ) {
+            j_file_extent_key_t* key = fs_rec->data;
+            j_file_extent_val_t* val = fs_rec->data + fs_rec->key_len;
+            extents[i].logical_addr     = key->logical_addr;
+            extents[i].length           = val->len_and_flags & J_FILE_EXTENT_LEN_MASK;
+            extents[i].phys_block_num   = val->phys_block_num;
+            i++;
+        }
+    }
+
+    *num_extents = count;
+    return extents;
+}
+
+/**
+ * Copy data from the container to the current position of a file descriptor,
+ * reading it into memory so that any blocks that contain only zeroes can be
+ * turned into holes rather than written out.
+ *
+ * in_offset:   The byte offset of the data within the container.
+ *
+ * RETURN VALUE:    `true` if successful, else `false`, in which case an
+ *              explanation is printed to stderr.
+ */
+static bool copy_skipping_zero_blocks(int fd, uint64_t in_offset, uint64_t num_bytes) {
+    size_t buffer_size = OUTPUT_MAX_COPY_BYTES - OUTPUT_MAX_COPY_BYTES % nx_block_size;
+    char* buffer = malloc(buffer_size);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success = true;
+    for (uint64_t offset = 0; success && offset < num_bytes; offset += buffer_size) {
+        size_t slice_bytes = num_bytes - offset < buffer_size ? num_bytes - offset : buffer_size;
+        if (pread_bytes(buffer, in_offset + offset, slice_bytes) != slice_bytes) {
+            fprintf(stderr, "\nERROR: %s: Could not read %zu bytes at byte offset %#" PRIx64 ".\n", __func__, slice_bytes, in_offset + offset);
+            success = false;
+            break;
+        }
+
+        success = append_output_skipping_zero_blocks(fd, buffer, slice_bytes, nx_block_size);
+    }
+
+    free(buffer);
+    return success;
+}
+
+/**
+ * Find the extent of a file that contains a given byte offset within the
+ * file, using a binary search, since extents are sorted by logical address.
+ *
+ * RETURN VALUE:
+ *      The index of the extent that contains `offset`; or if none does, the
+ *      index of the first extent that starts after `offset`, which is
+ *      `num_extents` if there is no such extent.
+ */
+size_t find_file_extent(file_extent_t* extents, size_t num_extents, uint64_t offset) {
+    // Find the first extent that starts after `offset`
+    size_t low = 0;
+    size_t high = num_extents;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (extents[mid].logical_addr <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    // The extent before that one contains `offset`, if it extends far enough
+    if (low > 0 && offset - extents[low - 1].logical_addr < extents[low - 1].length) {
+        return low - 1;
+    }
+    return low;
+}
+
+/**
+ * Write a range of bytes of a file's data to the current position of a file
+ * descriptor, such as that of stdout. Only the extents that overlap the range
+ * are read, and each of them is copied with as few large reads as possible
+ * rather than block by block. Where the output is a regular file or pipe, the
+ * data is copied by the kernel without passing through userspace; see
+ * `copy_to_output_fd()`.
+ *
+ * Each extent is placed at its logical address within the file. Sparse
+ * extents, gaps between extents, and any gap between the last extent and the
+ * end of the file are holes, which are seeked over rather than written when
+ * the output is a regular file; see `skip_output_hole()`.
+ *
+ * file_size:   The size of the file in bytes. The file's last extent may be
+ *      longer than this, in which case the excess is not written.
+ *
+ * range_start, range_length:   The range of bytes within the file to write.
+ *      Any part of the range beyond the end of the file is ignored.
+ *
+ * skip_zero_blocks:    Whether to also turn blocks that contain only zeroes
+ *      into holes. This requires reading all of the data into memory to
+ *      check it, so zero-copy output isn't used.
+ *
+ * RETURN VALUE:    `true` if all of the data was written, else `false`, in
+ *              which case an explanation is printed to stderr.
+ */
+bool write_file_range_to_fd(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, uint64_t range_start, uint64_t range_length, bool skip_zero_blocks) {
+    if (range_start >= file_size) {
+        return finish_output_holes(fd);
+    }
+    uint64_t range_end = file_size;
+    if (range_length < file_size - range_start) {
+        range_end = range_start + range_length;
+    }
+
+    uint64_t position = range_start;
+    for (size_t i = find_file_extent(extents, num_extents, range_start); i < num_extents && position < range_end; i++) {
+        file_extent_t* extent = extents + i;
+        if (extent->logical_addr >= range_end) {
+            break;
+        }
+        uint64_t extent_end = extent->logical_addr + extent->length;
+        if (extent_end <= position) {
+            fprintf(stderr, "\nERROR: %s: Extent %zu of %zu overlaps the previous one; skipping it.\n", __func__, i+1, num_extents);
+            continue;
+        }
+
+        if (extent->logical_addr > position) {
+            if (!skip_output_hole(fd, extent->logical_addr - position)) {
+                return false;
+            }
+            position = extent->logical_addr;
+        }
+
+        uint64_t offset_in_extent = position - extent->logical_addr;
+        uint64_t num_bytes = (extent_end < range_end ? extent_end : range_end) - position;
+        uint64_t in_offset = extent->phys_block_num * nx_block_size + offset_in_extent;
+
+        bool success;
+        if (extent->phys_block_num == 0) {
+            success = skip_output_hole(fd, num_bytes);
+        } else if (skip_zero_blocks) {
+            success = copy_skipping_zero_blocks(fd, in_offset, num_bytes);
+        } else {
+            success = copy_to_output_fd(fd, fileno(nx), in_offset, num_bytes);
+        }
+        if (!success) {
+            fprintf(stderr, "\nERROR: %s: Could not copy extent %zu of %zu (%" PRIu64 " bytes from block %#" PRIx64 ").\n", __func__, i+1, num_extents, num_bytes, extent->phys_block_num);
+            return false;
+        }
+        position += num_bytes;
+    }
+
+    return skip_output_hole(fd, range_end - position) && finish_output_holes(fd);
+}
+
+/**
+ * Write all of a file's data to the current position of a file descriptor;
+ * see `write_file_range_to_fd()`.
+ */
+bool write_file_data_to_fd(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, bool skip_zero_blocks) {
+    return write_file_range_to_fd(fd, extents, num_extents, file_size, 0, file_size, skip_zero_blocks);
+}
+
+/**
+ * Create an empty batch of files to be recovered from a given volume.
+ *
+ * RETURN VALUE:
+ *      A pointer to the new batch. The caller must free this pointer with
+ *      `free_recover_batch()` when it is no longer needed.
+ */
+recover_batch_t* create_recover_batch(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree) {
+    recover_batch_t* batch = calloc(1, sizeof(recover_batch_t));
+    if (!batch) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `batch`.\n", __func__);
+        exit(-1);
+    }
+    batch->fs_omap_btree = fs_omap_btree;
+    batch->fs_root_btree = fs_root_btree;
+    return batch;
+}
+
+void free_recover_batch(recover_batch_t* batch) {
+    if (!batch) {
+        return;
+    }
+    for (size_t i = 0; i < batch->num_files; i++) {
+        free(batch->files[i].output_path);
+        free(batch->files[i].extents);
+    }
+    free(batch->files);
+    free(batch);
+}
+
+/**
+ * Look up the inode and file extents of a given file, and add it to a batch.
+ *
+ * fs_oid:  The file-system object ID of the file.
+ *
+ * output_path:     The path that the file's data will be written to.
+ *
+ * RETURN VALUE:
+ *      `true` if the file was added, or `false` if it doesn't exist or isn't
+ *      a regular file, in which case an explanation is printed to stderr.
+ */
+bool add_file_to_recover_batch(recover_batch_t* batch, oid_t fs_oid, const char* output_path) {
+    j_rec_t** fs_records = get_fs_records(batch->fs_omap_btree, batch->fs_root_btree, fs_oid, (xid_t)(~0) );
+    if (!fs_records) {
+        fprintf(stderr, "- No records found with OID %#"PRIx64"; skipping it.\n", fs_oid);
+        return false;
+    }
+
+    uint16_t inode_len = 0;
+    j_inode_val_t* inode = get_inode_from_fs_records(fs_records, &inode_len);
+    if (!inode || (inode->mode & S_IFMT) != S_IFREG) {
+        fprintf(stderr, "- File-system object %#"PRIx64" is not a regular file; skipping it.\n", fs_oid);
+        free_j_rec_array(fs_records);
+        return false;
+    }
+    if (inode->bsd_flags & DECMPFS_UF_COMPRESSED) {
+        // Batches copy extents straight from disk, which would yield the compressed data
+        fprintf(stderr, "- File-system object %#"PRIx64" is compressed; recover it on its own or with `--recursive` instead; skipping it.\n", fs_oid);
+        free_j_rec_array(fs_records);
+        return false;
+    }
+
+    if (batch->num_files == batch->capacity) {
+        batch->capacity = batch->capacity ? 2 * batch->capacity : 64;
+        batch->files = realloc(batch->files, batch->capacity * sizeof(recover_batch_file_t));
+        if (!batch->files) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `batch->files`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    recover_batch_file_t* file = batch->files + batch->num_files;
+    file->output_path = strdup(output_path);
+    if (!file->output_path) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `file->output_path`.\n", __func__);
+        exit(-1);
+    }
+    file->fs_oid = fs_oid;
+    file->file_size = inode_len == sizeof(j_inode_val_t) ? 0 : get_file_size(inode, inode_len);
+    file->extents = get_file_extents_from_fs_records(fs_records, &(file->num_extents));
+    batch->num_files++;
+
+    free_j_rec_array(fs_records);
+    return true;
+}
+
+/**
+ * The part of a file extent that needs to be read, i.e. excluding any part
+ * beyond the end of the file, along with the file that it belongs to.
+ */
+typedef struct {
+    paddr_t     phys_block_num;
+    uint64_t    num_blocks;
+    uint64_t    num_bytes;
+    uint64_t    logical_addr;
+    size_t      file_index;
+} batch_piece_t;
+
+static int compare_batch_pieces(const void* a, const void* b) {
+    const batch_piece_t* piece_a = a;
+    const batch_piece_t* piece_b = b;
+    if (piece_a->phys_block_num != piece_b->phys_block_num) {
+        return piece_a->phys_block_num < piece_b->phys_block_num ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Maximum number of blocks read from the container in a single request when
+ * recovering a batch of files.
+ */
+#define RECOVER_BATCH_MAX_READ_BLOCKS   256
+
+/**
+ * Recover all files in a batch, reading the container in a single sweep in
+ * order of increasing physical block address.
+ *
+ * log:     The stream that progress messages are written to.
+ *
+ * RETURN VALUE:
+ *      The number of files that were recovered in full. Errors pertaining to
+ *      individual files are printed to stderr, and don't stop the others from
+ *      being recovered.
+ */
+size_t run_recover_batch(recover_batch_t* batch, FILE* log) {
+    size_t num_files = batch->num_files;
+    bool* file_failed = calloc(num_files, sizeof(bool));
+    char** paths = malloc(num_files * sizeof(char*));
+    if ((num_files != 0 && !file_failed) || (num_files != 0 && !paths)) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `file_failed` and `paths`.\n", __func__);
+        exit(-1);
+    }
+
+    fprintf(log, "Creating %zu output files ... ", num_files);
+    size_t num_pieces = 0;
+    for (size_t i = 0; i < num_files; i++) {
+        paths[i] = batch->files[i].output_path;
+        if (!create_output_file(paths[i], batch->files[i].file_size)) {
+            file_failed[i] = true;
+            continue;
+        }
+        num_pieces += batch->files[i].num_extents;
+    }
+    fprintf(log, "OK.\n");
+
+    batch_piece_t* pieces = malloc(num_pieces * sizeof(batch_piece_t));
+    if (num_pieces != 0 && !pieces) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `pieces`.\n", __func__);
+        exit(-1);
+    }
+
+    // Sparse extents and those lying entirely beyond the end of the file
+    // have no data to read; the output file is already the right size, and
+    // reads as zeroes there.
+    num_pieces = 0;
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < num_files; i++) {
+        recover_batch_file_t* file = batch->files + i;
+        if (file_failed[i]) {
+            continue;
+        }
+        for (size_t j = 0; j < file->num_extents; j++) {
+            file_extent_t* extent = file->extents + j;
+            if (extent->phys_block_num == 0 || extent->logical_addr >= file->file_size) {
+                continue;
+            }
+
+            batch_piece_t* piece = pieces + num_pieces;
+            piece->phys_block_num   = extent->phys_block_num;
+            piece->logical_addr     = extent->logical_addr;
+            piece->num_bytes        = extent->length;
+            if (piece->num_bytes > file->file_size - extent->logical_addr) {
+                piece->num_bytes = file->file_size - extent->logical_addr;
+            }
+            piece->num_blocks       = (piece->num_bytes + nx_block_size - 1) / nx_block_size;
+            piece->file_index       = i;
+            total_bytes += piece->num_bytes;
+            num_pieces++;
+        }
+    }
+
+    fprintf(log, "Sorting %zu extents by physical block address ... ", num_pieces);
+    qsort(pieces, num_pieces, sizeof(batch_piece_t), compare_batch_pieces);
+    fprintf(log, "OK.\n");
+
+    char* buffer = malloc(RECOVER_BATCH_MAX_READ_BLOCKS * nx_block_size);
+    if (!buffer) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `buffer`.\n", __func__);
+        exit(-1);
+    }
+
+    output_files_t output_files;
+    init_output_files(&output_files, paths, num_files);
+
+    fprintf(log, "Reading %"PRIu64" bytes of file data in physical block order ... ", total_bytes);
+    size_t i = 0;
+    while (i < num_pieces) {
+        batch_piece_t* piece = pieces + i;
+
+        if (piece->num_blocks > RECOVER_BATCH_MAX_READ_BLOCKS) {
+            // A large extent; read it on its own, in several requests
+            for (uint64_t offset = 0; offset < piece->num_bytes; offset += RECOVER_BATCH_MAX_READ_BLOCKS * nx_block_size) {
+                uint64_t block_offset = offset / nx_block_size;
+                uint64_t num_blocks = piece->num_blocks - block_offset;
+                if (num_blocks > RECOVER_BATCH_MAX_READ_BLOCKS) {
+                    num_blocks = RECOVER_BATCH_MAX_READ_BLOCKS;
+                }
+                uint64_t num_bytes = piece->num_bytes - offset;
+                if (num_bytes > num_blocks * nx_block_size) {
+                    num_bytes = num_blocks * nx_block_size;
+                }
+
+                if (read_blocks(buffer, piece->phys_block_num + block_offset, num_blocks) != num_blocks) {
+                    fprintf(stderr, "\nERROR: Failed to read blocks %#"PRIx64" to %#"PRIx64" of `%s`.\n", piece->phys_block_num + block_offset, piece->phys_block_num + block_offset + num_blocks - 1, paths[piece->file_index]);
+                    file_failed[piece->file_index] = true;
+                    break;
+                }
+                if (!write_output_file(&output_files, piece->file_index, buffer, num_bytes, piece->logical_addr + offset)) {
+                    file_failed[piece->file_index] = true;
+                    break;
+                }
+            }
+            i++;
+            continue;
+        }
+
+        // Gather the following extents which can be read in the same request,
+        // i.e. which lie close by and fit within the buffer.
+        paddr_t run_start = piece->phys_block_num;
+        paddr_t run_end = run_start + piece->num_blocks;
+        size_t i_end = i + 1;
+        while (
+               i_end < num_pieces
+            && pieces[i_end].num_blocks <= RECOVER_BATCH_MAX_READ_BLOCKS
+            && pieces[i_end].phys_block_num <= run_end + READ_BATCH_MAX_GAP_BLOCKS
+            && pieces[i_end].phys_block_num + (paddr_t)pieces[i_end].num_blocks - run_start <= RECOVER_BATCH_MAX_READ_BLOCKS
+        ) {
+            paddr_t piece_end = pieces[i_end].phys_block_num + pieces[i_end].num_blocks;
+            if (piece_end > run_end) {
+                run_end = piece_end;
+            }
+            i_end++;
+        }
+
+        bool read_success = read_blocks(buffer, run_start, run_end - run_start) == (size_t)(run_end - run_start);
+        for (; i < i_end; i++) {
+            piece = pieces + i;
+            if (!read_success) {
+                fprintf(stderr, "\nERROR: Failed to read blocks %#"PRIx64" to %#"PRIx64" of `%s`.\n", piece->phys_block_num, piece->phys_block_num + piece->num_blocks - 1, paths[piece->file_index]);
+                file_failed[piece->file_index] = true;
+                continue;
+            }
+            char* data = buffer + (piece->phys_block_num - run_start) * nx_block_size;
+            if (!write_output_file(&output_files, piece->file_index, data, piece->num_bytes, piece->logical_addr)) {
+                file_failed[piece->file_index] = true;
+            }
+        }
+    }
+    if (!close_output_files(&output_files)) {
+        fprintf(stderr, "\nERROR: Some output files could not be closed successfully.\n");
+    }
+    fprintf(log, "OK.\n");
+
+    size_t num_recovered = 0;
+    for (size_t i = 0; i < num_files; i++) {
+        if (file_failed[i]) {
+            fprintf(stderr, "- Failed to fully recover file-system object %#"PRIx64" to `%s`.\n", batch->files[i].fs_oid, paths[i]);
+        } else {
+            num_recovered++;
+        }
+    }
+
+    free(buffer);
+    free(pieces);
+    free(paths);
+    free(file_failed);
+    return num_recovered;
+}
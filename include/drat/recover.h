@@ -0,0 +1,78 @@
+#ifndef DRAT_RECOVER_H
+#define DRAT_RECOVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/general.h>   // paddr_t
+#include <apfs/object.h>    // oid_t
+#include <apfs/btree.h>
+#include <apfs/j.h>
+
+#include <drat/func/btree.h>    // j_rec_t
+
+/**
+ * A single file extent, i.e. a run of `length` bytes of a file's data,
+ * starting at byte offset `logical_addr` within the file, which are stored
+ * contiguously on disk starting at block `phys_block_num`. A physical block
+ * number of zero denotes a sparse extent, i.e. one with no data on disk.
+ */
+typedef struct {
+    uint64_t    logical_addr;
+    uint64_t    length;
+    paddr_t     phys_block_num;
+} file_extent_t;
+
+oid_t get_fs_oid_for_path(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree, const char* path);
+j_inode_val_t* get_inode_from_fs_records(j_rec_t** fs_records, uint16_t* inode_len);
+char* get_symlink_target_from_fs_records(j_rec_t** fs_records);
+file_extent_t* get_file_extents_from_fs_records(j_rec_t** fs_records, size_t* num_extents);
+size_t find_file_extent(file_extent_t* extents, size_t num_extents, uint64_t offset);
+bool write_file_range_to_fd(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, uint64_t range_start, uint64_t range_length, bool skip_zero_blocks);
+bool write_file_data_to_fd(int fd, file_extent_t* extents, size_t num_extents, uint64_t file_size, bool skip_zero_blocks);
+
+/**
+ * A file to be recovered as part of a batch.
+ *
+ * output_path:     The path that the file's data will be written to.
+ *
+ * fs_oid:  The file-system object ID of the file's inode.
+ *
+ * file_size:   The size of the file in bytes. The file's last extent may be
+ *      longer than this, in which case the excess is not written.
+ *
+ * extents:     Array of `num_extents` extents comprising the file's data.
+ */
+typedef struct {
+    char*           output_path;
+    oid_t           fs_oid;
+    uint64_t        file_size;
+    file_extent_t*  extents;
+    size_t          num_extents;
+} recover_batch_file_t;
+
+/**
+ * A batch of files to be recovered from a single volume. Rather than reading
+ * each file's data in turn, the extents of all files in the batch are sorted
+ * by physical block address and read in a single sweep across the disk, with
+ * the data being scattered into the corresponding output files. This avoids
+ * seeking back and forth across the disk, which is what dominates the time
+ * taken to recover many small files from a hard disk.
+ */
+typedef struct {
+    btree_node_phys_t*      fs_omap_btree;
+    btree_node_phys_t*      fs_root_btree;
+    recover_batch_file_t*   files;
+    size_t                  num_files;
+    size_t                  capacity;
+} recover_batch_t;
+
+recover_batch_t* create_recover_batch(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree);
+void free_recover_batch(recover_batch_t* batch);
+
+bool add_file_to_recover_batch(recover_batch_t* batch, oid_t fs_oid, const char* output_path);
+size_t run_recover_batch(recover_batch_t* batch, FILE* log);
+
+#endif // DRAT_RECOVER_H
@@ -0,0 +1,1116 @@
+/**
+ * Functions used to parse, compile, and evaluate queries for the `search`
+ * command; see `search-query.h` for details.
+ */
+
+#include "search-query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <apfs/btree.h>
+#include <apfs/omap.h>
+#include <apfs/j.h>
+#include <apfs/jconst.h>
+
+#include <drat/io.h>
+
+#include <drat/func/boolean.h>
+#include <drat/func/cksum.h>
+
+/**
+ * A keyword accepted by `--type`. Keywords that stand for any B-tree node
+ * have two rows, one for root nodes and one for non-root nodes.
+ */
+typedef struct {
+    const char* keyword;
+    uint32_t    type;
+    uint32_t    subtype;
+    uint16_t    btn_flags;
+} search_type_keyword_t;
+
+#define ANY     SEARCH_ANY_TYPE
+
+#define BTREE_KEYWORD(keyword, subtype, btn_flags)  \
+    { keyword, OBJECT_TYPE_BTREE,       subtype, btn_flags },  \
+    { keyword, OBJECT_TYPE_BTREE_NODE,  subtype, btn_flags }
+
+static const search_type_keyword_t search_type_keywords[] = {
+    { "invalid",                OBJECT_TYPE_INVALID,            ANY, 0 },
+    { "test",                   OBJECT_TYPE_TEST,               ANY, 0 },
+    { "nxsb",                   OBJECT_TYPE_NX_SUPERBLOCK,      ANY, 0 },
+    BTREE_KEYWORD("btree",      ANY, 0),
+    { "btree-root",             OBJECT_TYPE_BTREE,              ANY, 0 },
+    { "btree-nonroot",          OBJECT_TYPE_BTREE_NODE,         ANY, 0 },
+    BTREE_KEYWORD("btree-leaf", ANY, BTNODE_LEAF),
+    { "spaceman",               OBJECT_TYPE_SPACEMAN,           ANY, 0 },
+    { "spaceman-cab",           OBJECT_TYPE_SPACEMAN_CAB,       ANY, 0 },
+    { "spaceman-cib",           OBJECT_TYPE_SPACEMAN_CIB,       ANY, 0 },
+    { "spaceman-bitmap",        OBJECT_TYPE_SPACEMAN_BITMAP,    ANY, 0 },
+    BTREE_KEYWORD("spaceman-free-queue-tree",   OBJECT_TYPE_SPACEMAN_FREE_QUEUE,    0),
+    BTREE_KEYWORD("extent-list-tree",           OBJECT_TYPE_EXTENT_LIST_TREE,       0),
+    { "omap",                   OBJECT_TYPE_OMAP,               ANY, 0 },
+    BTREE_KEYWORD("omap-tree",                  OBJECT_TYPE_OMAP,                   0),
+    BTREE_KEYWORD("omap-tree-leaf",             OBJECT_TYPE_OMAP,                   BTNODE_LEAF),
+    { "xp-map",                 OBJECT_TYPE_CHECKPOINT_MAP,     ANY, 0 },
+    { "fs",                     OBJECT_TYPE_FS,                 ANY, 0 },
+    BTREE_KEYWORD("fs-tree",                    OBJECT_TYPE_FSTREE,                 0),
+    BTREE_KEYWORD("fs-tree-leaf",               OBJECT_TYPE_FSTREE,                 BTNODE_LEAF),
+    BTREE_KEYWORD("block-ref-tree",             OBJECT_TYPE_BLOCKREFTREE,           0),
+    BTREE_KEYWORD("snap-meta-tree",             OBJECT_TYPE_SNAPMETATREE,           0),
+    { "reaper",                 OBJECT_TYPE_NX_REAPER,          ANY, 0 },
+    { "reaper-list",            OBJECT_TYPE_NX_REAP_LIST,       ANY, 0 },
+    BTREE_KEYWORD("omap-snapshot-tree",         OBJECT_TYPE_OMAP_SNAPSHOT,          0),
+    { "efi-jumpstart",          OBJECT_TYPE_EFI_JUMPSTART,      ANY, 0 },
+    BTREE_KEYWORD("fusion-middle-tree",         OBJECT_TYPE_FUSION_MIDDLE_TREE,     0),
+    { "fusion-wbc",             OBJECT_TYPE_NX_FUSION_WBC,      ANY, 0 },
+    { "fusion-wbc-list",        OBJECT_TYPE_NX_FUSION_WBC_LIST, ANY, 0 },
+    { "er-state",               OBJECT_TYPE_ER_STATE,           ANY, 0 },
+    { "gbitmap",                OBJECT_TYPE_GBITMAP,            ANY, 0 },
+    BTREE_KEYWORD("gbitmap-tree",               OBJECT_TYPE_GBITMAP_TREE,           0),
+    { "gbitmap-block",          OBJECT_TYPE_GBITMAP_BLOCK,      ANY, 0 },
+    { "er-recovery-block",      OBJECT_TYPE_ER_RECOVERY_BLOCK,  ANY, 0 },
+    { "snap-meta-ext",          OBJECT_TYPE_SNAP_META_EXT,      ANY, 0 },
+    { "integrity-meta",         OBJECT_TYPE_INTEGRITY_META,     ANY, 0 },
+    BTREE_KEYWORD("fext-tree",                  OBJECT_TYPE_FEXT_TREE,              0),
+    { "container-keybag",       OBJECT_TYPE_CONTAINER_KEYBAG,   ANY, 0 },
+    { "volume-keybag",          OBJECT_TYPE_VOLUME_KEYBAG,      ANY, 0 },
+    { "media-keybag",           OBJECT_TYPE_MEDIA_KEYBAG,       ANY, 0 },
+};
+
+static const char* search_fs_record_type_keywords[] = {
+    [APFS_TYPE_ANY]             = "any",
+    [APFS_TYPE_SNAP_METADATA]   = "snap-meta",
+    [APFS_TYPE_EXTENT]          = "extent",
+    [APFS_TYPE_INODE]           = "inode",
+    [APFS_TYPE_XATTR]           = "xattr",
+    [APFS_TYPE_SIBLING_LINK]    = "sibling-link",
+    [APFS_TYPE_DSTREAM_ID]      = "dstream",
+    [APFS_TYPE_CRYPTO_STATE]    = "crypto",
+    [APFS_TYPE_FILE_EXTENT]     = "file-extent",
+    [APFS_TYPE_DIR_REC]         = "dentry",
+    [APFS_TYPE_DIR_STATS]       = "dir-stats",
+    [APFS_TYPE_SNAP_NAME]       = "snap-name",
+    [APFS_TYPE_SIBLING_MAP]     = "sibling-map",
+    [APFS_TYPE_FILE_INFO]       = "file-info",
+    [14]                        = NULL,
+    [APFS_TYPE_INVALID]         = "invalid",
+};
+
+void init_search_query(search_query_t* query) {
+    memset(query, 0, sizeof(search_query_t));
+}
+
+void free_search_query(search_query_t* query) {
+    free(query->oids.ranges);
+    free(query->xids.ranges);
+    free(query->types);
+    free(query->omap_key_oids.ranges);
+    free(query->omap_key_xids.ranges);
+    free(query->omap_val_paddrs.ranges);
+    free(query->fsoids.ranges);
+    for (size_t i = 0; i < query->num_dentry_names; i++) {
+        free(query->dentry_names[i]);
+    }
+    free(query->dentry_names);
+    for (size_t i = 0; i < query->num_dentry_patterns; i++) {
+        free(query->dentry_patterns[i]);
+    }
+    free(query->dentry_patterns);
+    free(query->dentry_fsoids.ranges);
+    if (query->dentry_name_set.slots) {
+        free_name_set(&query->dentry_name_set);
+    }
+    if (query->dentry_pattern_automaton.transitions) {
+        free_name_automaton(&query->dentry_pattern_automaton);
+    }
+    init_search_query(query);
+}
+
+/**
+ * Split a comma-delimited list into its items. A backslash escapes the
+ * character that follows it, so that items can contain commas.
+ *
+ * RETURN VALUE:
+ *      An array of `*num_items` items, which the caller must free along with
+ *      each of the items.
+ */
+static char** split_search_list(const char* arg, size_t* num_items) {
+    size_t arg_len = strlen(arg);
+    char** items = malloc((arg_len + 1) * sizeof(char*));
+    char* item = malloc(arg_len + 1);
+    if (!items || !item) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `items`.\n", __func__);
+        exit(-1);
+    }
+
+    *num_items = 0;
+    size_t item_len = 0;
+    for (const char* c = arg; ; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            item[item_len++] = *++c;
+            continue;
+        }
+        if (*c != ',' && *c != '\0') {
+            item[item_len++] = *c;
+            continue;
+        }
+
+        item[item_len] = '\0';
+        items[*num_items] = strdup(item);
+        if (!items[*num_items]) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `items[*num_items]`.\n", __func__);
+            exit(-1);
+        }
+        (*num_items)++;
+        item_len = 0;
+        if (*c == '\0') {
+            break;
+        }
+    }
+
+    free(item);
+    return items;
+}
+
+static void free_search_list(char** items, size_t num_items) {
+    for (size_t i = 0; i < num_items; i++) {
+        free(items[i]);
+    }
+    free(items);
+}
+
+/**
+ * Parse a decimal or hexadecimal number that makes up the whole of a string.
+ */
+static bool parse_search_number(const char* arg, uint64_t* value) {
+    if (arg[0] == '\0' || arg[0] == '-' || arg[0] == '+') {
+        return false;
+    }
+    char* end = NULL;
+    errno = 0;
+    *value = strtoull(arg, &end, 0);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * Parse a comma-delimited list of values and inclusive ranges of values, e.g.
+ * `0x1-0x3,0x5`, appending them to a list of ranges.
+ *
+ * RETURN VALUE:    `true` if the list is valid, else `false`.
+ */
+bool parse_search_ranges(const char* arg, search_ranges_t* ranges) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+
+    ranges->ranges = realloc(ranges->ranges, (ranges->num_ranges + num_items) * sizeof(search_range_t));
+    if (!ranges->ranges) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `ranges->ranges`.\n", __func__);
+        exit(-1);
+    }
+
+    bool success = true;
+    for (size_t i = 0; success && i < num_items; i++) {
+        search_range_t* range = ranges->ranges + ranges->num_ranges;
+        char* dash = strchr(items[i], '-');
+        if (dash) {
+            *dash = '\0';
+            success = parse_search_number(items[i], &range->min)
+                && parse_search_number(dash + 1, &range->max)
+                && range->min <= range->max;
+        } else {
+            success = parse_search_number(items[i], &range->min);
+            range->max = range->min;
+        }
+        ranges->num_ranges++;
+    }
+
+    free_search_list(items, num_items);
+    return success;
+}
+
+bool search_ranges_contain(search_ranges_t* ranges, uint64_t value) {
+    if (ranges->num_ranges == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < ranges->num_ranges; i++) {
+        if (value >= ranges->ranges[i].min && value <= ranges->ranges[i].max) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Determine whether any value in a given inclusive range is in a list of
+ * ranges.
+ */
+static bool search_ranges_overlap(search_ranges_t* ranges, uint64_t min, uint64_t max) {
+    if (ranges->num_ranges == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < ranges->num_ranges; i++) {
+        if (min <= ranges->ranges[i].max && max >= ranges->ranges[i].min) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_search_type(search_query_t* query, uint32_t type, uint32_t subtype, uint16_t btn_flags) {
+    query->types = realloc(query->types, (query->num_types + 1) * sizeof(search_type_t));
+    if (!query->types) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `query->types`.\n", __func__);
+        exit(-1);
+    }
+    query->types[query->num_types++] = (search_type_t){ type, subtype, btn_flags };
+}
+
+/**
+ * Parse a value of `--type`, i.e. a comma-delimited list of keywords, numeric
+ * types, and `<type>/<subtype>` pairs, either side of which may be omitted.
+ *
+ * RETURN VALUE:    `true` if the list is valid, else `false`.
+ */
+bool parse_search_types(const char* arg, search_query_t* query) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+
+    bool success = true;
+    for (size_t i = 0; success && i < num_items; i++) {
+        uint64_t subtype = ANY;
+        char* slash = strchr(items[i], '/');
+        if (slash) {
+            *slash = '\0';
+            success = parse_search_number(slash + 1, &subtype) && subtype <= UINT32_MAX;
+        }
+
+        uint64_t type = ANY;
+        if (!success || items[i][0] == '\0') {
+            add_search_type(query, ANY, subtype, 0);
+            continue;
+        }
+        if (parse_search_number(items[i], &type)) {
+            success = type <= UINT32_MAX;
+            add_search_type(query, type, subtype, 0);
+            continue;
+        }
+
+        success = false;
+        for (size_t j = 0; j < sizeof(search_type_keywords) / sizeof(search_type_keywords[0]); j++) {
+            const search_type_keyword_t* keyword = search_type_keywords + j;
+            if (strcmp(items[i], keyword->keyword) == 0) {
+                add_search_type(query, keyword->type, slash ? subtype : keyword->subtype, keyword->btn_flags);
+                success = true;
+            }
+        }
+    }
+
+    free_search_list(items, num_items);
+    return success;
+}
+
+/**
+ * Parse a value of `--storage-type`.
+ */
+bool parse_search_storage_types(const char* arg, uint32_t* storage_types) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+
+    bool success = true;
+    for (size_t i = 0; success && i < num_items; i++) {
+        if (strcmp(items[i], "physical") == 0) {
+            *storage_types |= 1 << (OBJ_PHYSICAL >> 30);
+        } else if (strcmp(items[i], "ephemeral") == 0) {
+            *storage_types |= 1 << (OBJ_EPHEMERAL >> 30);
+        } else if (strcmp(items[i], "virtual") == 0) {
+            *storage_types |= 1 << (OBJ_VIRTUAL >> 30);
+        } else {
+            success = false;
+        }
+    }
+
+    free_search_list(items, num_items);
+    return success;
+}
+
+/**
+ * Parse a value of `--btree-flags`.
+ */
+bool parse_search_btn_flags(const char* arg, uint16_t* btn_flags) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+
+    bool success = true;
+    for (size_t i = 0; success && i < num_items; i++) {
+        if (strcmp(items[i], "root") == 0) {
+            *btn_flags |= BTNODE_ROOT;
+        } else if (strcmp(items[i], "leaf") == 0) {
+            *btn_flags |= BTNODE_LEAF;
+        } else if (strcmp(items[i], "fixed-kv-size") == 0) {
+            *btn_flags |= BTNODE_FIXED_KV_SIZE;
+        } else if (strcmp(items[i], "hashed") == 0) {
+            *btn_flags |= BTNODE_HASHED;
+        } else if (strcmp(items[i], "noheader") == 0) {
+            *btn_flags |= BTNODE_NOHEADER;
+        } else {
+            success = false;
+        }
+    }
+
+    free_search_list(items, num_items);
+    return success;
+}
+
+/**
+ * Parse a value of `--fsrt`, i.e. a list of keywords and numeric types.
+ */
+bool parse_search_fs_record_types(const char* arg, uint16_t* fs_record_types) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+
+    bool success = true;
+    for (size_t i = 0; success && i < num_items; i++) {
+        uint64_t type = 0;
+        success = parse_search_number(items[i], &type) && type <= APFS_TYPE_MAX;
+        for (size_t j = 0; !success && j <= APFS_TYPE_MAX; j++) {
+            if (search_fs_record_type_keywords[j] && strcmp(items[i], search_fs_record_type_keywords[j]) == 0) {
+                type = j;
+                success = true;
+            }
+        }
+
+        // `any` is the same as not specifying a type at all
+        if (success && type == APFS_TYPE_ANY) {
+            *fs_record_types = 0xffff;
+        } else if (success) {
+            *fs_record_types |= 1 << type;
+        }
+    }
+
+    free_search_list(items, num_items);
+    return success;
+}
+
+/**
+ * Append items to a list of names, taking ownership of them.
+ */
+static void append_search_names(char*** names, size_t* num_names, char** items, size_t num_items) {
+    *names = realloc(*names, (*num_names + num_items) * sizeof(char*));
+    if (*num_names + num_items != 0 && !*names) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `names`.\n", __func__);
+        exit(-1);
+    }
+    memcpy(*names + *num_names, items, num_items * sizeof(char*));
+    *num_names += num_items;
+}
+
+/**
+ * Parse a value of `--dentry-name`; see `split_search_list()`.
+ */
+bool parse_search_dentry_names(const char* arg, search_query_t* query) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+    append_search_names(&query->dentry_names, &query->num_dentry_names, items, num_items);
+    free(items);
+    return true;
+}
+
+/**
+ * Parse a value of `--dentry-pattern`; see `split_search_list()`. Empty
+ * patterns, which would match every name, are invalid.
+ */
+bool parse_search_dentry_patterns(const char* arg, search_query_t* query) {
+    size_t num_items = 0;
+    char** items = split_search_list(arg, &num_items);
+    for (size_t i = 0; i < num_items; i++) {
+        if (items[i][0] == '\0') {
+            free_search_list(items, num_items);
+            return false;
+        }
+    }
+    append_search_names(&query->dentry_patterns, &query->num_dentry_patterns, items, num_items);
+    free(items);
+    return true;
+}
+
+/**
+ * Read a file of names or patterns, one per line, for `--dentry-name-file` or
+ * `--dentry-pattern-file`, and append them to a list. Lines are taken as they
+ * are, without escapes, except that line endings are removed and empty lines
+ * are skipped.
+ *
+ * RETURN VALUE:    `true` if the file was read, else `false`, in which case
+ *      an explanation is printed to stderr.
+ */
+bool parse_search_name_file(const char* path, char*** names, size_t* num_names) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open `%s`: %s.\n", path, strerror(errno));
+        return false;
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_capacity, file)) != -1) {
+        while (line_len != 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
+        }
+        if (line_len == 0) {
+            continue;
+        }
+
+        char* name = strdup(line);
+        if (!name) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `name`.\n", __func__);
+            exit(-1);
+        }
+        append_search_names(names, num_names, &name, 1);
+    }
+
+    bool success = !ferror(file);
+    if (!success) {
+        fprintf(stderr, "Could not read `%s`: %s.\n", path, strerror(errno));
+    }
+    free(line);
+    fclose(file);
+    return success;
+}
+
+/**
+ * Get the keyword for an object type, or a NULL pointer if it doesn't have
+ * one of its own.
+ */
+static const char* get_search_type_keyword(uint32_t type) {
+    for (size_t i = 0; i < sizeof(search_type_keywords) / sizeof(search_type_keywords[0]); i++) {
+        const search_type_keyword_t* keyword = search_type_keywords + i;
+        if (keyword->type == type && keyword->subtype == ANY && keyword->btn_flags == 0 && strcmp(keyword->keyword, "btree") != 0) {
+            return keyword->keyword;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the keyword for a B-tree subtype, e.g. `omap-tree`, or a NULL pointer
+ * if it doesn't have one.
+ */
+static const char* get_search_subtype_keyword(uint32_t subtype) {
+    for (size_t i = 0; i < sizeof(search_type_keywords) / sizeof(search_type_keywords[0]); i++) {
+        const search_type_keyword_t* keyword = search_type_keywords + i;
+        if (keyword->type == OBJECT_TYPE_BTREE && keyword->subtype == subtype && keyword->btn_flags == 0) {
+            return keyword->keyword;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the type of an object from its `o_type` field: the type proper, without
+ * the storage type and flags, except for keybags, whose types are four-character
+ * codes that use the whole field.
+ */
+uint32_t get_search_object_type(uint32_t o_type) {
+    if (o_type > OBJECT_TYPE_MASK && get_search_type_keyword(o_type)) {
+        return o_type;  // A keybag
+    }
+    return o_type & OBJECT_TYPE_MASK;
+}
+
+/**
+ * Get the type of an object as shown in search results, e.g. `btree-root/omap-tree`,
+ * using hexadecimal numbers for types and subtypes that don't have a keyword.
+ *
+ * o_type, o_subtype:   The `o_type` and `o_subtype` fields of the object.
+ */
+void get_search_type_string(uint32_t o_type, uint32_t o_subtype, char* type_string, size_t size) {
+    uint32_t type = get_search_object_type(o_type);
+    const char* type_keyword = get_search_type_keyword(type);
+    const char* subtype_keyword = get_search_subtype_keyword(o_subtype);
+
+    int len = type_keyword
+        ? snprintf(type_string, size, "%s", type_keyword)
+        : snprintf(type_string, size, "%#"PRIx32"", type);
+    if (o_subtype != 0 && len >= 0 && (size_t)len < size) {
+        if (subtype_keyword) {
+            snprintf(type_string + len, size - len, "/%s", subtype_keyword);
+        } else {
+            snprintf(type_string + len, size - len, "/%#"PRIx32"", o_subtype);
+        }
+    }
+}
+
+/**
+ * Get the storage type of an object as shown in search results, e.g. `physical`.
+ */
+const char* get_search_storage_type_string(uint32_t o_type) {
+    switch (o_type & OBJ_STORAGETYPE_MASK) {
+        case OBJ_PHYSICAL:  return "physical";
+        case OBJ_EPHEMERAL: return "ephemeral";
+        case OBJ_VIRTUAL:   return "virtual";
+        default:            return "invalid";
+    }
+}
+
+/**
+ * Intersect a pair of type patterns.
+ *
+ * RETURN VALUE:    `true` if some object could match both, in which case
+ *              `*result` is set to the pattern that matches exactly such
+ *              objects, else `false`.
+ */
+static bool intersect_search_types(search_type_t* a, const search_type_t* b, search_type_t* result) {
+    if (a->type != ANY && b->type != ANY && a->type != b->type) {
+        return false;
+    }
+    if (a->subtype != ANY && b->subtype != ANY && a->subtype != b->subtype) {
+        return false;
+    }
+    result->type = a->type == ANY ? b->type : a->type;
+    result->subtype = a->subtype == ANY ? b->subtype : a->subtype;
+    result->btn_flags = a->btn_flags | b->btn_flags;
+    return true;
+}
+
+/**
+ * Restrict the types that a query matches to those that make sense for a
+ * parameter, e.g. `--omap-key-oid` only makes sense for object map B-tree
+ * nodes. If no types were specified, the parameter's types are used.
+ *
+ * RETURN VALUE:    `false` if none of the specified types make sense for the
+ *              parameter, in which case an explanation is printed to stderr,
+ *              else `true`.
+ */
+static bool restrict_search_types(search_query_t* query, const char* param, const char* context) {
+    search_type_t context_types[2];
+    size_t num_context_types = 0;
+    for (size_t i = 0; i < sizeof(search_type_keywords) / sizeof(search_type_keywords[0]); i++) {
+        const search_type_keyword_t* keyword = search_type_keywords + i;
+        if (strcmp(keyword->keyword, context) == 0) {
+            context_types[num_context_types++] = (search_type_t){ keyword->type, keyword->subtype, keyword->btn_flags };
+        }
+    }
+
+    if (query->num_types == 0) {
+        for (size_t i = 0; i < num_context_types; i++) {
+            add_search_type(query, context_types[i].type, context_types[i].subtype, context_types[i].btn_flags);
+        }
+        return true;
+    }
+
+    search_type_t* types = malloc(query->num_types * num_context_types * sizeof(search_type_t));
+    if (!types) {
+        fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `types`.\n", __func__);
+        exit(-1);
+    }
+    size_t num_types = 0;
+    for (size_t i = 0; i < query->num_types; i++) {
+        for (size_t j = 0; j < num_context_types; j++) {
+            if (intersect_search_types(query->types + i, context_types + j, types + num_types)) {
+                num_types++;
+            }
+        }
+    }
+
+    free(query->types);
+    query->types = types;
+    query->num_types = num_types;
+    if (num_types == 0) {
+        fprintf(stderr, "`%s` can only be used with `--type %s`, which conflicts with the specified `--type`.\n", param, context);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get the table of contents and the key and value areas of a B-tree node,
+ * checking that they lie within the block.
+ *
+ * RETURN VALUE:    `true` if the node's layout is sane, else `false`.
+ */
+static bool get_search_node_layout(btree_node_phys_t* node, size_t toc_entry_size, char** toc_start, char** key_start, char** val_end) {
+    char* node_end = (char*)node + nx_block_size;
+    *toc_start = (char*)node->btn_data + node->btn_table_space.off;
+    *key_start = *toc_start + node->btn_table_space.len;
+    *val_end = node_end;
+    if (node->btn_flags & BTNODE_ROOT) {
+        *val_end -= sizeof(btree_info_t);
+    }
+    return *key_start <= *val_end
+        && (size_t)node->btn_nkeys * toc_entry_size <= node->btn_table_space.len;
+}
+
+/** Steps that look at the object header **/
+
+static bool match_storage_type(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)detail;
+    (void)detail_size;
+    return query->storage_types & (1 << ((block->o_type & OBJ_STORAGETYPE_MASK) >> 30));
+}
+
+static bool match_oid(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)detail;
+    (void)detail_size;
+    return search_ranges_contain(&query->oids, block->o_oid);
+}
+
+static bool match_xid(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)detail;
+    (void)detail_size;
+    return search_ranges_contain(&query->xids, block->o_xid);
+}
+
+static bool is_btree_node_type(uint32_t o_type) {
+    uint32_t type = o_type & OBJECT_TYPE_MASK;
+    return type == OBJECT_TYPE_BTREE || type == OBJECT_TYPE_BTREE_NODE;
+}
+
+static bool match_type(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)detail;
+    (void)detail_size;
+    for (size_t i = 0; i < query->num_types; i++) {
+        search_type_t* type = query->types + i;
+        if (type->type != ANY) {
+            // Keybag types use the whole of `o_type`
+            uint32_t o_type = type->type > OBJECT_TYPE_MASK ? block->o_type : block->o_type & OBJECT_TYPE_MASK;
+            if (o_type != type->type) {
+                continue;
+            }
+        }
+        if (type->subtype != ANY && block->o_subtype != type->subtype) {
+            continue;
+        }
+        if (type->btn_flags != 0) {
+            btree_node_phys_t* node = (btree_node_phys_t*)block;
+            if (!is_btree_node_type(block->o_type) || (node->btn_flags & type->btn_flags) != type->btn_flags) {
+                continue;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool match_btn_flags(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)detail;
+    (void)detail_size;
+    btree_node_phys_t* node = (btree_node_phys_t*)block;
+    return is_btree_node_type(block->o_type) && (node->btn_flags & query->btn_flags);
+}
+
+static bool match_plausible_header(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)query;
+    (void)detail;
+    (void)detail_size;
+    return is_obj_header_plausible(block);
+}
+
+/**
+ * Determine whether a query asks for a type or subtype that isn't defined by
+ * APFS, e.g. `--type invalid`, in which case the objects it matches would all
+ * be rejected by `match_plausible_header()`.
+ */
+static bool has_unknown_search_type(search_query_t* query) {
+    for (size_t i = 0; i < query->num_types; i++) {
+        search_type_t* type = query->types + i;
+        if (type->type != ANY && type->type <= OBJECT_TYPE_MASK && !is_known_object_type(type->type)) {
+            return true;
+        }
+        if (type->subtype != ANY && type->subtype != 0 && !is_known_object_type(type->subtype)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool match_cksum(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    (void)query;
+    (void)detail;
+    (void)detail_size;
+    return is_cksum_valid((uint32_t*)block);
+}
+
+/** Steps that decode B-tree records **/
+
+/**
+ * Match object map B-tree nodes that contain at least one mapping matching
+ * the `--omap-*` parameters.
+ */
+static bool match_omap_records(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    btree_node_phys_t* node = (btree_node_phys_t*)block;
+    char* toc_start;
+    char* key_start;
+    char* val_end;
+    if (!(node->btn_flags & BTNODE_FIXED_KV_SIZE) || !get_search_node_layout(node, sizeof(kvoff_t), &toc_start, &key_start, &val_end)) {
+        return false;
+    }
+
+    bool is_leaf = node->btn_flags & BTNODE_LEAF;
+    size_t val_size = is_leaf ? sizeof(omap_val_t) : sizeof(paddr_t);
+    uint32_t num_matches = 0;
+    kvoff_t* toc_entry = (kvoff_t*)toc_start;
+    for (uint32_t i = 0; i < node->btn_nkeys; i++, toc_entry++) {
+        if (key_start + toc_entry->k + sizeof(omap_key_t) > val_end || toc_entry->v < val_size || val_end - toc_entry->v < key_start) {
+            continue;
+        }
+        omap_key_t* key = (omap_key_t*)(key_start + toc_entry->k);
+        if (!search_ranges_contain(&query->omap_key_oids, key->ok_oid) || !search_ranges_contain(&query->omap_key_xids, key->ok_xid)) {
+            continue;
+        }
+
+        paddr_t paddr = is_leaf ? ((omap_val_t*)(val_end - toc_entry->v))->ov_paddr : *(paddr_t*)(val_end - toc_entry->v);
+        if (is_leaf && !search_ranges_contain(&query->omap_val_paddrs, paddr)) {
+            continue;
+        }
+
+        if (num_matches++ == 0) {
+            snprintf(
+                detail, detail_size, "(OID %#"PRIx64", XID %#"PRIx64") -> %s%#"PRIx64"",
+                key->ok_oid, key->ok_xid, is_leaf ? "" : "child node ", paddr
+            );
+        }
+    }
+
+    if (num_matches > 1) {
+        size_t len = strlen(detail);
+        snprintf(detail + len, detail_size - len, " and %"PRIu32" more mappings", num_matches - 1);
+    }
+    return num_matches != 0;
+}
+
+/**
+ * Determine whether a dentry's name is one of those given by `--dentry-name*`,
+ * or contains one of those given by `--dentry-pattern*`.
+ */
+static bool match_dentry_name(search_query_t* query, const char* name, size_t name_len) {
+    if (query->num_dentry_names == 0 && query->num_dentry_patterns == 0) {
+        return true;
+    }
+    return (query->num_dentry_names != 0 && name_set_contains(&query->dentry_name_set, name, name_len))
+        || (query->num_dentry_patterns != 0 && name_automaton_match(&query->dentry_pattern_automaton, name, name_len, NULL));
+}
+
+/**
+ * Find the records of a file-system B-tree node that match the `--fsoid`,
+ * `--fsrt`, and `--dentry-*` parameters.
+ *
+ * detail:  If not a NULL pointer, a buffer of `detail_size` bytes to describe
+ *      the first matching record and the number of others in.
+ *
+ * results:     If not a NULL pointer, a line is added to it for each matching
+ *      record, which must be a dentry, giving the node's address `addr` and
+ *      XID, the dentry's parent and file OIDs, and its name.
+ *
+ * RETURN VALUE:    The number of matching records.
+ */
+static uint32_t scan_fs_records(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size, paddr_t addr, block_scan_results_t* results) {
+    btree_node_phys_t* node = (btree_node_phys_t*)block;
+    char* toc_start;
+    char* key_start;
+    char* val_end;
+    if ((node->btn_flags & BTNODE_FIXED_KV_SIZE) || !get_search_node_layout(node, sizeof(kvloc_t), &toc_start, &key_start, &val_end)) {
+        return 0;
+    }
+
+    bool is_leaf = node->btn_flags & BTNODE_LEAF;
+    bool has_dentry_params = query->num_dentry_names != 0 || query->num_dentry_patterns != 0 || query->dentry_fsoids.num_ranges != 0;
+    uint32_t num_matches = 0;
+    kvloc_t* toc_entry = (kvloc_t*)toc_start;
+    for (uint32_t i = 0; i < node->btn_nkeys; i++, toc_entry++) {
+        if (
+               toc_entry->k.len < sizeof(j_key_t)
+            || key_start + toc_entry->k.off + toc_entry->k.len > val_end
+            || toc_entry->v.off < toc_entry->v.len
+            || val_end - toc_entry->v.off < key_start
+        ) {
+            continue;
+        }
+
+        j_key_t* hdr = (j_key_t*)(key_start + toc_entry->k.off);
+        uint64_t fsoid = hdr->obj_id_and_type & OBJ_ID_MASK;
+        uint8_t record_type = (hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT;
+        if (!search_ranges_contain(&query->fsoids, fsoid)) {
+            continue;
+        }
+        if (query->fs_record_types != 0 && !(query->fs_record_types & (1 << record_type))) {
+            continue;
+        }
+
+        // Dentries have hashed keys, unless their key is exactly the size of
+        // an unhashed one.
+        const char* name = NULL;
+        size_t name_len = 0;
+        uint64_t file_id = 0;
+        if (record_type == APFS_TYPE_DIR_REC) {
+            j_drec_key_t* drec_key = (j_drec_key_t*)hdr;
+            j_drec_hashed_key_t* hashed_key = (j_drec_hashed_key_t*)hdr;
+            if (toc_entry->k.len >= sizeof(j_drec_key_t) && toc_entry->k.len == sizeof(j_drec_key_t) + drec_key->name_len) {
+                name = (char*)drec_key->name;
+                name_len = drec_key->name_len;
+            } else if (toc_entry->k.len >= sizeof(j_drec_hashed_key_t)) {
+                name = (char*)hashed_key->name;
+                name_len = hashed_key->name_len_and_hash & J_DREC_LEN_MASK;
+                if (name_len > toc_entry->k.len - sizeof(j_drec_hashed_key_t)) {
+                    name_len = toc_entry->k.len - sizeof(j_drec_hashed_key_t);
+                }
+            }
+            // The stored length includes the terminating NUL
+            if (name_len != 0 && name[name_len - 1] == '\0') {
+                name_len--;
+            }
+            if (is_leaf && toc_entry->v.len >= sizeof(j_drec_val_t)) {
+                file_id = ((j_drec_val_t*)(val_end - toc_entry->v.off))->file_id;
+            }
+        }
+
+        if (has_dentry_params) {
+            if (
+                   !name
+                || !match_dentry_name(query, name, name_len)
+                || (query->dentry_fsoids.num_ranges != 0 && (!is_leaf || !search_ranges_contain(&query->dentry_fsoids, file_id)))
+            ) {
+                continue;
+            }
+        }
+
+        if (results && name) {
+            add_block_scan_result(
+                results, "%#"PRIx64"\tXID %#"PRIx64"\tparent %#"PRIx64"\tfile %#"PRIx64"\t%.*s\n",
+                addr, block->o_xid, fsoid, file_id, (int)name_len, name
+            );
+        }
+        if (num_matches++ == 0 && detail) {
+            const char* keyword = search_fs_record_type_keywords[record_type];
+            if (name && is_leaf) {
+                snprintf(detail, detail_size, "%s record of FSOID %#"PRIx64": `%.*s` -> %#"PRIx64"", keyword, fsoid, (int)name_len, name, file_id);
+            } else if (name) {
+                snprintf(detail, detail_size, "%s record of FSOID %#"PRIx64": `%.*s`", keyword, fsoid, (int)name_len, name);
+            } else {
+                snprintf(detail, detail_size, "%s record of FSOID %#"PRIx64"", keyword ? keyword : "unknown", fsoid);
+            }
+        }
+    }
+
+    if (num_matches > 1 && detail) {
+        size_t len = strlen(detail);
+        snprintf(detail + len, detail_size - len, " and %"PRIu32" more records", num_matches - 1);
+    }
+    return num_matches;
+}
+
+/**
+ * Match file-system B-tree nodes that contain at least one record matching
+ * the `--fsoid`, `--fsrt`, and `--dentry-*` parameters.
+ */
+static bool match_fs_records(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size) {
+    return scan_fs_records(query, block, detail, detail_size, 0, NULL) != 0;
+}
+
+static void add_search_step(search_query_t* query, search_step_fn step) {
+    query->steps[query->num_steps++] = step;
+}
+
+/**
+ * Check a query's parameters for conflicts, narrow its types to those implied
+ * by the context-specific parameters, and build its chain of steps.
+ *
+ * RETURN VALUE:    `true` if the query is valid, else `false`, in which case
+ *              an explanation is printed to stderr.
+ */
+bool compile_search_query(search_query_t* query) {
+    bool has_omap_params = query->omap_key_oids.num_ranges != 0 || query->omap_key_xids.num_ranges != 0;
+    bool has_fs_params = query->fsoids.num_ranges != 0 || query->fs_record_types != 0;
+    bool has_dentry_params = query->num_dentry_names != 0 || query->num_dentry_patterns != 0 || query->dentry_fsoids.num_ranges != 0;
+
+    if (
+           (query->btn_flags != 0 && !restrict_search_types(query, "--btree-flags", "btree"))
+        || (has_omap_params && !restrict_search_types(query, "--omap-key-*", "omap-tree"))
+        || (query->omap_val_paddrs.num_ranges != 0 && !restrict_search_types(query, "--omap-val-paddr", "omap-tree-leaf"))
+        || (has_fs_params && !restrict_search_types(query, "--fsoid` and `--fsrt", "fs-tree"))
+        || (has_dentry_params && !restrict_search_types(query, "--dentry-*", "fs-tree-leaf"))
+    ) {
+        return false;
+    }
+    if (has_dentry_params) {
+        if (query->fs_record_types != 0 && query->fs_record_types != 0xffff && !(query->fs_record_types & (1 << APFS_TYPE_DIR_REC))) {
+            fprintf(stderr, "`--dentry-*` can only be used with `--fsrt dentry`, which conflicts with the specified `--fsrt`.\n");
+            return false;
+        }
+        query->fs_record_types = 1 << APFS_TYPE_DIR_REC;
+        query->report_dentries = true;
+    }
+    if (query->num_dentry_names != 0 && !query->dentry_name_set.slots) {
+        init_name_set(&query->dentry_name_set, query->dentry_names, query->num_dentry_names);
+    }
+    if (query->num_dentry_patterns != 0 && !query->dentry_pattern_automaton.transitions) {
+        init_name_automaton(&query->dentry_pattern_automaton, query->dentry_patterns, query->num_dentry_patterns);
+    }
+    if (query->fs_record_types == 0xffff) {
+        query->fs_record_types = 0;
+    }
+
+    // Cheapest first: these only compare fields of the object header
+    query->num_steps = 0;
+    if (query->storage_types != 0) {
+        add_search_step(query, match_storage_type);
+    }
+    if (query->oids.num_ranges != 0) {
+        add_search_step(query, match_oid);
+    }
+    if (query->xids.num_ranges != 0) {
+        add_search_step(query, match_xid);
+    }
+    if (query->num_types != 0) {
+        add_search_step(query, match_type);
+    }
+    if (query->btn_flags != 0) {
+        add_search_step(query, match_btn_flags);
+    }
+    query->num_header_steps = query->num_steps;
+
+    // Then, a structural check of the header and B-tree node geometry, which
+    // rejects most blocks that aren't objects before computing the checksum,
+    // unless the query asks for objects that would fail it
+    if (!has_unknown_search_type(query)) {
+        add_search_step(query, match_plausible_header);
+    }
+    query->cksum_step = query->num_steps;
+    add_search_step(query, match_cksum);
+
+    if (has_omap_params || query->omap_val_paddrs.num_ranges != 0) {
+        add_search_step(query, match_omap_records);
+    }
+    // Dentries are reported by `search_block()` itself, as it finds them
+    if ((has_fs_params || has_dentry_params) && !query->report_dentries) {
+        add_search_step(query, match_fs_records);
+    }
+    return true;
+}
+
+/**
+ * Evaluate a compiled query against a block, adding a line describing the
+ * block to `results` if it matches, or when searching for dentries, a line for
+ * each matching dentry within it; see `block_scan_fn`.
+ */
+void search_block(void* context, obj_phys_t* block, paddr_t addr, block_scan_results_t* results) {
+    search_query_t* query = context;
+
+    char detail[256] = "";
+    for (size_t i = 0; i < query->num_steps; i++) {
+        if (!query->steps[i](query, block, detail, sizeof(detail))) {
+            if (i < query->cksum_step) {
+                results->num_rejected++;
+            } else if (i == query->cksum_step) {
+                results->num_invalid++;
+            }
+            return;
+        }
+    }
+    if (query->report_dentries) {
+        scan_fs_records(query, block, NULL, 0, addr, results);
+        return;
+    }
+
+    char type_string[64];
+    get_search_type_string(block->o_type, block->o_subtype, type_string, sizeof(type_string));
+    add_block_scan_result(
+        results, "%#"PRIx64"\t%s\t%s\tOID %#"PRIx64"\tXID %#"PRIx64"%s%s\n",
+        addr, type_string, get_search_storage_type_string(block->o_type), block->o_oid, block->o_xid,
+        detail[0] ? "\t" : "", detail
+    );
+}
+
+/**
+ * Determine whether the block described by an entry of a block index could
+ * match a compiled query, by running the steps that only look at the object
+ * header, and checking that the key range of a B-tree node could contain a
+ * matching record. Blocks that aren't in the index can't match, since their
+ * checksums are invalid.
+ */
+bool search_block_index_entry(search_query_t* query, block_index_entry_t* entry) {
+    btree_node_phys_t node;
+    memset(&node, 0, sizeof(node));
+    node.btn_o.o_oid        = entry->bie_oid;
+    node.btn_o.o_xid        = entry->bie_xid;
+    node.btn_o.o_type       = entry->bie_type;
+    node.btn_o.o_subtype    = entry->bie_subtype;
+    node.btn_flags          = entry->bie_btn_flags;
+    node.btn_level          = entry->bie_btn_level;
+    node.btn_nkeys          = entry->bie_btn_nkeys;
+
+    for (size_t i = 0; i < query->num_header_steps; i++) {
+        if (!query->steps[i](query, (obj_phys_t*)&node, NULL, 0)) {
+            return false;
+        }
+    }
+
+    if (!is_btree_node_type(entry->bie_type) || entry->bie_btn_nkeys == 0) {
+        return true;
+    }
+
+    // Keys within a node are sorted, so every key lies between the first and
+    // the last one.
+    uint64_t first_key[2];
+    uint64_t last_key[2];
+    memcpy(first_key, entry->bie_first_key, sizeof(first_key));
+    memcpy(last_key, entry->bie_last_key, sizeof(last_key));
+    if (entry->bie_subtype == OBJECT_TYPE_OMAP && first_key[0] <= last_key[0]) {
+        return search_ranges_overlap(&query->omap_key_oids, first_key[0], last_key[0]);
+    }
+    uint64_t first_fsoid = first_key[0] & OBJ_ID_MASK;
+    uint64_t last_fsoid = last_key[0] & OBJ_ID_MASK;
+    if (entry->bie_subtype == OBJECT_TYPE_FSTREE && first_fsoid <= last_fsoid) {
+        return search_ranges_overlap(&query->fsoids, first_fsoid, last_fsoid);
+    }
+    return true;
+}
+
+/**
+ * Determine whether a filter might contain any of the values in a list of
+ * ranges. Lists that contain too many values to look up individually are
+ * assumed to match.
+ */
+static bool search_filter_may_contain(const uint8_t* filter, uint32_t num_lines, search_ranges_t* ranges) {
+    uint64_t num_values = 0;
+    for (size_t i = 0; i < ranges->num_ranges; i++) {
+        num_values += ranges->ranges[i].max - ranges->ranges[i].min + 1;
+        if (num_values > SEARCH_MAX_FILTER_LOOKUPS || num_values == 0) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < ranges->num_ranges; i++) {
+        for (uint64_t value = ranges->ranges[i].min; ; value++) {
+            if (block_index_filter_may_contain(filter, num_lines, value)) {
+                return true;
+            }
+            if (value == ranges->ranges[i].max) {
+                break;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Determine whether a region of a block index could contain a block that
+ * matches a compiled query, using the region's OID and FSOID filters.
+ */
+bool search_block_index_region(search_query_t* query, block_index_t* index, uint64_t region) {
+    block_index_region_t* region_info = index->regions + region;
+    if (region_info->bir_entry_count == 0) {
+        return false;
+    }
+    const uint8_t* oid_filter = index->filters + region_info->bir_filter_offset;
+    const uint8_t* fsoid_filter = oid_filter + (size_t)region_info->bir_oid_filter_lines * BLOCK_INDEX_FILTER_LINE_BYTES;
+    if (query->oids.num_ranges != 0 && !search_filter_may_contain(oid_filter, region_info->bir_oid_filter_lines, &query->oids)) {
+        return false;
+    }
+    if (query->fsoids.num_ranges != 0 && !search_filter_may_contain(fsoid_filter, region_info->bir_fsoid_filter_lines, &query->fsoids)) {
+        return false;
+    }
+    return true;
+}
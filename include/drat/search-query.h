@@ -0,0 +1,154 @@
+#ifndef DRAT_SEARCH_QUERY_H
+#define DRAT_SEARCH_QUERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <apfs/object.h>
+
+#include <drat/block-scan.h>
+#include <drat/block-index.h>
+#include <drat/name-match.h>
+
+/**
+ * Queries for the `search` command; see `docs/commands/search.md` for the
+ * search parameters and their meanings.
+ *
+ * Each parameter is parsed into a list of alternatives, any of which may
+ * match; a block matches the query if every parameter that was specified
+ * matches. Once all of the parameters have been parsed, the query is compiled
+ * into a chain of steps, each of which tests one parameter. Steps are ordered
+ * by cost: those that only look at the object header come first, then the
+ * checksum is verified, and only then are the records in a B-tree node
+ * decoded. Parameters that weren't specified get no step at all, so a query
+ * like `--oid 0x404` costs a few comparisons per block, and a checksum only
+ * for blocks that have that OID.
+ *
+ * Given a block index, the header steps can instead be run against its
+ * entries, along with a check of each B-tree node's key range, so that only
+ * the blocks that could match need to be read at all. Before that, the
+ * index's region filters rule out regions that can't contain the OIDs or
+ * FSOIDs being searched for, so that their entries needn't be read either.
+ */
+
+#define SEARCH_MAX_STEPS    12
+
+/**
+ * Maximum number of values of `--oid` or `--fsoid` to look up in an index's
+ * region filters; wider searches don't use the filters.
+ */
+#define SEARCH_MAX_FILTER_LOOKUPS   256
+
+/** Wildcard for the type or subtype of `search_type_t` */
+#define SEARCH_ANY_TYPE     UINT32_MAX
+
+/**
+ * A list of inclusive ranges of values. A list with no ranges matches any
+ * value.
+ */
+typedef struct {
+    uint64_t    min;
+    uint64_t    max;
+} search_range_t;
+
+typedef struct {
+    search_range_t* ranges;
+    size_t          num_ranges;
+} search_ranges_t;
+
+/**
+ * An object type and subtype to match, either of which may be
+ * `SEARCH_ANY_TYPE`, along with B-tree node flags that must all be set.
+ */
+typedef struct {
+    uint32_t    type;
+    uint32_t    subtype;
+    uint16_t    btn_flags;
+} search_type_t;
+
+typedef struct search_query search_query_t;
+
+/**
+ * A step of a compiled query.
+ *
+ * RETURN VALUE:    `true` if the block passes this step, else `false`.
+ */
+typedef bool (*search_step_fn)(search_query_t* query, obj_phys_t* block, char* detail, size_t detail_size);
+
+/**
+ * storage_types:   Bitmask of acceptable storage types, with bit `n` set for
+ *      storage type `n << 30`; zero matches any storage type.
+ *
+ * btn_flags:   B-tree node flags, any of which may be set; zero matches any
+ *      flags.
+ *
+ * fs_record_types:     Bitmask of acceptable file-system record types, with
+ *      bit `n` set for `APFS_TYPE_*` value `n`; zero matches any type.
+ *
+ * dentry_names, dentry_patterns:  Names that dentries must have, and
+ *      patterns that they must contain, ignoring case; a dentry matches if it
+ *      matches any of either. Once compiled, these are looked up with
+ *      `dentry_name_set` and `dentry_pattern_automaton`.
+ *
+ * report_dentries:     Whether each matching dentry is reported on a line of
+ *      its own, rather than each matching block.
+ *
+ * num_header_steps:    The number of `steps` that only look at the object
+ *      header fields recorded by a block index. They are followed by a check
+ *      that the header is plausible, unless the query asks for types that
+ *      would fail it, then by the checksum, which is step `cksum_step`.
+ */
+struct search_query {
+    search_ranges_t     oids;
+    search_ranges_t     xids;
+    uint32_t            storage_types;
+    search_type_t*      types;
+    size_t              num_types;
+    uint16_t            btn_flags;
+
+    search_ranges_t     omap_key_oids;
+    search_ranges_t     omap_key_xids;
+    search_ranges_t     omap_val_paddrs;
+
+    search_ranges_t     fsoids;
+    uint16_t            fs_record_types;
+    char**              dentry_names;
+    size_t              num_dentry_names;
+    char**              dentry_patterns;
+    size_t              num_dentry_patterns;
+    search_ranges_t     dentry_fsoids;
+
+    name_set_t          dentry_name_set;
+    name_automaton_t    dentry_pattern_automaton;
+    bool                report_dentries;
+
+    search_step_fn      steps[SEARCH_MAX_STEPS];
+    size_t              num_steps;
+    size_t              num_header_steps;
+    size_t              cksum_step;
+};
+
+void init_search_query(search_query_t* query);
+void free_search_query(search_query_t* query);
+
+bool parse_search_ranges(const char* arg, search_ranges_t* ranges);
+bool parse_search_types(const char* arg, search_query_t* query);
+bool parse_search_storage_types(const char* arg, uint32_t* storage_types);
+bool parse_search_btn_flags(const char* arg, uint16_t* btn_flags);
+bool parse_search_fs_record_types(const char* arg, uint16_t* fs_record_types);
+bool parse_search_dentry_names(const char* arg, search_query_t* query);
+bool parse_search_dentry_patterns(const char* arg, search_query_t* query);
+bool parse_search_name_file(const char* path, char*** names, size_t* num_names);
+
+bool compile_search_query(search_query_t* query);
+bool search_ranges_contain(search_ranges_t* ranges, uint64_t value);
+void search_block(void* query, obj_phys_t* block, paddr_t addr, block_scan_results_t* results);
+bool search_block_index_region(search_query_t* query, block_index_t* index, uint64_t region);
+bool search_block_index_entry(search_query_t* query, block_index_entry_t* entry);
+
+uint32_t get_search_object_type(uint32_t o_type);
+void get_search_type_string(uint32_t o_type, uint32_t o_subtype, char* type_string, size_t size);
+const char* get_search_storage_type_string(uint32_t o_type);
+
+#endif // DRAT_SEARCH_QUERY_H
@@ -44,6 +44,31 @@ char* get_om_flags_string(omap_phys_t* omap) {
     return get_flags_enum_string(flags, ARRAY_SIZE(flags), omap->om_flags, false);
 }
 
+/**
+ * Get a human-readable string that lists the flags that are set on a given
+ * object map value.
+ * 
+ * omap_val:    A pointer to the object map value in question.
+ * 
+ * single_line: If true, the flags are listed on a single line, delimited by
+ *      commas; else, they are listed as a bulleted list.
+ * 
+ * RETURN VALUE:
+ *      A pointer to the first character of the string. The caller must free
+ *      this pointer when it is no longer needed.
+ */
+char* get_ov_flags_string(omap_val_t* omap_val, bool single_line) {
+    enum_string_mapping_t flags[] = {
+        { OMAP_VAL_DELETED,             "Deleted" },
+        { OMAP_VAL_SAVED,               "Saved" },
+        { OMAP_VAL_ENCRYPTED,           "Encrypted" },
+        { OMAP_VAL_NOHEADER,            "No header" },
+        { OMAP_VAL_CRYPTO_GENERATION,   "Crypto generation" },
+    };
+
+    return get_flags_enum_string(flags, ARRAY_SIZE(flags), omap_val->ov_flags, single_line);
+}
+
 /**
  * Print a nicely formatted string describing the data contained in an object
  * map, including the data in its header.
@@ -96,7 +121,10 @@ void print_omap_key(omap_key_t* omap_key) {
  * map value.
  */
 void print_omap_val(omap_val_t* omap_val) {
-    // TODO: Print flags
+    char* flags_string = get_ov_flags_string(omap_val, true);
+    printf("  - Flags:                          %s\n",             flags_string);
+    free(flags_string);
+
     printf("  - Object size:                    %"PRIu32" bytes\n", omap_val->ov_size);
     printf("  - Object address in container:    %#"PRIx64"\n",      omap_val->ov_paddr);
 }
@@ -18,36 +18,54 @@ typedef struct {
  * Function prototypes; function implementations are
  * contained within the respective command's source file.
  */
+command_function cmd_benchmark_omap_lookup;
+command_function cmd_carve;
+command_function cmd_census;
+command_function cmd_create_index;
+command_function cmd_create_omap_index;
 command_function cmd_explore_fs_tree;
 command_function cmd_explore_omap_tree;
+command_function cmd_find_known_files;
 command_function cmd_inspect;
 command_function cmd_list_raw;
 command_function cmd_list;
 command_function cmd_modify;
+command_function cmd_query_omap_index;
 command_function cmd_read;
 command_function cmd_recover_raw;
 command_function cmd_recover;
 command_function cmd_resolver;
-command_function cmd_search_last_btree_node;
 command_function cmd_search;
 command_function cmd_version;
 
 static drat_command_t drat_commands[] = {
+    { "carve"                   , cmd_carve                     , "Carve files out of raw blocks by their header and footer signatures, optionally only from free space" },
+    { "census"                  , cmd_census                    , "Count the objects in the partition by type, B-tree level and XID, and report the addresses at which each kind lies" },
+    { "create-index"            , cmd_create_index              , "Scan the partition for objects with valid checksums and build an index of them for use by `search`" },
+    { "create-omap-index"       , cmd_create_omap_index         , "Scan the partition for object map leaf nodes, including stale ones, and build an index of all mappings found" },
     { "explore-fs-tree"         , cmd_explore_fs_tree           , "Explore filesystem B-tree" },
     { "explore-omap-tree"       , cmd_explore_omap_tree         , "Explore object map B-tree" },
+    { "find-known-files"        , cmd_find_known_files          , "Sweep the partition for blocks of given reference files, and report where copies of them likely lie" },
     { "inspect"                 , cmd_inspect                   , "Inspect APFS partition" },
     { "list-raw"                , cmd_list_raw                  , "List directory contents or file info based on its filesystem OID" },
     { "list"                    , cmd_list                      , "List directory contents or file info based on its filepath" },
     // { "modify"                  , cmd_modify                    , "Modify structures on disk to resolve problems" },
+    { "query-omap-index"        , cmd_query_omap_index          , "List all known versions of a Virtual OID using an index built by `create-omap-index`" },
     { "read"                    , cmd_read                      , "Read a block and display information about it" },
     { "recover-raw"             , cmd_recover_raw               , "Recover a file based on its filesystem OID" },
     { "recover"                 , cmd_recover                   , "Recover a file based on its filepath" },
     { "resolver"                , cmd_resolver                  , "Check if given Virtual OIDs resolve to given Physical OIDs" },
-    { "search-last-btree-node"  , cmd_search_last_btree_node    , "Search the partition for B-tree nodes, reporting the Physical OID of the last one discovered" },
     { "search"                  , cmd_search                    , "Search the partition for blocks with certain features/properties" },
     { "version"                 , cmd_version                   , "Display Drat's version number along with legal info (copyright, warranty, and license)" },
 };
 
+/**
+ * Commands used when developing Drat, which aren't listed in its usage info.
+ */
+static drat_command_t drat_developer_commands[] = {
+    { "benchmark-omap-lookup"   , cmd_benchmark_omap_lookup     , "Measure the speed of Virtual OID lookups in an object map B-tree" },
+};
+
 /**
  * Given the name of a command `command_name`, return a pointer to the
  * corresponding function `command_main` for that command.
@@ -67,6 +85,11 @@ command_function* get_command_function(char* command_name) {
             return drat_commands[i].function;
         }
     }
+    for (size_t i = 0; i < ARRAY_SIZE(drat_developer_commands); i++) {
+        if (strcmp(drat_developer_commands[i].name, command_name) == 0) {
+            return drat_developer_commands[i].function;
+        }
+    }
 
     return NULL;
 }
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <apfs/object.h>
+#include <apfs/omap.h>
+#include <apfs/btree.h>
+
+#include <drat/io.h>
+
+#include <drat/func/boolean.h>
+#include <drat/func/btree.h>
+#include <drat/func/omap-node.h>
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> <root node address> [<iterations>]\n"
+        "Example: %s /dev/disk0s2 0x3af2 100\n"
+        "\n"
+        "Every object map entry in the object map B-tree whose root node lies at the\n"
+        "given address is looked up `<iterations>` times (default: 10) using each of\n"
+        "the available lookup strategies, and the time taken by each is reported.\n",
+
+        argv[0],
+        argv[0]
+    );
+}
+
+/**
+ * Append the key and target address of every entry in the leaves of the
+ * subtree rooted at `node` to the `keys` and `paddrs` arrays.
+ */
+static void collect_omap_entries(omap_node_t* node, omap_key_t** keys, paddr_t** paddrs, size_t* num_keys, size_t* capacity) {
+    if (!(node->flags & BTNODE_LEAF)) {
+        // `node` remains valid until it is released, even if reading its
+        // children evicts it from the cache
+        for (uint32_t i = 0; i < node->nkeys; i++) {
+            omap_node_t* child = read_omap_node(node->vals[i].ov_paddr);
+            if (child) {
+                collect_omap_entries(child, keys, paddrs, num_keys, capacity);
+                release_omap_node(child);
+            }
+        }
+        return;
+    }
+
+    if (*num_keys + node->nkeys > *capacity) {
+        *capacity = 2 * (*capacity + node->nkeys);
+        *keys   = realloc(*keys,   *capacity * sizeof(omap_key_t));
+        *paddrs = realloc(*paddrs, *capacity * sizeof(paddr_t));
+        if (!*keys || !*paddrs) {
+            fprintf(stderr, "\nABORT: %s: Could not allocate sufficient memory for `keys` and `paddrs`.\n", __func__);
+            exit(-1);
+        }
+    }
+
+    for (uint32_t i = 0; i < node->nkeys; i++) {
+        (*keys)[*num_keys].ok_oid = node->oids[i];
+        (*keys)[*num_keys].ok_xid = node->xids[i];
+        (*paddrs)[*num_keys] = node->vals[i].ov_paddr;
+        (*num_keys)++;
+    }
+}
+
+static double get_elapsed_seconds(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int cmd_benchmark_omap_lookup(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+    nx_path = argv[1];
+
+    paddr_t root_node_addr;
+    bool parse_success = sscanf(argv[2], "0x%" SCNx64, &root_node_addr);
+    if (!parse_success) {
+        parse_success = sscanf(argv[2], "%" SCNu64, &root_node_addr);
+    }
+    if (!parse_success) {
+        fprintf(stderr, "%s is not a valid block address.\n", argv[2]);
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    uint64_t num_iterations = 10;
+    if (argc == 4) {
+        if (sscanf(argv[3], "%" SCNu64, &num_iterations) != 1 || num_iterations == 0) {
+            fprintf(stderr, "%s is not a valid number of iterations.\n", argv[3]);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    // Open (device special) file corresponding to an APFS container, read-only
+    printf("Opening file at `%s` in read-only mode ... ", nx_path);
+    nx = fopen(nx_path, "rb");
+    if (!nx) {
+        fprintf(stderr, "\nABORT: ");
+        report_fopen_error();
+        printf("\n");
+        return -errno;
+    }
+    printf("OK.\n");
+
+    btree_node_phys_t* root_node = malloc(nx_block_size);
+    if (!root_node) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `root_node`.\n");
+        return -1;
+    }
+
+    printf("Reading block %#" PRIx64 " ... ", root_node_addr);
+    if (read_blocks(root_node, root_node_addr, 1) != 1) {
+        fprintf(stderr, "\nABORT: Failed to read block %#" PRIx64 ".\n", root_node_addr);
+        return -1;
+    }
+    printf("OK.\n");
+
+    if (!is_btree_node_phys_root(root_node) || !is_omap_tree(root_node)) {
+        fprintf(stderr, "\nABORT: Block %#" PRIx64 " is not the root node of an object map B-tree.\n", root_node_addr);
+        return -1;
+    }
+
+    printf("Collecting the entries of the B-tree ... ");
+    omap_key_t* keys = NULL;
+    paddr_t* paddrs = NULL;
+    size_t num_keys = 0;
+    size_t capacity = 0;
+    omap_node_t* root = get_omap_node(root_node, root_node_addr);
+    if (!root) {
+        fprintf(stderr, "\nABORT: Could not decode the root node.\n");
+        return -1;
+    }
+    collect_omap_entries(root, &keys, &paddrs, &num_keys, &capacity);
+    release_omap_node(root);
+    printf("OK; found %zu entries.\n\n", num_keys);
+
+    if (num_keys == 0) {
+        printf("END: The B-tree is empty, so there is nothing to benchmark.\n");
+        return 0;
+    }
+
+    struct {
+        const char* name;
+        bool        use_cache;
+        bool        use_simd;
+    } strategies[] = {
+        { "Uncached nodes, binary search"   , false , false },
+        { "Cached nodes, binary search"     , true  , false },
+        { "Cached nodes, AVX2 search"       , true  , true  },
+    };
+    size_t num_strategies = sizeof(strategies) / sizeof(strategies[0]);
+    if (!is_omap_key_search_simd_available()) {
+        printf("SIMD key search is not available on this machine; skipping that strategy.\n\n");
+        num_strategies--;
+    }
+
+    printf("Looking up each of the %zu entries %" PRIu64 " times with each strategy:\n", num_keys, num_iterations);
+    double baseline_ns = 0;
+    for (size_t s = 0; s < num_strategies; s++) {
+        set_omap_node_cache_enabled(strategies[s].use_cache);
+        clear_omap_node_cache();
+        set_omap_key_search_simd_enabled(strategies[s].use_simd);
+
+        uint64_t num_mismatches = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t iteration = 0; iteration < num_iterations; iteration++) {
+            for (size_t i = 0; i < num_keys; i++) {
+                omap_entry_t* entry = get_btree_phys_omap_entry(root_node, keys[i].ok_oid, keys[i].ok_xid);
+                if (!entry || entry->val.ov_paddr != paddrs[i]) {
+                    num_mismatches++;
+                }
+                free(entry);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns_per_lookup = get_elapsed_seconds(&start, &end) * 1e9 / (num_iterations * num_keys);
+        if (s == 0) {
+            baseline_ns = ns_per_lookup;
+        }
+        printf(
+            "- %-32s %10.1f ns/lookup  ||  %6.2fx  ||  %" PRIu64 " mismatches\n",
+            strategies[s].name,
+            ns_per_lookup,
+            baseline_ns / ns_per_lookup,
+            num_mismatches
+        );
+    }
+    printf("\n");
+
+    set_omap_node_cache_enabled(true);
+    set_omap_key_search_simd_enabled(true);
+
+    free(keys);
+    free(paddrs);
+    free(root_node);
+    fclose(nx);
+    return 0;
+}
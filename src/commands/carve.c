@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+
+#include <drat/io.h>
+#include <drat/nx-session.h>
+#include <drat/output.h>
+#include <drat/block-scan.h>
+#include <drat/allocation-bitmap.h>
+#include <drat/carve.h>
+#include <drat/recover-tree.h>  // get_default_recover_thread_count()
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> [--types <types>] [--output <directory>] [--free-space] [--limit <N>] [--jobs <N>]\n"
+        "Types:   ",
+
+        argv[0]
+    );
+    for (size_t i = 0; i < num_carve_signatures; i++) {
+        fprintf(argc == 1 ? stdout : stderr, "%s%s", i == 0 ? "" : ", ", carve_signatures[i].name);
+    }
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "\n"
+        "Example: %s /dev/disk0s2 --types jpeg,png --free-space\n"
+        "         %s /dev/disk0s2 --output carved-files\n",
+
+        argv[0],
+        argv[0]
+    );
+}
+
+int cmd_carve(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    nx_path = argv[1];
+    carve_context_t context;
+    init_carve_context(&context, NULL, NULL, 0);
+    char* output_dir = NULL;
+    bool free_space = false;
+    uint64_t limit = 0;
+    uint32_t num_threads = get_default_recover_thread_count();
+    for (int i = 2; i < argc; i++) {
+        bool valid = true;
+        if (strcmp(argv[i], "--free-space") == 0) {
+            free_space = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
+        }
+
+        char* option = argv[i++];
+        char* value = argv[i];
+        if (strcmp(option, "--types") == 0) {
+            valid = parse_carve_types(value, &context);
+        } else if (strcmp(option, "--output") == 0) {
+            output_dir = value;
+        } else if (strcmp(option, "--limit") == 0) {
+            valid = sscanf(value, "%"SCNu64"", &limit) == 1 && limit != 0;
+        } else if (strcmp(option, "--jobs") == 0) {
+            valid = sscanf(value, "%"SCNu32"", &num_threads) == 1 && num_threads != 0;
+        } else {
+            fprintf(stderr, "Unrecognised option `%s`.\n", option);
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (!valid) {
+            fprintf(stderr, "`%s` is not a valid value for `%s`; see `docs/commands/carve.md`.\n", value, option);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    if (output_dir && !make_directories(output_dir)) {
+        fprintf(stderr, "\nABORT: Could not create the output directory `%s`.\n", output_dir);
+        return -1;
+    }
+
+    // Only free space is carved when asked, which needs the space manager of
+    // the latest checkpoint; otherwise, the container needn't be valid at all
+    nx_session_t* session = NULL;
+    allocation_bitmap_t* allocated = NULL;
+    uint64_t num_blocks = 0;
+    if (free_space) {
+        session = open_nx_session(nx_path, stderr);
+        if (!session) {
+            return -errno;
+        }
+        allocated = read_allocation_bitmap(session);
+        if (!allocated) {
+            close_nx_session(session);
+            return -1;
+        }
+        num_blocks = allocated->num_blocks;
+        fprintf(
+            stderr, "The space manager marks %"PRIu64" of %"PRIu64" blocks as allocated; only the other %"PRIu64" will be carved.\n",
+            allocated->num_allocated, num_blocks, num_blocks - allocated->num_allocated
+        );
+    } else {
+        // Open (device special) file corresponding to an APFS container, read-only
+        fprintf(stderr, "Opening file at `%s` in read-only mode ... ", nx_path);
+        nx = fopen(nx_path, "rb");
+        if (!nx) {
+            fprintf(stderr, "\nABORT: ");
+            report_fopen_error();
+            fprintf(stderr, "\n");
+            return -errno;
+        }
+        fprintf(stderr, "OK.\n");
+
+        nx_superblock_t* nxsb = malloc(nx_block_size);
+        if (!nxsb) {
+            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nxsb`.\n");
+            return -1;
+        }
+
+        fprintf(stderr, "Reading block 0x0 to obtain block count ... ");
+        if (read_blocks(nxsb, 0x0, 1) != 1) {
+            fprintf(stderr, "FAILED.\n");
+            return -1;
+        }
+        fprintf(stderr, "OK.\n");
+        num_blocks = nxsb->nx_block_count;
+        free(nxsb);
+    }
+    fprintf(stderr, "The specified device has %" PRIu64 " = %#" PRIx64 " blocks.\n", num_blocks, num_blocks);
+
+    context.output_dir = output_dir;
+    context.allocated = allocated;
+    context.num_blocks = num_blocks;
+    fprintf(stderr, "Commencing carving:\n\n");
+
+    // Results go to stdout, one per line, so that they can be piped into
+    // other tools; everything else goes to stderr.
+    block_scan_stats_t stats;
+    bool success = scan_blocks(0, num_blocks, num_threads, limit, carve_block, &context, stdout, stderr, &stats);
+
+    fprintf(stderr, "\nScanned %#"PRIx64" blocks with %"PRIu32" threads", stats.num_blocks, stats.num_threads);
+    if (stats.limit_reached) {
+        fprintf(stderr, ", stopping early as the limit of %"PRIu64" files was reached", limit);
+    }
+    fprintf(stderr, ".\n");
+    fprintf(stderr, "- Read errors:         %"PRIu64"\n", stats.num_read_errors);
+    fprintf(stderr, "- Files found:         %"PRIu64"\n", stats.num_results);
+
+    free_allocation_bitmap(allocated);
+    if (session) {
+        close_nx_session(session);
+    } else {
+        fclose(nx);
+    }
+    return success ? 0 : -1;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+
+#include <drat/io.h>
+#include <drat/block-scan.h>
+#include <drat/census.h>
+#include <drat/search-query.h>  // get_search_type_string()
+#include <drat/recover-tree.h>  // get_default_recover_thread_count()
+
+/**
+ * Width of the bars of the histogram printed to stderr.
+ */
+#define CENSUS_BAR_WIDTH    40
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> [--xid-buckets <N>] [--xid-bucket-width <N>] [--jobs <N>]\n"
+        "Example: %s /dev/disk0s2 > census.tsv\n",
+
+        argv[0],
+        argv[0]
+    );
+}
+
+int cmd_census(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    nx_path = argv[1];
+    uint16_t num_xid_buckets = CENSUS_DEFAULT_XID_BUCKETS;
+    xid_t xid_bucket_width = 0;
+    uint32_t num_threads = get_default_recover_thread_count();
+    for (int i = 2; i < argc; i++) {
+        bool valid = true;
+        if (i + 1 == argc) {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
+        }
+
+        char* option = argv[i++];
+        char* value = argv[i];
+        if (strcmp(option, "--xid-buckets") == 0) {
+            valid = sscanf(value, "%"SCNu16"", &num_xid_buckets) == 1 && num_xid_buckets != 0 && num_xid_buckets != UINT16_MAX;
+        } else if (strcmp(option, "--xid-bucket-width") == 0) {
+            valid = sscanf(value, "%"SCNu64"", &xid_bucket_width) == 1 && xid_bucket_width != 0;
+        } else if (strcmp(option, "--jobs") == 0) {
+            valid = sscanf(value, "%"SCNu32"", &num_threads) == 1 && num_threads != 0;
+        } else {
+            fprintf(stderr, "Unrecognised option `%s`.\n", option);
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (!valid) {
+            fprintf(stderr, "`%s` is not a valid value for `%s`; see `docs/commands/census.md`.\n", value, option);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    // Open (device special) file corresponding to an APFS container, read-only
+    fprintf(stderr, "Opening file at `%s` in read-only mode ... ", nx_path);
+    nx = fopen(nx_path, "rb");
+    if (!nx) {
+        fprintf(stderr, "\nABORT: ");
+        report_fopen_error();
+        fprintf(stderr, "\n");
+        return -errno;
+    }
+    fprintf(stderr, "OK.\n");
+
+    nx_superblock_t* nxsb = malloc(nx_block_size);
+    if (!nxsb) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nxsb`.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Reading block 0x0 to obtain block count and next XID ... ");
+    if (read_blocks(nxsb, 0x0, 1) != 1) {
+        fprintf(stderr, "FAILED.\n");
+        return -1;
+    }
+    fprintf(stderr, "OK.\n");
+    uint64_t num_blocks = nxsb->nx_block_count;
+    xid_t next_xid = nxsb->nx_next_xid;
+    free(nxsb);
+    fprintf(stderr, "The specified device has %" PRIu64 " = %#" PRIx64 " blocks.\n", num_blocks, num_blocks);
+
+    // Unless given, the bucket width is chosen so that the buckets cover the
+    // XIDs up to the next XID according to block 0
+    if (xid_bucket_width == 0) {
+        xid_bucket_width = (next_xid + num_xid_buckets - 1) / num_xid_buckets;
+    }
+    census_t census;
+    init_census(&census, xid_bucket_width, num_xid_buckets);
+    fprintf(
+        stderr, "Grouping XIDs into %"PRIu16" buckets of %#"PRIx64" XIDs; block 0 gives the next XID as %#"PRIx64".\n",
+        num_xid_buckets, census.xid_bucket_width, next_xid
+    );
+    fprintf(stderr, "Commencing census:\n\n");
+
+    block_scan_stats_t stats;
+    bool success = scan_block_chunks(0, num_blocks, num_threads, count_census_chunk, NULL, &census, stdout, stderr, &stats);
+
+    // The census goes to stdout, one line per kind of object, so that it can be
+    // piped into other tools; everything else goes to stderr.
+    size_t num_entries = 0;
+    census_entry_t* entries = get_census_entries(&census, &num_entries);
+    printf("type\tstorage\tlevel\txids\tobjects\tfirst-addr\tlast-addr\tmin-xid\tmax-xid\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        census_entry_t* entry = entries + i;
+
+        char type_string[64];
+        get_search_type_string(entry->key.type, entry->key.subtype, type_string, sizeof(type_string));
+        char level_string[8] = "-";
+        if (entry->key.level != CENSUS_NO_LEVEL) {
+            snprintf(level_string, sizeof(level_string), "%"PRIu16"", entry->key.level);
+        }
+        xid_t bucket_start = entry->key.xid_bucket * census.xid_bucket_width;
+        char xids_string[40];
+        if (entry->key.xid_bucket < census.num_xid_buckets) {
+            snprintf(xids_string, sizeof(xids_string), "%#"PRIx64"-%#"PRIx64"", bucket_start, bucket_start + census.xid_bucket_width - 1);
+        } else {
+            snprintf(xids_string, sizeof(xids_string), "%#"PRIx64"-", bucket_start);
+        }
+
+        printf(
+            "%s\t%s\t%s\t%s\t%"PRIu64"\t%#"PRIx64"\t%#"PRIx64"\t%#"PRIx64"\t%#"PRIx64"\n",
+            type_string, get_search_storage_type_string(entry->key.storage), level_string, xids_string,
+            entry->count, entry->first_addr, entry->last_addr, entry->min_xid, entry->max_xid
+        );
+    }
+
+    // Then, a histogram of the object types for a quick look, merging the
+    // levels and XID buckets of each
+    fprintf(stderr, "\nObjects by type:\n");
+    uint64_t max_count = 0;
+    for (size_t i = 0, j; i < num_entries; i = j) {
+        uint64_t count = 0;
+        for (j = i; j < num_entries && entries[j].key.type == entries[i].key.type && entries[j].key.subtype == entries[i].key.subtype; j++) {
+            count += entries[j].count;
+        }
+        if (count > max_count) {
+            max_count = count;
+        }
+    }
+    for (size_t i = 0, j; i < num_entries; i = j) {
+        uint64_t count = 0;
+        paddr_t first_addr = entries[i].first_addr;
+        paddr_t last_addr = entries[i].last_addr;
+        for (j = i; j < num_entries && entries[j].key.type == entries[i].key.type && entries[j].key.subtype == entries[i].key.subtype; j++) {
+            count += entries[j].count;
+            if (entries[j].first_addr < first_addr) {
+                first_addr = entries[j].first_addr;
+            }
+            if (entries[j].last_addr > last_addr) {
+                last_addr = entries[j].last_addr;
+            }
+        }
+
+        char type_string[64];
+        get_search_type_string(entries[i].key.type, entries[i].key.subtype, type_string, sizeof(type_string));
+        char bar[CENSUS_BAR_WIDTH + 1];
+        size_t bar_len = (count * CENSUS_BAR_WIDTH + max_count - 1) / max_count;
+        memset(bar, '#', bar_len);
+        bar[bar_len] = '\0';
+        fprintf(
+            stderr, "- %-32s %10"PRIu64"  %-*s  %#"PRIx64"-%#"PRIx64"\n",
+            type_string, count, CENSUS_BAR_WIDTH, bar, first_addr, last_addr
+        );
+    }
+    free(entries);
+
+    fprintf(stderr, "\nScanned %#"PRIx64" blocks with %"PRIu32" threads.\n", stats.num_blocks, stats.num_threads);
+    fprintf(stderr, "- Read errors:         %"PRIu64"\n", stats.num_read_errors);
+    fprintf(stderr, "- Objects:             %"PRIu64"\n", census.num_objects);
+    fprintf(stderr, "- Rejected by header:  %"PRIu64"\n", stats.num_rejected);
+    fprintf(stderr, "- Invalid checksum:    %"PRIu64"\n", stats.num_invalid);
+    fprintf(stderr, "- Zeroed blocks:       %"PRIu64"\n", census.num_zeroed - stats.num_read_errors);
+
+    free_census(&census);
+    fclose(nx);
+    return success ? 0 : -1;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+
+#include <drat/io.h>
+#include <drat/block-scan.h>
+#include <drat/block-index.h>
+#include <drat/recover-tree.h>  // get_default_recover_thread_count()
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> <index file> [--jobs <N>] [--resume] [--refresh]\n"
+        "Example: %s /dev/disk0s2 drat-index.bin\n"
+        "         %s /dev/disk0s2 drat-index.bin --refresh\n",
+
+        argv[0],
+        argv[0],
+        argv[0]
+    );
+}
+
+int cmd_create_index(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    if (argc < 3) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+    nx_path = argv[1];
+    char* index_path = argv[2];
+
+    uint32_t num_threads = get_default_recover_thread_count();
+    bool resume = false;
+    bool refresh = false;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        } else if (strcmp(argv[i], "--refresh") == 0) {
+            refresh = true;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            i++;
+            if (sscanf(argv[i], "%"SCNu32"", &num_threads) != 1 || num_threads == 0) {
+                fprintf(stderr, "%s is not a valid number of jobs.\n", argv[i]);
+                print_usage(argc, argv);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    // Open (device special) file corresponding to an APFS container, read-only
+    printf("Opening file at `%s` in read-only mode ... ", nx_path);
+    nx = fopen(nx_path, "rb");
+    if (!nx) {
+        fprintf(stderr, "\nABORT: ");
+        report_fopen_error();
+        printf("\n");
+        return -errno;
+    }
+    printf("OK.\n");
+
+    nx_superblock_t* nxsb = malloc(nx_block_size);
+    if (!nxsb) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nxsb`.\n");
+        return -1;
+    }
+
+    printf("Reading block 0x0 to obtain block count and container UUID ... ");
+    if (read_blocks(nxsb, 0x0, 1) != 1) {
+        printf("FAILED.\n");
+        return -1;
+    }
+    printf("OK.\n");
+
+    // Regions of the old index whose contents haven't changed are reused
+    block_index_t* previous = NULL;
+    if (refresh) {
+        printf("Reading the index to refresh at `%s` ... ", index_path);
+        previous = read_block_index(index_path, true);
+        if (!previous) {
+            return -1;
+        }
+        if (
+               memcmp(previous->header.bih_nx_uuid, nxsb->nx_uuid, sizeof(uuid_t)) != 0
+            || previous->header.bih_block_size != nx_block_size
+        ) {
+            printf("FAILED.\n");
+            fprintf(stderr, "The index was created for a different container.\n");
+            return -1;
+        }
+        printf("OK.\n");
+    }
+
+    printf("Opening index file at `%s%s` ... ", index_path, BLOCK_INDEX_PARTIAL_SUFFIX);
+    block_index_builder_t* builder = open_block_index_builder(index_path, nxsb->nx_uuid, nxsb->nx_block_count, resume, previous);
+    free(nxsb);
+    if (!builder) {
+        return -1;
+    }
+    printf("OK.\n");
+
+    paddr_t start_addr = builder->header.bih_regions_done * BLOCK_INDEX_REGION_BLOCKS;
+    paddr_t end_addr = builder->header.bih_block_count;
+    if (resume && start_addr != 0) {
+        printf("Resuming from block %#"PRIx64", with %"PRIu64" objects already indexed.\n", start_addr, builder->header.bih_entry_count);
+    }
+
+    printf("Scanning %#"PRIx64" blocks with %"PRIu32" threads:\n", end_addr - start_addr, num_threads);
+    block_scan_stats_t stats;
+    if (!scan_block_chunks(start_addr, end_addr, num_threads, index_block_chunk, checkpoint_block_index, builder, builder->file, stdout, &stats)) {
+        fprintf(stderr, "\nABORT: The scan did not complete; run the same command with `--resume` to continue it.\n");
+        free_block_index_builder(builder);
+        return -1;
+    }
+
+    printf("Writing index ... ");
+    if (!finish_block_index(builder)) {
+        printf("FAILED.\n");
+        return -1;
+    }
+    printf("OK.\n");
+
+    printf("\nIndexed %"PRIu64" objects with valid checksums.\n", builder->header.bih_entry_count);
+    printf("- Blocks scanned:      %"PRIu64"\n", stats.num_blocks);
+    if (refresh) {
+        printf("- Unchanged regions:   %"PRIu64" of %"PRIu64"\n", builder->num_reused, builder->header.bih_regions_done - builder->base_regions);
+    }
+    printf("- Rejected by header:  %"PRIu64"\n", stats.num_rejected);
+    printf("- Invalid checksum:    %"PRIu64"\n", stats.num_invalid);
+    printf("- Read errors:         %"PRIu64"\n", stats.num_read_errors);
+
+    free_block_index_builder(builder);
+    free_block_index(previous);
+    fclose(nx);
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+#include <apfs/omap.h>
+#include <apfs/btree.h>
+
+#include <drat/io.h>
+#include <drat/nx-session.h>
+#include <drat/allocation-bitmap.h>
+#include <drat/omap-index.h>
+
+#include <drat/func/boolean.h>
+#include <drat/func/cksum.h>
+
+/**
+ * Number of blocks to read from the container at a time whilst scanning.
+ */
+#define SCAN_CHUNK_NUM_BLOCKS   256
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> <index file> [<start address> <end address>] [--free-space]\n"
+        "Example: %s /dev/disk0s2 omap-index.bin\n"
+        "         %s /dev/disk0s2 omap-index.bin 0x0 0x100000\n"
+        "         %s /dev/disk0s2 omap-index.bin --free-space\n",
+
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0]
+    );
+}
+
+/**
+ * Parse a block address given on the command line in either hexadecimal
+ * (with leading `0x`) or decimal.
+ *
+ * RETURN VALUE:    `true` if `arg` was a valid address, else `false`.
+ */
+static bool parse_address(char* arg, uint64_t* addr) {
+    bool parse_success = sscanf(arg, "0x%"SCNx64"", addr);
+    if (!parse_success) {
+        parse_success = sscanf(arg, "%"SCNu64"", addr);
+    }
+    return parse_success;
+}
+
+/**
+ * Determine whether a given block could be worth adding to the index, i.e.
+ * whether its header says that it is an object map B-tree leaf node with
+ * fixed-size keys and values, and is plausible. Only the checksums of such
+ * candidates need to be computed.
+ */
+static bool is_omap_leaf_candidate(obj_phys_t* block) {
+    if (!is_btree_node_phys(block) || !is_omap_tree(block)) {
+        return false;
+    }
+
+    btree_node_phys_t* node = block;
+    if (
+           !(node->btn_flags & BTNODE_LEAF)
+        || !(node->btn_flags & BTNODE_FIXED_KV_SIZE)
+        || node->btn_level != 0
+        || node->btn_nkeys == 0
+    ) {
+        return false;
+    }
+
+    return is_obj_header_plausible(block);
+}
+
+int cmd_create_omap_index(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    bool free_space = false;
+    char* args[5] = { argv[0] };
+    int num_args = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--free-space") == 0) {
+            free_space = true;
+        } else if (num_args < 5) {
+            args[num_args++] = argv[i];
+        } else {
+            num_args++;
+        }
+    }
+    if (num_args != 3 && num_args != 5) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+    nx_path = args[1];
+    char* index_path = args[2];
+
+    uint64_t start_addr = 0;
+    uint64_t end_addr = 0;
+    if (num_args == 5) {
+        if (!parse_address(args[3], &start_addr)) {
+            fprintf(stderr, "Start address must be specified as a hexadecimal or decimal number.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (!parse_address(args[4], &end_addr)) {
+            fprintf(stderr, "End address must be specified as a hexadecimal or decimal number.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    // Only free space is scanned when asked, which needs the space manager of
+    // the latest checkpoint; otherwise, the container needn't be valid at all
+    nx_session_t* session = NULL;
+    allocation_bitmap_t* allocated = NULL;
+    if (free_space) {
+        session = open_nx_session(nx_path, stdout);
+        if (!session) {
+            return -errno;
+        }
+        allocated = read_allocation_bitmap(session);
+        if (!allocated) {
+            close_nx_session(session);
+            return -1;
+        }
+        printf(
+            "The space manager marks %"PRIu64" of %"PRIu64" blocks as allocated; only the other %"PRIu64" will be scanned.\n",
+            allocated->num_allocated, allocated->num_blocks, allocated->num_blocks - allocated->num_allocated
+        );
+    } else {
+        // Open (device special) file corresponding to an APFS container, read-only
+        printf("Opening file at `%s` in read-only mode ... ", nx_path);
+        nx = fopen(nx_path, "rb");
+        if (!nx) {
+            fprintf(stderr, "\nABORT: ");
+            report_fopen_error();
+            printf("\n");
+            return -errno;
+        }
+        printf("OK.\n");
+    }
+
+    int result = -1;
+    omap_index_t* index = NULL;
+    char (*blocks)[nx_block_size] = malloc(SCAN_CHUNK_NUM_BLOCKS * nx_block_size);
+    if (!blocks) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `blocks`.\n");
+        goto cleanup;
+    }
+
+    printf("Reading block 0x0 to obtain block count and container UUID ... ");
+    if (read_blocks(blocks[0], 0x0, 1) != 1) {
+        printf("FAILED.\n");
+        goto cleanup;
+    }
+    printf("OK.\n");
+
+    nx_superblock_t* nxsb = blocks[0];
+    uint64_t num_blocks = nxsb->nx_block_count;
+    if (num_args != 5) {
+        end_addr = num_blocks;
+    }
+    if (end_addr > num_blocks) {
+        end_addr = num_blocks;
+    }
+    if (start_addr >= end_addr) {
+        fprintf(stderr, "\nABORT: The specified address range is empty.\n");
+        goto cleanup;
+    }
+
+    index = create_omap_index(nxsb->nx_uuid);
+    index->header.oih_start_paddr = start_addr;
+    index->header.oih_end_paddr = end_addr;
+
+    printf("Scanning blocks %#"PRIx64" to %#"PRIx64" for object map leaf nodes:\n", start_addr, end_addr - 1);
+
+    // Blocks whose headers rule them out aren't checksummed at all, and with
+    // `--free-space`, allocated blocks aren't even looked at, since any object
+    // map nodes among them are part of the live object maps
+    uint64_t num_allocated = 0;
+    uint64_t num_rejected = 0;
+    uint64_t num_invalid = 0;
+
+    for (uint64_t chunk_addr = start_addr; chunk_addr < end_addr; chunk_addr += SCAN_CHUNK_NUM_BLOCKS) {
+        size_t num_to_read = SCAN_CHUNK_NUM_BLOCKS;
+        if (end_addr - chunk_addr < num_to_read) {
+            num_to_read = end_addr - chunk_addr;
+        }
+
+        printf("\rReading %#"PRIx64" ... found %"PRIu64" nodes, %"PRIu64" mappings so far.", chunk_addr, index->header.oih_node_count, index->header.oih_entry_count);
+
+        size_t num_read = read_blocks(blocks, chunk_addr, num_to_read);
+        if (num_read != num_to_read) {
+            if (feof(nx)) {
+                printf("\nReached end of file; ending scan.\n");
+                end_addr = chunk_addr + num_read;
+                index->header.oih_end_paddr = end_addr;
+            } else {
+                assert(ferror(nx));
+                printf("\n- An error occurred whilst reading blocks starting at %#"PRIx64".\n", chunk_addr);
+                clearerr(nx);
+            }
+        }
+
+        for (size_t i = 0; i < num_read; i++) {
+            if (allocated && is_block_allocated(allocated, chunk_addr + i)) {
+                num_allocated++;
+            } else if (!is_omap_leaf_candidate(blocks[i])) {
+                num_rejected++;
+            } else if (!is_cksum_valid(blocks[i])) {
+                num_invalid++;
+            } else {
+                add_omap_leaf_to_index(index, blocks[i], chunk_addr + i);
+            }
+        }
+    }
+
+    printf("\n\nFound %"PRIu64" object map leaf nodes containing %"PRIu64" mappings in total.\n", index->header.oih_node_count, index->header.oih_entry_count);
+    if (allocated) {
+        printf("- Allocated:           %"PRIu64"\n", num_allocated);
+    }
+    printf("- Rejected by header:  %"PRIu64"\n", num_rejected);
+    printf("- Invalid checksum:    %"PRIu64"\n", num_invalid);
+
+    printf("Sorting and de-duplicating mappings ... ");
+    finalize_omap_index(index);
+    printf("OK; %"PRIu64" distinct mappings remain.\n", index->header.oih_entry_count);
+
+    printf("Writing index to `%s` ... ", index_path);
+    if (!write_omap_index(index, index_path)) {
+        goto cleanup;
+    }
+    printf("OK.\n\n");
+    result = 0;
+
+cleanup:
+    free_omap_index(index);
+    free(blocks);
+    free_allocation_bitmap(allocated);
+    if (session) {
+        close_nx_session(session);
+    } else {
+        fclose(nx);
+    }
+    return result;
+}
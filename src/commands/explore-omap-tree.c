@@ -11,6 +11,7 @@
 
 #include <drat/func/boolean.h>
 #include <drat/func/cksum.h>
+#include <drat/func/btree.h>
 
 #include <drat/string/object.h>
 #include <drat/string/nx.h>
@@ -25,8 +26,12 @@ static void print_usage(int argc, char** argv) {
     fprintf(
         argc == 1 ? stdout : stderr,
         
-        "Usage:   %s <container> <root node address>\n"
-        "Example: %s /dev/disk0s2 0x3af2\n",
+        "Usage:   %s <container> <root node address> [--all-versions <Virtual OID>]\n"
+        "Example: %s /dev/disk0s2 0x3af2\n"
+        "\n"
+        "If `--all-versions` is specified, the tree is not explored interactively;\n"
+        "instead, every version (XID, block address, and flags) of the object with\n"
+        "the given Virtual OID that is present in the tree is listed.\n",
         
         argv[0],
         argv[0]    
@@ -40,7 +45,7 @@ int cmd_explore_omap_tree(int argc, char** argv) {
     }
 
     // Extrapolate CLI arguments, exit if invalid
-    if (argc != 3) {
+    if (argc != 3 && argc != 5) {
         fprintf(stderr, "Incorrect number of arguments.\n");
         print_usage(argc, argv);
         return 1;
@@ -58,6 +63,26 @@ int cmd_explore_omap_tree(int argc, char** argv) {
         print_usage(argc, argv);
         return 1;
     }
+
+    bool list_all_versions = (argc == 5);
+    oid_t all_versions_oid = 0;
+    if (list_all_versions) {
+        if (strcmp(argv[3], "--all-versions") != 0) {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[3]);
+            print_usage(argc, argv);
+            return 1;
+        }
+
+        parse_success = sscanf(argv[4], "0x%"SCNx64"", &all_versions_oid);
+        if (!parse_success) {
+            parse_success = sscanf(argv[4], "%"SCNu64"", &all_versions_oid);
+        }
+        if (!parse_success) {
+            fprintf(stderr, "%s is not a valid Virtual OID.\n", argv[4]);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
     
     // Open (device special) file corresponding to an APFS container, read-only
     printf("Opening file at `%s` in read-only mode ... ", nx_path);
@@ -91,6 +116,41 @@ int cmd_explore_omap_tree(int argc, char** argv) {
     }
     printf("\n");
 
+    if (list_all_versions) {
+        printf("Listing all versions of the object with Virtual OID %#"PRIx64" ... ", all_versions_oid);
+        omap_entry_t** versions = get_btree_phys_omap_entries(root_node, all_versions_oid);
+        if (!versions) {
+            fprintf(stderr, "\nABORT: Could not walk the object map B-tree.\n");
+            return -1;
+        }
+        printf("OK.\n\n");
+
+        size_t num_versions = 0;
+        for (omap_entry_t** cursor = versions; *cursor; cursor++, num_versions++) {
+            omap_entry_t* entry = *cursor;
+
+            char* flags_string = get_ov_flags_string(&(entry->val), true);
+            printf(
+                "- %3zu:"
+                "  XID = %#9"PRIx64""
+                "  ||  Target block = %#9"PRIx64""
+                "  ||  Flags = %s\n",
+
+                num_versions,
+                entry->key.ok_xid,
+                entry->val.ov_paddr,
+                flags_string
+            );
+            free(flags_string);
+        }
+        printf("\nFound %zu versions.\n", num_versions);
+
+        free_omap_entry_array(versions);
+        free(root_node);
+        fclose(nx);
+        return 0;
+    }
+
     // Allocate space for the current working node,
     // then copy the root node to this space.
     btree_node_phys_t* node = malloc(nx_block_size);
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <sys/errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/nx.h>
+
+#include <drat/io.h>
+#include <drat/block-scan.h>
+#include <drat/known-blocks.h>
+#include <drat/recover-tree.h>  // get_default_recover_thread_count()
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <container> <reference file> [<reference file> ...] [--jobs <N>]\n"
+        "Example: %s /dev/disk0s2 report.docx photo.jpg\n",
+
+        argv[0],
+        argv[0]
+    );
+}
+
+int cmd_find_known_files(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    if (argc < 3) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+    nx_path = argv[1];
+
+    uint32_t num_threads = get_default_recover_thread_count();
+    char** reference_paths = malloc(argc * sizeof(char*));
+    if (!reference_paths) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `reference_paths`.\n");
+        return -1;
+    }
+    int num_references = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            i++;
+            if (sscanf(argv[i], "%"SCNu32"", &num_threads) != 1 || num_threads == 0) {
+                fprintf(stderr, "%s is not a valid number of jobs.\n", argv[i]);
+                print_usage(argc, argv);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
+        } else {
+            reference_paths[num_references++] = argv[i];
+        }
+    }
+    if (num_references == 0) {
+        fprintf(stderr, "At least one reference file must be specified.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    // Open (device special) file corresponding to an APFS container, read-only
+    fprintf(stderr, "Opening file at `%s` in read-only mode ... ", nx_path);
+    nx = fopen(nx_path, "rb");
+    if (!nx) {
+        fprintf(stderr, "\nABORT: ");
+        report_fopen_error();
+        fprintf(stderr, "\n");
+        return -errno;
+    }
+    fprintf(stderr, "OK.\n");
+
+    nx_superblock_t* nxsb = malloc(nx_block_size);
+    if (!nxsb) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nxsb`.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Reading block 0x0 to obtain block count ... ");
+    if (read_blocks(nxsb, 0x0, 1) != 1) {
+        fprintf(stderr, "FAILED.\n");
+        return -1;
+    }
+    fprintf(stderr, "OK.\n");
+    uint64_t num_blocks = nxsb->nx_block_count;
+    free(nxsb);
+    fprintf(stderr, "The specified device has %" PRIu64 " = %#" PRIx64 " blocks.\n", num_blocks, num_blocks);
+
+    // The reference files are split into blocks of the container's block size
+    fprintf(stderr, "Hashing %d reference files ... ", num_references);
+    known_blocks_t* known = create_known_blocks();
+    for (int i = 0; i < num_references; i++) {
+        if (!add_known_file(known, reference_paths[i])) {
+            fprintf(stderr, "FAILED.\n");
+            return -1;
+        }
+    }
+    index_known_blocks(known);
+    free(reference_paths);
+    fprintf(stderr, "OK.\n");
+    fprintf(
+        stderr, "Looking for %zu blocks, leaving out %"PRIu64" that consist of a single repeated byte.\n",
+        known->num_blocks, known->num_skipped
+    );
+    fprintf(stderr, "Commencing sweep:\n\n");
+
+    // Results go to stdout, one per line, so that they can be piped into
+    // other tools; everything else goes to stderr.
+    block_scan_stats_t stats;
+    bool success = scan_blocks(0, num_blocks, num_threads, 0, find_known_block, known, stdout, stderr, &stats);
+
+    // Then, the likely locations of each file
+    size_t num_locations = 0;
+    known_file_location_t* locations = get_known_file_locations(known, &num_locations);
+    uint32_t num_files_found = 0;
+    for (size_t i = 0; i < num_locations; i++) {
+        known_file_location_t* location = locations + i;
+        if (i == 0 || location->file_index != location[-1].file_index) {
+            num_files_found++;
+        }
+        printf(
+            "location\t%#"PRIx64"-%#"PRIx64"\t%s\t%"PRIu64"-%"PRIu64"\t%"PRIu64" of %"PRIu64" blocks\n",
+            location->first_addr, location->last_addr, known->paths[location->file_index],
+            (uint64_t)location->first_block_index * nx_block_size, ((uint64_t)location->last_block_index + 1) * nx_block_size,
+            location->num_matches, known->file_known_blocks[location->file_index]
+        );
+    }
+    free(locations);
+
+    fprintf(stderr, "\nScanned %#"PRIx64" blocks with %"PRIu32" threads.\n", stats.num_blocks, stats.num_threads);
+    fprintf(stderr, "- Read errors:         %"PRIu64"\n", stats.num_read_errors);
+    fprintf(stderr, "- Matching blocks:     %"PRIu64"\n", stats.num_results);
+    fprintf(stderr, "- Likely locations:    %zu\n", num_locations);
+    fprintf(stderr, "- Files found:         %"PRIu32" of %zu\n", num_files_found, known->num_files);
+
+    free_known_blocks(known);
+    fclose(nx);
+    return success ? 0 : -1;
+}
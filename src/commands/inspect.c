@@ -15,6 +15,7 @@
 #include <apfs/snap.h>
 
 #include <drat/io.h>
+#include <drat/nx-session.h>
 
 #include <drat/func/boolean.h>
 #include <drat/func/cksum.h>
@@ -55,181 +56,34 @@ int cmd_inspect(int argc, char** argv) {
     }
     nx_path = argv[1];
     
-    // Open (device special) file corresponding to an APFS container, read-only
-    printf("Opening file at `%s` in read-only mode ... ", nx_path);
-    nx = fopen(nx_path, "rb");
-    if (!nx) {
-        fprintf(stderr, "\nABORT: ");
-        report_fopen_error();
+    nx_session_t* session = open_nx_session(nx_path, stdout);
+    if (!session) {
         printf("\n");
         return -errno;
     }
-    printf("OK.\nSimulating a mount of the APFS container.\n");
-    
-    printf("Reading container superblock at address 0x0, assuming default block size of %"PRIu32" bytes ... ", nx_block_size);
-    nx_superblock_t* nxsb = malloc(nx_block_size);
-    if (!nxsb) {
-        fprintf(stderr, "ABORT: Could not allocate sufficient memory for `nxsb`.\n");
-        return -1;
-    }
-    if (read_blocks(nxsb, 0x0, 1) != 1) {
-        fprintf(stderr, "ABORT: Failed to successfully read block 0x0.\n");
-        return -1;
-    }
 
-    if (nx_block_size != nxsb->nx_block_size) {
-        nx_block_size = nxsb->nx_block_size;
-        printf("Actual block size stated in container superblock is %"PRIu32" bytes; re-reading block 0x0 using new block size ... ", nx_block_size);
-        nxsb = realloc(nxsb, nx_block_size);
-        if (!nxsb) {
-            fprintf(stderr, "ABORT: Could not allocate sufficient memory for `nxsb`.\n");
-            return -1;
-        }
-        if (read_blocks(nxsb, 0x0, 1) != 1) {
-            fprintf(stderr, "ABORT: Failed to successfully read block 0x0.\n");
-            return -1;
-        }
-    }
-
-    printf("validating checksum ... ");
-    if (is_cksum_valid(nxsb)) {
-        printf("OK.\n");
-    } else {
-        printf("FAILED.\n!! APFS ERROR !! Checksum of block 0x0 should validate, but it doesn't. Proceeding as if it does.\n");
-    }
-
-    printf("\nDetails of block 0x0:\n");
-    printf("--------------------------------------------------------------------------------\n");
-    print_nx_superblock(nxsb);
-    printf("--------------------------------------------------------------------------------\n");
-    printf("\n");
-
-    if (!is_nx_superblock(nxsb)) {
-        printf("!! APFS ERROR !! Block 0x0 should be a container superblock, but it isn't. Proceeding as if it is.\n\n");
-    }
-    if (nxsb->nx_magic != NX_MAGIC) {
-        printf("!! APFS ERROR !! Container superblock at 0x0 doesn't have the correct magic number. Proceeding as if it does.\n");
-    }
-
-    printf("Locating the checkpoint descriptor area:\n");
-    
-    uint32_t xp_desc_blocks = nxsb->nx_xp_desc_blocks & ~(1 << 31);
-    printf("- Its length is %"PRIu32" blocks.\n", xp_desc_blocks);
-
-    char (*xp_desc)[nx_block_size] = malloc(xp_desc_blocks * nx_block_size);
-    if (!xp_desc) {
-        fprintf(stderr, "ABORT: Could not allocate sufficient memory for %"PRIu32" blocks.\n", xp_desc_blocks);
+    nx_superblock_t* nxsb = get_session_nx_superblock(session);
+    if (!nxsb) {
+        close_nx_session(session);
         return -1;
     }
 
-    if (nxsb->nx_xp_desc_blocks >> 31) {
-        printf("- It is not contiguous.\n");
-        printf("- The Physical OID of the B-tree representing it is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
-        printf("END: The ability to handle this case has not yet been implemented.\n\n");   // TODO: implement case when xp_desc area is not contiguous
-        return 0;
-    } else {
-        printf("- It is contiguous.\n");
-        printf("- The address of its first block is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
-
-        printf("Loading the checkpoint descriptor area into memory ... ");
-        if (read_blocks(xp_desc, nxsb->nx_xp_desc_base, xp_desc_blocks) != xp_desc_blocks) {
-            fprintf(stderr, "\nABORT: Failed to read all blocks in the checkpoint descriptor area.\n");
-            return -1;
-        }
-        printf("OK.\n");
-    }
-
-    printf("Locating the most recent well-formed container superblock in the checkpoint descriptor area:\n");
-    
-    uint32_t i_latest_nx = 0;
-    xid_t xid_latest_nx = 0;
-
-    xid_t max_xid = ~0;     // `~0` is the highest possible XID
-
-    for (uint32_t i = 0; i < xp_desc_blocks; i++) {
-        if (!is_cksum_valid(xp_desc[i])) {
-            printf("- !! APFS WARNING !! Block at index %"PRIu32" within this area failed checksum validation. Skipping it.\n", i);
-            continue;
-        }
-        
-        if (is_nx_superblock(xp_desc[i])) {
-            if ( ((nx_superblock_t*)xp_desc[i])->nx_magic  !=  NX_MAGIC ) {
-                printf("- !! APFS WARNING !! Container superblock at index %"PRIu32" within this area is malformed; incorrect magic number. Skipping it.\n", i);
-                continue;
-            }
-
-            if (
-                    ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  >  xid_latest_nx )
-                    && ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  <= max_xid  )
-            ) {
-                i_latest_nx = i;
-                xid_latest_nx = ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid;
-            }
-        } else if (!is_checkpoint_map_phys(xp_desc[i])) {
-            printf("- !! APFS ERROR !! Block at index %"PRIu32" within this area is not a container superblock or checkpoint map. Skipping it.\n", i);
-            continue;
-        }
-    }
-
-    if (xid_latest_nx == 0) {
-        printf("No container superblock with an XID that doesn't exceed %#"PRIx64" exists in the checkpoint descriptor area.\n", max_xid);
-        return 0;
-    }
-
-    // Don't need a copy of the block 0x0 NXSB which is stored in `nxsb`
-    // anymore; replace that data with the latest NXSB.
-    // This also lets us avoid repeatedly casting to `nx_superblock_t*`.
-    memcpy(nxsb, xp_desc[i_latest_nx], sizeof(nx_superblock_t));
-
-    printf("- It lies at index %"PRIu32" within the checkpoint descriptor area.\n", i_latest_nx);
-
     printf("\nDetails of this container superblock:\n");
     printf("--------------------------------------------------------------------------------\n");
     print_nx_superblock(nxsb);
     printf("--------------------------------------------------------------------------------\n");
-    
-    printf(
-        "- The corresponding checkpoint starts at index %"PRIu32" within the"
-        " checkpoint descriptor area, and spans %"PRIu32" blocks.\n\n",
-        nxsb->nx_xp_desc_index,
-        nxsb->nx_xp_desc_len
-    );
+    printf("\n");
 
-    // Copy the contents of the checkpoint we are currently considering to its
-    // own array for easy access. The checkpoint descriptor area is a ring
-    // buffer stored as an array, so doing this also allows us to handle the
-    // case where the checkpoint we're considering wraps around the ring buffer.
-    printf("Loading the corresponding checkpoint ... ");
-    
-    // The array `xp` will comprise the blocks in the checkpoint, in order.
-    char (*xp)[nx_block_size] = malloc(nxsb->nx_xp_desc_len * nx_block_size);
+    uint32_t xp_len = 0;
+    char (*xp)[nx_block_size] = get_session_checkpoint(session, &xp_len);
     if (!xp) {
-        fprintf(stderr, "\nABORT: Couldn't allocate sufficient memory.\n");
+        close_nx_session(session);
         return -1;
     }
 
-    if (nxsb->nx_xp_desc_index + nxsb->nx_xp_desc_len <= xp_desc_blocks) {
-        // The simple case: the checkpoint is already contiguous in `xp_desc`.
-        memcpy(xp, xp_desc[nxsb->nx_xp_desc_index], nxsb->nx_xp_desc_len * nx_block_size);
-    } else {
-        // The case where the checkpoint wraps around from the end of the
-        // checkpoint descriptor area to the start.
-        uint32_t segment_1_len = xp_desc_blocks - nxsb->nx_xp_desc_index;
-        uint32_t segment_2_len = nxsb->nx_xp_desc_len - segment_1_len;
-        memcpy(xp,                 xp_desc + nxsb->nx_xp_desc_index, segment_1_len * nx_block_size);
-        memcpy(xp + segment_1_len, xp_desc,                          segment_2_len * nx_block_size);
-    }
-    printf("OK.\n");
-    
-    // We could `free(xp_desc)` at this point, but instead, we retain our copy
-    // of the checkpoint descriptor area in case any of the Ephemeral objects
-    // referenced by the current checkpoint are malformed; then, we can
-    // retrieve an older checkpoint without having to read the checkpoint
-    // descriptor area again.
-
     printf("\nDetails of each block in this checkpoint:\n");
     printf("--------------------------------------------------------------------------------\n");
-    for (uint32_t i = 0; i < nxsb->nx_xp_desc_len; i++) {
+    for (uint32_t i = 0; i < xp_len; i++) {
         if (is_nx_superblock(xp[i])) {
             print_nx_superblock(xp[i]);
         } else {
@@ -239,55 +93,21 @@ int cmd_inspect(int argc, char** argv) {
         printf("--------------------------------------------------------------------------------\n");
     }
 
-    uint32_t xp_obj_len = 0;    // This variable will equal the number of
-    // checkpoint-mappings = no. of Ephemeral objects used by this checkpoint.
     printf("\nDetails of each checkpoint-mapping in this checkpoint:\n");
     printf("--------------------------------------------------------------------------------\n");
-    for (uint32_t i = 0; i < nxsb->nx_xp_desc_len; i++) {
+    for (uint32_t i = 0; i < xp_len; i++) {
         if (is_checkpoint_map_phys(xp[i])) {
             print_checkpoint_map_phys_mappings(xp[i]);
-            xp_obj_len += ((checkpoint_map_phys_t*)xp[i])->cpm_count;
         }
     }
-    printf("- There are %"PRIu32" checkpoint-mappings in this checkpoint.\n\n", xp_obj_len);
+    printf("\n");
 
-    printf("Reading the Ephemeral objects used by this checkpoint ... ");
-    char (*xp_obj)[nx_block_size] = malloc(xp_obj_len * nx_block_size);
+    uint32_t xp_obj_len = 0;
+    char (*xp_obj)[nx_block_size] = get_session_ephemeral_objects(session, &xp_obj_len);
     if (!xp_obj) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `xp_obj`.\n");
-        return -1;
-    }
-    uint32_t num_read = 0;
-    for (uint32_t i = 0; i < nxsb->nx_xp_desc_len; i++) {
-        if (is_checkpoint_map_phys(xp[i])) {
-            checkpoint_map_phys_t* xp_map = xp[i];  // Avoid lots of casting
-            for (uint32_t j = 0; j < xp_map->cpm_count; j++) {
-                if (read_blocks(xp_obj[num_read], xp_map->cpm_map[j].cpm_paddr, 1) != 1) {
-                    fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", xp_map->cpm_map[j].cpm_paddr);
-                    return -1;
-                }
-                num_read++;
-            }
-        }
-    }
-    printf("OK.\n");
-    assert(num_read = xp_obj_len);
-
-    printf("Validating the Ephemeral objects ... ");
-    for (uint32_t i = 0; i < xp_obj_len; i++) {
-        if (!is_cksum_valid(xp_obj[i])) {
-            printf("FAILED.\n");
-            printf("An Ephemeral object used by this checkpoint is malformed. Going back to look at the previous checkpoint instead.\n");
-            
-            // TODO: Handle case where data for a given checkpoint is malformed
-            printf("END: Handling of this case has not yet been implemented.\n");
-            return 0;
-        }
+        close_nx_session(session);
+        return 0;
     }
-    printf("OK.\n");
-
-    free(xp);
-    free(xp_desc);
 
     printf("\nDetails of the Ephemeral objects:\n");
     printf("--------------------------------------------------------------------------------\n");
@@ -297,26 +117,12 @@ int cmd_inspect(int argc, char** argv) {
     }
     printf("\n");
 
-    printf("The container superblock states that the container object map has Physical OID %#"PRIx64".\n", nxsb->nx_omap_oid);
-
-    printf("Loading the container object map ... ");
-    omap_phys_t* nx_omap = malloc(nx_block_size);
-    if (read_blocks(nx_omap, nxsb->nx_omap_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nx_omap`.\n");
-        return -1;
-    }
-    printf("OK.\n");
-    
-    printf("Validating the container object map ... ");
-    if (!is_cksum_valid(nx_omap)) {
-        printf("FAILED.\n");
-        printf("This container object map is malformed. Going back to look at the previous checkpoint instead.\n");
-        
-        // TODO: Handle case where a given container object map is malformed
-        printf("END: Handling of this case has not yet been implemented.\n");
+    omap_phys_t* nx_omap = get_session_nx_omap(session);
+    btree_node_phys_t* nx_omap_btree = get_session_nx_omap_btree(session);
+    if (!nx_omap || !nx_omap_btree) {
+        close_nx_session(session);
         return 0;
     }
-    printf("OK.\n");
 
     printf("\nDetails of the container object map:\n");
     printf("--------------------------------------------------------------------------------\n");
@@ -324,92 +130,30 @@ int cmd_inspect(int argc, char** argv) {
     printf("--------------------------------------------------------------------------------\n");
     printf("\n");
 
-    if ((nx_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
-        printf("END: The container object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
-        return 0;
-    }
-
-    printf("Reading the root node of the container object map B-tree ... ");
-    btree_node_phys_t* nx_omap_btree = malloc(nx_block_size);
-    if (!nx_omap_btree) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nx_omap_btree`.\n");
-        return -1;
-    }
-    if (read_blocks(nx_omap_btree, nx_omap->om_tree_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", nx_omap->om_tree_oid);
-        return -1;
-    }
-    printf("OK.\n");
-
-    printf("Validating the root node of the container object map B-tree ... ");
-    if (!is_cksum_valid(nx_omap_btree)) {
-        printf("FAILED.\n");
-    } else {
-        printf("OK.\n");
-    }
-
     printf("\nDetails of the container object map B-tree:\n");
     printf("--------------------------------------------------------------------------------\n");
     print_btree_node_phys(nx_omap_btree);
     printf("--------------------------------------------------------------------------------\n");
     printf("\n");
 
-    uint32_t num_file_systems = 0;
-    for (uint32_t i = 0; i < NX_MAX_FILE_SYSTEMS; i++) {
-        if (nxsb->nx_fs_oid[i] == 0) {
-            break;
-        }
-        num_file_systems++;
-    }
+    uint32_t num_file_systems = get_session_num_volumes(session);
     printf("The container superblock lists %"PRIu32" APFS volumes, whose superblocks have the following Virtual OIDs:\n", num_file_systems);
     for (uint32_t i = 0; i < num_file_systems; i++) {
         printf("- %#"PRIx64"\n", nxsb->nx_fs_oid[i]);
     }
     printf("\n");
 
-    printf("Reading the APFS volume superblocks ... ");
-    char (*apsbs)[nx_block_size] = malloc(nx_block_size * num_file_systems);
-    if (!apsbs) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `apsbs`.\n");
-        return -1;
-    }
-    for (uint32_t i = 0; i < num_file_systems; i++) {
-        omap_entry_t* fs_entry = get_btree_phys_omap_entry(nx_omap_btree, nxsb->nx_fs_oid[i], nxsb->nx_o.o_xid);
-        if (!fs_entry) {
-            fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `nx_omap_btree`.\n", nxsb->nx_fs_oid[i], nxsb->nx_o.o_xid);
-            return -1;
-        }
-        if (read_blocks(apsbs + i, fs_entry->val.ov_paddr, 1) != 1) {
-            fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_entry->val.ov_paddr);
-            return -1;
-        }
-    }
-    printf("OK.\n");
-
-    printf("Validating the APFS volume superblocks ... ");
     for (uint32_t i = 0; i < num_file_systems; i++) {
-        if (!is_cksum_valid(apsbs + i)) {
-            printf("FAILED.\n- The checksum of the APFS volume with OID %#"PRIx64" did not validate.\n- Going back to look at the previous checkpoint instead.\n", nxsb->nx_fs_oid[i]);
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            printf("END: Handling of this case has not yet been implemented.\n");
-            return 0;
-        }
-
-        if ( ((apfs_superblock_t*)(apsbs + i))->apfs_magic  !=  APFS_MAGIC ) {
-            printf("FAILED.\n- The magic string of the APFS volume with OID %#"PRIx64" did not validate.\n- Going back to look at the previous checkpoint instead.\n", nxsb->nx_fs_oid[i]);
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            printf("END: Handling of this case has not yet been implemented.\n");
+        if (!get_session_volume_superblock(session, i)) {
+            close_nx_session(session);
             return 0;
         }
     }
-    printf("OK.\n");
 
     printf("\nDetails of these volume superblocks:\n");
     printf("--------------------------------------------------------------------------------\n");
     for (uint32_t i = 0; i < num_file_systems; i++) {
-        print_apfs_superblock(apsbs + i);
+        print_apfs_superblock(get_session_volume_superblock(session, i));
         printf("--------------------------------------------------------------------------------\n");
     }
     printf("\n");
@@ -419,33 +163,15 @@ int cmd_inspect(int argc, char** argv) {
     printf("--------------------------------------------------------------------------------\n");
     printf("\n");
     for (uint32_t i = 0; i < num_file_systems; i++) {
-        apfs_superblock_t* apsb = apsbs + i;
+        apfs_superblock_t* apsb = get_session_volume_superblock(session, i);
         printf("Simulating a mount of volume %"PRIu32" (%s).\n", i, apsb->apfs_volname);
         printf("\n");
 
-        printf("The volume object map has Physical OID %#"PRIx64".\n", apsb->apfs_omap_oid);
-
-        printf("Reading the volume object map ... ");
-        omap_phys_t* fs_omap = malloc(nx_block_size);
+        omap_phys_t* fs_omap = get_session_volume_omap(session, i);
         if (!fs_omap) {
-            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_omap`.\n");
-            return -1;
-        }
-        if (read_blocks(fs_omap, apsb->apfs_omap_oid, 1) != 1) {
-            fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", apsb->apfs_omap_oid);
-            return -1;
-        }
-        printf("OK.\n");
-
-        printf("Validating the volume object map ... ");
-        if (!is_cksum_valid(fs_omap)) {
-            printf("FAILED.\n- The checksum did not validate.\n- Going back to look at the previous checkpoint instead.\n");
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            printf("END: Handling of this case has not yet been implemented.\n");
+            close_nx_session(session);
             return 0;
         }
-        printf("OK.\n");
 
         printf("\nDetails of the volume object map:\n");
         printf("--------------------------------------------------------------------------------\n");
@@ -453,28 +179,10 @@ int cmd_inspect(int argc, char** argv) {
         printf("--------------------------------------------------------------------------------\n");
         printf("\n");
 
-        if ((fs_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
-            printf("END: The volume object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
-            return 0;
-        }
-
-        printf("Reading the root node of the volume object map B-tree ... ");
-        btree_node_phys_t* fs_omap_btree = malloc(nx_block_size);
+        btree_node_phys_t* fs_omap_btree = get_session_volume_omap_btree(session, i);
         if (!fs_omap_btree) {
-            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_omap_btree`.\n");
-            return -1;
-        }
-        if (read_blocks(fs_omap_btree, fs_omap->om_tree_oid, 1) != 1) {
-            fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_omap->om_tree_oid);
-            return -1;
-        }
-        printf("OK.\n");
-
-        printf("Validating the root node of the volume object map B-tree ... ");
-        if (!is_cksum_valid(fs_omap_btree)) {
-            printf("FAILED.\n");
-        } else {
-            printf("OK.\n");
+            close_nx_session(session);
+            return 0;
         }
 
         printf("\nDetails of the volume object map B-tree:\n");
@@ -483,35 +191,11 @@ int cmd_inspect(int argc, char** argv) {
         printf("--------------------------------------------------------------------------------\n");
         printf("\n");
 
-        printf("The file-system tree root for this volume has Virtual OID %#"PRIx64".\n", apsb->apfs_root_tree_oid);
-        printf("Looking up this Virtual OID in the volume object map ... ");
-        omap_entry_t* fs_root_entry = get_btree_phys_omap_entry(fs_omap_btree, apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
-        if (!fs_root_entry) {
-            fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `fs_omap_btree`.\n", apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
-            return -1;
-        }
-        printf("corresponding block address is %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
-
-        printf("Reading ... ");
-        btree_node_phys_t* fs_root_btree = malloc(nx_block_size);
+        btree_node_phys_t* fs_root_btree = get_session_volume_fs_root_btree(session, i);
         if (!fs_root_btree) {
-            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_root_btree`.\n");
-            return -1;
-        }
-        if (read_blocks(fs_root_btree, fs_root_entry->val.ov_paddr, 1) != 1) {
-            fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
-            return -1;
-        }
-        free(fs_root_entry);  // No longer need the block address of the file-system root.
-        printf("validating ... ");
-        if (!is_cksum_valid(fs_root_btree)) {
-            printf("FAILED.\nGoing back to look at the previous checkpoint instead.\n");
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            printf("END: Handling of this case has not yet been implemented.\n");
+            close_nx_session(session);
             return 0;
         }
-        printf("OK.\n");
 
         printf("\nDetails of the file-system B-tree root node:\n");
         printf("--------------------------------------------------------------------------------\n");
@@ -676,19 +360,10 @@ int cmd_inspect(int argc, char** argv) {
         printf("--------------------------------------------------------------------------------\n");
         printf("--------------------------------------------------------------------------------\n");
         printf("\n");
-
-        
-        free(fs_omap_btree);
-        free(fs_omap);
     }
 
     // Closing statements; de-allocate all memory, close all file descriptors.
-    free(apsbs);
-    free(nx_omap_btree);
-    free(nx_omap);
-    free(xp_obj);
-    free(nxsb);
-    fclose(nx);
+    close_nx_session(session);
     printf("END: All done.\n");
     return 0;
 }
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <apfs/object.h>
+#include <apfs/omap.h>
+
+#include <drat/omap-index.h>
+
+#include <drat/string/omap.h>
+
+/**
+ * Print usage info for this program.
+ */
+static void print_usage(int argc, char** argv) {
+    fprintf(
+        argc == 1 ? stdout : stderr,
+
+        "Usage:   %s <index file> <Virtual OID> [<max XID>]\n"
+        "Example: %s omap-index.bin 0x402\n"
+        "         %s omap-index.bin 0x402 0x1f2a\n",
+
+        argv[0],
+        argv[0],
+        argv[0]
+    );
+}
+
+int cmd_query_omap_index(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    setbuf(stdout, NULL);
+
+    // Extrapolate CLI arguments, exit if invalid
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
+    }
+    char* index_path = argv[1];
+
+    oid_t oid;
+    bool parse_success = sscanf(argv[2], "0x%" SCNx64, &oid);
+    if (!parse_success) {
+        parse_success = sscanf(argv[2], "%" SCNu64, &oid);
+    }
+    if (!parse_success) {
+        fprintf(stderr, "%s is not a valid Virtual OID.\n", argv[2]);
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    xid_t max_xid = ~0ULL;
+    if (argc == 4) {
+        parse_success = sscanf(argv[3], "0x%" SCNx64, &max_xid);
+        if (!parse_success) {
+            parse_success = sscanf(argv[3], "%" SCNu64, &max_xid);
+        }
+        if (!parse_success) {
+            fprintf(stderr, "%s is not a valid XID.\n", argv[3]);
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    printf("Reading object map index at `%s` ... ", index_path);
+    omap_index_t* index = read_omap_index(index_path);
+    if (!index) {
+        return -1;
+    }
+    printf("OK.\n");
+    printf(
+        "Index covers blocks %#" PRIx64 " to %#" PRIx64 " and contains %" PRIu64 " mappings from %" PRIu64 " object map leaf nodes.\n\n",
+        index->header.oih_start_paddr,
+        index->header.oih_end_paddr - 1,
+        index->header.oih_entry_count,
+        index->header.oih_node_count
+    );
+
+    size_t num_entries = 0;
+    omap_index_entry_t* entries = get_omap_index_entries(index, oid, &num_entries);
+    omap_index_entry_t* resolved = argc == 4 ? get_omap_index_entry(index, oid, max_xid) : NULL;
+
+    printf("Mappings for Virtual OID %#" PRIx64 ":\n", oid);
+    for (size_t i = 0; i < num_entries; i++) {
+        omap_val_t val = {
+            .ov_flags   = entries[i].oie_flags,
+            .ov_size    = entries[i].oie_size,
+            .ov_paddr   = entries[i].oie_paddr,
+        };
+        char* flags_string = get_ov_flags_string(&val, true);
+
+        printf(
+            "%s %3zu:  XID = %#" PRIx64 "  ||  Target block = %#" PRIx64 "  ||  Flags = %s  ||  Found in %" PRIu64 " node(s), newest: XID %#" PRIx64 " at block %#" PRIx64 "\n",
+            resolved == entries + i ? "->" : "- ",
+            i,
+            entries[i].oie_xid,
+            entries[i].oie_paddr,
+            flags_string,
+            entries[i].oie_node_count,
+            entries[i].oie_node_xid,
+            entries[i].oie_node_paddr
+        );
+
+        free(flags_string);
+    }
+    printf("Found %zu versions.\n", num_entries);
+
+    if (argc == 4) {
+        if (resolved) {
+            printf("As of XID %#" PRIx64 ", this Virtual OID resolves to block %#" PRIx64 " (marked `->` above).\n", max_xid, resolved->oie_paddr);
+        } else {
+            printf("This Virtual OID has no mapping with an XID of at most %#" PRIx64 ".\n", max_xid);
+        }
+    }
+    printf("\n");
+
+    free_omap_index(index);
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 #include <apfs/object.h>
 #include <apfs/nx.h>
@@ -15,10 +16,19 @@
 #include <apfs/snap.h>
 
 #include <drat/io.h>
+#include <drat/decmpfs.h>
+#include <drat/nx-session.h>
 #include <drat/print-fs-records.h>
+#include <drat/output.h>
+#include <drat/recover.h>
+#include <drat/recover-journal.h>
+#include <drat/recover-pipeline.h>
+#include <drat/recover-tar.h>
+#include <drat/recover-tree.h>
 
 #include <drat/func/boolean.h>
 #include <drat/func/cksum.h>
+#include <drat/func/digest.h>
 #include <drat/func/btree.h>
 #include <drat/func/j.h>
 
@@ -36,425 +46,643 @@ static void print_usage(int argc, char** argv) {
     fprintf(
         argc == 1 ? stdout : stderr,
         
-        "Usage:   %s <container> <volume ID> <path in volume>\n"
-        "Example: %s /dev/disk0s2  0  /Users/john/Documents\n",
+        "Usage:   %s <container> <volume ID> <path in volume> [--offset <N>] [--length <M>] [--sparse] [--jobs <N>] [--hash <digests>]\n"
+        "         %s <container> <volume ID> <path in volume> --out <output file> [--resume] [--hash <digests>]\n"
+        "         %s <container> <volume ID> --manifest <manifest file> --out <output directory>\n"
+        "         %s <container> <volume ID> --recursive <directory in volume> --out <output directory> [--jobs <N>] [--resume] [--hash <digests>]\n"
+        "         %s <container> <volume ID> --recursive <directory in volume> --tar\n"
+        "Example: %s /dev/disk0s2  0  /Users/john/Documents/file.txt\n"
+        "         %s /dev/disk0s2  0  /Users/john/vm.img --out vm.img --resume\n"
+        "         %s /dev/disk0s2  0  --manifest files.txt --out recovered\n"
+        "         %s /dev/disk0s2  0  --recursive /Users/john --out john --jobs 4\n"
+        "         %s /dev/disk0s2  0  --recursive /Users/john --tar | gzip > john.tar.gz\n"
+        "\n"
+        "The first form writes the data of the file at the given path to stdout. If\n"
+        "stdout is a regular file, sparse regions of the file become holes in it rather\n"
+        "than being written out as zeroes; with `--sparse`, so do any blocks of zeroes.\n"
+        "To write only part of the file, specify the byte offset to start at with\n"
+        "`--offset` and/or the number of bytes to write with `--length`; only the file\n"
+        "extents that cover that range are read. The data is read by `<N>` threads\n"
+        "(default: one per CPU, up to 8) ahead of it being written, and the throughput\n"
+        "of reading and writing is reported when done.\n"
+        "\n"
+        "The second form writes the data of the file to the given output file instead,\n"
+        "keeping a journal of its progress at `<output file>.drat-journal`. If the\n"
+        "recovery is interrupted, running it again with `--resume` carries on where it\n"
+        "stopped, without reading the parts that were already recovered again, so long\n"
+        "as the output file still contains them.\n"
+        "\n"
+        "The third form recovers every file listed in the manifest, which has one\n"
+        "entry per line: either an absolute path within the volume, or a file-system\n"
+        "object ID like `0xd4a7f`. Blank lines and lines starting with `#` are ignored.\n"
+        "A file at path `/a/b` is written to `<output directory>/a/b`, and a file given\n"
+        "by its object ID is written to `<output directory>/<object ID>`. The data of\n"
+        "all the files is read in a single pass in the order that it lies on disk,\n"
+        "which is far faster than recovering each file separately.\n"
+        "\n"
+        "The fourth form recreates the given directory and everything within it at the\n"
+        "output directory, including symbolic links, permissions, and timestamps. File\n"
+        "data is copied by `<N>` worker threads (default: one per CPU, up to 8). A\n"
+        "journal of the files that have been recovered is kept at\n"
+        "`<output directory>.drat-journal`, and `--resume` works as for the second form.\n"
+        "\n"
+        "The fifth form writes the given directory and everything within it to stdout\n"
+        "as a POSIX tar archive instead, including symbolic links, hard links,\n"
+        "permissions, and timestamps, without creating any files locally. Paths in the\n"
+        "archive start with the directory's name.\n"
+        "\n"
+        "With `--hash`, digests of the content of each recovered file are computed as\n"
+        "it is written, and printed to stderr, or to the file given by\n"
+        "`--hash-out <file>`, in the format `SHA256 (<path>) = <digest>`, which\n"
+        "`sha256sum -c` accepts. `<digests>` is a comma-separated list of `sha256` and\n"
+        "`xxh64`. Files are named by their output path, or by their path in the volume\n"
+        "when written to stdout.\n",
         
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0],
+        argv[0],
         argv[0],
         argv[0]
     );
 }
 
-int cmd_recover(int argc, char** argv) {
-    if (argc == 1) {
-        print_usage(argc, argv);
-        return 0;
-    }
-    
-    setbuf(stdout, NULL);
-
-    // Extrapolate CLI arguments, exit if invalid
-    if (argc != 4) {
-        fprintf(stderr, "Incorrect number of arguments.\n");
-        print_usage(argc, argv);
-        return 1;
-    }
-    
-    nx_path = argv[1];
-
-    uint32_t volume_id;
-    bool parse_success = sscanf(argv[2], "%"SCNu32"", &volume_id);
-    if (!parse_success) {
-        fprintf(stderr, "%s is not a valid volume ID.\n", argv[2]);
-        print_usage(argc, argv);
-        return 1;
-    }
-
-    char* path_stack = argv[3];
-    
-    // Open (device special) file corresponding to an APFS container, read-only
-    fprintf(stderr, "Opening file at `%s` in read-only mode ... ", nx_path);
-    nx = fopen(nx_path, "rb");
-    if (!nx) {
-        fprintf(stderr, "\nABORT: ");
-        report_fopen_error();
+/**
+ * Recover every file listed in a manifest file to an output directory; see
+ * `print_usage()` for the manifest format.
+ *
+ * RETURN VALUE:    The exit status for the command.
+ */
+static int recover_manifest(btree_node_phys_t* fs_omap_btree, btree_node_phys_t* fs_root_btree, const char* manifest_path, const char* output_dir) {
+    FILE* manifest = fopen(manifest_path, "r");
+    if (!manifest) {
+        fprintf(stderr, "\nABORT: Could not open the manifest file `%s`: %s.\n", manifest_path, strerror(errno));
         return -errno;
     }
-    fprintf(stderr, "OK.\nSimulating a mount of the APFS container.\n");
-    
-    // Using `nx_superblock_t*`, but allocating a whole block of memory.
-    // This way, we can read the entire block and validate its checksum,
-    // but still have direct access to the fields in `nx_superblock_t`
-    // without needing to epxlicitly cast to that datatype.
-    nx_superblock_t* nxsb = malloc(nx_block_size);
-    if (!nxsb) {
-        fprintf(stderr, "ABORT: Could not allocate sufficient memory to create `nxsb`.\n");
-        return -1;
-    }
 
-    if (read_blocks(nxsb, 0x0, 1) != 1) {
-        fprintf(stderr, "ABORT: Failed to successfully read block 0x0.\n");
-        return -1;
-    }
+    recover_batch_t* batch = create_recover_batch(fs_omap_btree, fs_root_btree);
 
-    fprintf(stderr, "Validating checksum of block 0x0 ... ");
-    if (!is_cksum_valid(nxsb)) {
-        fprintf(stderr, "FAILED.\n!! APFS ERROR !! Checksum of block 0x0 should validate, but it doesn't. Proceeding as if it does.\n");
-    }
-    fprintf(stderr, "OK.\n");
+    fprintf(stderr, "Reading the manifest file `%s` and looking up each file's extents:\n", manifest_path);
+    size_t num_entries = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+    while ( (line_len = getline(&line, &line_size, manifest)) != -1 ) {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
+        }
+        if (line_len == 0 || line[0] == '#') {
+            continue;
+        }
+        num_entries++;
+
+        oid_t fs_oid = 0;
+        char* output_path = NULL;
+        if (line[0] == '/') {
+            fs_oid = get_fs_oid_for_path(fs_omap_btree, fs_root_btree, line);
+            if (fs_oid == 0) {
+                fprintf(stderr, "- Could not find a dentry for `%s`; skipping it.\n", line);
+                continue;
+            }
+            if (asprintf(&output_path, "%s%s", output_dir, line) == -1) {
+                output_path = NULL;
+            }
+        } else {
+            bool parse_success = sscanf(line, "0x%"SCNx64"", &fs_oid);
+            if (!parse_success) {
+                parse_success = sscanf(line, "%"SCNu64"", &fs_oid);
+            }
+            if (!parse_success || fs_oid == 0) {
+                fprintf(stderr, "- `%s` is neither an absolute path nor a file-system object ID; skipping it.\n", line);
+                continue;
+            }
+            if (asprintf(&output_path, "%s/%#"PRIx64"", output_dir, fs_oid) == -1) {
+                output_path = NULL;
+            }
+        }
+        if (!output_path) {
+            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `output_path`.\n");
+            exit(-1);
+        }
 
-    if (!is_nx_superblock(nxsb)) {
-        fprintf(stderr, "\nABORT: Block 0x0 isn't a container superblock.\n\n");
-    }
-    if (nxsb->nx_magic != NX_MAGIC) {
-        fprintf(stderr, "!! APFS ERROR !! Container superblock at 0x0 doesn't have the correct magic number. Proceeding as if it does.\n");
+        add_file_to_recover_batch(batch, fs_oid, output_path);
+        free(output_path);
     }
+    free(line);
+    fclose(manifest);
+    fprintf(stderr, "- Found %zu regular files among %zu manifest entries.\n", batch->num_files, num_entries);
 
-    fprintf(stderr, "Locating the checkpoint descriptor area:\n");
-    
-    uint32_t xp_desc_blocks = nxsb->nx_xp_desc_blocks & ~(1 << 31);
-    fprintf(stderr, "- Its length is %"PRIu32" blocks.\n", xp_desc_blocks);
+    size_t num_recovered = run_recover_batch(batch, stderr);
+    fprintf(stderr, "Recovered %zu of %zu files to `%s`.\n", num_recovered, batch->num_files, output_dir);
 
-    char (*xp_desc)[nx_block_size] = malloc(xp_desc_blocks * nx_block_size);
-    if (!xp_desc) {
-        fprintf(stderr, "ABORT: Could not allocate sufficient memory for %"PRIu32" blocks.\n", xp_desc_blocks);
-        return -1;
-    }
+    bool all_recovered = num_recovered == num_entries;
+    free_recover_batch(batch);
+    return all_recovered ? 0 : 1;
+}
 
-    if (nxsb->nx_xp_desc_blocks >> 31) {
-        fprintf(stderr, "- It is not contiguous.\n");
-        fprintf(stderr, "- The Physical OID of the B-tree representing it is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
-        fprintf(stderr, "END: The ability to handle this case has not yet been implemented.\n\n");   // TODO: implement case when xp_desc area is not contiguous
+/**
+ * Recover a file to an output file, keeping a journal of the ranges of the
+ * file that have been recovered so far; see `recover-journal.h`.
+ *
+ * resume:  Whether to carry on from the journal of an earlier run. Ranges that
+ *      the journal says were recovered, and which the output file still
+ *      contains, aren't read from the container again.
+ *
+ * digests:     A set of content digests to update with the file's content,
+ *      or a NULL pointer. Resumed ranges are hashed from the output file.
+ *
+ * RETURN VALUE:    The exit status for the command.
+ */
+static int recover_file_to_path(file_extent_t* extents, size_t num_extents, oid_t fs_oid, uint64_t file_size, const char* output_path, bool resume, digest_ctx_t* digests) {
+    recover_journal_t* journal = open_recover_journal(output_path, fs_oid, file_size, resume, stderr);
+    if (!journal) {
         return -1;
-    } else {
-        fprintf(stderr, "- It is contiguous.\n");
-        fprintf(stderr, "- The address of its first block is %#"PRIx64".\n", nxsb->nx_xp_desc_base);
+    }
 
-        fprintf(stderr, "Loading the checkpoint descriptor area into memory ... ");
-        if (read_blocks(xp_desc, nxsb->nx_xp_desc_base, xp_desc_blocks) != xp_desc_blocks) {
-            fprintf(stderr, "\nABORT: Failed to read all blocks in the checkpoint descriptor area.\n");
+    // Only reuse the existing output if there is something to resume
+    int fd = -1;
+    uint64_t existing_size = 0;
+    if (journal->num_entries != 0) {
+        fd = open_existing_output_file(output_path, &existing_size);
+        if (fd != -1 && existing_size != file_size && ftruncate(fd, file_size) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd == -1) {
+        if (!create_output_file(output_path, file_size)) {
+            close_recover_journal(journal, false);
+            return -1;
+        }
+        fd = open_existing_output_file(output_path, &existing_size);
+        if (fd == -1) {
+            fprintf(stderr, "\nERROR: Could not open `%s`: %s.\n", output_path, strerror(errno));
+            close_recover_journal(journal, false);
             return -1;
         }
-        fprintf(stderr, "OK.\n");
     }
 
-    fprintf(stderr, "Locating the most recent well-formed container superblock in the checkpoint descriptor area:\n");
-    
-    uint32_t i_latest_nx = 0;
-    xid_t xid_latest_nx = 0;
-
-    xid_t max_xid = ~0;     // `~0` is the highest possible XID
+    fprintf(stderr, "Recovering %"PRIu64" bytes to `%s` ... ", file_size, output_path);
+    uint64_t num_bytes_copied = 0;
+    uint64_t num_bytes_resumed = 0;
+    uint64_t position = 0;  // End of the last range recovered
+    bool success = true;
+    for (size_t i = 0; success && i < num_extents; i++) {
+        file_extent_t* extent = extents + i;
 
-    for (uint32_t i = 0; i < xp_desc_blocks; i++) {
-        if (!is_cksum_valid(xp_desc[i])) {
-            fprintf(stderr, "- Block at index %"PRIu32" within this area failed checksum validation. Skipping it.\n", i);
+        // Sparse extents, and data beyond the end of the file, are skipped;
+        // the output file is already the right size and reads as zeroes there.
+        if (extent->phys_block_num == 0 || extent->logical_addr >= file_size) {
             continue;
         }
-        
-        if (is_nx_superblock(xp_desc[i])) {
-            if ( ((nx_superblock_t*)xp_desc[i])->nx_magic  !=  NX_MAGIC ) {
-                fprintf(stderr, "- Container superblock at index %"PRIu32" within this area is malformed; incorrect magic number. Skipping it.\n", i);
-                continue;
-            }
+        uint64_t extent_bytes = extent->length;
+        if (extent_bytes > file_size - extent->logical_addr) {
+            extent_bytes = file_size - extent->logical_addr;
+        }
 
-            if (
-                    ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  >  xid_latest_nx )
-                    && ( ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid  <= max_xid  )
-            ) {
-                i_latest_nx = i;
-                xid_latest_nx = ((nx_superblock_t*)xp_desc[i])->nx_o.o_xid;
-            }
-        } else if (!is_checkpoint_map_phys(xp_desc[i])) {
-            fprintf(stderr, "- Block at index %"PRIu32" within this area is not a container superblock or checkpoint map. Skipping it.\n", i);
+        // As in `get_recover_chunks()`, data that an earlier extent already
+        // covered isn't recovered again.
+        if (extent->logical_addr + extent_bytes <= position) {
+            fprintf(stderr, "\nERROR: %s: Extent %zu of %zu overlaps the previous one; skipping it.\n", __func__, i+1, num_extents);
             continue;
         }
-    }
-
-    if (xid_latest_nx == 0) {
-        fprintf(stderr, "No container superblock with an XID that doesn't exceed %#"PRIx64" exists in the checkpoint descriptor area.\n", max_xid);
-        return -1;
-    }
+        uint64_t start_offset = extent->logical_addr < position ? position - extent->logical_addr : 0;
 
-    // Don't need a copy of the block 0x0 NXSB which is stored in `nxsb`
-    // anymore; replace that data with the latest NXSB.
-    // This also lets us avoid repeatedly casting to `nx_superblock_t*`.
-    memcpy(nxsb, xp_desc[i_latest_nx], sizeof(nx_superblock_t));
+        for (uint64_t offset = start_offset; offset < extent_bytes; offset += RECOVER_JOURNAL_RANGE_BYTES) {
+            uint64_t output_offset = extent->logical_addr + offset;
+            uint64_t num_bytes = extent_bytes - offset;
+            if (num_bytes > RECOVER_JOURNAL_RANGE_BYTES) {
+                num_bytes = RECOVER_JOURNAL_RANGE_BYTES;
+            }
 
-    fprintf(stderr, "- It lies at index %"PRIu32" within the checkpoint descriptor area.\n", i_latest_nx);
-    fprintf(
-        stderr,
-        "- The corresponding checkpoint starts at index %"PRIu32" within"
-        " the checkpoint descriptor area, and spans %"PRIu32" blocks.\n\n",
-        nxsb->nx_xp_desc_index,
-        nxsb->nx_xp_desc_len
-    );
+            // Digests cover the whole file in logical order, so the gaps
+            // between extents are hashed as the zeroes that they read as.
+            digest_ctx_t initial_digests;
+            if (digests) {
+                update_digests_with_zeroes(digests, output_offset - position);
+                initial_digests = *digests;
+            }
+            position = output_offset + num_bytes;
 
-    // Copy the contents of the checkpoint we are currently considering to its
-    // own array for easy access. The checkpoint descriptor area is a ring
-    // buffer stored as an array, so doing this also allows us to handle the
-    // case where the checkpoint we're considering wraps around the ring buffer.
-    fprintf(stderr, "Loading the corresponding checkpoint ... ");
-    
-    // The array `xp` will comprise the blocks in the checkpoint, in order.
-    char (*xp)[nx_block_size] = malloc(nxsb->nx_xp_desc_len * nx_block_size);
-    if (!xp) {
-        fprintf(stderr, "\nABORT: Couldn't allocate sufficient memory.\n");
-        return -1;
-    }
+            recover_journal_entry_t* entry = find_recover_journal_entry(journal, output_offset);
+            uint64_t hash = RECOVER_JOURNAL_HASH_INIT;
+            if (entry && entry->length == num_bytes && hash_output_range(fd, output_offset, num_bytes, &hash, digests) && hash == entry->hash) {
+                num_bytes_resumed += num_bytes;
+                continue;
+            }
+            if (digests) {
+                *digests = initial_digests;
+            }
 
-    if (nxsb->nx_xp_desc_index + nxsb->nx_xp_desc_len <= xp_desc_blocks) {
-        // The simple case: the checkpoint is already contiguous in `xp_desc`.
-        memcpy(xp, xp_desc[nxsb->nx_xp_desc_index], nxsb->nx_xp_desc_len * nx_block_size);
-    } else {
-        // The case where the checkpoint wraps around from the end of the
-        // checkpoint descriptor area to the start.
-        uint32_t segment_1_len = xp_desc_blocks - nxsb->nx_xp_desc_index;
-        uint32_t segment_2_len = nxsb->nx_xp_desc_len - segment_1_len;
-        memcpy(xp,                 xp_desc + nxsb->nx_xp_desc_index, segment_1_len * nx_block_size);
-        memcpy(xp + segment_1_len, xp_desc,                          segment_2_len * nx_block_size);
-    }
-    fprintf(stderr, "OK.\n");
-    
-    // We could `free(xp_desc)` at this point, but instead, we retain our copy
-    // of the checkpoint descriptor area in case any of the Ephemeral objects
-    // referenced by the current checkpoint are malformed; then, we can
-    // retrieve an older checkpoint without having to read the checkpoint
-    // descriptor area again.
+            if (
+                   lseek(fd, output_offset, SEEK_SET) == -1
+                || !copy_to_output_fd(fd, fileno(nx), extent->phys_block_num * nx_block_size + offset, num_bytes)
+            ) {
+                fprintf(stderr, "\nERROR: Could not recover bytes %#"PRIx64" to %#"PRIx64" of the file.\n", output_offset, output_offset + num_bytes - 1);
+                success = false;
+                break;
+            }
 
-    uint32_t xp_obj_len = 0;    // This variable will equal the number of
-    // checkpoint-mappings = no. of Ephemeral objects used by this checkpoint.
-    for (uint32_t i = 0; i < nxsb->nx_xp_desc_len; i++) {
-        if (is_checkpoint_map_phys(xp[i])) {
-            xp_obj_len += ((checkpoint_map_phys_t*)xp[i])->cpm_count;
+            // The data is hashed as written, by reading it back from the
+            // output file rather than from the container.
+            hash = RECOVER_JOURNAL_HASH_INIT;
+            if (!hash_output_range(fd, output_offset, num_bytes, &hash, digests) || !add_recover_journal_entry(journal, output_offset, num_bytes, hash)) {
+                success = false;
+                break;
+            }
+            num_bytes_copied += num_bytes;
         }
     }
-    fprintf(stderr, "- There are %"PRIu32" checkpoint-mappings in this checkpoint.\n\n", xp_obj_len);
 
-    fprintf(stderr, "Reading the Ephemeral objects used by this checkpoint ... ");
-    char (*xp_obj)[nx_block_size] = malloc(xp_obj_len * nx_block_size);
-    if (!xp_obj) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `xp_obj`.\n");
-        return -1;
+    if (close(fd) != 0) {
+        fprintf(stderr, "\nERROR: Could not finish writing to `%s`: %s.\n", output_path, strerror(errno));
+        success = false;
     }
-    uint32_t num_read = 0;
-    for (uint32_t i = 0; i < nxsb->nx_xp_desc_len; i++) {
-        if (is_checkpoint_map_phys(xp[i])) {
-            checkpoint_map_phys_t* xp_map = xp[i];  // Avoid lots of casting
-            for (uint32_t j = 0; j < xp_map->cpm_count; j++) {
-                if (read_blocks(xp_obj[num_read], xp_map->cpm_map[j].cpm_paddr, 1) != 1) {
-                    fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", xp_map->cpm_map[j].cpm_paddr);
-                    return -1;
-                }
-                num_read++;
-            }
+    if (success) {
+        fprintf(stderr, "OK.\n");
+        if (digests) {
+            update_digests_with_zeroes(digests, file_size - position);
         }
     }
-    fprintf(stderr, "OK.\n");
-    assert(num_read = xp_obj_len);
-
-    fprintf(stderr, "Validating the Ephemeral objects ... ");
-    for (uint32_t i = 0; i < xp_obj_len; i++) {
-        if (!is_cksum_valid(xp_obj[i])) {
-            fprintf(stderr, "FAILED.\n");
-            fprintf(stderr, "An Ephemeral object used by this checkpoint is malformed. Going back to look at the previous checkpoint instead.\n");
-            
-            // TODO: Handle case where data for a given checkpoint is malformed
-            fprintf(stderr, "END: Handling of this case has not yet been implemented.\n");
-            return -1;
-        }
+    if (num_bytes_resumed != 0) {
+        fprintf(stderr, "Copied %"PRIu64" bytes from the container; %"PRIu64" bytes were already recovered by an earlier run.\n", num_bytes_copied, num_bytes_resumed);
     }
-    fprintf(stderr, "OK.\n");
 
-    free(xp);
-    free(xp_desc);
+    success = close_recover_journal(journal, success) && success;
+    return success ? 0 : -1;
+}
 
-    fprintf(stderr, "The container superblock states that the container object map has Physical OID %#"PRIx64".\n", nxsb->nx_omap_oid);
+/**
+ * Where the decompressed data of a compressed file is written; see
+ * `write_decompressed_range()`.
+ *
+ * position:    The offset within the file of the next byte of data.
+ *
+ * range_start, range_end:  The range of the file's data to output.
+ */
+typedef struct {
+    int             fd;
+    uint64_t        position;
+    uint64_t        range_start;
+    uint64_t        range_end;
+    bool            skip_zero_blocks;
+    digest_ctx_t*   digests;
+} decompressed_output_t;
 
-    fprintf(stderr, "Loading the container object map ... ");
-    omap_phys_t* nx_omap = malloc(nx_block_size);
-    if (read_blocks(nx_omap, nxsb->nx_omap_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nx_omap`.\n");
-        return -1;
+/**
+ * Write the part of some decompressed data that lies within the requested
+ * range to the current position of the output.
+ */
+static bool write_decompressed_range(void* context, const void* data, size_t num_bytes) {
+    decompressed_output_t* output = context;
+    uint64_t start = output->position;
+    uint64_t end = start + num_bytes;
+    output->position = end;
+
+    if (start < output->range_start) {
+        start = output->range_start;
     }
-    fprintf(stderr, "OK.\n");
-    
-    fprintf(stderr, "Validating the container object map ... ");
-    if (!is_cksum_valid(nx_omap)) {
-        fprintf(stderr, "FAILED.\n");
-        return -1;
+    if (end > output->range_end) {
+        end = output->range_end;
     }
-    fprintf(stderr, "OK.\n");
-
-    if ((nx_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
-        fprintf(stderr, "END: The container object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
-        return -1;
+    if (start >= end) {
+        return true;
     }
 
-    fprintf(stderr, "Reading the root node of the container object map B-tree ... ");
-    btree_node_phys_t* nx_omap_btree = malloc(nx_block_size);
-    if (!nx_omap_btree) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nx_omap_btree`.\n");
-        return -1;
+    const char* bytes = (const char*)data + (start - (output->position - num_bytes));
+    if (output->digests) {
+        update_digests(output->digests, bytes, end - start);
     }
-    if (read_blocks(nx_omap_btree, nx_omap->om_tree_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", nx_omap->om_tree_oid);
-        return -1;
+    return output->skip_zero_blocks
+        ? append_output_skipping_zero_blocks(output->fd, bytes, end - start, nx_block_size)
+        : append_output_fd(output->fd, bytes, end - start);
+}
+
+/**
+ * Recover a transparently compressed file, decompressing its data with a
+ * pool of `num_threads` threads. The data is written to `output_path`, or
+ * if that is a NULL pointer, the requested range of it is written to stdout.
+ *
+ * name:    The file's path within the volume, used in error messages.
+ *
+ * digests:     A set of content digests to update with the data written, or
+ *      a NULL pointer.
+ *
+ * RETURN VALUE:    The exit status for the command.
+ */
+static int recover_compressed_file(decmpfs_file_t* file, const char* name, const char* output_path, uint64_t range_start, uint64_t range_length, bool skip_zero_blocks, uint32_t num_threads, digest_ctx_t* digests) {
+    uint64_t range_end = file->size;
+    if (range_start > file->size) {
+        range_end = range_start;
+    } else if (range_length < file->size - range_start) {
+        range_end = range_start + range_length;
+    }
+
+    decompressed_output_t output = {
+        .fd                 = fileno(stdout),
+        .range_start        = range_start,
+        .range_end          = range_end,
+        .skip_zero_blocks   = skip_zero_blocks,
+        .digests            = digests,
+    };
+
+    // An output file is created at its full size, so runs of zeroes within
+    // it are left as holes.
+    if (output_path) {
+        if (!create_output_file(output_path, file->size)) {
+            return -1;
+        }
+        output.fd = open_output_file(output_path);
+        if (output.fd == -1) {
+            return -1;
+        }
+        output.skip_zero_blocks = true;
     }
-    fprintf(stderr, "OK.\n");
 
-    fprintf(stderr, "Validating the root node of the container object map B-tree ... ");
-    if (!is_cksum_valid(nx_omap_btree)) {
-        fprintf(stderr, "FAILED.\n");
-    } else {
+    fprintf(
+        stderr, "Decompressing %"PRIu64" bytes of %s-compressed data to `%s` ... ",
+        output.range_end - output.range_start, get_decmpfs_type_name(file->type), output_path ? output_path : "stdout"
+    );
+    bool success = decompress_decmpfs_file(file, num_threads, write_decompressed_range, &output, name)
+        && finish_output_holes(output.fd);
+    if (output_path && close(output.fd) != 0) {
+        fprintf(stderr, "\nERROR: Could not finish writing to `%s`: %s.\n", output_path, strerror(errno));
+        success = false;
+    }
+    if (success) {
         fprintf(stderr, "OK.\n");
     }
+    return success ? 0 : -1;
+}
 
-    uint32_t num_file_systems = 0;
-    for (uint32_t i = 0; i < NX_MAX_FILE_SYSTEMS; i++) {
-        if (nxsb->nx_fs_oid[i] == 0) {
-            break;
-        }
-        num_file_systems++;
-    }
-    fprintf(stderr, "The container superblock lists %"PRIu32" APFS volumes, whose superblocks have the following Virtual OIDs:\n", num_file_systems);
-    for (uint32_t i = 0; i < num_file_systems; i++) {
-        fprintf(stderr, "- %#"PRIx64"\n", nxsb->nx_fs_oid[i]);
+/**
+ * Parse a byte count given on the command line, in any base accepted by
+ * `strtoull()`, e.g. in decimal, or in hexadecimal with a leading `0x`.
+ *
+ * RETURN VALUE:    `true` if `arg` was a valid byte count, else `false`.
+ */
+static bool parse_byte_count(const char* arg, uint64_t* value) {
+    char* end = NULL;
+    errno = 0;
+    *value = strtoull(arg, &end, 0);
+    return errno == 0 && end != arg && *end == '\0' && arg[0] != '-';
+}
+
+int cmd_recover(int argc, char** argv) {
+    if (argc == 1) {
+        print_usage(argc, argv);
+        return 0;
     }
-    fprintf(stderr, "\n");
+    
+    setbuf(stdout, NULL);
 
-    fprintf(stderr, "Reading the APFS volume superblocks ... ");
-    char (*apsbs)[nx_block_size] = malloc(nx_block_size * num_file_systems);
-    if (!apsbs) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `apsbs`.\n");
-        return -1;
+    // Extrapolate CLI arguments, exit if invalid
+    char* manifest_path = NULL;
+    char* recursive_path = NULL;
+    char* output_path = NULL;
+    uint32_t num_threads = get_default_recover_thread_count();
+    bool skip_zero_blocks = false;
+    uint64_t range_start = 0;
+    uint64_t range_length = UINT64_MAX;
+    bool has_range = false;
+    bool resume = false;
+    bool tar = false;
+    uint32_t digest_types = 0;
+    char* digest_path = NULL;
+    if (argc < 4) {
+        fprintf(stderr, "Incorrect number of arguments.\n");
+        print_usage(argc, argv);
+        return 1;
     }
-    for (uint32_t i = 0; i < num_file_systems; i++) {
-        omap_entry_t* fs_entry = get_btree_phys_omap_entry(nx_omap_btree, nxsb->nx_fs_oid[i], nxsb->nx_o.o_xid);
-        if (!fs_entry) {
-            fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `nx_omap_btree`.\n", nxsb->nx_fs_oid[i], nxsb->nx_o.o_xid);
-            return -1;
+    bool single_file = strncmp(argv[3], "--", 2) != 0;
+    for (int i = single_file ? 4 : 3; i < argc; i += 2) {
+        // These options take no value
+        if (strcmp(argv[i], "--sparse") == 0) {
+            skip_zero_blocks = true;
+            i--;
+            continue;
         }
-        if (read_blocks(apsbs + i, fs_entry->val.ov_paddr, 1) != 1) {
-            fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_entry->val.ov_paddr);
-            return -1;
+        if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+            i--;
+            continue;
+        }
+        if (strcmp(argv[i], "--tar") == 0) {
+            tar = true;
+            i--;
+            continue;
+        }
+        if (i + 1 == argc) {
+            fprintf(stderr, "Option `%s` requires a value.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (strcmp(argv[i], "--manifest") == 0) {
+            manifest_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--recursive") == 0) {
+            recursive_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--out") == 0) {
+            output_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--offset") == 0) {
+            if (!parse_byte_count(argv[i + 1], &range_start)) {
+                fprintf(stderr, "%s is not a valid byte count.\n", argv[i + 1]);
+                print_usage(argc, argv);
+                return 1;
+            }
+            has_range = true;
+        } else if (strcmp(argv[i], "--length") == 0) {
+            if (!parse_byte_count(argv[i + 1], &range_length)) {
+                fprintf(stderr, "%s is not a valid byte count.\n", argv[i + 1]);
+                print_usage(argc, argv);
+                return 1;
+            }
+            has_range = true;
+        } else if (strcmp(argv[i], "--hash") == 0) {
+            digest_types = parse_digest_types(argv[i + 1]);
+            if (digest_types == 0) {
+                fprintf(stderr, "%s is not a valid list of digests; the supported digests are `sha256` and `xxh64`.\n", argv[i + 1]);
+                print_usage(argc, argv);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--hash-out") == 0) {
+            digest_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--jobs") == 0) {
+            if (sscanf(argv[i + 1], "%"SCNu32"", &num_threads) != 1 || num_threads == 0) {
+                fprintf(stderr, "%s is not a valid number of jobs.\n", argv[i + 1]);
+                print_usage(argc, argv);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unrecognised option `%s`.\n", argv[i]);
+            print_usage(argc, argv);
+            return 1;
         }
     }
-    fprintf(stderr, "OK.\n");
-
-    fprintf(stderr, "Validating the APFS volume superblocks ... ");
-    for (uint32_t i = 0; i < num_file_systems; i++) {
-        if (!is_cksum_valid(apsbs + i)) {
-            fprintf(
-                stderr,
-                "FAILED.\n- The checksum of the APFS volume with OID %#"PRIx64" did not validate."
-                "\n- Going back to look at the previous checkpoint instead.\n",
-                nxsb->nx_fs_oid[i]
-            );
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            fprintf(stderr, "END: Handling of this case has not yet been implemented.\n");
-            return -1;
+    if (single_file) {
+        if (manifest_path || recursive_path || tar) {
+            fprintf(stderr, "`--manifest`, `--recursive`, and `--tar` can't be used when recovering a single file.\n");
+            print_usage(argc, argv);
+            return 1;
         }
-
-        if ( ((apfs_superblock_t*)(apsbs + i))->apfs_magic  !=  APFS_MAGIC ) {
-            fprintf(
-                stderr,
-                "FAILED.\n- The magic string of the APFS volume with OID %#"PRIx64" did not validate."
-                "\n- Going back to look at the previous checkpoint instead.\n",
-                nxsb->nx_fs_oid[i]
-            );
-
-            // TODO: Handle case where data for a given checkpoint is malformed
-            fprintf(stderr, "END: Handling of this case has not yet been implemented.\n");
-            return -1;
+        if (output_path && (skip_zero_blocks || has_range)) {
+            fprintf(stderr, "`--sparse`, `--offset`, and `--length` can only be used when writing to stdout.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (resume && !output_path) {
+            fprintf(stderr, "`--resume` requires `--out`.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+    } else if (tar) {
+        if (!recursive_path || manifest_path || output_path || resume || digest_types || skip_zero_blocks || has_range) {
+            fprintf(stderr, "`--tar` requires `--recursive`, and can't be used with any option other than `--jobs`.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+    } else {
+        if ((!manifest_path == !recursive_path) || !output_path) {
+            fprintf(stderr, "Exactly one of `--manifest` and `--recursive` must be specified, along with `--out` or `--tar`.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+        if (skip_zero_blocks || has_range) {
+            fprintf(stderr, "`--sparse`, `--offset`, and `--length` can only be used when recovering a single file.\n");
+            print_usage(argc, argv);
+            return 1;
+        }
+        if ((resume || digest_types) && manifest_path) {
+            fprintf(stderr, "`--resume` and `--hash` can't be used with `--manifest`.\n");
+            print_usage(argc, argv);
+            return 1;
         }
     }
-    fprintf(stderr, "OK.\n");
-
-    fprintf(stderr, "\n Volume list\n================\n");
-    for (uint32_t i = 0; i < num_file_systems; i++) {
-        fprintf(stderr, "%2"PRIu32": %s\n", i, ((apfs_superblock_t*)(apsbs + i))->apfs_volname);
+    if (digest_path && !digest_types) {
+        fprintf(stderr, "`--hash-out` requires `--hash`.\n");
+        print_usage(argc, argv);
+        return 1;
     }
+    
+    nx_path = argv[1];
 
-    if (volume_id >= num_file_systems) {
-        fprintf(stderr, "The specified volume ID (%"PRIu32") does not exist in the list above. Exiting.\n", volume_id);
-        return -1;
+    uint32_t volume_id;
+    bool parse_success = sscanf(argv[2], "%"SCNu32"", &volume_id);
+    if (!parse_success) {
+        fprintf(stderr, "%s is not a valid volume ID.\n", argv[2]);
+        print_usage(argc, argv);
+        return 1;
     }
-    apfs_superblock_t* apsb = apsbs + volume_id;
 
-    fprintf(stderr, "The volume object map has Physical OID %#"PRIx64".\n", apsb->apfs_omap_oid);
+    char* path_stack = argv[3];
 
-    fprintf(stderr, "Reading the volume object map ... ");
-    omap_phys_t* fs_omap = malloc(nx_block_size);
-    if (!fs_omap) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_omap`.\n");
-        return -1;
+    FILE* digest_stream = stderr;
+    if (digest_path) {
+        digest_stream = fopen(digest_path, "w");
+        if (!digest_stream) {
+            fprintf(stderr, "\nABORT: Could not open the digest file `%s`: %s.\n", digest_path, strerror(errno));
+            return -errno;
+        }
     }
-    if (read_blocks(fs_omap, apsb->apfs_omap_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", apsb->apfs_omap_oid);
-        return -1;
+    
+    nx_session_t* session = open_nx_session(nx_path, stderr);
+    if (!session) {
+        return -errno;
     }
-    fprintf(stderr, "OK.\n");
 
-    fprintf(stderr, "Validating the volume object map ... ");
-    if (!is_cksum_valid(fs_omap)) {
-        fprintf(stderr, "\nFAILED. The checksum did not validate.");
+    // Only the structures needed to reach the file-system root of the
+    // specified volume are read from the container.
+    btree_node_phys_t* fs_root_btree = get_session_volume_fs_root_btree(session, volume_id);
+    if (!fs_root_btree) {
+        close_nx_session(session);
         return -1;
     }
-    fprintf(stderr, "OK.\n");
+    btree_node_phys_t* fs_omap_btree = get_session_volume_omap_btree(session, volume_id);
 
-    if ((fs_omap->om_tree_type & OBJ_STORAGETYPE_MASK) != OBJ_PHYSICAL) {
-        fprintf(stderr, "END: The volume object map B-tree is not of the Physical storage type, and therefore it cannot be located.\n");
-        return -1;
+    if (manifest_path) {
+        int status = recover_manifest(fs_omap_btree, fs_root_btree, manifest_path, output_path);
+        close_nx_session(session);
+        fprintf(stderr, "END: All done.\n");
+        return status;
     }
 
-    fprintf(stderr, "Reading the root node of the volume object map B-tree ... ");
-    btree_node_phys_t* fs_omap_btree = malloc(nx_block_size);
-    if (!fs_omap_btree) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_omap_btree`.\n");
-        return -1;
-    }
-    if (read_blocks(fs_omap_btree, fs_omap->om_tree_oid, 1) != 1) {
-        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_omap->om_tree_oid);
-        return -1;
-    }
-    fprintf(stderr, "OK.\n");
+    if (recursive_path) {
+        oid_t dir_oid = get_fs_oid_for_path(fs_omap_btree, fs_root_btree, recursive_path);
+        if (dir_oid == 0) {
+            fprintf(stderr, "Could not find a dentry for that path. Exiting.\n");
+            close_nx_session(session);
+            return -1;
+        }
 
-    fprintf(stderr, "Validating the root node of the volume object map B-tree ... ");
-    if (!is_cksum_valid(fs_omap_btree)) {
-        fprintf(stderr, "FAILED.\n");
-    } else {
-        fprintf(stderr, "OK.\n");
-    }
+        if (tar) {
+            // Name the archive's root after the directory, or `.` for the root of the volume
+            const char* root_name = recursive_path + strlen(recursive_path);
+            while (root_name > recursive_path && root_name[-1] == '/') {
+                root_name--;
+            }
+            const char* root_end = root_name;
+            while (root_name > recursive_path && root_name[-1] != '/') {
+                root_name--;
+            }
+            char* root = root_end == root_name ? strdup(".") : strndup(root_name, root_end - root_name);
+            if (!root) {
+                fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `root`.\n");
+                exit(-1);
+            }
 
-    fprintf(stderr, "The file-system tree root for this volume has Virtual OID %#"PRIx64".\n", apsb->apfs_root_tree_oid);
-    fprintf(stderr, "Looking up this Virtual OID in the volume object map ... ");
-    omap_entry_t* fs_root_entry = get_btree_phys_omap_entry(fs_omap_btree, apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
-    if (!fs_root_entry) {
-        fprintf(stderr, "\nABORT: No objects with Virtual OID %#"PRIx64" and maximum XID %#"PRIx64" exist in `fs_omap_btree`.\n", apsb->apfs_root_tree_oid, apsb->apfs_o.o_xid);
-        return -1;
-    }
-    fprintf(stderr, "corresponding block address is %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
+            recover_tar_stats_t stats;
+            bool success = recover_tree_as_tar(fs_omap_btree, fs_root_btree, dir_oid, root, fileno(stdout), num_threads, stderr, &stats);
+            fprintf(
+                stderr,
+                "Wrote %"PRIu64" directories, %"PRIu64" files (%"PRIu64" bytes), %"PRIu64" hard links, and %"PRIu64" symbolic links to the archive;"
+                " skipped %"PRIu64" other items; failed to recover %"PRIu64" items.\n",
+                stats.num_directories, stats.num_files, stats.num_bytes, stats.num_hardlinks, stats.num_symlinks,
+                stats.num_skipped, stats.num_failed
+            );
+            free(root);
+            close_nx_session(session);
+            fprintf(stderr, "END: All done.\n");
+            return success ? 0 : 1;
+        }
 
-    fprintf(stderr, "Reading ... ");
-    btree_node_phys_t* fs_root_btree = malloc(nx_block_size);
-    if (!fs_root_btree) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `fs_root_btree`.\n");
-        return -1;
-    }
-    if (read_blocks(fs_root_btree, fs_root_entry->val.ov_paddr, 1) != 1) {
-        fprintf(stderr, "\nABORT: Failed to read block %#"PRIx64".\n", fs_root_entry->val.ov_paddr);
-        return -1;
+        recover_journal_t* journal = open_recover_journal(output_path, dir_oid, 0, resume, stderr);
+        if (!journal) {
+            close_nx_session(session);
+            return -1;
+        }
+
+        recover_tree_stats_t stats;
+        bool success = recover_tree(fs_omap_btree, fs_root_btree, dir_oid, output_path, num_threads, journal, digest_types, digest_stream, stderr, &stats);
+        fprintf(
+            stderr,
+            "Recovered %"PRIu64" directories, %"PRIu64" files (%"PRIu64" bytes), and %"PRIu64" symbolic links to `%s`;"
+            " skipped %"PRIu64" other items; failed to recover %"PRIu64" items.\n",
+            stats.num_directories, stats.num_files, stats.num_bytes, stats.num_symlinks, output_path,
+            stats.num_skipped, stats.num_failed
+        );
+        if (stats.num_resumed != 0) {
+            fprintf(stderr, "%"PRIu64" more files were already recovered by an earlier run, according to the journal.\n", stats.num_resumed);
+        }
+
+        // Keep the journal if anything failed, so that it can be retried
+        success = close_recover_journal(journal, success) && success;
+        if (digest_path && fclose(digest_stream) != 0) {
+            fprintf(stderr, "\nERROR: Could not finish writing to `%s`: %s.\n", digest_path, strerror(errno));
+            success = false;
+        }
+        close_nx_session(session);
+        fprintf(stderr, "END: All done.\n");
+        return success ? 0 : 1;
     }
-    free(fs_root_entry);  // No longer need the block address of the file-system root.
 
-    fprintf(stderr, "validating ... ");
-    if (!is_cksum_valid(fs_root_btree)) {
-        fprintf(stderr, "FAILED.\n");
+    oid_t fs_oid = get_fs_oid_for_path(fs_omap_btree, fs_root_btree, path_stack);
+    if (fs_oid == 0) {
+        fprintf(stderr, "Could not find a dentry for that path. Exiting.\n");
         return -1;
     }
-    fprintf(stderr, "OK.\n");
-
-    oid_t fs_oid = 0x2;
 
     j_rec_t** fs_records = get_fs_records(fs_omap_btree, fs_root_btree, fs_oid, (xid_t)(~0) );
     if (!fs_records) {
@@ -462,60 +690,10 @@ int cmd_recover(int argc, char** argv) {
         return -1;
     }
 
-    char* path = malloc(strlen(path_stack) + 1);
-    if (!path) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `path`.\n");
-        return -1;
-    }
-    memcpy(path, path_stack, strlen(path_stack) + 1);
-
-    char* path_element;
-    while ( (path_element = strsep(&path, "/")) != NULL ) {
-        // If path element is empty string, skip it
-        if (*path_element == '\0') {
-            continue;
-        }
-        
-        signed int matching_record_index = -1;
-        for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
-            j_rec_t* fs_rec = *fs_rec_cursor;
-            j_key_t* hdr = fs_rec->data;
-            if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_DIR_REC ) {
-                j_drec_hashed_key_t* key = fs_rec->data;   
-                if (strcmp((char*)key->name, path_element) == 0) {
-                    matching_record_index = fs_rec_cursor - fs_records;
-                    break;
-                }
-            }
-        }
-
-        if (matching_record_index == -1) {
-            // No match
-            fprintf(stderr, "Could not find a dentry for that path. Exiting.\n");
-            return -1;
-        }
-
-        // Get the file ID of the matching record's target
-        j_rec_t* fs_rec = fs_records[matching_record_index];
-        j_drec_val_t* val = fs_rec->data + fs_rec->key_len;
-
-        // Get the records for the target
-        fs_oid = val->file_id;
-        free_j_rec_array(fs_records);
-        fs_records = get_fs_records(fs_omap_btree, fs_root_btree, fs_oid, (xid_t)(~0) );
-    }
-
     fprintf(stderr, "\nRecords for file-system object %#"PRIx64" -- `%s` --\n", fs_oid, path_stack);
     // `fs_records` now contains the records for the item at the specified path
     print_fs_records(fs_records);
 
-    // Output content from all matching file extents
-    char* buffer = malloc(nx_block_size);
-    if (!buffer) {
-        fprintf(stderr, "Could not allocate sufficient memory for `buffer`.\n");
-        return -1;
-    }
-
     // Get file size
     uint64_t file_size = 0;
     for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
@@ -527,73 +705,75 @@ int cmd_recover(int argc, char** argv) {
             file_size = get_file_size(inode, fs_rec->val_len);
         }
     }
+
+    // A compressed file has no data of its own; its data stream is empty
+    decmpfs_file_t* compressed = get_decmpfs_file(fs_omap_btree, fs_root_btree, fs_records);
+    if (compressed) {
+        if (resume) {
+            fprintf(stderr, "The file is compressed, so it can't be resumed; recovering it from the start.\n");
+        }
+        digest_ctx_t digests;
+        init_digests(&digests, digest_types);
+        int status = recover_compressed_file(compressed, path_stack, output_path, range_start, range_length, skip_zero_blocks, num_threads, digest_types ? &digests : NULL);
+        if (status == 0 && digest_types) {
+            print_digests(digest_stream, &digests, output_path ? output_path : path_stack);
+        }
+        if (digest_path && fclose(digest_stream) != 0) {
+            fprintf(stderr, "\nERROR: Could not finish writing to `%s`: %s.\n", digest_path, strerror(errno));
+            status = -1;
+        }
+        free_decmpfs_file(compressed);
+        free_j_rec_array(fs_records);
+        close_nx_session(session);
+        fprintf(stderr, "END: All done.\n");
+        return status;
+    }
+
     if (file_size == 0) {
         // Not a file, or file size couldn't be found; abort.
         exit(-1);
     }
 
-    // Keep track of how many more bytes we need to output
-    uint64_t bytes_remaining = file_size;
-
-    bool found_file_extent = false;
-    // Go through all the fs records
-    for (j_rec_t** fs_rec_cursor = fs_records; *fs_rec_cursor; fs_rec_cursor++) {
-        j_rec_t* fs_rec = *fs_rec_cursor;
-        j_key_t* hdr = fs_rec->data;
-
-        // Go through all the extent records
-        if ( ((hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT)  ==  APFS_TYPE_FILE_EXTENT ) {
-            found_file_extent = true;
-            j_file_extent_val_t* val = fs_rec->data + fs_rec->key_len;
-
-            // Output the content from this particular file extent
-            uint64_t block_addr = val->phys_block_num;
-
-            uint64_t extent_len_blocks = (val->len_and_flags & J_FILE_EXTENT_LEN_MASK) / nx_block_size;
-            for (uint64_t i = 0;   i < extent_len_blocks;   i++, block_addr++) {
-                if (read_blocks(buffer, block_addr, 1) != 1) {
-                    fprintf(stderr, "\n\nEncountered an error reading block %#"PRIx64" (block %"PRIu64" of %"PRIu64"). Exiting.\n\n", block_addr, i+1, extent_len_blocks);
-                    return -1;
-                }
-                
-                uint64_t bytes_to_write = nx_block_size;
-                if (bytes_remaining < nx_block_size) {
-                    bytes_to_write = bytes_remaining;
-                }
-                if (fwrite(buffer, bytes_to_write, 1, stdout) != 1) {
-                    fprintf(stderr, "\n\nEncountered an error writing block %"PRIu64" of %"PRIu64" to `stdout`. Exiting.\n\n", i+1, extent_len_blocks);
-                    return -1;
-                }
-                bytes_remaining -= bytes_to_write;
-
-                if (bytes_remaining == 0) {
-                    break;  // Exit extent loop
-                }
-            }
+    // Output content from the file extents that cover the requested range at
+    // their logical offsets, excluding any data in the last extent beyond the
+    // end of the file
+    digest_ctx_t digests;
+    init_digests(&digests, digest_types);
+    size_t num_extents = 0;
+    file_extent_t* extents = get_file_extents_from_fs_records(fs_records, &num_extents);
+    if (num_extents == 0) {
+        fprintf(stderr, "Could not find any file extents for the specified path.\n");
+    } else if (output_path) {
+        if (recover_file_to_path(extents, num_extents, fs_oid, file_size, output_path, resume, digest_types ? &digests : NULL) != 0) {
+            return -1;
         }
-
-        if (bytes_remaining == 0) {
-            break;  // Exit fs record loop
+        if (digest_types) {
+            print_digests(digest_stream, &digests, output_path);
+        }
+    } else {
+        recover_pipeline_stats_t stats;
+        if (!recover_file_pipelined(fileno(stdout), extents, num_extents, file_size, range_start, range_length, skip_zero_blocks, num_threads, digest_types ? &digests : NULL, &stats)) {
+            fprintf(stderr, "\n\nEncountered an error writing the file's data to `stdout`. Exiting.\n\n");
+            return -1;
+        }
+        print_recover_pipeline_stats(stderr, &stats);
+        if (digest_types) {
+            // The data has no output path, so it is named by its path in the volume
+            print_digests(digest_stream, &digests, path_stack);
         }
     }
-    if (!found_file_extent) {
-        fprintf(stderr, "Could not find any file extents for the specified path.\n");
+    free(extents);
+    if (digest_path && fclose(digest_stream) != 0) {
+        fprintf(stderr, "\nERROR: Could not finish writing to `%s`: %s.\n", digest_path, strerror(errno));
+        return -1;
     }
 
     free_j_rec_array(fs_records);
     
     // TODO: RESUME HERE
     
-    free(fs_omap_btree);
-    free(fs_omap);
-
     // Closing statements; de-allocate all memory, close all file descriptors.
-    free(apsbs);
-    free(nx_omap_btree);
-    free(nx_omap);
-    free(xp_obj);
-    free(nxsb);
-    fclose(nx);
+    close_nx_session(session);
     fprintf(stderr, "END: All done.\n");
     return 0;
 }
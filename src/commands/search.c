@@ -1,32 +1,23 @@
 #include <stdio.h>
 #include <sys/errno.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 #include <inttypes.h>
 
 #include <apfs/object.h>
 #include <apfs/nx.h>
-#include <apfs/omap.h>
-#include <apfs/fs.h>
-#include <apfs/j.h>
-#include <apfs/dstream.h>
-#include <apfs/sibling.h>
-#include <apfs/snap.h>
 
 #include <drat/io.h>
+#include <drat/block-scan.h>
+#include <drat/block-index.h>
+#include <drat/search-query.h>
+#include <drat/recover-tree.h>  // get_default_recover_thread_count()
 
-#include <drat/func/boolean.h>
-#include <drat/func/cksum.h>
-#include <drat/func/btree.h>
-
-#include <drat/string/object.h>
-#include <drat/string/nx.h>
-#include <drat/string/omap.h>
-#include <drat/string/btree.h>
-#include <drat/string/fs.h>
-#include <drat/string/j.h>
+/**
+ * Maximum number of consecutive regions of an index whose entries are read
+ * at once.
+ */
+#define SEARCH_INDEX_RUN_REGIONS    64
 
 /**
  * Print usage info for this program.
@@ -34,10 +25,23 @@
 static void print_usage(int argc, char** argv) {
     fprintf(
         argc == 1 ? stdout : stderr,
-        
-        "Usage:   %s <container>\n"
-        "Example: %s /dev/disk0s2\n",
-        
+
+        "Usage:   %s <container> <search parameters> [--index <index file>] [--limit <N>] [--jobs <N>]\n"
+        "Search parameters:\n"
+        "         --oid <values>             --xid <values>              --storage-type <types>\n"
+        "         --type <types>             --btree-flags <flags>\n"
+        "         --omap-key-oid <values>    --omap-key-xid <values>     --omap-val-paddr <values>\n"
+        "         --fsoid <values>           --fsrt <types>\n"
+        "         --dentry-name <names>      --dentry-name-file <path>   --dentry-fsoid <values>\n"
+        "         --dentry-pattern <patterns>                            --dentry-pattern-file <path>\n"
+        "Example: %s /dev/disk0s2  --type omap-tree-leaf --omap-key-oid 0x1b16dd-0x1b3926\n"
+        "         %s /dev/disk0s2  --dentry-name 'id_rsa,id_rsa.pub' --limit 10\n"
+        "         %s /dev/disk0s2  --dentry-pattern-file wanted.txt\n"
+        "         %s /dev/disk0s2  --oid 0x404 --index drat-index.bin\n",
+
+        argv[0],
+        argv[0],
+        argv[0],
         argv[0],
         argv[0]
     );
@@ -48,459 +52,210 @@ int cmd_search(int argc, char** argv) {
         print_usage(argc, argv);
         return 0;
     }
-    
+
     setbuf(stdout, NULL);
 
     // Extrapolate CLI arguments, exit if invalid
-    if (argc != 2) {
+    if (argc < 4 || argc % 2 != 0) {
         fprintf(stderr, "Incorrect number of arguments.\n");
         print_usage(argc, argv);
         return 1;
     }
     nx_path = argv[1];
-    
+
+    search_query_t query;
+    init_search_query(&query);
+    uint64_t limit = 0;
+    uint32_t num_threads = get_default_recover_thread_count();
+    char* index_path = NULL;
+    bool has_params = false;
+    for (int i = 2; i < argc; i += 2) {
+        char* option = argv[i];
+        char* value = argv[i + 1];
+        bool valid = true;
+        if (strcmp(option, "--index") == 0) {
+            index_path = value;
+        } else if (strcmp(option, "--limit") == 0) {
+            valid = sscanf(value, "%"SCNu64"", &limit) == 1 && limit != 0;
+        } else if (strcmp(option, "--jobs") == 0) {
+            valid = sscanf(value, "%"SCNu32"", &num_threads) == 1 && num_threads != 0;
+        } else {
+            has_params = true;
+            if (strcmp(option, "--oid") == 0) {
+                valid = parse_search_ranges(value, &query.oids);
+            } else if (strcmp(option, "--xid") == 0) {
+                valid = parse_search_ranges(value, &query.xids);
+            } else if (strcmp(option, "--storage-type") == 0) {
+                valid = parse_search_storage_types(value, &query.storage_types);
+            } else if (strcmp(option, "--type") == 0) {
+                valid = parse_search_types(value, &query);
+            } else if (strcmp(option, "--btree-flags") == 0) {
+                valid = parse_search_btn_flags(value, &query.btn_flags);
+            } else if (strcmp(option, "--omap-key-oid") == 0) {
+                valid = parse_search_ranges(value, &query.omap_key_oids);
+            } else if (strcmp(option, "--omap-key-xid") == 0) {
+                valid = parse_search_ranges(value, &query.omap_key_xids);
+            } else if (strcmp(option, "--omap-val-paddr") == 0) {
+                valid = parse_search_ranges(value, &query.omap_val_paddrs);
+            } else if (strcmp(option, "--fsoid") == 0) {
+                valid = parse_search_ranges(value, &query.fsoids);
+            } else if (strcmp(option, "--fsrt") == 0) {
+                valid = parse_search_fs_record_types(value, &query.fs_record_types);
+            } else if (strcmp(option, "--dentry-name") == 0) {
+                valid = parse_search_dentry_names(value, &query);
+            } else if (strcmp(option, "--dentry-name-file") == 0) {
+                valid = parse_search_name_file(value, &query.dentry_names, &query.num_dentry_names);
+            } else if (strcmp(option, "--dentry-pattern") == 0) {
+                valid = parse_search_dentry_patterns(value, &query);
+            } else if (strcmp(option, "--dentry-pattern-file") == 0) {
+                valid = parse_search_name_file(value, &query.dentry_patterns, &query.num_dentry_patterns);
+            } else if (strcmp(option, "--dentry-fsoid") == 0) {
+                valid = parse_search_ranges(value, &query.dentry_fsoids);
+            } else {
+                fprintf(stderr, "Unrecognised option `%s`.\n", option);
+                print_usage(argc, argv);
+                free_search_query(&query);
+                return 1;
+            }
+        }
+        if (!valid) {
+            fprintf(stderr, "`%s` is not a valid value for `%s`; see `docs/commands/search.md`.\n", value, option);
+            print_usage(argc, argv);
+            free_search_query(&query);
+            return 1;
+        }
+    }
+    if (!has_params) {
+        fprintf(stderr, "At least one search parameter must be specified.\n");
+        print_usage(argc, argv);
+        free_search_query(&query);
+        return 1;
+    }
+    if (!compile_search_query(&query)) {
+        print_usage(argc, argv);
+        free_search_query(&query);
+        return 1;
+    }
+
     // Open (device special) file corresponding to an APFS container, read-only
-    printf("Opening file at `%s` in read-only mode ... ", nx_path);
+    fprintf(stderr, "Opening file at `%s` in read-only mode ... ", nx_path);
     nx = fopen(nx_path, "rb");
     if (!nx) {
         fprintf(stderr, "\nABORT: ");
         report_fopen_error();
-        printf("\n");
+        fprintf(stderr, "\n");
+        free_search_query(&query);
         return -errno;
     }
-    printf("OK.\n");
+    fprintf(stderr, "OK.\n");
 
-    obj_phys_t* block = malloc(nx_block_size);
-    if (!block) {
-        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `block`.\n");
+    nx_superblock_t* nxsb = malloc(nx_block_size);
+    if (!nxsb) {
+        fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `nxsb`.\n");
         return -1;
     }
 
-    printf("Reading block 0x0 to obtain block count ... ");
-    if (read_blocks(block, 0x0, 1) != 1) {
-        printf("FAILED.\n");
+    fprintf(stderr, "Reading block 0x0 to obtain block count ... ");
+    if (read_blocks(nxsb, 0x0, 1) != 1) {
+        fprintf(stderr, "FAILED.\n");
         return -1;
     }
-    printf("OK.\n");
-
-    uint64_t num_blocks = ((nx_superblock_t*)block)->nx_block_count;
-    printf("The specified device has %" PRIu64 " = %#" PRIx64 " blocks. Commencing search:\n\n", num_blocks, num_blocks);
-
-    uint64_t num_matches = 0;
-
-    /** Search for dentries for items with any of these names **/
-    size_t NUM_DENTRY_NAMES = 10;
-    char* dentry_names[] = {
-        // catch-all entries
-        ".localized",
-
-        // .ssh entries
-        "id_rsa",
-        "id_rsa.pub",
-        "authorized_keys",
-        "known_hosts",
-
-        // Desktop entries
-        "Wallpapers",
-        
-        // Documents entries
-        "Finances",
-
-        // Downloads entries
-        "Software",
-
-        // Movies entries
-        "TV",
-
-        // Music entries
-        "iTunes",
-    };
-
-    size_t NUM_FS_OIDS = 9;
-    uint64_t fs_oids[] = {
-        0xb4a57,
-        0xb54a9,
-        0xb54aa,
-        0xb54af,
-        0xb54b4,
-        0xb54b5,
-        0xb54e5,
-        0xb54ed,
-        0xb550c,
-    };
-
-    size_t NUM_FS_OID_RANGES = 14;
-    uint64_t fs_oid_ranges[][2] = {
-        {0xb4b1b,   0xb4b1b},
-        {0xb4b33,   0xb4b33},
-        {0xb4b71,   0xb4b71},
-        {0xb4b7f,   0xb4b82},
-        {0xb4bbb,   0xb4bbc},
-        {0xb4c78,   0xb4c78},
-        {0xb4c8c,   0xb4c8c},
-        {0xb4cb6,   0xb4cb6},
-        {0xb4cdb,   0xb4cdb},
-        {0xb4cf1,   0xb4cf1},
-        {0xb4d06,   0xb4d06},
-        {0xb4d1c,   0xb4d1c},
-        {0xb4d32,   0xb4d32},
-        {0xb4e2d,   0xb4e57},
-    };
-
-    size_t NUM_BLOCKS = 62;
-    uint64_t blocks[] = {
-        0xd6cf2, 0xd4ba8, 0xd0add, 0xe14ec, 0xa9a58, 0xb6c56, 0xd47c4, 0xb7292, 0xac8b2,
-        0xd668d, 0xd60f4, 0xd67ec, 0xd6941, 0xd6a18, 0xd69fb, 0xd3d06, 0xd68b5, 0xd683c,
-        0xd6848, 0xd6820, 0xd6865, 0xd67ed, 0xd6ac1, 0xd5b73, 0xf3864, 0xd4393, 0xd3a9d,
-        0xd4392, 0xd4395, 0xd4372, 0xd437d, 0xd4381, 0xd436a, 0xd4371, 0xd436b, 0xd4383,
-        0xd461c, 0xd984c, 0xd44c3, 0xd1e78, 0xd3adb, 0xd0ee5, 0xd0251, 0xd25f3, 0xb6907,
-        0xa7ccd, 0xd4efa, 0xd760b, 0xd2625, 0xd38af, 0xd1de4, 0xd0536, 0xd1002, 0xd0f0d,
-        0xd3015, 0xd171c, 0xdb96a, 0xd5ff0, 0xd193f, 0xed80b, 0xd1588, 0xd85ff, 
-    };
-
-    uint64_t start_addr = 0xa5e3b;
-    uint64_t end_addr   = 0x13adf2;
-    uint64_t addr_range_size = end_addr - start_addr;
-
-    double addr_index_100 = 0;
-
-    /** Search over all B-tree nodes **/
-    if (true) {
-        for (uint64_t addr = start_addr;    addr < end_addr;    addr++, addr_index_100 += 100) {
-            printf("\rReading block %#9" PRIx64 " (%6.2f%%) ... ", addr, addr_index_100/addr_range_size);
-
-            if (read_blocks(block, addr, 1) != 1) {
-                if (feof(nx)) {
-                    printf("Reached end of file; ending search.\n");
-                    break;
-                }
-
-                assert(ferror(nx));
-                printf("- An error occurred whilst reading block %#" PRIx64 ".\n", addr);
+    fprintf(stderr, "OK.\n");
+
+    uint64_t num_blocks = nxsb->nx_block_count;
+    fprintf(stderr, "The specified device has %" PRIu64 " = %#" PRIx64 " blocks.\n", num_blocks, num_blocks);
+
+    // With an index, only read the blocks whose index entries could match,
+    // and only read the entries of regions whose filters could match
+    paddr_t* candidates = NULL;
+    uint64_t num_candidates = 0;
+    if (index_path) {
+        fprintf(stderr, "Reading index file at `%s` ... ", index_path);
+        block_index_t* index = read_block_index(index_path, false);
+        if (!index) {
+            return -1;
+        }
+        if (
+               memcmp(index->header.bih_nx_uuid, nxsb->nx_uuid, sizeof(uuid_t)) != 0
+            || index->header.bih_block_size != nx_block_size
+            || index->header.bih_block_count != num_blocks
+        ) {
+            fprintf(stderr, "FAILED.\nThe index was created for a different container; recreate it with `create-index`.\n");
+            return -1;
+        }
+        fprintf(stderr, "OK.\n");
+
+        uint64_t num_regions = index->header.bih_region_count;
+        uint64_t num_regions_read = 0;
+        uint64_t num_entries_read = 0;
+        block_index_entry_t* entries = malloc(SEARCH_INDEX_RUN_REGIONS * BLOCK_INDEX_REGION_BLOCKS * sizeof(block_index_entry_t));
+        if (!entries) {
+            fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `entries`.\n");
+            return -1;
+        }
+        for (uint64_t region = 0; region < num_regions; ) {
+            if (!search_block_index_region(&query, index, region)) {
+                region++;
                 continue;
             }
 
-            /** Search criteria **/
-
-            /** Search for Omap leaf nodes that contain mappings for given Virtual OIDs **/
-            if (false) {
-                if (   is_cksum_valid(block)
-                    && is_btree_node_phys_non_root(block)
-                    && is_omap_tree(block)
-                ) {
-                    btree_node_phys_t* node = block;
-                    
-                    if ( ! (node->btn_flags & BTNODE_FIXED_KV_SIZE) ) {
-                        printf("Omap tree node with non-fixed key and value sizes; skipping this block\n");
-                        continue;
-                    }
-
-                    if ( ! (node->btn_flags & BTNODE_LEAF) ) {
-                        continue;
-                    }
-                    
-                    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
-                    char* key_start = toc_start + node->btn_table_space.len;
-
-                    kvoff_t* toc_entry = toc_start;
-                    for (uint32_t i = 0;   i < node->btn_nkeys;   i++, toc_entry++) {
-                        omap_key_t* key = key_start + toc_entry->k;
-                        if ( key->ok_oid >= 0x1b16dd  &&  key->ok_oid <= 0x1b3926 ) {
-                            // Found a match; print details, then move on to the next block
-                            num_matches++;
-
-                            kvoff_t* first_toc_entry = toc_start;
-                            omap_key_t* first_key = key_start + first_toc_entry->k;
-
-                            kvoff_t* last_toc_entry = first_toc_entry + node->btn_nkeys - 1;
-                            omap_key_t* last_key = key_start + last_toc_entry->k;
-
-                            printf("\rMATCHED %#8" PRIx64 " || Node XID = %#9" PRIx64 " || from (OID, XID) = (%#9" PRIx64 ", %#9" PRIx64 ") => (%#9" PRIx64 ", %#9" PRIx64 ")\n",
-                                addr,
-                                node->btn_o.o_xid,
-                                first_key->ok_oid,
-                                first_key->ok_xid,
-                                last_key->ok_oid,
-                                last_key->ok_xid
-                            );
-
-                            break;
-                        }
-                    }
-                }
+            // Read the entries of a run of regions that pass at once
+            uint64_t run_len = 1;
+            while (
+                   run_len < SEARCH_INDEX_RUN_REGIONS
+                && region + run_len < num_regions
+                && search_block_index_region(&query, index, region + run_len)
+            ) {
+                run_len++;
             }
-
-            /** Search for Virtual objects with a given Virtual OID **/
-            if (true) {
-                if (is_cksum_valid(block)) {
-                    if ( (block->o_type & OBJ_STORAGETYPE_MASK)  ==  OBJ_VIRTUAL ) {
-                        switch (block->o_oid) {
-                            case 0x25e8fa:
-                                num_matches++;
-                                printf("\rMATCHED %#8" PRIx64 " || OID = %#9" PRIx64 " || XID = %#9" PRIx64 "\n", addr, block->o_oid, block->o_xid);
-                                break;
-
-                            default:
-                                break;
-                        }
-                    }
-                }
+            uint64_t num_entries = index->region_starts[region + run_len] - index->region_starts[region];
+            if (!read_block_index_entries(index, region, run_len, entries)) {
+                return -1;
             }
 
-            /** Search for FS-Root B-tree leaf nodes containing records for certain FS OIDs **/
-            if (true) {
-                if (   is_cksum_valid(block)
-                    && is_btree_node_phys(block)
-                    && is_fs_tree(block)
-                ) {
-                    btree_node_phys_t* node = block;
-
-                    if (node->btn_flags & BTNODE_FIXED_KV_SIZE) {
-                        // File-system B-tree nodes don't have fixed-size keys and values ... do they? 
-                        printf("FIXED_KV_SIZE\n");
-                        continue;
-                    }
-
-                    if ( ! (node->btn_flags & BTNODE_LEAF) ) {
-                        // Not a leaf node; look at next block
-                        printf("NOT A LEAF\n");
-                        continue;
-                    }
-
-                    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
-                    char* key_start = toc_start + node->btn_table_space.len;
-                    char* val_end   = (char*)node + nx_block_size;
-                    if (node->btn_flags & BTNODE_ROOT) {
-                        val_end -= sizeof(btree_info_t);
-                    }
-
-                    kvloc_t* toc_entry = toc_start;
-                    for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
-                        j_key_t* hdr = key_start + toc_entry->k.off;
-                        uint64_t oid = hdr->obj_id_and_type & OBJ_ID_MASK;
-
-                        if (   oid == 0xae9549
-                            // || (oid >= 0xda06a  &&  oid <= 0xda079)
-                            // || (oid >= 0x3a6386  &&  oid <= 0x3a6398)
-                        ) {
-                            num_matches++;
-                            
-                            kvloc_t* first_toc_entry = toc_start;
-                            j_key_t* first_hdr = key_start + first_toc_entry->k.off;
-                            uint64_t first_oid = first_hdr->obj_id_and_type & OBJ_ID_MASK;
-
-                            kvloc_t* last_toc_entry = first_toc_entry + node->btn_nkeys - 1;
-                            j_key_t* last_hdr = key_start + last_toc_entry->k.off;
-                            uint64_t last_oid = last_hdr->obj_id_and_type & OBJ_ID_MASK;
-
-                            printf("\rMATCHED %#8" PRIx64 " || First record OID: %#" PRIx64 " || Last record OID: %#" PRIx64 " || Node XID: %#" PRIx64 "\n", addr, first_oid, last_oid, node->btn_o.o_xid);
-                            
-                            // Found a match; don't need to check other entries in this node
-                            break;
-                        }
-                    }
-                }
-            }
-
-            /** Search for dentries of items with certain names/properties **/
-            if (true) {
-                if (   is_cksum_valid(block)
-                    && is_btree_node_phys(block)
-                    && is_fs_tree(block)
-                ) {
-                    btree_node_phys_t* node = block;
-
-                    if (node->btn_flags & BTNODE_FIXED_KV_SIZE) {
-                        printf("FIXED_KV_SIZE\n");
-                        continue;
-                    }
-
-                    if ( ! (node->btn_flags & BTNODE_LEAF) ) {
-                        // Not a leaf node; look at next block
-                        continue;
-                    }
-
-                    printf("LEAF NODE // OID = %#" PRIx64 " // XID = %#" PRIx64 " ... ", node->btn_o.o_oid, node->btn_o.o_xid);
-                    
-                    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
-                    char* key_start = toc_start + node->btn_table_space.len;
-                    char* val_end   = (char*)node + nx_block_size;
-                    if (node->btn_flags & BTNODE_ROOT) {
-                        printf("ALSO A ROOT NODE ...");
-                        val_end -= sizeof(btree_info_t);
-                    }
-
-                    uint32_t num_matches_in_node = 0;
-
-                    printf("Inspecting entries contained in this node ...\n");
-                    kvloc_t* toc_entry = toc_start;
-                    for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
-                        printf("\r- Entry %u ... ", i);
-
-                        j_key_t* hdr = key_start + toc_entry->k.off;
-                        uint8_t record_type = (hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT;
-                        switch (record_type) {
-                            case APFS_TYPE_DIR_REC: {
-                                printf("DENTRY ... ");
-
-                                j_drec_hashed_key_t* key = hdr;
-                                j_drec_val_t* val = val_end - toc_entry->v.off;
-
-                                for (size_t j = 0; j < NUM_DENTRY_NAMES; j++) {
-                                    if (strcasecmp((char*)key->name, dentry_names[j]) == 0) {
-                                        num_matches_in_node++;
-                                        num_matches++;
-
-                                        printf("MATCHED --- query = %s --- match = %s\n", dentry_names[j], key->name);
-                                        
-                                        // Found a match; don't need to compare against other strings
-                                        break;
-                                    }
-                                }
-                            } break;
-                            // case APFS_TYPE_INODE: {
-                            //     printf("INDOE ... ");
-
-                            //     j_inode_key_t* key = hdr;
-                            //     j_inode_val_t* val = val_end - toc_entry->v.off;
-
-                            //     if (val->parent_id == 0x1) {
-                            //         num_matches_in_node++;
-                            //         num_matches++;
-
-                            //         printf("MATCHED --- query = INODE 0x1 --- match = ")
-                            //     }
-                            // } break;
-                            default: break;
-                        }
-                    }
-
-                    if (num_matches_in_node == 0) {
-                        // Move to start of line,
-                        // clear whole line (which reads "- Entry x"),
-                        // move up one line,
-                        // clear whole line (which reads "Reading block [...] Inspecting entries")
-                        printf("\r\033[2K\033[A\033[2K");
-                    }
-                }
+            candidates = realloc(candidates, (num_candidates + num_entries) * sizeof(paddr_t));
+            if (num_candidates + num_entries != 0 && !candidates) {
+                fprintf(stderr, "\nABORT: Could not allocate sufficient memory for `candidates`.\n");
+                return -1;
             }
-
-            /** Search for dentries pointing to items with certain file-system object IDs **/
-            if (true) {
-                if (   is_cksum_valid(block)
-                    && is_btree_node_phys(block)
-                    && is_fs_tree(block)
-                ) {
-                    btree_node_phys_t* node = block;
-
-                    if (node->btn_flags & BTNODE_FIXED_KV_SIZE) {
-                        printf("FIXED_KV_SIZE\n");
-                        continue;
-                    }
-
-                    if ( ! (node->btn_flags & BTNODE_LEAF) ) {
-                        // Not a leaf node; look at next block
-                        continue;
-                    }
-
-                    char* toc_start = (char*)node->btn_data + node->btn_table_space.off;
-                    char* key_start = toc_start + node->btn_table_space.len;
-                    char* val_end   = (char*)node + nx_block_size;
-                    if (node->btn_flags & BTNODE_ROOT) {
-                        val_end -= sizeof(btree_info_t);
-                    }
-
-                    uint32_t num_matches_in_node = 0;
-
-                    printf("\n");
-
-                    kvloc_t* toc_entry = toc_start;
-                    for (uint32_t i = 0;    i < node->btn_nkeys;    i++, toc_entry++) {
-                        printf("\r- Entry %u ... ", i);
-
-                        j_key_t* hdr = key_start + toc_entry->k.off;
-                        uint8_t record_type = (hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT;
-                        if (record_type != APFS_TYPE_DIR_REC) {
-                            // Not a dentry; look at next entry in this leaf node
-                            continue;
-                        }
-
-                        j_drec_hashed_key_t* key = hdr;
-                        j_drec_val_t* val = val_end - toc_entry->v.off;
-
-                        /** Check whether FS OID matches one in `fs_oids[]` **/
-                        // for (size_t j = 0; j < NUM_FS_OIDS; j++) {
-                        //     if (val->file_id == fs_oids[j]) {
-                        //         num_matches_in_node++;
-                        //         num_matches++;
-
-                        //         printf("MATCHED --- query = %#" PRIx64 " --- match = %s\n", fs_oids[j], key->name);
-                                
-                        //         // Found a match; don't need to compare against other FS OIDs
-                        //         break;
-                        //     }
-                        // }
-
-                        /** Check whether FS OID lies within a range in `fs_oid_ranges[]` **/
-                        for (size_t j = 0; j < NUM_FS_OID_RANGES; j++) {
-                            if ( (val->file_id >= fs_oid_ranges[j][0])  &&  (val->file_id <= fs_oid_ranges[j][1]) ) {
-                                num_matches_in_node++;
-                                num_matches++;
-
-                                printf( "MATCHED --- query = (%#" PRIx64 ", %#" PRIx64 ") --- match = %#" PRIx64 " --- name = %s\n",
-                                    fs_oid_ranges[j][0],
-                                    fs_oid_ranges[j][1],
-                                    val->file_id,
-                                    key->name
-                                );
-                                
-                                // Found a match; don't need to compare against other FS OIDs
-                                break;
-                            }
-                        }
-                    }
-
-                    if (num_matches_in_node == 0) {
-                        // Move to start of line,
-                        // clear whole line (which reads "- Entry x"),
-                        // move up one line,
-                        // clear whole line (which reads "Reading block [...] Inspecting entries")
-                        printf("\r\033[2K\033[A\033[2K");
-                    }
+            for (uint64_t i = 0; i < num_entries; i++) {
+                if (search_block_index_entry(&query, entries + i)) {
+                    candidates[num_candidates++] = entries[i].bie_paddr;
                 }
             }
+            num_regions_read += run_len;
+            num_entries_read += num_entries;
+            region += run_len;
         }
+        fprintf(
+            stderr, "The index's filters narrow the search to %"PRIu64" of %"PRIu64" regions, and its entries to %"PRIu64" of %"PRIu64" indexed objects.\n",
+            num_regions_read, num_regions, num_candidates, index->header.bih_entry_count
+        );
+        free(entries);
+        free_block_index(index);
     }
-
-    /** Get FS record types of first record in certain blocks on disk **/
-    if (false) {
-        for (size_t block_index = 0;    block_index < NUM_BLOCKS;   block_index++) {
-            uint64_t addr = blocks[block_index];
-            printf("\rReading block %2lu: %#" PRIx64 " ... ", block_index, addr);
-
-            if (read_blocks(block, addr, 1) != 1) {
-                if (feof(nx)) {
-                    printf("Reached end of file; ending search.\n");
-                    break;
-                }
-
-                assert(ferror(nx));
-                printf("- An error occurred whilst reading block %#" PRIx64 ".\n", addr);
-                continue;
-            }
-
-            btree_node_phys_t* node = block;
-
-            kvloc_t* first_toc_entry = (char*)node->btn_data + node->btn_table_space.off;
-            char* key_start = (char*)first_toc_entry + node->btn_table_space.len;
-            j_key_t* hdr = key_start + first_toc_entry->k.off;
-
-            // printf("--- first record type = %#" PRIx64 "\n", (hdr->obj_id_and_type & OBJ_TYPE_MASK) >> OBJ_TYPE_SHIFT );
-            printf("--- node OID = %#16" PRIx64 "\n", node->btn_o.o_oid);
-        }
+    free(nxsb);
+    fprintf(stderr, "Commencing search:\n\n");
+
+    // Results go to stdout, one per line, so that they can be piped into
+    // other tools; everything else goes to stderr.
+    block_scan_stats_t stats;
+    bool success = index_path
+        ? scan_block_list(candidates, num_candidates, num_threads, limit, search_block, &query, stdout, stderr, &stats)
+        : scan_blocks(0, num_blocks, num_threads, limit, search_block, &query, stdout, stderr, &stats);
+    free(candidates);
+
+    fprintf(stderr, "\nScanned %#"PRIx64" blocks with %"PRIu32" threads", stats.num_blocks, stats.num_threads);
+    if (stats.limit_reached) {
+        fprintf(stderr, ", stopping early as the limit of %"PRIu64" matches was reached", limit);
     }
-
-    printf("\n\nFinished search; found %" PRIu64 " results.\n\n", num_matches);
-    
-    return 0;
+    fprintf(stderr, ".\n");
+    fprintf(stderr, "- Rejected by header:  %"PRIu64"\n", stats.num_rejected);
+    fprintf(stderr, "- Invalid checksum:    %"PRIu64"\n", stats.num_invalid);
+    fprintf(stderr, "- Read errors:         %"PRIu64"\n", stats.num_read_errors);
+    fprintf(stderr, "- Matches:             %"PRIu64"\n", stats.num_results);
+
+    free_search_query(&query);
+    fclose(nx);
+    return success ? 0 : -1;
 }